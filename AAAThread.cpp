@@ -791,6 +791,7 @@ status_t AAAThread::handleMessageNewStats(MessageNewStats *msgFrame)
     Vector<Message> messages;
     struct timeval capture_timestamp = msgFrame->capture_timestamp;
     unsigned int capture_sequence_number = msgFrame->sequence_number;
+    PERFORMANCE_TRACES_FRAME_STAGE(-1, capture_sequence_number);
 
     if (!m3ARunning)
         return status;
@@ -21,7 +21,7 @@
 #include <utils/threads.h>
 #include <time.h>
 #include "UltraLowLight.h"
-#include "MessageQueue.h"
+#include "RingMessageQueue.h"
 #include "IAtomIspObserver.h"
 #include "SensorThread.h"
 
@@ -226,7 +226,7 @@ private:
 // private data
 private:
 
-    MessageQueue<Message, MessageId> mMessageQueue;
+    RingMessageQueue<Message, MessageId> mMessageQueue;
     bool mThreadRunning;
     I3AControls* m3AControls;
     ICallbackAAA* mAAADoneCallback;
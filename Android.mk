@@ -43,6 +43,7 @@ LOCAL_SRC_FILES := \
 	CameraConf.cpp \
 	ColorConverter.cpp \
 	ImageScaler.cpp \
+	WorkerPool.cpp \
 	EXIFMaker.cpp \
 	SWJpegEncoder.cpp \
 	CallbacksThread.cpp \
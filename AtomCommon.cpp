@@ -17,6 +17,7 @@
 
 #include "AtomCommon.h"
 #include "PlatformData.h"
+#include "WorkerPool.h"
 #include <ia_coordinate.h>
 #ifndef GRAPHIC_IS_GEN
 #include <hal_public.h>
@@ -28,6 +29,12 @@
 #include <dlfcn.h>
 #include <sys/types.h>
 #include <pthread.h>
+#include <string.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#include <emmintrin.h>
+#define ATOM_COMMON_SIMD
+#endif
 
 #define MAX_BACKTRACE_DEPTH 15
 
@@ -269,6 +276,39 @@ bool isBayerFormat(int fourcc)
     return afb->bayer;
 }
 
+/**
+ * Returns the CpuFeature bitmask of the CPU we are running on.
+ *
+ * The CPUID query is done only once. Setting CAMERA_DISABLE_SIMD in the
+ * camera.hal.control property masks out all features, which makes every
+ * kernel fall back to its scalar reference implementation.
+ */
+unsigned int getCpuFeatures()
+{
+    static int features = -1;
+
+    if (features < 0) {
+        unsigned int detected = 0;
+#if defined(__i386__) || defined(__x86_64__)
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+        if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+            if (edx & bit_SSE2)
+                detected |= CPU_FEATURE_SSE2;
+            if ((ecx & bit_SSSE3) && (detected & CPU_FEATURE_SSE2))
+                detected |= CPU_FEATURE_SSSE3;
+        }
+#endif
+        LOG1("@%s: SSE2 %d, SSSE3 %d", __FUNCTION__,
+             (detected & CPU_FEATURE_SSE2) != 0, (detected & CPU_FEATURE_SSSE3) != 0);
+        features = detected;
+    }
+
+    if (gControlLevel & CAMERA_DISABLE_SIMD)
+        return 0;
+
+    return features;
+}
+
 /**
  * TODO: This needs to be removed once CSS API changes to support different bpl's
  *
@@ -346,103 +386,236 @@ void convertFromAndroidToIaCoordinates(const CameraWindow &srcWindow, CameraWind
  * vertically based on the camera sensor orientation and device
  * orientation.
  */
-void mirrorBuffer(AtomBuffer *buffer, int currentOrientation, int cameraOrientation)
+void mirrorBuffer(AtomBuffer *buffer, int currentOrientation, int cameraOrientation,
+                  bool multiThreaded)
 {
     LOG1("@%s", __FUNCTION__);
 
     int rotation = (cameraOrientation - currentOrientation + 360) % 360;
     if (rotation == 90 || rotation == 270) {
-        flipBufferH(buffer);
+        flipBufferH(buffer, multiThreaded);
     } else {
-        flipBufferV(buffer);
+        flipBufferV(buffer, multiThreaded);
     }
 }
 
-void flipBufferV(AtomBuffer *buffer) {
-    LOG1("@%s", __FUNCTION__);
-    int width, height, bpl;
-    unsigned char *data = NULL;
+struct FlipJob {
+    unsigned char *data;
+    int width;
+    int height;
+    int bpl;
+};
 
+static void initFlipJob(FlipJob *job, AtomBuffer *buffer)
+{
     void *ptr = NULL;
     if (buffer->shared)
         ptr = (void *) *((char **)buffer->dataPtr);
     else
         ptr = buffer->dataPtr;
 
-    data = (unsigned char *) ptr;
-    width = buffer->width;
-    height = buffer->height;
-    bpl = buffer->bpl;
-    int w = width / 2;
-    unsigned char temp = 0;
+    job->data = (unsigned char *) ptr;
+    job->width = buffer->width;
+    job->height = buffer->height;
+    job->bpl = buffer->bpl;
+}
 
-    // Y
-    for (int j=0; j < height; j++) {
-        for (int i=0; i < w; i++) {
-            temp = data[i];
-            data[i] = data[width-i-1];
-            data[width-i-1] = temp;
+/**
+ * Mirrors the bytes [left, right) of a row in place, as samples of 'size'
+ * bytes (1 for luma, 2 for UV pairs).
+ */
+static void mirrorRowScalar(unsigned char *row, int left, int right, int size)
+{
+    unsigned char temp;
+    for (right -= size; left < right; left += size, right -= size) {
+        for (int k = 0; k < size; k++) {
+            temp = row[left + k];
+            row[left + k] = row[right + k];
+            row[right + k] = temp;
         }
-        data = data + bpl;
     }
+}
 
-    int h = height / 2;
-    unsigned char tempu = 0;
-    unsigned char tempv = 0;
+#ifdef ATOM_COMMON_SIMD
+// reverses the samples of a vector of 16 bytes or 8 UV pairs
+__attribute__((target("sse2")))
+static inline __m128i reverseSamplesSSE2(__m128i v, int size)
+{
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    if (size == 1)
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    return v;
+}
 
-    // U+V
-    for (int j=0; j < h; j++) {
-        for (int i=0; i < w; i+=2) {
-            tempu = data[i];
-            tempv = data[i+1];
-            data[i] = data[width-i-2];
-            data[i+1] = data[width-i-1];
-            data[width-i-2] = tempu;
-            data[width-i-1] = tempv;
-        }
+// swaps and reverses 16 bytes from both ends towards the middle
+__attribute__((target("sse2")))
+static void mirrorRowSSE2(unsigned char *row, int bytes, int size)
+{
+    int left = 0;
+    int right = bytes;
+    for (; right - left >= 32; left += 16, right -= 16) {
+        const __m128i l = _mm_loadu_si128((const __m128i *)(row + left));
+        const __m128i r = _mm_loadu_si128((const __m128i *)(row + right - 16));
+        _mm_storeu_si128((__m128i *)(row + left), reverseSamplesSSE2(r, size));
+        _mm_storeu_si128((__m128i *)(row + right - 16), reverseSamplesSSE2(l, size));
+    }
+    mirrorRowScalar(row, left, right, size);
+}
+#endif
+
+static void mirrorRow(unsigned char *row, int bytes, int size, bool simd)
+{
+#ifdef ATOM_COMMON_SIMD
+    if (simd) {
+        mirrorRowSSE2(row, bytes, size);
+        return;
+    }
+#endif
+    mirrorRowScalar(row, 0, bytes, size);
+}
+
+// mirrors the luma rows [first, last) and the chroma rows belonging to them
+static void flipRowsV(void *context, int first, int last)
+{
+    const FlipJob *job = (const FlipJob *) context;
+    const int width = job->width;
+    const int bpl = job->bpl;
+    const bool simd = (getCpuFeatures() & CPU_FEATURE_SSE2) != 0;
+    unsigned char *data = job->data + first * bpl;
+
+    // Y
+    for (int j = first; j < last; j++) {
+        mirrorRow(data, width, 1, simd);
         data = data + bpl;
     }
+
+    // U+V, mirrored as pairs
+    data = job->data + job->height * bpl + (first / 2) * bpl;
+    for (int j = first / 2; j < last / 2; j++) {
+        mirrorRow(data, width & ~1, 2, simd);
+        data = data + bpl;
+    }
+}
+
+static void swapRows(unsigned char *a, unsigned char *b, int n)
+{
+    unsigned char temp[256];
+    while (n > 0) {
+        const int chunk = MIN(n, (int) sizeof(temp));
+        memcpy(temp, a, chunk);
+        memcpy(a, b, chunk);
+        memcpy(b, temp, chunk);
+        a += chunk;
+        b += chunk;
+        n -= chunk;
+    }
+}
+
+// swaps the luma rows i and height-1-i for i in [first, last), and the
+// chroma rows belonging to them
+static void flipRowsH(void *context, int first, int last)
+{
+    const FlipJob *job = (const FlipJob *) context;
+    const int width = job->width;
+    const int height = job->height;
+    const int bpl = job->bpl;
+    unsigned char *data = job->data;
+
+    // Y
+    for (int i = first; i < last; i++)
+        swapRows(data + i * bpl, data + (height - 1 - i) * bpl, width);
+
+    // U+V
+    data = data + bpl * height;
+    const int heightUV = height / 2;
+    for (int i = first / 2; i < last / 2; i++)
+        swapRows(data + i * bpl, data + (heightUV - 1 - i) * bpl, width);
 }
 
-void flipBufferH(AtomBuffer *buffer) {
+void flipBufferV(AtomBuffer *buffer, bool multiThreaded) {
     LOG1("@%s", __FUNCTION__);
-    int width, height, bpl;
-    unsigned char *data = NULL;
+    FlipJob job;
+    initFlipJob(&job, buffer);
 
-    void *ptr = NULL;
-    if (buffer->shared)
-        ptr = (void *) *((char **)buffer->dataPtr);
+    if (multiThreaded)
+        WorkerPool::runStripes(flipRowsV, &job, job.height, 2,
+                               WorkerPool::minStripeRows(job.width, 2));
     else
-        ptr = buffer->dataPtr;
+        flipRowsV(&job, 0, job.height);
+}
+
+void flipBufferH(AtomBuffer *buffer, bool multiThreaded) {
+    LOG1("@%s", __FUNCTION__);
+    FlipJob job;
+    initFlipJob(&job, buffer);
+
+    // one unit of work is a pair of rows
+    const int pairs = job.height / 2;
+    if (multiThreaded)
+        WorkerPool::runStripes(flipRowsH, &job, pairs, 2,
+                               WorkerPool::minStripeRows(2 * job.width, 2));
+    else
+        flipRowsH(&job, 0, pairs);
+}
 
-    data = (unsigned char *) ptr;
-    width = buffer->width;
-    height = buffer->height;
-    bpl = buffer->bpl;
-    int h = height / 2;
-    unsigned char temp = 0;
+struct CropCopyJob {
+    const unsigned char *srcY;
+    const unsigned char *srcUV;
+    int srcBpl;
+    unsigned char *dstY;
+    unsigned char *dstUV;
+    int dstBpl;
+    int width;
+};
 
-    // Y
-    for (int j=0; j < width; j++) {
-        for (int i=0; i < h; i++) {
-            temp = data[i*bpl + j];
-            data[i*bpl + j] = data[(height-1-i)*bpl + j];
-            data[(height-1-i)*bpl + j] = temp;
-        }
+// copies the luma rows [first, last) and the chroma rows belonging to them
+static void copyCropRows(void *context, int first, int last)
+{
+    const CropCopyJob *job = (const CropCopyJob *) context;
+
+    for (int i = first; i < last; i++)
+        memcpy(job->dstY + i * job->dstBpl, job->srcY + i * job->srcBpl, job->width);
+    for (int i = first / 2; i < last / 2; i++)
+        memcpy(job->dstUV + i * job->dstBpl, job->srcUV + i * job->srcBpl, job->width);
+}
+
+void cropNV12Buffer(const AtomBuffer *src, AtomBuffer *dst, int left, int top,
+                    bool multiThreaded)
+{
+    LOG2("@%s", __FUNCTION__);
+    const int width = dst->width;
+    const int height = dst->height;
+
+    // the 4:2:0 chroma needs even offsets
+    if (left < 0 || top < 0 || ((left | top) & 1) || dst->bpl < width
+        || left + width > src->width || top + height > src->height) {
+        ALOGE("@%s: cannot crop %dx%d at %d,%d from %dx%d to bpl %d", __FUNCTION__,
+              width, height, left, top, src->width, src->height, dst->bpl);
+        return;
     }
 
-    // U+V
-    data = data + bpl * height;
-    h = height / 4;
-    int heightUV = height / 2;
-
-    for (int j=0; j < width; j++) {
-        for (int i=0; i < h; i++) {
-            temp = data[i*bpl + j];
-            data[i*bpl + j] = data[(heightUV-1-i)*bpl + j];
-            data[(heightUV-1-i)*bpl + j] = temp;
-        }
+    if (left == 0 && top == 0 && width == src->width && height == src->height
+        && src->bpl == dst->bpl) {
+        memcpy(dst->dataPtr, src->dataPtr, dst->bpl * height * 3 / 2);
+        return;
     }
+
+    CropCopyJob job;
+    job.srcY = (const unsigned char *) src->dataPtr + top * src->bpl + left;
+    job.srcUV = (const unsigned char *) src->dataPtr + (src->height + top / 2) * src->bpl + left;
+    job.srcBpl = src->bpl;
+    job.dstY = (unsigned char *) dst->dataPtr;
+    job.dstUV = job.dstY + dst->bpl * height;
+    job.dstBpl = dst->bpl;
+    job.width = width;
+
+    if (multiThreaded)
+        WorkerPool::runStripes(copyCropRows, &job, height, 2,
+                               WorkerPool::minStripeRows(3 * width, 2));
+    else
+        copyCropRows(&job, 0, height);
 }
 
 int getGFXHALPixelFormatFromV4L2Format(int previewFormat)
@@ -488,6 +661,10 @@ int getGFXHALPixelFormatFromV4L2Format(int previewFormat)
 
 
 int get_backtrace(intptr_t* addrs, size_t max_entries) {
+#ifndef __i386__
+    // the frame walk below only knows the i386 stack layout
+    return 0;
+#else
     stack_crawl_state_t state;
     state.count = max_entries;
     state.addrs = addrs;
@@ -528,6 +705,7 @@ out:
     pthread_attr_destroy(&thread_attr);
 
     return max_entries - state.count;
+#endif
 }
 
 /**
@@ -520,10 +520,30 @@ void convertFromAndroidToIaCoordinates(const CameraWindow &srcWindow, CameraWind
 bool isParameterSet(const char *param, const CameraParameters &params);
 
 bool isBayerFormat(int fmt);
+
+/**
+ * SIMD instruction set extensions usable by the image processing kernels
+ */
+enum CpuFeature {
+    CPU_FEATURE_SSE2  = 1 << 0,
+    CPU_FEATURE_SSSE3 = 1 << 1
+};
+unsigned int getCpuFeatures();
+
 int SGXandDisplayBpl(int fourcc, int width);
-void mirrorBuffer(AtomBuffer *buffer, int currentOrientation, int cameraOrientation);
-void flipBufferV(AtomBuffer *buffer);
-void flipBufferH(AtomBuffer *buffer);
+// multiThreaded splits the work into stripes run on the WorkerPool
+void mirrorBuffer(AtomBuffer *buffer, int currentOrientation, int cameraOrientation,
+                  bool multiThreaded = false);
+void flipBufferV(AtomBuffer *buffer, bool multiThreaded = false);
+void flipBufferH(AtomBuffer *buffer, bool multiThreaded = false);
+
+/**
+ * Copies the dst->width x dst->height area at left,top of an NV12/NV21
+ * buffer to dst. Only the visible width of the rows is copied, not the
+ * bpl padding. The offsets must be even.
+ */
+void cropNV12Buffer(const AtomBuffer *src, AtomBuffer *dst, int left, int top,
+                    bool multiThreaded = false);
 
 void trace_callstack();
 void inject(AtomBuffer *b, const char* name);
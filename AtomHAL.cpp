@@ -344,6 +344,11 @@ static int atom_dump(struct camera_device * device, int fd)
             cam->control_thread->reInit3A();
     }
 
+    // with "setprop camera.hal.perf 64" the per-frame traces are written
+    // out as well, see PerformanceTraces::FrameTrace
+    if (gPerfLevel & CAMERA_DEBUG_LOG_PERF_FRAME_TRACE)
+        PerformanceTraces::FrameTrace::dump("/data/misc/media/camera_frametrace.json");
+
     return 0;
 }
 
@@ -6924,10 +6924,36 @@ void AtomISP::startObserver(ObserverType t)
  * polls and dequeues 3A statistics ready event into IAtomIspObserver::Message
  */
 status_t AtomISP::AAAStatSource::observe(IAtomIspObserver::Message *msg)
+{
+    LOG2("@%s", __FUNCTION__);
+    int ret = -1;
+
+    if (mISP->m3AStatscEnabled)
+        ret = mISP->m3AEventSubdevice->poll(FRAME_SYNC_POLL_TIMEOUT);
+
+    status_t status = observeReady(msg, ret);
+    if (status == NO_ERROR && msg->id == IAtomIspObserver::MESSAGE_ID_ERROR) {
+        // We sleep a moment but keep passing error messages to observers
+        // until further client controls.
+        usleep(ATOMISP_EVENT_RECOVERY_WAIT);
+    }
+    return status;
+}
+
+int AtomISP::AAAStatSource::getPollFd()
+{
+    return mISP->m3AEventSubdevice->getFd();
+}
+
+/**
+ * dequeues the 3A statistics ready event once the event subdevice has been
+ * polled, by observe() or by the observer reactor
+ */
+status_t AtomISP::AAAStatSource::observeReady(IAtomIspObserver::Message *msg, int pollResult)
 {
     LOG2("@%s", __FUNCTION__);
     struct v4l2_event event;
-    int ret;
+    int ret = pollResult;
 
     if (!mISP->m3AStatscEnabled) {
         msg->id = IAtomIspObserver::MESSAGE_ID_ERROR;
@@ -6935,8 +6961,6 @@ status_t AtomISP::AAAStatSource::observe(IAtomIspObserver::Message *msg)
         return INVALID_OPERATION;
     }
 
-    ret = mISP->m3AEventSubdevice->poll(FRAME_SYNC_POLL_TIMEOUT);
-
     if (ret <= 0) {
         ALOGE("Stats sync poll failed (%s), waiting recovery", (ret == 0) ? "timeout" : "error");
         ret = -1;
@@ -6950,9 +6974,6 @@ status_t AtomISP::AAAStatSource::observe(IAtomIspObserver::Message *msg)
 
     if (ret < 0) {
         msg->id = IAtomIspObserver::MESSAGE_ID_ERROR;
-        // We sleep a moment but keep passing error messages to observers
-        // until further client controls.
-        usleep(ATOMISP_EVENT_RECOVERY_WAIT);
         return NO_ERROR;
     }
 
@@ -7051,35 +7072,14 @@ status_t AtomISP::PreviewStreamSource::observe(IAtomIspObserver::Message *msg)
     int ret;
     LOG2("@%s", __FUNCTION__);
     int failCounter = 0;
-    int retry_count = ATOMISP_GETFRAME_RETRY_COUNT;
-    // Polling preview buffer needs more timeslot in file injection mode,
-    // driver needs more than 20s to fill the 640x480 preview buffer, so
-    // set retry count to 60
-    if (mISP->isFileInjectionEnabled())
-        retry_count = 40;
+    int retry_count = getRetryCount();
 
     int maxTimeoutCount = PlatformData::getMaxISPTimeoutCount();
 
 try_again:
     ret = mISP->mPreviewDevice->poll(ATOMISP_PREVIEW_POLL_TIMEOUT);
     if (ret > 0) {
-        LOG2("@%s Entering dequeue : num-of-buffers queued %d", __FUNCTION__, mISP->mNumPreviewBuffersQueued);
-        status = mISP->getPreviewFrame(&msg->data.frameBuffer.buff);
-        if (status != NO_ERROR) {
-            msg->id = IAtomIspObserver::MESSAGE_ID_ERROR;
-            status = UNKNOWN_ERROR;
-        } else {
-            if (msg->data.frameBuffer.buff.status != FRAME_STATUS_CORRUPTED) {
-                // Initialized timeout count when get normal preview frame
-                mISPTimeoutCount = 0;
-            }
-            msg->data.frameBuffer.buff.owner = mISP;
-            msg->id = IAtomIspObserver::MESSAGE_ID_FRAME;
-            if (mISP->checkSkipFrame(msg->data.frameBuffer.buff.frameCounter,
-                       mISP->mExtIspVideoHighSpeed ? mISP->mConfig.recording_fps : mISP->mConfig.preview_fps)
-                || mISP->checkSkipFrameForVideoZoom())
-                msg->data.frameBuffer.buff.status = FRAME_STATUS_SKIPPED;
-        }
+        status = dequeueFrame(msg);
     } else {
         ALOGE("@%s v4l2_poll for preview device failed! (%s)", __FUNCTION__, (ret==0)?"timeout":"error");
         msg->id = IAtomIspObserver::MESSAGE_ID_ERROR;
@@ -7110,6 +7110,91 @@ try_again:
     return status;
 }
 
+/**
+ * dequeues a preview frame from the polled device into IAtomIspObserver::Message
+ */
+status_t AtomISP::PreviewStreamSource::dequeueFrame(IAtomIspObserver::Message *msg)
+{
+    LOG2("@%s Entering dequeue : num-of-buffers queued %d", __FUNCTION__, mISP->mNumPreviewBuffersQueued);
+    PerformanceTraces::FrameTrace frameTrace(__FUNCTION__, -1);
+    status_t status = mISP->getPreviewFrame(&msg->data.frameBuffer.buff);
+    if (status != NO_ERROR) {
+        msg->id = IAtomIspObserver::MESSAGE_ID_ERROR;
+        return UNKNOWN_ERROR;
+    }
+    frameTrace.setFrame(msg->data.frameBuffer.buff.frameCounter, msg->data.frameBuffer.buff.frameSequenceNbr);
+
+    if (msg->data.frameBuffer.buff.status != FRAME_STATUS_CORRUPTED) {
+        // Initialized timeout count when get normal preview frame
+        mISPTimeoutCount = 0;
+    }
+    msg->data.frameBuffer.buff.owner = mISP;
+    msg->id = IAtomIspObserver::MESSAGE_ID_FRAME;
+    if (mISP->checkSkipFrame(msg->data.frameBuffer.buff.frameCounter,
+               mISP->mExtIspVideoHighSpeed ? mISP->mConfig.recording_fps : mISP->mConfig.preview_fps)
+        || mISP->checkSkipFrameForVideoZoom())
+        msg->data.frameBuffer.buff.status = FRAME_STATUS_SKIPPED;
+    return NO_ERROR;
+}
+
+int AtomISP::PreviewStreamSource::getRetryCount()
+{
+    // Polling preview buffer needs more timeslot in file injection mode,
+    // driver needs more than 20s to fill the 640x480 preview buffer, so
+    // set retry count to 60
+    if (mISP->isFileInjectionEnabled())
+        return 40;
+    return ATOMISP_GETFRAME_RETRY_COUNT;
+}
+
+int AtomISP::PreviewStreamSource::getPollFd()
+{
+    return mISP->mPreviewDevice->getFd();
+}
+
+int AtomISP::PreviewStreamSource::getPollTimeout()
+{
+    return ATOMISP_PREVIEW_POLL_TIMEOUT;
+}
+
+/**
+ * non-blocking variant of observe() for the observer reactor
+ *
+ * Failed polls and dequeues are retried quietly as in observe(), the
+ * reactor waits between the retries instead of sleeping here.
+ */
+status_t AtomISP::PreviewStreamSource::observeReady(IAtomIspObserver::Message *msg, int pollResult)
+{
+    LOG2("@%s", __FUNCTION__);
+    status_t status;
+
+    if (pollResult > 0) {
+        status = dequeueFrame(msg);
+    } else {
+        ALOGE("@%s v4l2_poll for preview device failed! (%s)", __FUNCTION__, (pollResult==0)?"timeout":"error");
+        msg->id = IAtomIspObserver::MESSAGE_ID_ERROR;
+        status = pollResult ? UNKNOWN_ERROR : TIMED_OUT;
+        // If ISP timeout count is larger than max count, send out error message.
+        ++mISPTimeoutCount;
+        if (pollResult == 0 && mISPTimeoutCount >= PlatformData::getMaxISPTimeoutCount()) {
+            mReactorRetries = 0;
+            return status;
+        }
+    }
+
+    if (status == NO_ERROR) {
+        mReactorRetries = 0;
+        return status;
+    }
+
+    if (++mReactorRetries <= getRetryCount())
+        return WOULD_BLOCK;
+
+    ALOGD("@%s There were no preview buffers returned in time", __FUNCTION__);
+    mReactorRetries = 0;
+    return status;
+}
+
 void AtomISP::setNrEE(bool en)
 {
     LOG2("@%s", __FUNCTION__);
@@ -521,16 +521,25 @@ private:
     {
     public:
         PreviewStreamSource(const char*name, AtomISP *aisp)
-            :mName(name), mISP(aisp), mISPTimeoutCount(0) { };
+            :mName(name), mISP(aisp), mISPTimeoutCount(0), mReactorRetries(0) { };
 
         // IObserverSubject override
         virtual const char* getName() { return mName.string(); };
         virtual status_t observe(IAtomIspObserver::Message *msg);
+        virtual bool supportsReactor() { return true; };
+        virtual int getPollFd();
+        virtual int getPollTimeout();
+        virtual status_t observeReady(IAtomIspObserver::Message *msg, int pollResult);
+
+    private:
+        status_t dequeueFrame(IAtomIspObserver::Message *msg);
+        int getRetryCount();
 
     private:
         String8  mName;
         AtomISP *mISP;
         int mISPTimeoutCount;
+        int mReactorRetries;
     } mPreviewStreamSource;
 
     class AAAStatSource: public IObserverSubject
@@ -542,6 +551,10 @@ private:
         // IObserverSubject override
         virtual const char* getName() { return mName.string(); };
         virtual status_t observe(IAtomIspObserver::Message *msg);
+        virtual bool supportsReactor() { return true; };
+        virtual int getPollFd();
+        virtual int getPollTimeout() { return FRAME_SYNC_POLL_TIMEOUT; };
+        virtual status_t observeReady(IAtomIspObserver::Message *msg, int pollResult);
 
     private:
         String8  mName;
@@ -17,6 +17,11 @@
 #define LOG_TAG "Camera_ISPObserver"
 
 #include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include "LogHelper.h"
 #include "AtomIspObserverManager.h"
 #include "IAtomIspObserver.h"
@@ -45,6 +50,16 @@ AtomIspObserverManager::attachObserver(IAtomIspObserver *observer, IObserverSubj
     if (s == NULL)
         return BAD_VALUE;
 
+    if (useReactor(s)) {
+        if (mReactor == NULL) {
+            mReactor = new ObserverReactor();
+            mReactor->run("CamHAL_ObserverReactor");
+        }
+        if (reactorSubjectIndex(s) < 0)
+            mReactorSubjects.push(s);
+        return mReactor->attach(observer, s);
+    }
+
     ObserverVector::iterator it = mObserverThreads.begin();
     for (;it != mObserverThreads.end(); ++it)
         if (it->key == s) {
@@ -77,6 +92,21 @@ AtomIspObserverManager::detachObserver(IAtomIspObserver *observer, IObserverSubj
     Mutex::Autolock lock(mLock);
     if (s == NULL)
         return BAD_VALUE;
+
+    ssize_t index = reactorSubjectIndex(s);
+    if (index >= 0) {
+        ObserverState state = mReactor->detach(observer, s);
+        if (state == OBSERVER_STATE_STOPPED) {
+            mReactorSubjects.removeAt(index);
+            if (mReactorSubjects.isEmpty()) {
+                LOG2("last reactor subject, waiting reactor to stop");
+                mReactor->requestExitAndWait();
+                mReactor.clear();
+            }
+        }
+        return NO_ERROR;
+    }
+
     ObserverVector::iterator it = mObserverThreads.begin();
     for (;it != mObserverThreads.end(); ++it) {
         if (it->key == s) {
@@ -117,6 +147,37 @@ AtomIspObserverManager::setState(ObserverState state, IObserverSubject *s, bool
             (it->value)->setState(state, synchronous);
         }
     }
+    if (mReactor != NULL && (s == NULL || reactorSubjectIndex(s) >= 0))
+        mReactor->setState(state, s, synchronous);
+}
+
+/**
+ * Whether subject is, or is to be, observed by the ObserverReactor
+ *
+ * A subject keeps the way it is observed until its last observer is
+ * detached, the control property is only checked for new subjects.
+ */
+bool
+AtomIspObserverManager::useReactor(IObserverSubject *s)
+{
+    if (reactorSubjectIndex(s) >= 0)
+        return true;
+
+    ObserverVector::iterator it = mObserverThreads.begin();
+    for (;it != mObserverThreads.end(); ++it)
+        if (it->key == s)
+            return false;
+
+    return s->supportsReactor() && (gControlLevel & CAMERA_ENABLE_OBSERVER_REACTOR);
+}
+
+ssize_t
+AtomIspObserverManager::reactorSubjectIndex(IObserverSubject *s)
+{
+    for (size_t i = 0; i < mReactorSubjects.size(); i++)
+        if (mReactorSubjects[i] == s)
+            return i;
+    return -1;
 }
 
 /**
@@ -330,4 +391,415 @@ AtomIspObserverManager::ObserverThread::ObserverThread(IObserverSubject *s):
 
 }
 
+AtomIspObserverManager::ObserverReactor::ObserverReactor():
+    Thread(false)
+   ,mEpollFd(epoll_create(MAX_EVENTS))
+   ,mWakeFd(eventfd(0, 0))
+   ,mThreadRunning(false)
+   ,mMessageQueue("ObserverReactor", (int) MESSAGE_ID_MAX)
+{
+    LOG1("@%s", __FUNCTION__);
+    struct epoll_event ev;
+    CLEAR(ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;     // the subjects have their Subject here
+    if (mEpollFd < 0 || mWakeFd < 0
+        || epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &ev) < 0)
+        ALOGE("@%s: failed to set up epoll (%s)", __FUNCTION__, strerror(errno));
+}
+
+AtomIspObserverManager::ObserverReactor::~ObserverReactor()
+{
+    LOG1("@%s", __FUNCTION__);
+    for (size_t i = 0; i < mSubjects.size(); i++)
+        delete mSubjects[i];
+    mSubjects.clear();
+
+    if (mEpollFd >= 0)
+        ::close(mEpollFd);
+    if (mWakeFd >= 0)
+        ::close(mWakeFd);
+}
+
+/**
+ * Queue a message for the reactor thread and wake it up
+ *
+ * The eventfd counts the messages, it is written before the message is
+ * queued so the reactor never waits for a message that is not announced.
+ */
+status_t
+AtomIspObserverManager::ObserverReactor::send(Message *msg, MessageId replyId)
+{
+    uint64_t one = 1;
+    if (::write(mWakeFd, &one, sizeof(one)) != sizeof(one))
+        ALOGE("@%s: failed to wake up the reactor (%s)", __FUNCTION__, strerror(errno));
+    return mMessageQueue.send(msg, replyId);
+}
+
+status_t
+AtomIspObserverManager::ObserverReactor::attach(IAtomIspObserver *observer, IObserverSubject *s)
+{
+    LOG1("@%s:%s", s->getName(), __FUNCTION__);
+    Message msg;
+    msg.id = MESSAGE_ID_ATTACH;
+    msg.subject = s;
+    msg.data.observer.interface = observer;
+    return send(&msg);
+}
+
+ObserverState
+AtomIspObserverManager::ObserverReactor::detach(IAtomIspObserver *observer, IObserverSubject *s)
+{
+    LOG1("@%s:%s", s->getName(), __FUNCTION__);
+    Message msg;
+    msg.id = MESSAGE_ID_DETACH;
+    msg.subject = s;
+    msg.data.observer.interface = observer;
+    return (ObserverState) send(&msg, MESSAGE_ID_DETACH);
+}
+
+status_t
+AtomIspObserverManager::ObserverReactor::setState(ObserverState state, IObserverSubject *s, bool sync)
+{
+    LOG1("@%s:%s", (s) ? s->getName() : "all", __FUNCTION__);
+    Message msg;
+    msg.id = MESSAGE_ID_SET_STATE;
+    msg.subject = s;
+    msg.data.state.value = state;
+    msg.data.state.synchronous = sync;
+    return send(&msg, (sync)?MESSAGE_ID_SET_STATE:(MessageId)-1);
+}
+
+status_t
+AtomIspObserverManager::ObserverReactor::requestExitAndWait()
+{
+    LOG1("@%s", __FUNCTION__);
+    Message msg;
+    msg.id = MESSAGE_ID_EXIT;
+    msg.subject = NULL;
+    send(&msg);
+    return Thread::requestExitAndWait();
+}
+
+/**
+ * Main thread loop of ObserverReactor
+ *
+ * Waits on the fds of all the running subjects and on the eventfd of the
+ * message queue at once. Ready subjects are observed and their observers
+ * notified right away, in the order epoll reports them, then the poll
+ * timeouts and error back offs are checked and last the messages handled,
+ * so no Subject is deleted while the events of a batch still refer to it.
+ */
+bool
+AtomIspObserverManager::ObserverReactor::threadLoop()
+{
+    LOG1("@%s", __FUNCTION__);
+    struct epoll_event events[MAX_EVENTS];
+
+    mThreadRunning = true;
+    while (mThreadRunning) {
+        int n = epoll_wait(mEpollFd, events, MAX_EVENTS, nextTimeout());
+        if (n < 0) {
+            if (errno != EINTR) {
+                ALOGE("@%s: epoll_wait failed (%s)", __FUNCTION__, strerror(errno));
+                usleep(ERROR_BACKOFF_MS * 1000);
+            }
+            continue;
+        }
+
+        bool wake = false;
+        for (int i = 0; i < n; i++) {
+            Subject *s = (Subject*) events[i].data.ptr;
+            if (s == NULL) {
+                wake = true;
+                continue;
+            }
+            observe(s, (events[i].events & (EPOLLIN | EPOLLPRI)) ? 1 : -1);
+        }
+
+        handleTimeouts();
+
+        if (wake)
+            handleMessages();
+    }
+
+    LOG1("leaving reactor threadLoop");
+    return false;
+}
+
+/**
+ * Observe a subject whose fd is ready, or timed out, and notify its observers
+ */
+void
+AtomIspObserverManager::ObserverReactor::observe(Subject *s, int pollResult)
+{
+    if (s->state != OBSERVER_STATE_RUNNING)
+        return;
+
+    IAtomIspObserver::Message msg;
+    status_t status = s->subject->observeReady(&msg, pollResult);
+
+    if (pollResult < 0) {
+        // level triggered, leave the fd alone for a while not to spin on it
+        disarm(s);
+        s->rearmTime = systemTime() + nsecs_t(ERROR_BACKOFF_MS) * 1000000LL;
+    } else {
+        const int timeout = s->subject->getPollTimeout();
+        s->deadline = (timeout >= 0) ? systemTime() + nsecs_t(timeout) * 1000000LL : 0;
+    }
+
+    if (status == WOULD_BLOCK)
+        return;
+
+    if (notifyObservers(s, &msg)) {
+        LOG1("%s:Paused by notify request!", s->subject->getName());
+        pause(s);
+    }
+
+    if (status != NO_ERROR) {
+        LOG1("%s:Paused by ERROR!", s->subject->getName());
+        pause(s);
+    }
+}
+
+bool
+AtomIspObserverManager::ObserverReactor::notifyObservers(Subject *s, IAtomIspObserver::Message *msg)
+{
+    LOG2("@%s:%s", s->subject->getName(), __FUNCTION__);
+    bool ret = false;
+    List<IAtomIspObserver*>::iterator it = s->observers.begin();
+    for (;it != s->observers.end(); ++it)
+        ret |= (*it)->atomIspNotify(msg, s->state);
+    return ret;
+}
+
+void
+AtomIspObserverManager::ObserverReactor::pause(Subject *s)
+{
+    disarm(s);
+    s->state = OBSERVER_STATE_PAUSED;
+    notifyObservers(s, NULL);
+}
+
+/**
+ * Register the fd of a running subject to epoll, false if it has none
+ */
+bool
+AtomIspObserverManager::ObserverReactor::arm(Subject *s)
+{
+    struct epoll_event ev;
+    CLEAR(ev);
+    ev.events = EPOLLIN | EPOLLPRI;
+    ev.data.ptr = s;
+
+    s->rearmTime = 0;
+    s->fd = s->subject->getPollFd();
+    if (s->fd < 0 || epoll_ctl(mEpollFd, EPOLL_CTL_ADD, s->fd, &ev) < 0) {
+        LOG1("%s: no fd to wait for (%d)", s->subject->getName(), s->fd);
+        s->fd = -1;
+        return false;
+    }
+
+    const int timeout = s->subject->getPollTimeout();
+    s->deadline = (timeout >= 0) ? systemTime() + nsecs_t(timeout) * 1000000LL : 0;
+    return true;
+}
+
+void
+AtomIspObserverManager::ObserverReactor::disarm(Subject *s)
+{
+    if (s->fd >= 0) {
+        struct epoll_event ev;
+        CLEAR(ev);
+        if (epoll_ctl(mEpollFd, EPOLL_CTL_DEL, s->fd, &ev) < 0)
+            LOG1("%s: fd %d already gone from epoll", s->subject->getName(), s->fd);
+        s->fd = -1;
+    }
+    s->deadline = 0;
+    s->rearmTime = 0;
+}
+
+/**
+ * Time to wait in ms for the nearest poll timeout or end of back off
+ */
+int
+AtomIspObserverManager::ObserverReactor::nextTimeout()
+{
+    nsecs_t next = 0;
+    for (size_t i = 0; i < mSubjects.size(); i++) {
+        const Subject *s = mSubjects[i];
+        if (s->state != OBSERVER_STATE_RUNNING)
+            continue;
+        const nsecs_t t = (s->fd >= 0) ? s->deadline : s->rearmTime;
+        if (t != 0 && (next == 0 || t < next))
+            next = t;
+    }
+
+    if (next == 0)
+        return -1;
+
+    const nsecs_t left = next - systemTime();
+    return (left <= 0) ? 0 : (int) ((left + 999999LL) / 1000000LL);
+}
+
+void
+AtomIspObserverManager::ObserverReactor::handleTimeouts()
+{
+    const nsecs_t now = systemTime();
+    for (size_t i = 0; i < mSubjects.size(); i++) {
+        Subject *s = mSubjects[i];
+        if (s->state != OBSERVER_STATE_RUNNING)
+            continue;
+        if (s->fd >= 0 && s->deadline != 0 && now >= s->deadline) {
+            observe(s, 0);
+        } else if (s->fd < 0 && s->rearmTime != 0 && now >= s->rearmTime) {
+            if (!arm(s))
+                observe(s, -1);
+        }
+    }
+}
+
+/**
+ * Receive as many messages as the eventfd announced
+ */
+void
+AtomIspObserverManager::ObserverReactor::handleMessages()
+{
+    uint64_t count = 0;
+    if (::read(mWakeFd, &count, sizeof(count)) != sizeof(count)) {
+        ALOGE("@%s: failed to read the eventfd (%s)", __FUNCTION__, strerror(errno));
+        return;
+    }
+
+    while (count-- > 0) {
+        status_t status = NO_ERROR;
+        Message msg;
+        mMessageQueue.receive(&msg);
+
+        switch (msg.id) {
+            case MESSAGE_ID_EXIT:
+                mThreadRunning = false;
+                break;
+
+            case MESSAGE_ID_ATTACH:
+                status = handleMessageAttach(msg);
+                break;
+
+            case MESSAGE_ID_DETACH:
+                status = handleMessageDetach(msg);
+                break;
+
+            case MESSAGE_ID_SET_STATE:
+                status = handleMessageSetState(msg);
+                break;
+
+            default:
+                ALOGE("Invalid message");
+                status = BAD_VALUE;
+                break;
+        };
+
+        if (status < NO_ERROR)
+            ALOGE("ObserverReactor: error handling message %d", (int) msg.id);
+    }
+}
+
+AtomIspObserverManager::ObserverReactor::Subject*
+AtomIspObserverManager::ObserverReactor::findSubject(IObserverSubject *s)
+{
+    for (size_t i = 0; i < mSubjects.size(); i++)
+        if (mSubjects[i]->subject == s)
+            return mSubjects[i];
+    return NULL;
+}
+
+status_t
+AtomIspObserverManager::ObserverReactor::handleMessageAttach(Message &msg)
+{
+    LOG1("@%s:%s", msg.subject->getName(), __FUNCTION__);
+
+    Subject *s = findSubject(msg.subject);
+    if (s == NULL) {
+        // new subjects start paused, as with ObserverThread
+        s = new Subject;
+        s->subject = msg.subject;
+        s->state = OBSERVER_STATE_PAUSED;
+        s->fd = -1;
+        s->deadline = 0;
+        s->rearmTime = 0;
+        mSubjects.push(s);
+    }
+
+    List<IAtomIspObserver*>::iterator it = s->observers.begin();
+    for (;it != s->observers.end(); ++it)
+        if (*it == msg.data.observer.interface)
+            return ALREADY_EXISTS;
+
+    s->observers.push_back(msg.data.observer.interface);
+
+    return NO_ERROR;
+}
+
+status_t
+AtomIspObserverManager::ObserverReactor::handleMessageDetach(Message &msg)
+{
+    LOG1("@%s:%s", msg.subject->getName(), __FUNCTION__);
+    status_t status = BAD_VALUE;
+
+    Subject *s = findSubject(msg.subject);
+    if (s != NULL) {
+        List<IAtomIspObserver*>::iterator it = s->observers.begin();
+        for (;it != s->observers.end(); ++it)
+            if (*it == msg.data.observer.interface) {
+                s->observers.erase(it);
+                if (s->observers.empty()) {
+                    LOG1("%s: last observer removed, stopping", s->subject->getName());
+                    disarm(s);
+                    s->state = OBSERVER_STATE_STOPPED;
+                }
+                // Returning ObserverState cast to positive status_t
+                status = static_cast<status_t>(s->state);
+                break;
+            }
+
+        if (s->state == OBSERVER_STATE_STOPPED) {
+            for (size_t i = 0; i < mSubjects.size(); i++)
+                if (mSubjects[i] == s) {
+                    mSubjects.removeAt(i);
+                    break;
+                }
+            delete s;
+        }
+    }
+
+    mMessageQueue.reply(MESSAGE_ID_DETACH, status);
+    return NO_ERROR;
+}
+
+status_t
+AtomIspObserverManager::ObserverReactor::handleMessageSetState(Message &msg)
+{
+    LOG1("@%s:%s", (msg.subject) ? msg.subject->getName() : "all", __FUNCTION__);
+    for (size_t i = 0; i < mSubjects.size(); i++) {
+        Subject *s = mSubjects[i];
+        if (msg.subject != NULL && s->subject != msg.subject)
+            continue;
+
+        bool notifyStateChange = (s->state != msg.data.state.value);
+        s->state = msg.data.state.value;
+        if (notifyStateChange)
+            notifyObservers(s, NULL);
+
+        if (s->state != OBSERVER_STATE_RUNNING) {
+            disarm(s);
+        } else if (s->fd < 0 && s->rearmTime == 0 && !arm(s)) {
+            observe(s, -1);
+        }
+    }
+
+    if (msg.data.state.synchronous)
+        mMessageQueue.reply(MESSAGE_ID_SET_STATE, NO_ERROR);
+    return NO_ERROR;
+}
+
 } // namespace android
@@ -30,6 +30,21 @@ public:
     virtual ~IObserverSubject() { };
     virtual const char* getName() = 0;
     virtual status_t observe(IAtomIspObserver::Message *msg) = 0;
+
+    /**
+     * Optional interface for the observer reactor.
+     *
+     * A subject supporting it returns the fd of its device from
+     * getPollFd() while it is running. The reactor then calls
+     * observeReady() instead of observe(), with what poll() would have
+     * returned: positive when the fd is ready, 0 after getPollTimeout() ms
+     * without data and -1 on error. observeReady() must not block, and
+     * returns WOULD_BLOCK when there is nothing to notify yet.
+     */
+    virtual bool supportsReactor() { return false; };
+    virtual int getPollFd() { return -1; };
+    virtual int getPollTimeout() { return -1; };
+    virtual status_t observeReady(IAtomIspObserver::Message *msg, int pollResult) { return INVALID_OPERATION; };
 };
 
 /**
@@ -46,6 +61,12 @@ public:
  * IObserverSubject::observer(ObserverOperation, Message)
  * foreach (IAtomIspObserver)
  *      IAtomIspObserver::atomIspNotify(Message)
+ *
+ * With "setprop camera.hal.control 64" the subjects that support it are
+ * instead observed together by a single ObserverReactor thread, waiting
+ * on all their device fds with one epoll instance. This saves a thread
+ * and its wake-ups per subject. The observers are notified from the
+ * reactor thread, so a slow observer delays all the subjects.
  */
 class AtomIspObserverManager {
 public:
@@ -110,10 +131,97 @@ private:
             MessageQueue<Message, MessageId> mMessageQueue;
     };
 
+    class ObserverReactor:public Thread {
+        public:
+            ObserverReactor();
+            ~ObserverReactor();
+            status_t attach(IAtomIspObserver *observer, IObserverSubject *s);
+            ObserverState detach(IAtomIspObserver *observer, IObserverSubject *s);
+
+            status_t  setState(ObserverState state, IObserverSubject *s, bool sync = false);
+
+            virtual bool threadLoop();
+            virtual status_t requestExitAndWait();
+
+        private:
+            enum MessageId {
+                MESSAGE_ID_EXIT,
+                MESSAGE_ID_ATTACH,
+                MESSAGE_ID_DETACH,
+                MESSAGE_ID_SET_STATE,
+
+                MESSAGE_ID_MAX
+            };
+
+            struct MessageObserver {
+                IAtomIspObserver *interface;
+            };
+
+            struct MessageState {
+                ObserverState value;
+                bool synchronous;
+            };
+
+            union MessageData {
+                // MESSAGE_ID_ATTACH
+                // MESSAGE_ID_DETACH
+                MessageObserver observer;
+                // MESSAGE_ID_SET_STATE
+                MessageState    state;
+            };
+
+            struct Message {
+                MessageId id;
+                IObserverSubject *subject;
+                MessageData data;
+            };
+
+            // observed subject, only used by the reactor thread
+            struct Subject {
+                IObserverSubject *subject;
+                List< IAtomIspObserver* > observers;
+                ObserverState state;
+                int fd;             /*!< fd registered to epoll, -1 if none */
+                nsecs_t deadline;   /*!< end of the poll timeout, 0 if none */
+                nsecs_t rearmTime;  /*!< end of the back off after an error, 0 if none */
+            };
+
+        private:
+            status_t send(Message *msg, MessageId replyId = (MessageId) -1);
+            void handleMessages();
+            status_t handleMessageAttach(Message &msg);
+            status_t handleMessageDetach(Message &msg);
+            status_t handleMessageSetState(Message &msg);
+            Subject* findSubject(IObserverSubject *s);
+            bool notifyObservers(Subject *s, IAtomIspObserver::Message *msg);
+            void observe(Subject *s, int pollResult);
+            void pause(Subject *s);
+            bool arm(Subject *s);
+            void disarm(Subject *s);
+            int nextTimeout();
+            void handleTimeouts();
+
+        private:
+            static const int MAX_EVENTS = 8;
+            static const int ERROR_BACKOFF_MS = 33;
+
+            int mEpollFd;
+            int mWakeFd;        /*!< eventfd counting the messages sent */
+            bool mThreadRunning;
+            Vector<Subject*> mSubjects;
+            MessageQueue<Message, MessageId> mMessageQueue;
+    };
+
+private:
+    bool useReactor(IObserverSubject *s);
+    ssize_t reactorSubjectIndex(IObserverSubject *s);
+
 private:
     typedef key_value_pair_t<IObserverSubject*, sp<ObserverThread> > observer_pair_t;
     typedef Vector<observer_pair_t> ObserverVector;
     ObserverVector mObserverThreads;
+    sp<ObserverReactor> mReactor;
+    Vector<IObserverSubject*> mReactorSubjects;
     mutable Mutex mLock;
 
     /* PRETTY LOGGING SUPPORT */
@@ -46,6 +46,7 @@ Callbacks::Callbacks() :
     ,mStoreMetaDataInBuffers(false)
     ,mContShootingEnabled(false)
     ,mBurstCount(0)
+    ,mPoolBytes(0)
 {
     LOG1("@%s", __FUNCTION__);
 }
@@ -61,6 +62,7 @@ Callbacks::~Callbacks()
         mPanoramaMetadata->release(mPanoramaMetadata);
         mPanoramaMetadata = NULL;
     }
+    trimMemoryPool();
 }
 
 void Callbacks::setCallbacks(camera_notify_callback notify_cb,
@@ -349,6 +351,113 @@ void Callbacks::allocateMemory(camera_memory_t **buff, size_t size)
     }
 }
 
+/**
+ * Returns the size of the pooled block for size, 0 if it is too big to be
+ * pooled. Up to fineSize the blocks are powers of two, above it multiples
+ * of an eighth of the power of two below, so that a multi-MB buffer wastes
+ * at most 12.5% instead of up to half.
+ */
+static size_t poolBlockSize(size_t size, size_t minSize, size_t fineSize, size_t maxSize)
+{
+    size_t block = minSize;
+
+    if (size > maxSize)
+        return 0;
+    while (block < size && block < fineSize)
+        block <<= 1;
+    if (block >= size)
+        return block;
+
+    while (block * 2 < size)
+        block <<= 1;
+    const size_t step = block / 8;
+    return (size + step - 1) / step * step;
+}
+
+void Callbacks::allocatePooledMemory(AtomBuffer *buff, int size)
+{
+    LOG1("@%s: size %d", __FUNCTION__, size);
+    const size_t blockSize = size <= 0 ? 0 : poolBlockSize(size, MEMORY_POOL_MIN_SIZE,
+                                                           MEMORY_POOL_FINE_SIZE,
+                                                           MEMORY_POOL_MAX_SIZE);
+    if (blockSize == 0) {
+        allocateMemory(buff, size);
+        return;
+    }
+
+    buff->buff = NULL;
+    {
+        Mutex::Autolock lock(mPoolLock);
+        for (size_t i = 0; i < mPool.size(); i++) {
+            if (mPool[i]->size == blockSize) {
+                buff->buff = mPool[i];
+                mPool.removeAt(i);
+                mPoolBytes -= blockSize;
+                break;
+            }
+        }
+    }
+
+    if (buff->buff == NULL && mGetMemoryCB != NULL)
+        buff->buff = mGetMemoryCB(-1, blockSize, 1, mUserToken);
+
+    if (buff->buff != NULL) {
+        buff->dataPtr = buff->buff->data;
+        buff->size = size;
+    } else {
+        ALOGE("Pooled memory allocation failed");
+        buff->dataPtr = NULL;
+        buff->size = 0;
+    }
+}
+
+void Callbacks::releasePooledMemory(AtomBuffer *buff)
+{
+    LOG1("@%s: dataPtr %p", __FUNCTION__, buff->dataPtr);
+    camera_memory_t *mem = buff->buff;
+    buff->buff = NULL;
+    buff->dataPtr = NULL;
+    if (mem == NULL)
+        return;
+
+    // only block sizes go back, anything else came from allocateMemory()
+    if (mem->size != poolBlockSize(mem->size, MEMORY_POOL_MIN_SIZE,
+                                   MEMORY_POOL_FINE_SIZE, MEMORY_POOL_MAX_SIZE)) {
+        mem->release(mem);
+        return;
+    }
+
+    mPoolLock.lock();
+    mPool.push(mem);
+    mPoolBytes += mem->size;
+    bool trim = mPoolBytes > MEMORY_POOL_HIGH_WATERMARK;
+    mPoolLock.unlock();
+
+    if (trim)
+        trimMemoryPool(MEMORY_POOL_HIGH_WATERMARK);
+}
+
+/**
+ * Releases free pooled memory, biggest blocks first, until at most
+ * maxBytes are kept.
+ */
+void Callbacks::trimMemoryPool(size_t maxBytes)
+{
+    Mutex::Autolock lock(mPoolLock);
+    LOG1("@%s: %zu bytes pooled, keeping %zu", __FUNCTION__, mPoolBytes, maxBytes);
+    while (mPoolBytes > maxBytes) {
+        size_t biggest = 0;
+        for (size_t i = 1; i < mPool.size(); i++) {
+            if (mPool[i]->size > mPool[biggest]->size)
+                biggest = i;
+        }
+        camera_memory_t *mem = mPool[biggest];
+        mPool.removeAt(biggest);
+        mPoolBytes -= mem->size;
+        mem->release(mem);
+    }
+}
+
 void Callbacks::autoFocusDone(bool status)
 {
     LOG1("@%s", __FUNCTION__);
@@ -21,6 +21,7 @@
 #include <camera.h>
 #include <utils/threads.h>
 #include <utils/Timers.h>
+#include <utils/Vector.h>
 #include "AtomCommon.h"
 
 namespace android {
@@ -67,6 +68,22 @@ public:
 
     void allocateMemory(AtomBuffer *buff, int size);
     void allocateMemory(camera_memory_t **buff, size_t size);
+
+    /**
+     * Pooled variant of allocateMemory() for buffers that never leave the
+     * HAL. The memory is rounded up to a power of two, above 1 MiB to an
+     * eighth of one, and must be given back with releasePooledMemory(),
+     * which keeps it for the next request of the same block size instead
+     * of tearing down the heap. trimMemoryPool() frees the kept blocks,
+     * at the latest when a capture is over.
+     *
+     * Do not use it for buffers passed to the client in a data callback,
+     * the client may still be reading the shared memory after the callback
+     * returns.
+     */
+    void allocatePooledMemory(AtomBuffer *buff, int size);
+    void releasePooledMemory(AtomBuffer *buff);
+    void trimMemoryPool(size_t maxBytes = 0);
     void facesDetected(camera_frame_metadata_t *face_metadata);
     void sceneDetected(camera_scene_detection_metadata &metadata);
     void panoramaDisplUpdate(camera_panorama_metadata &metadata);
@@ -101,6 +118,15 @@ private:
     bool mContShootingEnabled;
     String8 mContShootingFilepath;
     int mBurstCount;
+
+    // free pooled memory, see poolBlockSize() for the block sizes
+    static const size_t MEMORY_POOL_MIN_SIZE = 4 * 1024;
+    static const size_t MEMORY_POOL_FINE_SIZE = 1024 * 1024;    // eighth steps above
+    static const size_t MEMORY_POOL_MAX_SIZE = 512 * 1024 * 1024;
+    static const size_t MEMORY_POOL_HIGH_WATERMARK = 64 * 1024 * 1024;
+    Mutex mPoolLock;
+    Vector<camera_memory_t*> mPool;
+    size_t mPoolBytes;  // total size of the free blocks
     };
 };
 
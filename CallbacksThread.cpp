@@ -811,6 +811,7 @@ status_t CallbacksThread::handleMessageSceneDetected(MessageSceneDetected *msg)
 status_t CallbacksThread::handleMessagePreviewDone(MessageFrame *msg)
 {
     LOG2("@%s", __FUNCTION__);
+    PERFORMANCE_TRACES_FRAME_STAGE(msg->frame.frameCounter, msg->frame.frameSequenceNbr);
     status_t status = NO_ERROR;
     if (!mPausePreviewCallbacks) {
         mCallbacks->previewFrameDone(&(msg->frame));
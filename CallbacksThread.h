@@ -19,7 +19,7 @@
 
 #include <utils/threads.h>
 #include <utils/Vector.h>
-#include "MessageQueue.h"
+#include "RingMessageQueue.h"
 #include "AtomCommon.h"
 #include "IFaceDetectionListener.h"
 #include "intel_camera_extensions.h"
@@ -346,7 +346,7 @@ private:
 // private data
 private:
 
-    MessageQueue<Message, MessageId> mMessageQueue;
+    RingMessageQueue<Message, MessageId> mMessageQueue;
     bool mThreadRunning;
     Callbacks *mCallbacks;
     unsigned mJpegRequested;
@@ -18,36 +18,607 @@
 #include <camera/CameraParameters.h>
 #include <linux/atomisp.h>
 #include <linux/videodev2.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include "ColorConverter.h"
 #include "LogHelper.h"
 #include "AtomCommon.h"
+#include "WorkerPool.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#define COLOR_CONVERTER_SIMD
+#endif
 
 namespace android {
 
-void YUV420ToRGB565(int width, int height, void *src, void *dst)
+/*
+ * Row kernels
+ *
+ * The conversions below are split into a plane walker and a row kernel.
+ * The plane walkers are shared, the row kernels exist in a scalar, SSE2 and
+ * SSSE3 flavour and are picked once at runtime according to the CPUID
+ * features (see getCpuFeatures()). When no SIMD extension is available the
+ * public functions use the original scalar implementations instead, which
+ * also serve as the reference for the vectorized code.
+ */
+
+/*
+ * Fixed point YUV -> RGB matrices, Q13 so that every coefficient and every
+ * pmaddwd operand fits in 16 bits:
+ *
+ *   y' = (Y - yOffset) * y + 0.5
+ *   R = (y' + crR * Cr) >> 13
+ *   G = (y' - cbG * Cb - crG * Cr) >> 13
+ *   B = (y' + cbB * Cb) >> 13
+ *
+ * with Cb and Cr centered on 0. Indexed by ColorMatrix.
+ */
+static const int COLOR_MATRIX_BITS = 13;
+
+struct ColorMatrixCoefs {
+    int yOffset;
+    int y;
+    int crR;
+    int cbG;
+    int crG;
+    int cbB;
+};
+
+static const ColorMatrixCoefs sColorMatrices[] = {
+    { 16, 9539, 13075, 3209, 6660, 16525 },     // COLOR_MATRIX_BT601_LIMITED
+    {  0, 8192, 11485, 2819, 5850, 14516 },     // COLOR_MATRIX_BT601_FULL
+    { 16, 9539, 14686, 1747, 4366, 17305 },     // COLOR_MATRIX_BT709_LIMITED
+};
+
+struct ColorConverterRowOps {
+    const char *name;
+    // NV12 UV row -> NV21 VU row, n bytes. src may equal dst.
+    void (*swapUVRow)(const unsigned char *src, unsigned char *dst, int n);
+    // interleaved pairs -> two planes: dst0 gets the even, dst1 the odd bytes
+    void (*splitUVRow)(const unsigned char *src, unsigned char *dst0,
+                       unsigned char *dst1, int pairs);
+    // two planes -> interleaved pairs: src0 goes to the even, src1 to the odd bytes
+    void (*mergeUVRow)(const unsigned char *src0, const unsigned char *src1,
+                       unsigned char *dst, int pairs);
+    // YUYV row -> Y row and, if dstVU is not NULL, a row of VU pairs
+    void (*yuyvToNV21Row)(const unsigned char *src, unsigned char *dstY,
+                          unsigned char *dstVU, int width);
+    // YUYV row -> Y row and one chroma row: U if chromaOffset is 1, V if 3
+    void (*yuyvToPlanarRow)(const unsigned char *src, unsigned char *dstY,
+                            unsigned char *dstC, int width, int chromaOffset);
+    // Y row + interleaved UV row -> RGB565. floorG selects the rounding of
+    // the green component used by YUV420ToRGB565() (see yuvToRGB565Pixel())
+    void (*yuvRowToRGB565)(const unsigned char *srcY, const unsigned char *srcUV,
+                           unsigned short *dst, int width, bool floorG);
+    // Y row + interleaved chroma row -> RGB565 or, if rgba is set, RGBA8888
+    // with the given matrix. swapUV is set for VU ordered (NV21) chroma
+    void (*yuvRowToRGB)(const unsigned char *srcY, const unsigned char *srcUV,
+                        unsigned char *dst, int width, const ColorMatrixCoefs *m,
+                        bool swapUV, bool rgba);
+};
+
+static inline unsigned short yuvToRGB565Pixel(int y, int cb, int cr, bool floorG)
+{
+    int r = y + ((359 * cr) >> 8);
+    int g = floorG ? y + ((-88 * cb - 183 * cr) >> 8)
+                   : y - ((88 * cb + 183 * cr) >> 8);
+    int b = y + ((454 * cb) >> 8);
+    r = CLIP(r, 255, 0);
+    g = CLIP(g, 255, 0);
+    b = CLIP(b, 255, 0);
+    return ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+}
+
+static inline void swapUVRowTail(const unsigned char *src, unsigned char *dst, int from, int n)
+{
+    for (int i = from; i + 1 < n; i += 2) {
+        unsigned char u = src[i];
+        dst[i] = src[i + 1];
+        dst[i + 1] = u;
+    }
+}
+
+static inline void splitUVRowTail(const unsigned char *src, unsigned char *dst0,
+                                  unsigned char *dst1, int from, int pairs)
+{
+    for (int i = from; i < pairs; i++) {
+        dst0[i] = src[2 * i];
+        dst1[i] = src[2 * i + 1];
+    }
+}
+
+static inline void mergeUVRowTail(const unsigned char *src0, const unsigned char *src1,
+                                  unsigned char *dst, int from, int pairs)
+{
+    for (int i = from; i < pairs; i++) {
+        dst[2 * i] = src0[i];
+        dst[2 * i + 1] = src1[i];
+    }
+}
+
+static inline void yuyvToNV21RowTail(const unsigned char *src, unsigned char *dstY,
+                                     unsigned char *dstVU, int from, int width)
+{
+    for (int j = from; j + 1 < width; j += 2) {
+        dstY[j] = src[2 * j];
+        dstY[j + 1] = src[2 * j + 2];
+        if (dstVU) {
+            dstVU[j] = src[2 * j + 3];
+            dstVU[j + 1] = src[2 * j + 1];
+        }
+    }
+}
+
+static inline void yuyvToPlanarRowTail(const unsigned char *src, unsigned char *dstY,
+                                       unsigned char *dstC, int from, int width,
+                                       int chromaOffset)
+{
+    for (int j = from; j + 1 < width; j += 2) {
+        dstY[j] = src[2 * j];
+        dstY[j + 1] = src[2 * j + 2];
+        dstC[j / 2] = src[2 * j + chromaOffset];
+    }
+}
+
+static inline void yuvRowToRGB565Tail(const unsigned char *srcY, const unsigned char *srcUV,
+                                      unsigned short *dst, int from, int width, bool floorG)
+{
+    for (int j = from; j + 1 < width; j += 2) {
+        int cb = srcUV[j] - 128;
+        int cr = srcUV[j + 1] - 128;
+        dst[j] = yuvToRGB565Pixel(srcY[j], cb, cr, floorG);
+        dst[j + 1] = yuvToRGB565Pixel(srcY[j + 1], cb, cr, floorG);
+    }
+}
+
+static inline void yuvToRGBPixel(int y, int cb, int cr, const ColorMatrixCoefs *m,
+                                 unsigned char *dst, bool rgba)
+{
+    const int luma = (y - m->yOffset) * m->y + (1 << (COLOR_MATRIX_BITS - 1));
+    int r = (luma + m->crR * cr) >> COLOR_MATRIX_BITS;
+    int g = (luma - m->cbG * cb - m->crG * cr) >> COLOR_MATRIX_BITS;
+    int b = (luma + m->cbB * cb) >> COLOR_MATRIX_BITS;
+    r = CLIP(r, 255, 0);
+    g = CLIP(g, 255, 0);
+    b = CLIP(b, 255, 0);
+    if (rgba) {
+        dst[0] = r;
+        dst[1] = g;
+        dst[2] = b;
+        dst[3] = 0xff;
+    } else {
+        *(unsigned short *) dst = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+    }
+}
+
+static inline void yuvRowToRGBTail(const unsigned char *srcY, const unsigned char *srcUV,
+                                   unsigned char *dst, int from, int width,
+                                   const ColorMatrixCoefs *m, bool swapUV, bool rgba)
+{
+    const int pixelBytes = rgba ? 4 : 2;
+    for (int j = from; j + 1 < width; j += 2) {
+        int cb = srcUV[j + swapUV] - 128;
+        int cr = srcUV[j + !swapUV] - 128;
+        yuvToRGBPixel(srcY[j], cb, cr, m, dst + j * pixelBytes, rgba);
+        yuvToRGBPixel(srcY[j + 1], cb, cr, m, dst + (j + 1) * pixelBytes, rgba);
+    }
+}
+
+#ifdef COLOR_CONVERTER_SIMD
+
+#define SSE2_FUNC __attribute__((target("sse2")))
+#define SSSE3_FUNC __attribute__((target("ssse3")))
+
+SSE2_FUNC
+static void swapUVRowSSE2(const unsigned char *src, unsigned char *dst, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i uv = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i vu = _mm_or_si128(_mm_slli_epi16(uv, 8), _mm_srli_epi16(uv, 8));
+        _mm_storeu_si128((__m128i *)(dst + i), vu);
+    }
+    swapUVRowTail(src, dst, i, n);
+}
+
+SSE2_FUNC
+static void splitUVRowSSE2(const unsigned char *src, unsigned char *dst0,
+                           unsigned char *dst1, int pairs)
+{
+    const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+    int i = 0;
+    for (; i + 16 <= pairs; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 2 * i + 16));
+        __m128i even = _mm_packus_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes));
+        __m128i odd = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128((__m128i *)(dst0 + i), even);
+        _mm_storeu_si128((__m128i *)(dst1 + i), odd);
+    }
+    splitUVRowTail(src, dst0, dst1, i, pairs);
+}
+
+SSE2_FUNC
+static void mergeUVRowSSE2(const unsigned char *src0, const unsigned char *src1,
+                           unsigned char *dst, int pairs)
+{
+    int i = 0;
+    for (; i + 16 <= pairs; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src0 + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src1 + i));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+    }
+    mergeUVRowTail(src0, src1, dst, i, pairs);
+}
+
+SSE2_FUNC
+static void yuyvToNV21RowSSE2(const unsigned char *src, unsigned char *dstY,
+                              unsigned char *dstVU, int width)
+{
+    const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+    int j = 0;
+    for (; j + 16 <= width; j += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + 2 * j));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 2 * j + 16));
+        __m128i y = _mm_packus_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes));
+        _mm_storeu_si128((__m128i *)(dstY + j), y);
+        if (dstVU) {
+            __m128i uv = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+            __m128i vu = _mm_or_si128(_mm_slli_epi16(uv, 8), _mm_srli_epi16(uv, 8));
+            _mm_storeu_si128((__m128i *)(dstVU + j), vu);
+        }
+    }
+    yuyvToNV21RowTail(src, dstY, dstVU, j, width);
+}
+
+SSE2_FUNC
+static void yuyvToPlanarRowSSE2(const unsigned char *src, unsigned char *dstY,
+                                unsigned char *dstC, int width, int chromaOffset)
+{
+    const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+    int j = 0;
+    for (; j + 32 <= width; j += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + 2 * j));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + 2 * j + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + 2 * j + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + 2 * j + 48));
+        _mm_storeu_si128((__m128i *)(dstY + j),
+                         _mm_packus_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes)));
+        _mm_storeu_si128((__m128i *)(dstY + j + 16),
+                         _mm_packus_epi16(_mm_and_si128(c, lowBytes), _mm_and_si128(d, lowBytes)));
+        __m128i uv0 = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        __m128i uv1 = _mm_packus_epi16(_mm_srli_epi16(c, 8), _mm_srli_epi16(d, 8));
+        __m128i chroma = (chromaOffset == 1) ?
+            _mm_packus_epi16(_mm_and_si128(uv0, lowBytes), _mm_and_si128(uv1, lowBytes)) :
+            _mm_packus_epi16(_mm_srli_epi16(uv0, 8), _mm_srli_epi16(uv1, 8));
+        _mm_storeu_si128((__m128i *)(dstC + j / 2), chroma);
+    }
+    yuyvToPlanarRowTail(src, dstY, dstC, j, width, chromaOffset);
+}
+
+/**
+ * Converts 16 pixels per iteration. The chroma terms are computed with
+ * pmaddwd on the (Cb, Cr) pairs as they come from the NV12 UV plane, so
+ * the sums and the arithmetic shifts are the same as in the scalar code
+ * and the output is bit exact with it.
+ */
+SSE2_FUNC
+static void yuvRowToRGB565SSE2(const unsigned char *srcY, const unsigned char *srcUV,
+                               unsigned short *dst, int width, bool floorG)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i max = _mm_set1_epi16(255);
+    const __m128i coefB = _mm_set1_epi32(454);
+    const __m128i coefR = _mm_set1_epi32(359 << 16);
+    const __m128i coefG = floorG ? _mm_set1_epi32(((-183 & 0xffff) << 16) | (-88 & 0xffff))
+                                 : _mm_set1_epi32((183 << 16) | 88);
+    const __m128i maskR = _mm_set1_epi16(0xf8);
+    const __m128i maskG = _mm_set1_epi16(0xfc);
+    int j = 0;
+
+    for (; j + 16 <= width; j += 16) {
+        __m128i y = _mm_loadu_si128((const __m128i *)(srcY + j));
+        __m128i uv = _mm_loadu_si128((const __m128i *)(srcUV + j));
+        __m128i y0 = _mm_unpacklo_epi8(y, zero);
+        __m128i y1 = _mm_unpackhi_epi8(y, zero);
+        __m128i c0 = _mm_sub_epi16(_mm_unpacklo_epi8(uv, zero), bias);
+        __m128i c1 = _mm_sub_epi16(_mm_unpackhi_epi8(uv, zero), bias);
+
+        // one 16 bit term per chroma sample, i.e. per two pixels
+        __m128i b = _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(c0, coefB), 8),
+                                    _mm_srai_epi32(_mm_madd_epi16(c1, coefB), 8));
+        __m128i g = _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(c0, coefG), 8),
+                                    _mm_srai_epi32(_mm_madd_epi16(c1, coefG), 8));
+        __m128i r = _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(c0, coefR), 8),
+                                    _mm_srai_epi32(_mm_madd_epi16(c1, coefR), 8));
+        if (!floorG)
+            g = _mm_sub_epi16(zero, g);
+
+        __m128i halves[2] = { y0, y1 };
+        for (int k = 0; k < 2; k++) {
+            __m128i bk = k ? _mm_unpackhi_epi16(b, b) : _mm_unpacklo_epi16(b, b);
+            __m128i gk = k ? _mm_unpackhi_epi16(g, g) : _mm_unpacklo_epi16(g, g);
+            __m128i rk = k ? _mm_unpackhi_epi16(r, r) : _mm_unpacklo_epi16(r, r);
+            bk = _mm_min_epi16(_mm_max_epi16(_mm_add_epi16(halves[k], bk), zero), max);
+            gk = _mm_min_epi16(_mm_max_epi16(_mm_add_epi16(halves[k], gk), zero), max);
+            rk = _mm_min_epi16(_mm_max_epi16(_mm_add_epi16(halves[k], rk), zero), max);
+            __m128i pix = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(rk, maskR), 8),
+                          _mm_or_si128(_mm_slli_epi16(_mm_and_si128(gk, maskG), 3),
+                                       _mm_srli_epi16(bk, 3)));
+            _mm_storeu_si128((__m128i *)(dst + j + 8 * k), pix);
+        }
+    }
+    yuvRowToRGB565Tail(srcY, srcUV, dst, j, width, floorG);
+}
+
+// 16 bit coefficient pair for pmaddwd on a chroma pair in memory order
+static inline int chromaCoefPair(int cbCoef, int crCoef, bool swapUV)
+{
+    int first = swapUV ? crCoef : cbCoef;
+    int second = swapUV ? cbCoef : crCoef;
+    return (int) (((unsigned int) second << 16) | (first & 0xffff));
+}
+
+/**
+ * Converts 16 pixels per iteration with the sums of yuvToRGBPixel() in
+ * 32 bits: pmaddwd gives the chroma terms of a (Cb, Cr) pair and the luma
+ * term of a (Y, 0) pair. The results are clamped by the saturating packs,
+ * so the output is bit exact with the scalar code.
+ */
+SSE2_FUNC
+static void yuvRowToRGBSSE2(const unsigned char *srcY, const unsigned char *srcUV,
+                            unsigned char *dst, int width, const ColorMatrixCoefs *m,
+                            bool swapUV, bool rgba)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i yOffset = _mm_set1_epi16(m->yOffset);
+    const __m128i round = _mm_set1_epi32(1 << (COLOR_MATRIX_BITS - 1));
+    const __m128i coefY = _mm_set1_epi32(m->y);
+    const __m128i coefR = _mm_set1_epi32(chromaCoefPair(0, m->crR, swapUV));
+    const __m128i coefG = _mm_set1_epi32(chromaCoefPair(-m->cbG, -m->crG, swapUV));
+    const __m128i coefB = _mm_set1_epi32(chromaCoefPair(m->cbB, 0, swapUV));
+    const __m128i alpha = _mm_set1_epi8((char) 0xff);
+    const __m128i maskR = _mm_set1_epi16(0xf8);
+    const __m128i maskG = _mm_set1_epi16(0xfc);
+    int j = 0;
+
+    for (; j + 16 <= width; j += 16) {
+        __m128i y = _mm_loadu_si128((const __m128i *)(srcY + j));
+        __m128i uv = _mm_loadu_si128((const __m128i *)(srcUV + j));
+        __m128i y0 = _mm_sub_epi16(_mm_unpacklo_epi8(y, zero), yOffset);
+        __m128i y1 = _mm_sub_epi16(_mm_unpackhi_epi8(y, zero), yOffset);
+        __m128i c[2] = { _mm_sub_epi16(_mm_unpacklo_epi8(uv, zero), bias),
+                         _mm_sub_epi16(_mm_unpackhi_epi8(uv, zero), bias) };
+
+        // luma terms of pixels 4k..4k+3
+        __m128i luma[4] = {
+            _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(y0, zero), coefY), round),
+            _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(y0, zero), coefY), round),
+            _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(y1, zero), coefY), round),
+            _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(y1, zero), coefY), round)
+        };
+
+        __m128i coefs[3] = { coefR, coefG, coefB };
+        __m128i rgb[3];
+        for (int n = 0; n < 3; n++) {
+            __m128i out[4];
+            for (int h = 0; h < 2; h++) {
+                // one term per chroma pair, duplicated for its two pixels
+                __m128i t = _mm_madd_epi16(c[h], coefs[n]);
+                out[2 * h] = _mm_srai_epi32(_mm_add_epi32(luma[2 * h],
+                                            _mm_unpacklo_epi32(t, t)), COLOR_MATRIX_BITS);
+                out[2 * h + 1] = _mm_srai_epi32(_mm_add_epi32(luma[2 * h + 1],
+                                                _mm_unpackhi_epi32(t, t)), COLOR_MATRIX_BITS);
+            }
+            rgb[n] = _mm_packus_epi16(_mm_packs_epi32(out[0], out[1]),
+                                      _mm_packs_epi32(out[2], out[3]));
+        }
+
+        if (rgba) {
+            __m128i rg0 = _mm_unpacklo_epi8(rgb[0], rgb[1]);
+            __m128i rg1 = _mm_unpackhi_epi8(rgb[0], rgb[1]);
+            __m128i ba0 = _mm_unpacklo_epi8(rgb[2], alpha);
+            __m128i ba1 = _mm_unpackhi_epi8(rgb[2], alpha);
+            unsigned char *d = dst + 4 * j;
+            _mm_storeu_si128((__m128i *)(d), _mm_unpacklo_epi16(rg0, ba0));
+            _mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi16(rg0, ba0));
+            _mm_storeu_si128((__m128i *)(d + 32), _mm_unpacklo_epi16(rg1, ba1));
+            _mm_storeu_si128((__m128i *)(d + 48), _mm_unpackhi_epi16(rg1, ba1));
+        } else {
+            for (int k = 0; k < 2; k++) {
+                __m128i r = k ? _mm_unpackhi_epi8(rgb[0], zero) : _mm_unpacklo_epi8(rgb[0], zero);
+                __m128i g = k ? _mm_unpackhi_epi8(rgb[1], zero) : _mm_unpacklo_epi8(rgb[1], zero);
+                __m128i b = k ? _mm_unpackhi_epi8(rgb[2], zero) : _mm_unpacklo_epi8(rgb[2], zero);
+                __m128i pix = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(r, maskR), 8),
+                              _mm_or_si128(_mm_slli_epi16(_mm_and_si128(g, maskG), 3),
+                                           _mm_srli_epi16(b, 3)));
+                _mm_storeu_si128((__m128i *)(dst + 2 * j + 16 * k), pix);
+            }
+        }
+    }
+    yuvRowToRGBTail(srcY, srcUV, dst, j, width, m, swapUV, rgba);
+}
+
+SSSE3_FUNC
+static void swapUVRowSSSE3(const unsigned char *src, unsigned char *dst, int n)
+{
+    const __m128i shuffle = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                                          9, 8, 11, 10, 13, 12, 15, 14);
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(a, shuffle));
+        _mm_storeu_si128((__m128i *)(dst + i + 16), _mm_shuffle_epi8(b, shuffle));
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(a, shuffle));
+    }
+    swapUVRowTail(src, dst, i, n);
+}
+
+SSSE3_FUNC
+static void splitUVRowSSSE3(const unsigned char *src, unsigned char *dst0,
+                            unsigned char *dst1, int pairs)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14,
+                                          1, 3, 5, 7, 9, 11, 13, 15);
+    int i = 0;
+    for (; i + 16 <= pairs; i += 16) {
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 2 * i)), shuffle);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 2 * i + 16)), shuffle);
+        _mm_storeu_si128((__m128i *)(dst0 + i), _mm_unpacklo_epi64(a, b));
+        _mm_storeu_si128((__m128i *)(dst1 + i), _mm_unpackhi_epi64(a, b));
+    }
+    splitUVRowTail(src, dst0, dst1, i, pairs);
+}
+
+SSSE3_FUNC
+static void yuyvToNV21RowSSSE3(const unsigned char *src, unsigned char *dstY,
+                               unsigned char *dstVU, int width)
+{
+    // Y0..Y7 followed by V0 U0 .. V3 U3
+    const __m128i shuffle = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14,
+                                          3, 1, 7, 5, 11, 9, 15, 13);
+    int j = 0;
+    for (; j + 16 <= width; j += 16) {
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 2 * j)), shuffle);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 2 * j + 16)), shuffle);
+        _mm_storeu_si128((__m128i *)(dstY + j), _mm_unpacklo_epi64(a, b));
+        if (dstVU)
+            _mm_storeu_si128((__m128i *)(dstVU + j), _mm_unpackhi_epi64(a, b));
+    }
+    yuyvToNV21RowTail(src, dstY, dstVU, j, width);
+}
+
+SSSE3_FUNC
+static void yuyvToPlanarRowSSSE3(const unsigned char *src, unsigned char *dstY,
+                                 unsigned char *dstC, int width, int chromaOffset)
+{
+    // Y0..Y7 followed by U0..U3 and V0..V3
+    const __m128i shuffle = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14,
+                                          1, 5, 9, 13, 3, 7, 11, 15);
+    int j = 0;
+    for (; j + 32 <= width; j += 32) {
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 2 * j)), shuffle);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 2 * j + 16)), shuffle);
+        __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 2 * j + 32)), shuffle);
+        __m128i d = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 2 * j + 48)), shuffle);
+        _mm_storeu_si128((__m128i *)(dstY + j), _mm_unpacklo_epi64(a, b));
+        _mm_storeu_si128((__m128i *)(dstY + j + 16), _mm_unpacklo_epi64(c, d));
+        // U0-3 U4-7 V0-3 V4-7 and U8-11 U12-15 V8-11 V12-15
+        __m128i ab = _mm_unpackhi_epi32(a, b);
+        __m128i cd = _mm_unpackhi_epi32(c, d);
+        __m128i chroma = (chromaOffset == 1) ? _mm_unpacklo_epi64(ab, cd)
+                                             : _mm_unpackhi_epi64(ab, cd);
+        _mm_storeu_si128((__m128i *)(dstC + j / 2), chroma);
+    }
+    yuyvToPlanarRowTail(src, dstY, dstC, j, width, chromaOffset);
+}
+
+static const ColorConverterRowOps sRowOpsSSE2 = {
+    "SSE2",
+    swapUVRowSSE2,
+    splitUVRowSSE2,
+    mergeUVRowSSE2,
+    yuyvToNV21RowSSE2,
+    yuyvToPlanarRowSSE2,
+    yuvRowToRGB565SSE2,
+    yuvRowToRGBSSE2
+};
+
+// pshufb only pays off for the byte shuffles, the rest is shared with SSE2
+static const ColorConverterRowOps sRowOpsSSSE3 = {
+    "SSSE3",
+    swapUVRowSSSE3,
+    splitUVRowSSSE3,
+    mergeUVRowSSE2,
+    yuyvToNV21RowSSSE3,
+    yuyvToPlanarRowSSSE3,
+    yuvRowToRGB565SSE2,
+    yuvRowToRGBSSE2
+};
+
+#endif // COLOR_CONVERTER_SIMD
+
+static const ColorConverterRowOps *sRowOps = NULL;
+static pthread_once_t sRowOpsOnce = PTHREAD_ONCE_INIT;
+
+static void selectRowOps()
 {
-    int line, col, linewidth;
+#ifdef COLOR_CONVERTER_SIMD
+    unsigned int features = getCpuFeatures();
+    if (features & CPU_FEATURE_SSSE3)
+        sRowOps = &sRowOpsSSSE3;
+    else if (features & CPU_FEATURE_SSE2)
+        sRowOps = &sRowOpsSSE2;
+#endif
+    LOG1("color conversion kernels: %s", sRowOps ? sRowOps->name : "scalar");
+}
+
+/**
+ * Returns the SIMD row kernels for this CPU, or NULL when the scalar
+ * reference implementations have to be used. CAMERA_DISABLE_SIMD is
+ * checked on every call so that the reference path can be selected at
+ * runtime, see tools/ImageKernelBenchmark.cpp.
+ */
+static const ColorConverterRowOps *rowOps()
+{
+    // checked first, so that the kernels are not selected while
+    // getCpuFeatures() hides the SIMD extensions
+    if (gControlLevel & CAMERA_DISABLE_SIMD)
+        return NULL;
+    pthread_once(&sRowOpsOnce, selectRowOps);
+    return sRowOps;
+}
+
+static void copyPlane(int width, int height, int srcBpl, int dstBpl,
+                      const unsigned char *src, unsigned char *dst)
+{
+    if (srcBpl == dstBpl) {
+        memcpy(dst, src, dstBpl * height);
+        return;
+    }
+    for (int i = 0; i < height; i++) {
+        memcpy(dst, src, width);
+        src += srcBpl;
+        dst += dstBpl;
+    }
+}
+
+/*
+ * Scalar reference implementations
+ */
+
+static void YUV420ToRGB565Scalar(int width, int height, void *src, void *dst)
+{
+    int line, col;
     int y, u, v, yy, vr, ug, vg, ub;
     int r, g, b;
     const unsigned char *py, *pu, *pv;
     unsigned short *rgbs = (unsigned short *) dst;
 
-    linewidth = width >> 1;
     py = (unsigned char *) src;
-    pu = py + (width * height);
-    pv = pu + (width * height) / 4;
-
-    y = *py++;
-    yy = y << 8;
-    u = *pu - 128;
-    ug = 88 * u;
-    ub = 454 * u;
-    v = *pv - 128;
-    vg = 183 * v;
-    vr = 359 * v;
 
     for (line = 0; line < height; line++) {
+        pu = (unsigned char *) src + (width * height) + (line >> 1) * (width >> 1);
+        pv = pu + (width * height) / 4;
         for (col = 0; col < width; col++) {
+            y = *py++;
+            yy = y << 8;
+            u = pu[col >> 1] - 128;
+            ug = 88 * u;
+            ub = 454 * u;
+            v = pv[col >> 1] - 128;
+            vg = 183 * v;
+            vr = 359 * v;
+
             r = (yy + vr) >> 8;
             g = (yy - ug - vg) >> 8;
             b = (yy + ub ) >> 8;
@@ -59,28 +630,11 @@ void YUV420ToRGB565(int width, int height, void *src, void *dst)
             if (b > 255) b = 255;
             *rgbs++ = (((unsigned short)r>>3)<<11) | (((unsigned short)g>>2)<<5)
                    | (((unsigned short)b>>3)<<0);
-
-            y = *py++;
-            yy = y << 8;
-            if (col & 1) {
-                pu++;
-                pv++;
-                u = *pu - 128;
-                ug = 88 * u;
-                ub = 454 * u;
-                v = *pv - 128;
-                vg = 183 * v;
-                vr = 359 * v;
-            }
-        }
-        if ((line & 1) == 0) {
-            pu -= linewidth;
-            pv -= linewidth;
         }
     }
 }
 
-void trimConvertNV12ToRGB565(int width, int height, int srcBpl, void *src, void *dst)
+static void trimConvertNV12ToRGB565Scalar(int width, int height, int srcBpl, void *src, void *dst)
 {
 
     unsigned char *yuvs = (unsigned char *) src;
@@ -132,7 +686,7 @@ void trimConvertNV12ToRGB565(int width, int height, int srcBpl, void *src, void
 }
 
 // covert YV12 (Y plane, V plane, U plane) to NV21 (Y plane, interlaced VU bytes)
-void convertYV12ToNV21(int width, int height, int srcBpl, int dstBpl, void *src, void *dst)
+static void convertYV12ToNV21Scalar(int width, int height, int srcBpl, int dstBpl, void *src, void *dst)
 {
     const int cBpl = srcBpl>>1;
     const int vuBpl = dstBpl;
@@ -170,59 +724,9 @@ void convertYV12ToNV21(int width, int height, int srcBpl, int dstBpl, void *src,
     }
 }
 
-// copy YV12 to YV12 (Y plane, V plan, U plan) in case of different bpl length
-void copyYV12ToYV12(int width, int height, int srcBpl, int dstBpl, void *src, void *dst)
-{
-    // copy the entire Y plane
-    if (srcBpl == dstBpl) {
-        memcpy(dst, src, dstBpl * height);
-    } else {
-        unsigned char *srcPtrY = (unsigned char *)src;
-        unsigned char *dstPtrY = (unsigned char *)dst;
-        for (int i = 0; i < height; i ++) {
-            memcpy(dstPtrY, srcPtrY, width);
-            srcPtrY += srcBpl;
-            dstPtrY += dstBpl;
-        }
-    }
-
-    // copy VU plane
-    const int scBpl = srcBpl >> 1;
-    const int dcBpl = ALIGN16(dstBpl >> 1); // Android CTS required: U/V plane needs 16 bytes aligned!
-    if (dcBpl == scBpl) {
-        unsigned char *srcPtrVU = (unsigned char *)src + height * srcBpl;
-        unsigned char *dstPtrVU = (unsigned char *)dst + height * dstBpl;
-        memcpy(dstPtrVU, srcPtrVU, height * dcBpl);
-    } else {
-        const int wHalf = width >> 1;
-        const int hHalf = height >> 1;
-        unsigned char *srcPtrV = (unsigned char *)src + height * srcBpl;
-        unsigned char *srcPtrU = srcPtrV + scBpl * hHalf;
-        unsigned char *dstPtrV = (unsigned char *)dst + height * dstBpl;
-        unsigned char *dstPtrU = dstPtrV + dcBpl * hHalf;
-        for (int i = 0; i < hHalf; i ++) {
-            memcpy(dstPtrU, srcPtrU, wHalf);
-            memcpy(dstPtrV, srcPtrV, wHalf);
-            dstPtrU += dcBpl, srcPtrU += scBpl;
-            dstPtrV += dcBpl, srcPtrV += scBpl;
-        }
-    }
-}
-
-// copy NV21 to NV21 (Y plane, VU interleaved) in case of different bpl length
-void copyNV21ToNV21(int width, int height, int srcBpl, int dstBpl, char *src, char *dst)
-{
-    int copyHeight = height * 3 / 2;
-    while (copyHeight--) {
-        memcpy(dst, src, width);
-        src += srcBpl;
-        dst += dstBpl;
-    }
-}
-
 // covert NV12 (Y plane, interlaced UV bytes) to
 // NV21 (Y plane, interlaced VU bytes) and trim bpl to real width
-void trimConvertNV12ToNV21(int width, int height, int srcBpl, void *src, void *dst)
+static void trimConvertNV12ToNV21Scalar(int width, int height, int srcBpl, void *src, void *dst)
 {
     const int ysize = width * height;
     unsigned const char *pSrc = (unsigned char *)src;
@@ -247,61 +751,7 @@ void trimConvertNV12ToNV21(int width, int height, int srcBpl, void *src, void *d
     pSrc = (unsigned char *)src + srcBpl * height;
     pDst = (unsigned char *)dst + width * height;
     for (int j = 0; j < height / 2; j++) {
-        if (width >= 16) {
-            const uint32_t *ptr0 = (const uint32_t *)(pSrc);
-            uint32_t *ptr1 = (uint32_t *)(pDst);
-            int bNotLastLine = ((j+1) == (height/2)) ? 0 : 1;
-            int width_16 = (width + 15 * bNotLastLine) & ~0xf;
-            if ((((uint32_t)(pSrc)) & 0xf) == 0 && (((uint32_t)(pDst)) & 0xf) == 0) { // 16 bytes aligned for both src and dest
-                __asm__ volatile(\
-                                 "movl       %0,  %%eax      \n\t"
-                                 "movl       %1,  %%edx      \n\t"
-                                 "movl       %2,  %%ecx      \n\t"
-                                 "1:     \n\t"
-                                 "movdqa (%%eax), %%xmm1     \n\t"
-                                 "movdqa  %%xmm1, %%xmm0     \n\t"
-                                 "psllw       $8, %%xmm1     \n\t"
-                                 "psrlw       $8, %%xmm0     \n\t"
-                                 "por     %%xmm0, %%xmm1     \n\t"
-                                 "movdqa  %%xmm1, (%%edx)    \n\t"
-                                 "add        $16, %%eax      \n\t"
-                                 "add        $16, %%edx      \n\t"
-                                 "sub        $16, %%ecx      \n\t"
-                                 "jnz   1b \n\t"
-                                 : "+m"(ptr0), "+m"(ptr1), "+m"(width_16)
-                                 :
-                                 : "eax", "ecx", "edx", "xmm0", "xmm1"
-                                );
-            }
-            else { // either src or dest is not 16-bytes aligned
-                __asm__ volatile(\
-                                 "movl       %0,  %%eax      \n\t"
-                                 "movl       %1,  %%edx      \n\t"
-                                 "movl       %2,  %%ecx      \n\t"
-                                 "1:     \n\t"
-                                 "lddqu  (%%eax), %%xmm1     \n\t"
-                                 "movdqa  %%xmm1, %%xmm0     \n\t"
-                                 "psllw       $8, %%xmm1     \n\t"
-                                 "psrlw       $8, %%xmm0     \n\t"
-                                 "por     %%xmm0, %%xmm1     \n\t"
-                                 "movdqu  %%xmm1, (%%edx)    \n\t"
-                                 "add        $16, %%eax      \n\t"
-                                 "add        $16, %%edx      \n\t"
-                                 "sub        $16, %%ecx      \n\t"
-                                 "jnz   1b \n\t"
-                                 : "+m"(ptr0), "+m"(ptr1), "+m"(width_16)
-                                 :
-                                 : "eax", "ecx", "edx", "xmm0", "xmm1"
-                                );
-            }
-
-            // process remaining data of less than 16 bytes of last row
-            for (int i = width_16; i < width; i += 2) {
-                pDst[i] = pSrc[i + 1];
-                pDst[i + 1] = pSrc[i];
-            }
-        }
-        else if ((((uint32_t)(pSrc)) & 0x3) == 0 && (((uint32_t)(pDst)) & 0x3) == 0){  // 4 bytes aligned for both src and dest
+        if ((((uintptr_t)(pSrc)) & 0x3) == 0 && (((uintptr_t)(pDst)) & 0x3) == 0){  // 4 bytes aligned for both src and dest
             const uint32_t *ptr0 = (const uint32_t *)(pSrc);
             uint32_t *ptr1 = (uint32_t *)(pDst);
             int width_4 = width & ~3;
@@ -332,7 +782,7 @@ void trimConvertNV12ToNV21(int width, int height, int srcBpl, void *src, void *d
 }
 
 // covert NV12 (Y plane, interlaced UV bytes) to YV12 (Y plane, V plane, U plane)
-void align16ConvertNV12ToYV12(int width, int height, int srcBpl, void *src, void *dst)
+static void align16ConvertNV12ToYV12Scalar(int width, int height, int srcBpl, void *src, void *dst)
 {
     int yBpl = ALIGN16(width);
     size_t ySize = yBpl * height;
@@ -372,7 +822,7 @@ void align16ConvertNV12ToYV12(int width, int height, int srcBpl, void *src, void
 }
 
 // P411's Y, U, V are seperated. But the YUY2's Y, U and V are interleaved.
-void YUY2ToP411(int width, int height, void *src, void *dst)
+static void YUY2ToP411Scalar(int width, int height, int srcBpl, void *src, void *dst)
 {
     int ySize = width * height;
     int cSize = width * height / 4;
@@ -404,13 +854,13 @@ void YUY2ToP411(int width, int height, void *src, void *dst)
             dstPtrU = dstPtrU + wHalf;
         }
 
-        srcPtr = srcPtr + width * 2;
+        srcPtr = srcPtr + srcBpl;
         dstPtr = dstPtr + width;
     }
 }
 
 // P411's Y, U, V are separated. But the NV12's U and V are interleaved.
-void NV12ToP411Separate(int width, int height, void *srcY, void *srcUV, void *dst)
+static void NV12ToP411SeparateScalar(int width, int height, void *srcY, void *srcUV, void *dst)
 {
     int i, j, p, q;
     unsigned char *pdstU, *pdstV;
@@ -437,7 +887,7 @@ void NV12ToP411Separate(int width, int height, void *srcY, void *srcUV, void *ds
 }
 
 // P411's Y, U, V are separated. But the NV21's U and V are interleaved.
-void NV21ToP411Separate(int width, int height, void *srcY, void *srcUV, void *dst)
+static void NV21ToP411SeparateScalar(int width, int height, void *srcY, void *srcUV, void *dst)
 {
     int i, j, p, q;
     unsigned char *pdstU, *pdstV;
@@ -463,6 +913,391 @@ void NV21ToP411Separate(int width, int height, void *srcY, void *srcUV, void *ds
     }
 }
 
+// covert YUYV(YUY2, YUV422 format) to YV12 (Y plane, V plane, U plane)
+static void convertYUYVToYV12Scalar(int width, int height, int srcBpl, int dstBpl, void *src, void *dst)
+{
+    int ySize = width * height;
+    int cSize = ALIGN16(dstBpl/2) * height / 2;
+    int wHalf = width >> 1;
+
+    unsigned char *srcPtr = (unsigned char *) src;
+    unsigned char *dstPtr = (unsigned char *) dst;
+    unsigned char *dstPtrV = (unsigned char *) dst + ySize;
+    unsigned char *dstPtrU = (unsigned char *) dst + ySize + cSize;
+
+    for (int i = 0; i < height; i++) {
+        //The first line of the source
+        //Copy first Y Plane first
+        for (int j=0; j < width; j++) {
+            dstPtr[j] = srcPtr[j*2];
+        }
+
+        if (i & 1) {
+            //Copy the V plane
+            for (int k = 0; k< wHalf; k++) {
+                dstPtrV[k] = srcPtr[k * 4 + 3];
+            }
+            dstPtrV = dstPtrV + ALIGN16(dstBpl>>1);
+        } else {
+            //Copy the U plane
+            for (int k = 0; k< wHalf; k++) {
+                dstPtrU[k] = srcPtr[k * 4 + 1];
+            }
+            dstPtrU = dstPtrU + ALIGN16(dstBpl>>1);
+        }
+
+        srcPtr = srcPtr + srcBpl;
+        dstPtr = dstPtr + width;
+    }
+}
+
+// covert YUYV(YUY2, YUV422 format) to NV21 (Y plane, interlaced VU bytes)
+static void convertYUYVToNV21Scalar(int width, int height, int srcBpl, void *src, void *dst)
+{
+    int ySize = width * height;
+    int u_counter=1, v_counter=0;
+
+    unsigned char *srcPtr = (unsigned char *) src;
+    unsigned char *dstPtr = (unsigned char *) dst;
+    unsigned char *dstPtrUV = (unsigned char *) dst + ySize;
+
+    for (int i=0; i < height; i++) {
+        //The first line of the source
+        //Copy first Y Plane first
+        for (int j=0; j < width * 2; j++) {
+            if (j % 2 == 0)
+                dstPtr[j/2] = srcPtr[j];
+            if (i%2) {
+                if (( j % 4 ) == 3) {
+                    dstPtrUV[v_counter] = srcPtr[j]; //V plane
+                    v_counter += 2;
+                }
+                if (( j % 4 ) == 1) {
+                    dstPtrUV[u_counter] = srcPtr[j]; //U plane
+                    u_counter += 2;
+                }
+            }
+        }
+
+        srcPtr = srcPtr + srcBpl;
+        dstPtr = dstPtr + width;
+    }
+}
+
+/*
+ * Public entry points
+ */
+
+void YUV420ToRGB565(int width, int height, void *src, void *dst)
+{
+    const ColorConverterRowOps *ops = rowOps();
+    if (!ops) {
+        YUV420ToRGB565Scalar(width, height, src, dst);
+        return;
+    }
+
+    const int whalf = width >> 1;
+    const unsigned char *srcY = (const unsigned char *) src;
+    const unsigned char *srcU = srcY + width * height;
+    const unsigned char *srcV = srcU + (width * height) / 4;
+    unsigned short *rgb = (unsigned short *) dst;
+    unsigned char *uvRow = (unsigned char *) malloc(whalf * 2 + 2);
+    if (uvRow == NULL) {
+        ALOGE("%s: out of memory", __FUNCTION__);
+        return;
+    }
+
+    for (int i = 0; i < height; i++) {
+        // both lines of a chroma row share the interleaved copy
+        if ((i & 1) == 0)
+            ops->mergeUVRow(srcU + (i >> 1) * whalf, srcV + (i >> 1) * whalf, uvRow, whalf);
+        ops->yuvRowToRGB565(srcY + i * width, uvRow, rgb + i * width, width, true);
+    }
+
+    free(uvRow);
+}
+
+void trimConvertNV12ToRGB565(int width, int height, int srcBpl, void *src, void *dst)
+{
+    const ColorConverterRowOps *ops = rowOps();
+    if (!ops) {
+        trimConvertNV12ToRGB565Scalar(width, height, srcBpl, src, dst);
+        return;
+    }
+
+    const unsigned char *srcY = (const unsigned char *) src;
+    const unsigned char *srcUV = srcY + srcBpl * height;
+    unsigned short *rgb = (unsigned short *) dst;
+    for (int i = 0; i < height; i++)
+        ops->yuvRowToRGB565(srcY + i * srcBpl, srcUV + (i >> 1) * srcBpl,
+                            rgb + i * width, width, false);
+}
+
+struct RGBConvertJob {
+    const ColorConverterRowOps *ops;    // NULL for the scalar code
+    const ColorMatrixCoefs *matrix;
+    int width;
+    int srcBpl;
+    int dstBpl;
+    const unsigned char *srcY;
+    const unsigned char *srcUV;
+    unsigned char *dst;
+    bool swapUV;
+    bool rgba;
+};
+
+static void convertRGBRows(void *context, int first, int last)
+{
+    const RGBConvertJob *job = (const RGBConvertJob *) context;
+    for (int i = first; i < last; i++) {
+        const unsigned char *srcY = job->srcY + i * job->srcBpl;
+        const unsigned char *srcUV = job->srcUV + (i >> 1) * job->srcBpl;
+        unsigned char *dst = job->dst + i * job->dstBpl;
+        if (job->ops)
+            job->ops->yuvRowToRGB(srcY, srcUV, dst, job->width, job->matrix,
+                                  job->swapUV, job->rgba);
+        else
+            yuvRowToRGBTail(srcY, srcUV, dst, 0, job->width, job->matrix,
+                            job->swapUV, job->rgba);
+    }
+}
+
+status_t convertNV12ToRGB(int srcFourcc, int dstFourcc, int width, int height,
+                          int srcBpl, int dstBpl, void *src, void *dst,
+                          ColorMatrix matrix, bool multiThreaded)
+{
+    if ((srcFourcc != V4L2_PIX_FMT_NV12 && srcFourcc != V4L2_PIX_FMT_NV21)
+        || (dstFourcc != V4L2_PIX_FMT_RGB565 && dstFourcc != V4L2_PIX_FMT_RGB32)) {
+        ALOGE("%s: unsupported conversion %s -> %s", __FUNCTION__,
+              v4l2Fmt2Str(srcFourcc), v4l2Fmt2Str(dstFourcc));
+        return BAD_VALUE;
+    }
+    if (matrix < 0 || matrix >= COLOR_MATRIX_COUNT || (width & 1) || (height & 1)
+        || width <= 0 || height <= 0 || srcBpl < width
+        || dstBpl < pixelsToBytes(dstFourcc, width)) {
+        ALOGE("%s: invalid geometry %dx%d bpl %d/%d or matrix %d", __FUNCTION__,
+              width, height, srcBpl, dstBpl, matrix);
+        return BAD_VALUE;
+    }
+
+    RGBConvertJob job;
+    job.ops = rowOps();
+    job.matrix = &sColorMatrices[matrix];
+    job.width = width;
+    job.srcBpl = srcBpl;
+    job.dstBpl = dstBpl;
+    job.srcY = (const unsigned char *) src;
+    job.srcUV = job.srcY + srcBpl * height;
+    job.dst = (unsigned char *) dst;
+    job.swapUV = srcFourcc == V4L2_PIX_FMT_NV21;
+    job.rgba = dstFourcc == V4L2_PIX_FMT_RGB32;
+
+    if (multiThreaded)
+        WorkerPool::runStripes(convertRGBRows, &job, height, 2,
+                               WorkerPool::minStripeRows(dstBpl, 2));
+    else
+        convertRGBRows(&job, 0, height);
+    return NO_ERROR;
+}
+
+void convertYV12ToNV21(int width, int height, int srcBpl, int dstBpl, void *src, void *dst)
+{
+    const ColorConverterRowOps *ops = rowOps();
+    if (!ops) {
+        convertYV12ToNV21Scalar(width, height, srcBpl, dstBpl, src, dst);
+        return;
+    }
+
+    const int cBpl = srcBpl >> 1;
+    const int hhalf = height >> 1;
+    const unsigned char *srcV = (const unsigned char *) src + height * srcBpl;
+    const unsigned char *srcU = srcV + cBpl * hhalf;
+    unsigned char *dstVU = (unsigned char *) dst + dstBpl * height;
+
+    copyPlane(width, height, srcBpl, dstBpl, (const unsigned char *) src, (unsigned char *) dst);
+    for (int i = 0; i < hhalf; i++)
+        ops->mergeUVRow(srcV + i * cBpl, srcU + i * cBpl, dstVU + i * dstBpl, width >> 1);
+}
+
+// copy YV12 to YV12 (Y plane, V plan, U plan) in case of different bpl length
+void copyYV12ToYV12(int width, int height, int srcBpl, int dstBpl, void *src, void *dst)
+{
+    // copy the entire Y plane
+    if (srcBpl == dstBpl) {
+        memcpy(dst, src, dstBpl * height);
+    } else {
+        unsigned char *srcPtrY = (unsigned char *)src;
+        unsigned char *dstPtrY = (unsigned char *)dst;
+        for (int i = 0; i < height; i ++) {
+            memcpy(dstPtrY, srcPtrY, width);
+            srcPtrY += srcBpl;
+            dstPtrY += dstBpl;
+        }
+    }
+
+    // copy VU plane
+    const int scBpl = srcBpl >> 1;
+    const int dcBpl = ALIGN16(dstBpl >> 1); // Android CTS required: U/V plane needs 16 bytes aligned!
+    if (dcBpl == scBpl) {
+        unsigned char *srcPtrVU = (unsigned char *)src + height * srcBpl;
+        unsigned char *dstPtrVU = (unsigned char *)dst + height * dstBpl;
+        memcpy(dstPtrVU, srcPtrVU, height * dcBpl);
+    } else {
+        const int wHalf = width >> 1;
+        const int hHalf = height >> 1;
+        unsigned char *srcPtrV = (unsigned char *)src + height * srcBpl;
+        unsigned char *srcPtrU = srcPtrV + scBpl * hHalf;
+        unsigned char *dstPtrV = (unsigned char *)dst + height * dstBpl;
+        unsigned char *dstPtrU = dstPtrV + dcBpl * hHalf;
+        for (int i = 0; i < hHalf; i ++) {
+            memcpy(dstPtrU, srcPtrU, wHalf);
+            memcpy(dstPtrV, srcPtrV, wHalf);
+            dstPtrU += dcBpl, srcPtrU += scBpl;
+            dstPtrV += dcBpl, srcPtrV += scBpl;
+        }
+    }
+}
+
+// copy NV21 to NV21 (Y plane, VU interleaved) in case of different bpl length
+void copyNV21ToNV21(int width, int height, int srcBpl, int dstBpl, char *src, char *dst)
+{
+    int copyHeight = height * 3 / 2;
+    while (copyHeight--) {
+        memcpy(dst, src, width);
+        src += srcBpl;
+        dst += dstBpl;
+    }
+}
+
+void trimConvertNV12ToNV21(int width, int height, int srcBpl, void *src, void *dst)
+{
+    const ColorConverterRowOps *ops = rowOps();
+    if (!ops) {
+        trimConvertNV12ToNV21Scalar(width, height, srcBpl, src, dst);
+        return;
+    }
+
+    if (srcBpl < width) {
+        ALOGE("bad bpl value");
+        return;
+    }
+
+    const unsigned char *srcUV = (const unsigned char *) src + srcBpl * height;
+    unsigned char *dstVU = (unsigned char *) dst + width * height;
+
+    copyPlane(width, height, srcBpl, width, (const unsigned char *) src, (unsigned char *) dst);
+    for (int i = 0; i < height / 2; i++)
+        ops->swapUVRow(srcUV + i * srcBpl, dstVU + i * width, width);
+}
+
+void align16ConvertNV12ToYV12(int width, int height, int srcBpl, void *src, void *dst)
+{
+    const ColorConverterRowOps *ops = rowOps();
+    if (!ops) {
+        align16ConvertNV12ToYV12Scalar(width, height, srcBpl, src, dst);
+        return;
+    }
+
+    const int yBpl = ALIGN16(width);
+    const int cBpl = ALIGN16(yBpl / 2);
+    const size_t ySize = yBpl * height;
+    const size_t cSize = cBpl * height / 2;
+
+    if (srcBpl != yBpl && srcBpl <= width) {
+        ALOGE("bad src bpl value");
+        return;
+    }
+
+    const unsigned char *srcUV = (const unsigned char *) src + srcBpl * height;
+    unsigned char *dstV = (unsigned char *) dst + ySize;
+    unsigned char *dstU = dstV + cSize;
+
+    copyPlane(width, height, srcBpl, yBpl, (const unsigned char *) src, (unsigned char *) dst);
+    for (int i = 0; i < height / 2; i++)
+        ops->splitUVRow(srcUV + i * srcBpl, dstU + i * cBpl, dstV + i * cBpl, width / 2);
+}
+
+void YUY2ToP411(int width, int height, int srcBpl, void *src, void *dst)
+{
+    const ColorConverterRowOps *ops = rowOps();
+    if (!ops) {
+        YUY2ToP411Scalar(width, height, srcBpl, src, dst);
+        return;
+    }
+
+    const int wHalf = width >> 1;
+    const unsigned char *srcPtr = (const unsigned char *) src;
+    unsigned char *dstY = (unsigned char *) dst;
+    unsigned char *dstU = dstY + width * height;
+    unsigned char *dstV = dstU + width * height / 4;
+
+    for (int i = 0; i < height; i++) {
+        // even lines feed the U plane, odd lines the V plane
+        unsigned char *dstC = (i & 1) ? dstV + (i >> 1) * wHalf : dstU + (i >> 1) * wHalf;
+        ops->yuyvToPlanarRow(srcPtr + i * srcBpl, dstY + i * width, dstC,
+                             width, (i & 1) ? 3 : 1);
+    }
+}
+
+void NV12ToP411Separate(int width, int height, void *srcY, void *srcUV, void *dst)
+{
+    const ColorConverterRowOps *ops = rowOps();
+    if (!ops) {
+        NV12ToP411SeparateScalar(width, height, srcY, srcUV, dst);
+        return;
+    }
+
+    unsigned char *dstU = (unsigned char *) dst + width * height;
+    unsigned char *dstV = dstU + width * height / 4;
+
+    memcpy(dst, srcY, width * height);
+    // the source chroma rows are not padded, so it is one long row
+    ops->splitUVRow((const unsigned char *) srcUV, dstU, dstV, (width / 2) * (height / 2));
+}
+
+void NV21ToP411Separate(int width, int height, void *srcY, void *srcUV, void *dst)
+{
+    const ColorConverterRowOps *ops = rowOps();
+    if (!ops) {
+        NV21ToP411SeparateScalar(width, height, srcY, srcUV, dst);
+        return;
+    }
+
+    unsigned char *dstU = (unsigned char *) dst + width * height;
+    unsigned char *dstV = dstU + width * height / 4;
+
+    memcpy(dst, srcY, width * height);
+    ops->splitUVRow((const unsigned char *) srcUV, dstV, dstU, (width / 2) * (height / 2));
+}
+
+void splitNV12Chroma(int fourcc, int width, int rows, int srcBpl,
+                     const void *srcUV, void *dstU, void *dstV)
+{
+    const ColorConverterRowOps *ops = rowOps();
+    const unsigned char *src = (const unsigned char *) srcUV;
+    unsigned char *dst0 = (unsigned char *) (fourcc == V4L2_PIX_FMT_NV21 ? dstV : dstU);
+    unsigned char *dst1 = (unsigned char *) (fourcc == V4L2_PIX_FMT_NV21 ? dstU : dstV);
+
+    // unpadded rows are split as one long row
+    const bool packed = srcBpl == (width / 2) * 2;
+    const int pairs = packed ? (width / 2) * rows : width / 2;
+    const int count = packed ? 1 : rows;
+
+    for (int i = 0; i < count; i++) {
+        const unsigned char *row = src + i * srcBpl;
+        if (ops) {
+            ops->splitUVRow(row, dst0, dst1, pairs);
+        } else {
+            for (int j = 0; j < pairs; j++) {
+                dst0[j] = row[2 * j];
+                dst1[j] = row[2 * j + 1];
+            }
+        }
+        dst0 += pairs;
+        dst1 += pairs;
+    }
+}
+
 // P411's Y, U, V are seperated. But the NV12's U and V are interleaved.
 void NV12ToP411(int width, int height, void *src, void *dst)
 {
@@ -478,7 +1313,41 @@ void NV21ToP411(int width, int height, void *src, void *dst)
 // Re-pad YUV420 format image, the format can be YV12, YU12 or YUV420 planar.
 // If buffer size: (height*dstBpl*1.5) > (height*srcBpl*1.5), src and dst
 // buffer start addresses are same, the re-padding can be done inplace.
-void repadYUV420(int width, int height, int srcBpl, int dstBpl, void *src, void *dst)
+struct RepadJob {
+    int width;
+    int height;
+    int srcBpl;
+    int dstBpl;
+    const unsigned char *src;
+    unsigned char *dst;
+};
+
+// copies the luma rows [first, last) and the chroma rows belonging to them
+// of a YV12/YU12 image into a separate buffer
+static void repadRows(void *context, int first, int last)
+{
+    const RepadJob *job = (const RepadJob *) context;
+    const int scBpl = job->srcBpl >> 1;
+    const int dcBpl = job->dstBpl >> 1;
+    const int hhalf = job->height >> 1;
+
+    for (int i = first; i < last; i++)
+        memcpy(job->dst + i * job->dstBpl, job->src + i * job->srcBpl, job->width);
+
+    const unsigned char *sptr = job->src + job->height * job->srcBpl;
+    unsigned char *dptr = job->dst + job->height * job->dstBpl;
+    for (int plane = 0; plane < 2; plane++) {
+        for (int i = first >> 1; i < last >> 1; i++)
+            memcpy(dptr + i * dcBpl, sptr + i * scBpl, job->width >> 1);
+        sptr += hhalf * scBpl;
+        dptr += hhalf * dcBpl;
+    }
+}
+
+// This is a plain line copy, so it has no SIMD row kernel: memcpy() and
+// memmove() are already vectorized by the C library.
+void repadYUV420(int width, int height, int srcBpl, int dstBpl, void *src, void *dst,
+                 bool multiThreaded)
 {
     unsigned char *dptr;
     unsigned char *sptr;
@@ -499,6 +1368,14 @@ void repadYUV420(int width, int height, int srcBpl, int dstBpl, void *src, void
         return;
     }
 
+    if (multiThreaded && src != dst) {
+        RepadJob job = { width, height, srcBpl, dstBpl,
+                         (const unsigned char *) src, (unsigned char *) dst };
+        WorkerPool::runStripes(repadRows, &job, height, 2,
+                               WorkerPool::minStripeRows(2 * width, 2));
+        return;
+    }
+
     // copy V(YV12 case) or U(YU12 case) plane line by line
     sptr = (unsigned char *)src + sySize + 2*scSize - scBpl;
     dptr = (unsigned char *)dst + dySize + 2*dcSize - dcBpl;
@@ -531,75 +1408,44 @@ void repadYUV420(int width, int height, int srcBpl, int dstBpl, void *src, void
     }
 }
 
-// covert YUYV(YUY2, YUV422 format) to YV12 (Y plane, V plane, U plane)
 void convertYUYVToYV12(int width, int height, int srcBpl, int dstBpl, void *src, void *dst)
 {
-    int ySize = width * height;
-    int cSize = ALIGN16(dstBpl/2) * height / 2;
-    int wHalf = width >> 1;
+    const ColorConverterRowOps *ops = rowOps();
+    if (!ops) {
+        convertYUYVToYV12Scalar(width, height, srcBpl, dstBpl, src, dst);
+        return;
+    }
 
-    unsigned char *srcPtr = (unsigned char *) src;
-    unsigned char *dstPtr = (unsigned char *) dst;
-    unsigned char *dstPtrV = (unsigned char *) dst + ySize;
-    unsigned char *dstPtrU = (unsigned char *) dst + ySize + cSize;
+    const int cBpl = ALIGN16(dstBpl >> 1);
+    const int cSize = cBpl * height / 2;
+    const unsigned char *srcPtr = (const unsigned char *) src;
+    unsigned char *dstY = (unsigned char *) dst;
+    unsigned char *dstV = dstY + width * height;
+    unsigned char *dstU = dstV + cSize;
 
     for (int i = 0; i < height; i++) {
-        //The first line of the source
-        //Copy first Y Plane first
-        for (int j=0; j < width; j++) {
-            dstPtr[j] = srcPtr[j*2];
-        }
-
-        if (i & 1) {
-            //Copy the V plane
-            for (int k = 0; k< wHalf; k++) {
-                dstPtrV[k] = srcPtr[k * 4 + 3];
-            }
-            dstPtrV = dstPtrV + ALIGN16(dstBpl>>1);
-        } else {
-            //Copy the U plane
-            for (int k = 0; k< wHalf; k++) {
-                dstPtrU[k] = srcPtr[k * 4 + 1];
-            }
-            dstPtrU = dstPtrU + ALIGN16(dstBpl>>1);
-        }
-
-        srcPtr = srcPtr + srcBpl;
-        dstPtr = dstPtr + width;
+        unsigned char *dstC = (i & 1) ? dstV + (i >> 1) * cBpl : dstU + (i >> 1) * cBpl;
+        ops->yuyvToPlanarRow(srcPtr + i * srcBpl, dstY + i * width, dstC,
+                             width, (i & 1) ? 3 : 1);
     }
 }
 
-// covert YUYV(YUY2, YUV422 format) to NV21 (Y plane, interlaced VU bytes)
 void convertYUYVToNV21(int width, int height, int srcBpl, void *src, void *dst)
 {
-    int ySize = width * height;
-    int u_counter=1, v_counter=0;
-
-    unsigned char *srcPtr = (unsigned char *) src;
-    unsigned char *dstPtr = (unsigned char *) dst;
-    unsigned char *dstPtrUV = (unsigned char *) dst + ySize;
+    const ColorConverterRowOps *ops = rowOps();
+    if (!ops) {
+        convertYUYVToNV21Scalar(width, height, srcBpl, src, dst);
+        return;
+    }
 
-    for (int i=0; i < height; i++) {
-        //The first line of the source
-        //Copy first Y Plane first
-        for (int j=0; j < width * 2; j++) {
-            if (j % 2 == 0)
-                dstPtr[j/2] = srcPtr[j];
-            if (i%2) {
-                if (( j % 4 ) == 3) {
-                    dstPtrUV[v_counter] = srcPtr[j]; //V plane
-                    v_counter += 2;
-                }
-                if (( j % 4 ) == 1) {
-                    dstPtrUV[u_counter] = srcPtr[j]; //U plane
-                    u_counter += 2;
-                }
-            }
-        }
+    const unsigned char *srcPtr = (const unsigned char *) src;
+    unsigned char *dstY = (unsigned char *) dst;
+    unsigned char *dstVU = dstY + width * height;
 
-        srcPtr = srcPtr + srcBpl;
-        dstPtr = dstPtr + width;
-    }
+    // chroma is sampled from the odd lines only
+    for (int i = 0; i < height; i++)
+        ops->yuyvToNV21Row(srcPtr + i * srcBpl, dstY + i * width,
+                           (i & 1) ? dstVU + (i >> 1) * width : NULL, width);
 }
 
 void convertBuftoYV12(int format, int width, int height, int srcBpl, int
@@ -649,6 +1495,10 @@ const char *cameraParametersFormat(int v4l2Format)
         return CameraParameters::PIXEL_FORMAT_YUV420SP;
     case V4L2_PIX_FMT_YUYV:
         return CameraParameters::PIXEL_FORMAT_YUV422I;
+    case V4L2_PIX_FMT_RGB565:
+        return CameraParameters::PIXEL_FORMAT_RGB565;
+    case V4L2_PIX_FMT_RGB32:
+        return CameraParameters::PIXEL_FORMAT_RGBA8888;
     case V4L2_PIX_FMT_JPEG:
         return CameraParameters::PIXEL_FORMAT_JPEG;
     default:
@@ -677,6 +1527,10 @@ int V4L2Format(const char *cameraParamsFormat)
     if (strncmp(cameraParamsFormat, CameraParameters::PIXEL_FORMAT_RGB565, len) == 0)
         return V4L2_PIX_FMT_RGB565;
 
+    len = strlen(CameraParameters::PIXEL_FORMAT_RGBA8888);
+    if (strncmp(cameraParamsFormat, CameraParameters::PIXEL_FORMAT_RGBA8888, len) == 0)
+        return V4L2_PIX_FMT_RGB32;
+
     len = strlen(CameraParameters::PIXEL_FORMAT_JPEG);
     if (strncmp(cameraParamsFormat, CameraParameters::PIXEL_FORMAT_JPEG, len) == 0)
         return V4L2_PIX_FMT_JPEG;
@@ -21,10 +21,31 @@
 
 namespace android {
 
+/**
+ * YUV -> RGB conversion matrices. The ISP delivers full range BT.601, which
+ * is also what JPEG expects; video streams may be narrow range (see
+ * AtomISP::setNarrowGamma()) and HD video is conventionally BT.709.
+ */
+enum ColorMatrix {
+    COLOR_MATRIX_BT601_LIMITED = 0,
+    COLOR_MATRIX_BT601_FULL,
+    COLOR_MATRIX_BT709_LIMITED,
+    COLOR_MATRIX_COUNT
+};
+
 void YUV420ToRGB565(int width, int height, void *src, void *dst);
 
 void trimConvertNV12ToRGB565(int width, int height, int srcBpl, void *src, void *dst);
 
+/**
+ * Converts an NV12 or NV21 image to RGB565 or RGBA8888 (V4L2_PIX_FMT_RGB32,
+ * bytes in R, G, B, A order) using the given matrix. The chroma plane
+ * follows the luma plane with the same bpl. Width and height must be even.
+ */
+status_t convertNV12ToRGB(int srcFourcc, int dstFourcc, int width, int height,
+                          int srcBpl, int dstBpl, void *src, void *dst,
+                          ColorMatrix matrix, bool multiThreaded = false);
+
 void convertYV12ToNV21(int width, int height, int srcBpl, int dstBpl, void *src, void *dst);
 void copyYV12ToYV12(int width, int height, int srcBpl, int dstBpl, void *src, void *dst);
 void copyNV21ToNV21(int width, int height, int srcBpl, int dstBpl, char *src, char *dst);
@@ -38,7 +59,15 @@ void NV21ToP411(int width, int height, void *src, void *dst);
 void NV12ToP411Separate(int width, int height, void *srcY, void *srcUV, void *dst);
 void NV21ToP411Separate(int width, int height, void *srcY, void *srcUV, void *dst);
 
-void YUY2ToP411(int width, int height, void *src, void *dst);
+/**
+ * Splits rows of NV12 (or NV21) interleaved chroma into separate U and V
+ * planes, width / 2 samples per row. The source rows are srcBpl bytes
+ * apart, the destination rows are not padded.
+ */
+void splitNV12Chroma(int fourcc, int width, int rows, int srcBpl,
+                     const void *srcUV, void *dstU, void *dstV);
+
+void YUY2ToP411(int width, int height, int srcBpl, void *src, void *dst);
 
 void convertYUYVToYV12(int width, int height, int srcBpl, int dstBpl, void *src, void *dst);
 
@@ -50,7 +79,10 @@ void convertBuftoYV12(int fourcc, int width, int height, int srcBpl, int
 void convertBuftoNV21(int fourcc, int width, int height, int srcBpl, int
                       dstBpl, void *src, void *dst);
 
-void repadYUV420(int width, int height, int srcBpl, int dstBpl, void *src, void *dst);
+// src and dst may be the same buffer. multiThreaded only applies when they
+// are not, an in-place repad has to be done bottom up in one pass.
+void repadYUV420(int width, int height, int srcBpl, int dstBpl, void *src, void *dst,
+                 bool multiThreaded = false);
 
 const char *cameraParametersFormat(int v4l2Format);
 int V4L2Format(const char *cameraParamsFormat);
@@ -2232,7 +2232,15 @@ status_t ControlThread::startPreviewCore(bool videoMode)
         useHalVsPreview = true;
     }
 
-    mPreviewThread->setPreviewConfig(width, height, cb_fourcc, useSharedGfxBuffers, useHalVsPreview, mNumBuffers);
+    // the ISP outputs full range BT.601, with narrow gamma enabled for video
+    // it is limited range BT.601. AtomISP never configures BT.709 primaries,
+    // so HD video is no different.
+    ColorMatrix cbMatrix = COLOR_MATRIX_BT601_FULL;
+    if (videoMode && PlatformData::supportsNarrowGamma(mCameraId))
+        cbMatrix = COLOR_MATRIX_BT601_LIMITED;
+
+    mPreviewThread->setPreviewConfig(width, height, cb_fourcc, useSharedGfxBuffers, useHalVsPreview, mNumBuffers,
+                                     cbMatrix);
 
     // Get the preview size from PreviewThread and pass the configuration to AtomISP.
     status = mPreviewThread->fetchPreviewBufferGeometry(&width, &height, &bpl);
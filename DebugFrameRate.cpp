@@ -25,6 +25,7 @@ namespace android {
 DebugFrameRate::DebugFrameRate() :
     Thread(false)
     ,mCount(0)
+    ,mDropped(0)
     ,mStartTime(0)
     ,mActive(false)
 {
@@ -53,6 +54,13 @@ void DebugFrameRate::update()
     mMutex.unlock();
 }
 
+void DebugFrameRate::drop()
+{
+    mMutex.lock();
+    ++mDropped;
+    mMutex.unlock();
+}
+
 status_t DebugFrameRate::requestExitAndWait()
 {
     if(!mActive)
@@ -72,6 +80,7 @@ bool DebugFrameRate::threadLoop()
     while (1) {
         mMutex.lock();
         mCount = 0;
+        mDropped = 0;
         mStartTime = systemTime();
         status = mCondition.waitRelative(mMutex, WAIT_TIME_NSECS);
 
@@ -88,7 +97,8 @@ bool DebugFrameRate::threadLoop()
         delta = delta < 0.0 ? -delta : delta; // make sure is positive
         fps = mCount / delta;
 
-        ALOGD("time: %f seconds, frames: %d, fps: %f\n", (float) delta, mCount, fps);
+        ALOGD("time: %f seconds, frames: %d, dropped: %d, fps: %f\n", (float) delta, mCount,
+              mDropped, fps);
         mMutex.unlock();
     }
 
@@ -30,6 +30,7 @@ public:
     ~DebugFrameRate();
 
     void update();
+    void drop();                    // a frame was skipped, not rendered
     status_t requestExitAndWait();  // override
     status_t run();                 // override
 
@@ -41,6 +42,7 @@ private:
     static const int WAIT_TIME_NSECS = 2000000000; // 2 seconds
 
     int mCount;
+    int mDropped;
     nsecs_t mStartTime;
     Condition mCondition;
     Mutex mMutex;
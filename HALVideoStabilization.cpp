@@ -18,7 +18,6 @@
 
 #include "HALVideoStabilization.h"
 #include "LogHelper.h"
-#include "ImageScaler.h"
 #include "assert.h"
 #include "JpegCapture.h"
 
@@ -46,22 +45,27 @@ void HALVideoStabilization::getEnvelopeSize(int previewWidth, int previewHeight,
 void HALVideoStabilization::process(const AtomBuffer *inBuf, AtomBuffer *outBuf)
 {
     LOG2("@%s", __FUNCTION__);
-    assert(inBuf && outBuf && inBuf->width >= outBuf->width);
-    assert(inBuf->auxBuf);
-    unsigned char *nv12meta = ((unsigned char*)inBuf->auxBuf->dataPtr) + NV12_META_START;
+    assert(inBuf && outBuf && inBuf->width >= outBuf->width && inBuf->height >= outBuf->height);
 
-    if (inBuf->width == outBuf->width) {
-        memcpy((char *)outBuf->dataPtr, (const char*)inBuf->dataPtr, outBuf->size);
+    if (inBuf->width == outBuf->width && inBuf->height == outBuf->height) {
+        cropNV12Buffer(inBuf, outBuf, 0, 0);
         return;
     }
 
-    uint16_t leftCrop(getU16fromFrame(nv12meta, NV12_META_LEFT_OFFSET_ADDR));
-    uint16_t topCrop(getU16fromFrame(nv12meta, NV12_META_TOP_OFFSET_ADDR));
+    assert(inBuf->auxBuf);
+    unsigned char *nv12meta = ((unsigned char*)inBuf->auxBuf->dataPtr) + NV12_META_START;
+    int leftCrop(getU16fromFrame(nv12meta, NV12_META_LEFT_OFFSET_ADDR));
+    int topCrop(getU16fromFrame(nv12meta, NV12_META_TOP_OFFSET_ADDR));
+
+    // keep the crop inside the envelope and on the chroma grid
+    leftCrop = MIN(leftCrop, inBuf->width - outBuf->width) & ~1;
+    topCrop = MIN(topCrop, inBuf->height - outBuf->height) & ~1;
 
-    int rightCrop = inBuf->bpl - outBuf->bpl - leftCrop;
-    int bottomCrop = inBuf->height - outBuf->height - topCrop;
-    ImageScaler::cropNV12orNV21Image(inBuf, outBuf, leftCrop, rightCrop, topCrop, bottomCrop);
+    // outBuf is the gfx buffer that is queued to the window and handed to
+    // the encoder as is, neither takes an offset into the envelope. So this
+    // copy is the rendering of the frame and the only one on this path, an
+    // offset view of inBuf would not save it.
+    cropNV12Buffer(inBuf, outBuf, leftCrop, topCrop, true);
 }
 
 }
-
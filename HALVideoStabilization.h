@@ -28,6 +28,9 @@ public:
 
     static void getEnvelopeSize(int previewWidth, int previewHeight, int &envelopeWidth, int &envelopeHeight, int &bpl);
 
+    /**
+     * Copies the stabilized area of inBuf to outBuf.
+     */
     void process(const AtomBuffer *inBuf, AtomBuffer *outBuf);
 // prevent copy constructor and assignment operator
 private:
@@ -27,6 +27,14 @@ class AtomBuffer;
  *  Interface implemented by classes that want to receive preview frames after
  *  PreviewThread has finish with them
  *
+ *  When PreviewThread falls behind, a frame still queued to it is replaced by
+ *  the newer one and returned to the ISP without being processed, see
+ *  PreviewThread::dropPreviewFrame(). No callback is triggered for such a
+ *  frame, so "every frame" below means every frame PreviewThread processes,
+ *  not every frame from the ISP, and the ONCE callbacks come with the next
+ *  processed frame. Frames are only dropped when neither HAL video
+ *  stabilization nor the preview buffer queue use the preview stream.
+ *
  *  split from PreviewThread.h to reduce header dependencies.
  */
 class ICallbackPreview {
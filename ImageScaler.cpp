@@ -14,35 +14,39 @@
  * limitations under the License.
  */
 #define LOG_TAG "Camera_ImageScaler"
+#include <utils/RefBase.h>
+#include <utils/threads.h>
 #include "AtomCommon.h"
 #include "LogHelper.h"
 #include "ImageScaler.h"
+#include "ColorConverter.h"
+#include "WorkerPool.h"
 #include "assert.h"
 
-#define RESOLUTION_VGA_WIDTH    640
-#define RESOLUTION_VGA_HEIGHT   480
-#define RESOLUTION_QVGA_WIDTH   320
-#define RESOLUTION_QVGA_HEIGHT  240
-#define RESOLUTION_QCIF_WIDTH   176
-#define RESOLUTION_QCIF_HEIGHT  144
+#if defined(__i386__) || defined(__x86_64__)
+#include <emmintrin.h>
+#define IMAGE_SCALER_SIMD
+#endif
+
 #define MIN(a,b) ((a)<(b)?(a):(b))
 
 namespace android {
 
 void ImageScaler::downScaleImage(AtomBuffer *src, AtomBuffer *dst,
-        int src_skip_lines_top, int src_skip_lines_bottom)
+        int src_skip_lines_top, int src_skip_lines_bottom, bool multiThreaded)
 {
     downScaleImage(src->dataPtr, dst->dataPtr,
         dst->width, dst->height, dst->bpl,
         src->width, src->height, src->bpl,
-        src->fourcc, src_skip_lines_top, src_skip_lines_bottom);
+        src->fourcc, src_skip_lines_top, src_skip_lines_bottom, multiThreaded);
 }
 
 void ImageScaler::downScaleImage(void *src, void *dest,
     int dest_w, int dest_h, int dest_bpl,
     int src_w, int src_h, int src_bpl,
     int fourcc, int src_skip_lines_top, // number of lines that are skipped from src image start pointer
-    int src_skip_lines_bottom) // number of lines that are skipped after reading src_h (should be set always to reach full image height)
+    int src_skip_lines_bottom, // number of lines that are skipped after reading src_h (should be set always to reach full image height)
+    bool multiThreaded)
 {
     unsigned char *m_dest = (unsigned char *)dest;
     const unsigned char * m_src = (const unsigned char *)src;
@@ -64,14 +68,14 @@ void ImageScaler::downScaleImage(void *src, void *dest,
                 ImageScaler::downScaleAndCropNv12Image(m_dest, m_src,
                     dest_w, dest_h, dest_bpl,
                     src_w, src_h, src_bpl,
-                    src_skip_lines_top, src_skip_lines_bottom);
+                    src_skip_lines_top, src_skip_lines_bottom, multiThreaded);
             }
             break;
         }
         case V4L2_PIX_FMT_YUYV:
             // downscale
             ImageScaler::downScaleYUY2Image(m_dest, m_src,
-                dest_w, dest_h, src_w, src_h);
+                dest_w, dest_h, src_w, src_h, multiThreaded);
             break;
         default: {
             ALOGE("no downscale support for fourcc = %s 0x%x", v4l2Fmt2Str(fourcc), fourcc);
@@ -80,14 +84,126 @@ void ImageScaler::downScaleImage(void *src, void *dest,
     }
 }
 
-void ImageScaler::downScaleYUY2Image(unsigned char *dest, const unsigned char *src,
-    const int dest_w, const int dest_h, const int src_w, const int src_h)
+struct YUY2ScaleJob {
+    unsigned char *dest;
+    const unsigned char *src;
+    int dest_w;
+    int dest_h;
+    int src_w;
+    int src_h;
+};
+
+#ifdef IMAGE_SCALER_SIMD
+
+static inline int loadMacroPixel(const unsigned char *p)
 {
-    if (dest==NULL || dest_w <=0 || dest_h <=0 || src==NULL || src_w <=0 || src_h <= 0 )
-        return;
+    int v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
 
-    if (dest_w%2 != 0) // if the dest_w is not an even number, exit
+// (a * (256 - w) + b * w) >> 8 on 16 bit lanes, the sum fits unsigned
+__attribute__((target("sse2")))
+static inline __m128i lerpSSE2(__m128i a, __m128i b, __m128i w)
+{
+    const __m128i full = _mm_set1_epi16(256);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(a, _mm_sub_epi16(full, w)),
+                                        _mm_mullo_epi16(b, w)), 8);
+}
+
+/**
+ * SSE2 version of downScaleYUY2Rows(), four macro pixels per iteration.
+ * The horizontal positions and weights are the same on every row, so they
+ * are computed once. The special cases of the scalar code for a zero
+ * weight equal the general formula, they only avoid reading the neighbour,
+ * which is done here by pointing the neighbour at the sample itself. The
+ * output is bit exact.
+ */
+__attribute__((target("sse2")))
+static bool downScaleYUY2RowsSSE2(const YUY2ScaleJob *job, int first, int last)
+{
+    const int macros = job->dest_w >> 1;
+    const int scale_w = (job->src_w << 8) / job->dest_w;
+    const int scale_h = (job->src_h << 8) / job->dest_h;
+    const int srcBpl = 2 * job->src_w;
+    int *left = (int *) malloc(2 * macros * sizeof(int));
+    unsigned short *weights = (unsigned short *) malloc(4 * macros * sizeof(unsigned short));
+    if (left == NULL || weights == NULL) {
+        free(left);
+        free(weights);
+        return false;
+    }
+    int *right = left + macros;
+
+    for (int j = 0; j < macros; j++) {
+        const int src_j = j * scale_w;
+        const int dx = src_j & 0xff;
+        left[j] = (src_j >> 8) * 4;
+        right[j] = dx ? left[j] + 4 : left[j];
+        for (int k = 0; k < 4; k++)
+            weights[4 * j + k] = dx;
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    for (int i = first; i < last; i++) {
+        const int src_i = i * scale_h;
+        const int dy = src_i & 0xff;
+        const unsigned char *row0 = job->src + (src_i >> 8) * srcBpl;
+        const unsigned char *row1 = dy ? row0 + srcBpl : row0;
+        const __m128i wy = _mm_set1_epi16(dy);
+        unsigned char *out = job->dest + i * 2 * job->dest_w;
+        int j = 0;
+
+        for (; j + 4 <= macros; j += 4) {
+            __m128i a0 = _mm_setr_epi32(loadMacroPixel(row0 + left[j]), loadMacroPixel(row0 + left[j + 1]),
+                                        loadMacroPixel(row0 + left[j + 2]), loadMacroPixel(row0 + left[j + 3]));
+            __m128i b0 = _mm_setr_epi32(loadMacroPixel(row0 + right[j]), loadMacroPixel(row0 + right[j + 1]),
+                                        loadMacroPixel(row0 + right[j + 2]), loadMacroPixel(row0 + right[j + 3]));
+            __m128i a1 = _mm_setr_epi32(loadMacroPixel(row1 + left[j]), loadMacroPixel(row1 + left[j + 1]),
+                                        loadMacroPixel(row1 + left[j + 2]), loadMacroPixel(row1 + left[j + 3]));
+            __m128i b1 = _mm_setr_epi32(loadMacroPixel(row1 + right[j]), loadMacroPixel(row1 + right[j + 1]),
+                                        loadMacroPixel(row1 + right[j + 2]), loadMacroPixel(row1 + right[j + 3]));
+            const __m128i wxLo = _mm_loadu_si128((const __m128i *)(weights + 4 * j));
+            const __m128i wxHi = _mm_loadu_si128((const __m128i *)(weights + 4 * j + 8));
+
+            __m128i lo = lerpSSE2(lerpSSE2(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero), wxLo),
+                                  lerpSSE2(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero), wxLo), wy);
+            __m128i hi = lerpSSE2(lerpSSE2(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero), wxHi),
+                                  lerpSSE2(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero), wxHi), wy);
+            _mm_storeu_si128((__m128i *)(out + 4 * j), _mm_packus_epi16(lo, hi));
+        }
+
+        for (; j < macros; j++) {
+            const int dx = weights[4 * j];
+            for (int k = 0; k < 4; k++) {
+                unsigned int h0 = (row0[left[j] + k] * (256 - dx) + row0[right[j] + k] * dx) >> 8;
+                unsigned int h1 = (row1[left[j] + k] * (256 - dx) + row1[right[j] + k] * dx) >> 8;
+                out[4 * j + k] = (h0 * (256 - dy) + h1 * dy) >> 8;
+            }
+        }
+    }
+
+    free(left);
+    free(weights);
+    return true;
+}
+
+#endif // IMAGE_SCALER_SIMD
+
+// scales the destination rows [first, last)
+static void downScaleYUY2Rows(void *context, int first, int last)
+{
+    const YUY2ScaleJob *job = (const YUY2ScaleJob *) context;
+#ifdef IMAGE_SCALER_SIMD
+    if ((getCpuFeatures() & CPU_FEATURE_SSE2) && downScaleYUY2RowsSSE2(job, first, last))
         return;
+#endif
+    unsigned char *dest = job->dest;
+    const unsigned char *src = job->src;
+    const int dest_w = job->dest_w;
+    const int dest_h = job->dest_h;
+    const int src_w = job->src_w;
+    const int src_h = job->src_h;
 
     const int scale_w = (src_w<<8) / dest_w; // scale factors
     const int scale_h = (src_h<<8) / dest_h;
@@ -97,7 +213,7 @@ void ImageScaler::downScaleYUY2Image(unsigned char *dest, const unsigned char *s
     unsigned int val_1, val_2; // for bi-linear-interpolation
     int i,j,k;
 
-    for(i=0; i < dest_h; ++i) {
+    for(i=first; i < last; ++i) {
         src_i = i * scale_h;
         dy = src_i & 0xff;
         src_i >>= 8;
@@ -131,6 +247,24 @@ void ImageScaler::downScaleYUY2Image(unsigned char *dest, const unsigned char *s
     }
 }
 
+void ImageScaler::downScaleYUY2Image(unsigned char *dest, const unsigned char *src,
+    const int dest_w, const int dest_h, const int src_w, const int src_h,
+    bool multiThreaded)
+{
+    if (dest==NULL || dest_w <=0 || dest_h <=0 || src==NULL || src_w <=0 || src_h <= 0 )
+        return;
+
+    if (dest_w%2 != 0) // if the dest_w is not an even number, exit
+        return;
+
+    YUY2ScaleJob job = { dest, src, dest_w, dest_h, src_w, src_h };
+    if (multiThreaded)
+        WorkerPool::runStripes(downScaleYUY2Rows, &job, dest_h, 1,
+                               WorkerPool::minStripeRows(dest_w * 2));
+    else
+        downScaleYUY2Rows(&job, 0, dest_h);
+}
+
 void ImageScaler::trimNv12Image(unsigned char *dst, const unsigned char *src,
     const int dest_w, const int dest_h, const int dest_bpl,
     const int src_w, const int src_h, const int src_bpl,
@@ -156,179 +290,564 @@ void ImageScaler::trimNv12Image(unsigned char *dst, const unsigned char *src,
     }
 }
 
-// VGA-QCIF begin (Enzo specific)
-void ImageScaler::downScaleAndCropNv12Image(unsigned char *dest, const unsigned char *src,
-    const int dest_w, const int dest_h, const int dest_bpl,
-    const int src_w, const int src_h, const int src_bpl,
-    const int src_skip_lines_top, // number of lines that are skipped from src image start pointer
-    const int src_skip_lines_bottom) // number of lines that are skipped after reading src_h (should be set always to reach full image height)
+/*
+ * Separable polyphase scaler for NV12/NV21
+ *
+ * Every axis of a scaling geometry is described by a ScalerFilter holding,
+ * for each output sample, the first source sample it reads and 'taps' Q14
+ * coefficients. A vertical pass first blends the source lines of an output
+ * line into one Q7 intermediate line, a horizontal pass then filters that
+ * line into the destination. Downscaling averages the source area covered
+ * by each output pixel, so every source pixel is read once and contributes,
+ * upscaling interpolates bilinearly. Coefficients of taps that fall outside
+ * of the source are folded onto the edge pixels.
+ *
+ * The filters only depend on the source and destination length, so they are
+ * built once and kept in a small cache shared by all callers.
+ */
+static const int FILTER_BITS = 14;        // fraction bits of the coefficients
+static const int INTER_BITS = 7;          // fraction bits of the intermediate line
+static const int FILTER_CACHE_SIZE = 16;
+
+class ScalerFilter : public RefBase {
+public:
+    ScalerFilter(int srcLen, int dstLen);
+    ~ScalerFilter();
+
+    bool isValid() const { return start != NULL && coef != NULL; }
+
+    const int srcLen;
+    const int dstLen;
+    int count;      // taps with a coefficient, even for the vertical pass
+    int taps;       // coefficient stride, 4 or a multiple of 8 for the horizontal pass
+    int *start;     // first source sample of every output sample
+    short *coef;    // dstLen * taps coefficients, zero beyond count
+};
+
+ScalerFilter::ScalerFilter(int srcLen, int dstLen) :
+    srcLen(srcLen)
+    ,dstLen(dstLen)
+    ,count(0)
+    ,taps(0)
+    ,start(NULL)
+    ,coef(NULL)
 {
-    LOG1("@%s: dest_w: %d, dest_h: %d, dest_bpl: %d, src_w: %d, src_h: %d, src_bpl: %d, skip_top: %d, skip_bottom: %d, dest: %p, src: %p",
-         __FUNCTION__, dest_w, dest_h, dest_bpl, src_w, src_h, src_bpl, src_skip_lines_top, src_skip_lines_bottom, dest, src);
+    // 16.16 fixed point, so that the tables do not depend on the FPU
+    const int64_t one = 1 << 16;
+    const int64_t scale = ((int64_t)srcLen << 16) / dstLen;
+    const bool area = scale > one;
 
-    if (src_w == 800 && src_h == 600 && src_skip_lines_top == 0 && src_skip_lines_bottom == 0
-        && dest_w == RESOLUTION_QVGA_WIDTH && dest_h == RESOLUTION_QVGA_HEIGHT) {
-        downScaleNv12ImageFrom800x600ToQvga(dest, src, dest_bpl, src_bpl);
-        return;
-    }
-    if (src_w == RESOLUTION_VGA_WIDTH && src_h == RESOLUTION_VGA_HEIGHT
-        && src_skip_lines_top == 0 && src_skip_lines_bottom == 0
-        && dest_w == RESOLUTION_QVGA_WIDTH && dest_h == RESOLUTION_QVGA_HEIGHT) {
-        downScaleAndCropNv12ImageQvga(dest, src, dest_bpl, src_bpl);
-        return;
+    // downscaling averages the source area covered by each output sample,
+    // count is the widest span of source samples any of them touches
+    count = 2;
+    if (area) {
+        for (int x = 0; x < dstLen; x++) {
+            const int64_t lo = x * scale;
+            const int span = (int)((lo + scale - 1) >> 16) - (int)(lo >> 16) + 1;
+            count = MAX(count, span);
+        }
     }
-    if (src_w == RESOLUTION_VGA_WIDTH && src_h == RESOLUTION_VGA_HEIGHT
-        && src_skip_lines_top == 0 && src_skip_lines_bottom == 0
-        && dest_w == RESOLUTION_QCIF_WIDTH && dest_h == RESOLUTION_QCIF_WIDTH) {
-        downScaleAndCropNv12ImageQcif(dest, src, dest_bpl, src_bpl);
-        return;
+    count = (count + 1) & ~1;
+    taps = count <= 4 ? 4 : (count + 7) & ~7;
+
+    start = new int[dstLen];
+    coef = new short[dstLen * taps];
+    int64_t *weight = new int64_t[count];
+
+    for (int x = 0; x < dstLen; x++) {
+        int64_t lo, hi, center = 0;
+        int first;
+        if (area) {
+            lo = x * scale;
+            hi = lo + scale;
+            first = (int)(lo >> 16);
+        } else {
+            center = x * scale + scale / 2 - one / 2;
+            first = (int)(center >> 16);
+        }
+        const int s = MAX(0, MIN(first, srcLen - count));
+        int64_t sum = 0;
+
+        memset(weight, 0, count * sizeof(int64_t));
+        for (int i = 0; i < count; i++) {
+            const int64_t p = first + i;
+            int64_t w;
+            if (area) {
+                w = MIN(hi, (p + 1) << 16) - MAX(lo, p << 16);
+            } else {
+                const int64_t d = p * one - center;
+                w = one - (d < 0 ? -d : d);
+            }
+            if (w <= 0)
+                continue;
+            weight[MAX(0, MIN((int)p, srcLen - 1)) - s] += w;
+            sum += w;
+        }
+
+        short *c = coef + x * taps;
+        int total = 0;
+        int peak = 0;
+        memset(c, 0, taps * sizeof(short));
+        for (int i = 0; i < count; i++) {
+            c[i] = (short)(((weight[i] << FILTER_BITS) + sum / 2) / sum);
+            total += c[i];
+            if (c[i] > c[peak])
+                peak = i;
+        }
+        // the coefficients have to add up to exactly 1.0
+        c[peak] += (1 << FILTER_BITS) - total;
+        start[x] = s;
     }
 
-    // skip lines from top
-    if (src_skip_lines_top > 0)
-        src += src_skip_lines_top * src_bpl;
+    delete[] weight;
+}
 
-    // Correct aspect ratio is defined by destination buffer
-    long int aspect_ratio = (dest_w << 16) / dest_h;
-    // Then, we calculate what should be the width of source image
-    // (should be multiple by four)
-    int proper_source_width = (aspect_ratio * (long int)(src_h) + 0x8000L) >> 16;
-    proper_source_width = (proper_source_width + 2) & ~0x3;
-    // Now, the source image should have some surplus width
-    if (src_w < proper_source_width) {
-        ALOGE("%s: source image too narrow", __func__);
-        return;
+ScalerFilter::~ScalerFilter()
+{
+    delete[] start;
+    delete[] coef;
+}
+
+static Mutex sFilterCacheLock;
+static sp<ScalerFilter> sFilterCache[FILTER_CACHE_SIZE];
+static int sFilterCacheNext = 0;
+
+static sp<ScalerFilter> getScalerFilter(int srcLen, int dstLen)
+{
+    Mutex::Autolock lock(sFilterCacheLock);
+
+    for (int i = 0; i < FILTER_CACHE_SIZE; i++) {
+        const sp<ScalerFilter> &f = sFilterCache[i];
+        if (f != NULL && f->srcLen == srcLen && f->dstLen == dstLen)
+            return f;
     }
-    // Let's divide the surplus to both sides
-    int l_skip = (src_w - proper_source_width) >> 1;
-    int r_skip = src_w - proper_source_width - l_skip;
-    int skip = l_skip + r_skip;
 
-    int i, j, x1, y1, x2, y2;
-    unsigned int val_1, val_2;
-    int dx, dy;
-    int src_Y_data = src_bpl * (src_h + src_skip_lines_bottom + (src_skip_lines_top >> 1));
-    int dest_Y_data = dest_bpl * dest_h;
-    int flag, width, height;
-    if (0 == dest_w || 0 == dest_h) {
-        ALOGE("%s,dest_w or dest_h should not be 0", __func__);
-        return;
+    LOG1("@%s: new filter %d -> %d", __FUNCTION__, srcLen, dstLen);
+    sp<ScalerFilter> f = new ScalerFilter(srcLen, dstLen);
+    sFilterCache[sFilterCacheNext] = f;
+    sFilterCacheNext = (sFilterCacheNext + 1) % FILTER_CACHE_SIZE;
+    return f;
+}
+
+/*
+ * Scalar passes, also used for the tails of the SIMD passes
+ */
+
+static void verticalPass(const unsigned char *const *rows, const short *coef, int count,
+                         int from, int width, short *out)
+{
+    for (int x = from; x < width; x++) {
+        int acc = 1 << (FILTER_BITS - INTER_BITS - 1);
+        for (int i = 0; i < count; i++)
+            acc += coef[i] * rows[i][x];
+        out[x] = acc >> (FILTER_BITS - INTER_BITS);
     }
-    const int scaling_w = ((src_w - skip) << 8) / dest_w;
-    const int scaling_h = (src_h << 8) / dest_h;
-    dx = 0;
-    dy = 0;
-    // get Y data
-    for (i = 0; i < dest_h; i++) {
-        y1 = i * scaling_h;
-        dy = y1 & 0xff;
-        y2 = y1 >> 8;
-        for (j = 0; j < dest_w; j++) {
-            x1 = j * scaling_w;
-            dx = x1 & 0xff;
-            x2 = (x1 >> 8) + l_skip;
-            val_1 = ((unsigned int)src[y2 * src_bpl + x2] * (256 - dx)
-                    + (unsigned int)src[y2 * src_bpl + x2 + 1] * dx) >> 8;
-            val_2 = ((unsigned int)src[(y2 + 1) * src_bpl + x2] * (256 - dx)
-                    + (unsigned int)src[(y2 + 1) * src_bpl + x2 + 1] * dx) >> 8;
-            dest[i * dest_bpl + j] = MIN(((val_1 * (256 - dy) + val_2 * dy) >> 8), 0xff);
+}
+
+static void verticalPassUV(const unsigned char *const *rows, const short *coef, int count,
+                           int from, int pairs, short *outU, short *outV)
+{
+    for (int x = from; x < pairs; x++) {
+        int accU = 1 << (FILTER_BITS - INTER_BITS - 1);
+        int accV = accU;
+        for (int i = 0; i < count; i++) {
+            accU += coef[i] * rows[i][2 * x];
+            accV += coef[i] * rows[i][2 * x + 1];
         }
+        outU[x] = accU >> (FILTER_BITS - INTER_BITS);
+        outV[x] = accV >> (FILTER_BITS - INTER_BITS);
     }
-    flag = 0;
-    i = 0;
-    j = 0;
-    width = dest_w >> 1;
-    height = dest_h >> 1;
-    //get UV data
-    for (i = 0; i < height; i++) {
-        y1 = i * scaling_h;
-        dy = y1 & 0xff;
-        y2 = y1 >> 8;
-        for (j = 0; j < width; j++) {
-            x1 = j * scaling_w;
-            dx = x1 & 0xff;
-            x2 = (x1 >> 8) + l_skip / 2;
-            //fill U data
-            val_1 = ((unsigned int)src[y2 * src_bpl + (x2 << 1) + src_Y_data] * (256 - dx)
-                     + (unsigned int)src[y2 * src_bpl + ((x2 + 1) << 1) + src_Y_data] * dx) >> 8;
-            val_2 = ((unsigned int)src[(y2 + 1) * src_bpl + (x2 << 1) + src_Y_data] * (256 -dx)
-                     + (unsigned int)src[(y2 +1) * src_bpl + ((x2 + 1) << 1) + src_Y_data] * dx) >> 8;
-            dest[i * dest_bpl + (j << 1) + dest_Y_data] = MIN(((val_1 * (256 - dy) + val_2 * dy) >> 8), 0xff);
-            //fill V data
-            val_1 = ((unsigned int)src[y2 * src_bpl + (x2 << 1) + 1 + src_Y_data] * (256 - dx)
-                     + (unsigned int)src[y2 * src_bpl + ((x2 + 1) << 1) + 1 + src_Y_data] * dx) >> 8;
-            val_2 = ((unsigned int)src[(y2 + 1) * src_bpl + (x2 << 1) + 1 + src_Y_data] * (256 -dx)
-                     + (unsigned int)src[(y2 +1) * src_bpl + ((x2 + 1) << 1) + 1 + src_Y_data] * dx) >> 8;
-            dest[i * dest_bpl + (j << 1) + 1 + dest_Y_data] = MIN(((val_1 * (256 - dy) + val_2 * dy) >> 8), 0xff);
-        }
+}
+
+static inline unsigned char horizontalSample(const short *in, const ScalerFilter *f, int x)
+{
+    const short *c = f->coef + x * f->taps;
+    const short *p = in + f->start[x];
+    int acc = 1 << (FILTER_BITS + INTER_BITS - 1);
+    for (int i = 0; i < f->count; i++)
+        acc += c[i] * p[i];
+    return MIN(acc >> (FILTER_BITS + INTER_BITS), 0xff);
+}
+
+static void horizontalPass(const short *in, const ScalerFilter *f, int from, unsigned char *out)
+{
+    for (int x = from; x < f->dstLen; x++)
+        out[x] = horizontalSample(in, f, x);
+}
+
+static void horizontalPassUV(const short *inU, const short *inV, const ScalerFilter *f,
+                             int from, unsigned char *out)
+{
+    for (int x = from; x < f->dstLen; x++) {
+        out[2 * x] = horizontalSample(inU, f, x);
+        out[2 * x + 1] = horizontalSample(inV, f, x);
     }
 }
 
-void ImageScaler::downScaleAndCropNv12ImageQvga(unsigned char *dest, const unsigned char *src,
-    const int dest_bpl, const int src_bpl)
+/*
+ * At exactly 2:1 on both axes the area filter weights the four source
+ * pixels of an output pixel with 1/4 each. Both passes together then round
+ * like (a + b + c + d + 2) >> 2, so the 2x2 blocks are averaged directly,
+ * without the intermediate line, with the same result.
+ */
+
+static void halveLine(const unsigned char *row0, const unsigned char *row1,
+                      int from, int width, unsigned char *out)
 {
-    LOG1("@%s", __FUNCTION__);
-    const int dest_w = RESOLUTION_QVGA_WIDTH;
-    const int dest_h = RESOLUTION_QVGA_HEIGHT;
-    const int src_h = RESOLUTION_VGA_HEIGHT;
-    const int scale = 2;
+    for (int x = from; x < width; x++)
+        out[x] = (row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1] + 2) >> 2;
+}
 
-    // Y component
-    for (int i = 0; i < dest_h; i++) {
-        u_int32_t *s1 = (u_int32_t *)(&src[(i * scale + 0) * src_bpl]);
-        u_int32_t *s2 = (u_int32_t *)(&src[(i * scale + 1) * src_bpl]);
-        u_int32_t  *d = (u_int32_t *)(&dest[i * dest_bpl]);
-        // This processes 4 dest pixels at a time
-        for (int j = 0; j < dest_w; j+=4) {
-            u_int32_t a1; // Input data upper row
-            u_int32_t a2; // Input data lower row
-            u_int32_t b;  // Output data
-            a1 = *s1++;
-            a2 = *s2++;
-            b  = ((a1 & 0xff) + ((a1 >> 8) & 0xff) + (a2 & 0xff) + ((a2 >> 8) & 0xff) + 2) / 4;
-            b |= ((((a1 >> 16) & 0xff) + ((a1 >> 24) & 0xff) + ((a2 >> 16) & 0xff) + ((a2 >> 24) & 0xff) + 2) / 4) << 8;
-            a1 = *s1++;
-            a2 = *s2++;
-            b |= (((a1 & 0xff) + ((a1 >> 8) & 0xff) + (a2 & 0xff) + ((a2 >> 8) & 0xff) + 2) / 4) << 16;
-            b |= ((((a1 >> 16) & 0xff) + ((a1 >> 24) & 0xff) + ((a2 >> 16) & 0xff) + ((a2 >> 24) & 0xff) + 2) / 4) << 24;
-            *d++ = b;
+static void halveLineUV(const unsigned char *row0, const unsigned char *row1,
+                        int from, int pairs, unsigned char *out)
+{
+    for (int x = from; x < pairs; x++) {
+        const int i = 4 * x;
+        out[2 * x] = (row0[i] + row0[i + 2] + row1[i] + row1[i + 2] + 2) >> 2;
+        out[2 * x + 1] = (row0[i + 1] + row0[i + 3] + row1[i + 1] + row1[i + 3] + 2) >> 2;
+    }
+}
+
+#ifdef IMAGE_SCALER_SIMD
+
+/*
+ * SSE2 passes
+ *
+ * Both passes are built on pmaddwd. The vertical pass multiplies two source
+ * lines at a time, interleaved byte by byte, with a (c0, c1) coefficient
+ * pair. The horizontal pass does an 8 tap dot product per output sample and
+ * reduces four of them at once. The arithmetic is the same as in the scalar
+ * passes, so the results are bit exact.
+ */
+
+// filters 16 bytes starting at x into four vectors of four Q7 samples
+__attribute__((target("sse2")))
+static inline void verticalBlockSSE2(const unsigned char *const *rows, const short *coef,
+                                     int count, int x, __m128i acc[4])
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (FILTER_BITS - INTER_BITS - 1));
+
+    acc[0] = acc[1] = acc[2] = acc[3] = round;
+    for (int i = 0; i < count; i += 2) {
+        const __m128i c = _mm_set1_epi32((unsigned short)coef[i] | ((unsigned int)coef[i + 1] << 16));
+        const __m128i a = _mm_loadu_si128((const __m128i *)(rows[i] + x));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(rows[i + 1] + x));
+        const __m128i lo = _mm_unpacklo_epi8(a, b);
+        const __m128i hi = _mm_unpackhi_epi8(a, b);
+        acc[0] = _mm_add_epi32(acc[0], _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), c));
+        acc[1] = _mm_add_epi32(acc[1], _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), c));
+        acc[2] = _mm_add_epi32(acc[2], _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), c));
+        acc[3] = _mm_add_epi32(acc[3], _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), c));
+    }
+    for (int k = 0; k < 4; k++)
+        acc[k] = _mm_srai_epi32(acc[k], FILTER_BITS - INTER_BITS);
+}
+
+__attribute__((target("sse2")))
+static void verticalPassSSE2(const unsigned char *const *rows, const short *coef, int count,
+                             int width, short *out)
+{
+    __m128i acc[4];
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        verticalBlockSSE2(rows, coef, count, x, acc);
+        _mm_storeu_si128((__m128i *)(out + x), _mm_packs_epi32(acc[0], acc[1]));
+        _mm_storeu_si128((__m128i *)(out + x + 8), _mm_packs_epi32(acc[2], acc[3]));
+    }
+    verticalPass(rows, coef, count, x, width, out);
+}
+
+__attribute__((target("sse2")))
+static void verticalPassUVSSE2(const unsigned char *const *rows, const short *coef, int count,
+                               int pairs, short *outU, short *outV)
+{
+    __m128i acc[4];
+    int x = 0;
+    for (; x + 8 <= pairs; x += 8) {
+        verticalBlockSSE2(rows, coef, count, 2 * x, acc);
+        // (U V U V) -> (U U V V)
+        for (int k = 0; k < 4; k++)
+            acc[k] = _mm_shuffle_epi32(acc[k], _MM_SHUFFLE(3, 1, 2, 0));
+        const __m128i u = _mm_packs_epi32(_mm_unpacklo_epi64(acc[0], acc[1]),
+                                          _mm_unpacklo_epi64(acc[2], acc[3]));
+        const __m128i v = _mm_packs_epi32(_mm_unpackhi_epi64(acc[0], acc[1]),
+                                          _mm_unpackhi_epi64(acc[2], acc[3]));
+        _mm_storeu_si128((__m128i *)(outU + x), u);
+        _mm_storeu_si128((__m128i *)(outV + x), v);
+    }
+    verticalPassUV(rows, coef, count, x, pairs, outU, outV);
+}
+
+// filters output samples x .. x+3, returns them as 32 bit integers
+__attribute__((target("sse2")))
+static inline __m128i horizontalQuadSSE2(const short *in, const ScalerFilter *f, int x)
+{
+    const int taps = f->taps;
+
+    if (taps == 4) {
+        // two output samples per pmaddwd
+        const short *c = f->coef + x * 4;
+        const __m128i p01 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(in + f->start[x])),
+                                               _mm_loadl_epi64((const __m128i *)(in + f->start[x + 1])));
+        const __m128i p23 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)(in + f->start[x + 2])),
+                                               _mm_loadl_epi64((const __m128i *)(in + f->start[x + 3])));
+        // (a0 b0 a1 b1) -> (a0 a1 b0 b1)
+        const __m128i m01 = _mm_shuffle_epi32(_mm_madd_epi16(p01, _mm_loadu_si128((const __m128i *)c)),
+                                              _MM_SHUFFLE(3, 1, 2, 0));
+        const __m128i m23 = _mm_shuffle_epi32(_mm_madd_epi16(p23, _mm_loadu_si128((const __m128i *)(c + 8))),
+                                              _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i r = _mm_add_epi32(_mm_unpacklo_epi64(m01, m23), _mm_unpackhi_epi64(m01, m23));
+        r = _mm_add_epi32(r, _mm_set1_epi32(1 << (FILTER_BITS + INTER_BITS - 1)));
+        return _mm_srai_epi32(r, FILTER_BITS + INTER_BITS);
+    }
+
+    __m128i sum[4];
+    for (int j = 0; j < 4; j++) {
+        const short *p = in + f->start[x + j];
+        const short *c = f->coef + (x + j) * f->taps;
+        __m128i acc = _mm_madd_epi16(_mm_loadu_si128((const __m128i *)p),
+                                     _mm_loadu_si128((const __m128i *)c));
+        for (int i = 8; i < taps; i += 8)
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(p + i)),
+                                                    _mm_loadu_si128((const __m128i *)(c + i))));
+        sum[j] = acc;
+    }
+    // horizontal add of the four accumulators
+    const __m128i t0 = _mm_add_epi32(_mm_unpacklo_epi32(sum[0], sum[1]),
+                                     _mm_unpackhi_epi32(sum[0], sum[1]));
+    const __m128i t1 = _mm_add_epi32(_mm_unpacklo_epi32(sum[2], sum[3]),
+                                     _mm_unpackhi_epi32(sum[2], sum[3]));
+    __m128i r = _mm_add_epi32(_mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1));
+    r = _mm_add_epi32(r, _mm_set1_epi32(1 << (FILTER_BITS + INTER_BITS - 1)));
+    return _mm_srai_epi32(r, FILTER_BITS + INTER_BITS);
+}
+
+__attribute__((target("sse2")))
+static void horizontalPassSSE2(const short *in, const ScalerFilter *f, unsigned char *out)
+{
+    int x = 0;
+    for (; x + 8 <= f->dstLen; x += 8) {
+        const __m128i w = _mm_packs_epi32(horizontalQuadSSE2(in, f, x),
+                                          horizontalQuadSSE2(in, f, x + 4));
+        _mm_storel_epi64((__m128i *)(out + x), _mm_packus_epi16(w, w));
+    }
+    horizontalPass(in, f, x, out);
+}
+
+__attribute__((target("sse2")))
+static void horizontalPassUVSSE2(const short *inU, const short *inV, const ScalerFilter *f,
+                                 unsigned char *out)
+{
+    int x = 0;
+    for (; x + 4 <= f->dstLen; x += 4) {
+        const __m128i w = _mm_packs_epi32(horizontalQuadSSE2(inU, f, x),
+                                          horizontalQuadSSE2(inV, f, x));
+        const __m128i uv = _mm_unpacklo_epi16(w, _mm_unpackhi_epi64(w, w));
+        _mm_storel_epi64((__m128i *)(out + 2 * x), _mm_packus_epi16(uv, uv));
+    }
+    horizontalPassUV(inU, inV, f, x, out);
+}
+
+// 2x2 sums of the 16 source bytes at i, as eight 16 bit integers
+__attribute__((target("sse2")))
+static inline __m128i halveBlockSSE2(const unsigned char *row0, const unsigned char *row1, int i)
+{
+    const __m128i mask = _mm_set1_epi16(0xff);
+    const __m128i a = _mm_loadu_si128((const __m128i *)(row0 + i));
+    const __m128i b = _mm_loadu_si128((const __m128i *)(row1 + i));
+    return _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8)),
+                         _mm_add_epi16(_mm_and_si128(b, mask), _mm_srli_epi16(b, 8)));
+}
+
+// 2x2 sums of the 8 source pairs at i, as U V U V ... 16 bit integers
+__attribute__((target("sse2")))
+static inline __m128i halveBlockUVSSE2(const unsigned char *row0, const unsigned char *row1, int i)
+{
+    const __m128i mask = _mm_set1_epi16(0xff);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i a = _mm_loadu_si128((const __m128i *)(row0 + i));
+    const __m128i b = _mm_loadu_si128((const __m128i *)(row1 + i));
+    const __m128i u = _mm_madd_epi16(_mm_add_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)), one);
+    const __m128i v = _mm_madd_epi16(_mm_add_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)), one);
+    return _mm_or_si128(u, _mm_slli_epi32(v, 16));
+}
+
+__attribute__((target("sse2")))
+static void halveLineSSE2(const unsigned char *row0, const unsigned char *row1,
+                          int width, unsigned char *out)
+{
+    const __m128i round = _mm_set1_epi16(2);
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i lo = _mm_srli_epi16(_mm_add_epi16(halveBlockSSE2(row0, row1, 2 * x), round), 2);
+        const __m128i hi = _mm_srli_epi16(_mm_add_epi16(halveBlockSSE2(row0, row1, 2 * x + 16), round), 2);
+        _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(lo, hi));
+    }
+    halveLine(row0, row1, x, width, out);
+}
+
+__attribute__((target("sse2")))
+static void halveLineUVSSE2(const unsigned char *row0, const unsigned char *row1,
+                            int pairs, unsigned char *out)
+{
+    const __m128i round = _mm_set1_epi16(2);
+    int x = 0;
+    for (; x + 8 <= pairs; x += 8) {
+        const __m128i lo = _mm_srli_epi16(_mm_add_epi16(halveBlockUVSSE2(row0, row1, 4 * x), round), 2);
+        const __m128i hi = _mm_srli_epi16(_mm_add_epi16(halveBlockUVSSE2(row0, row1, 4 * x + 16), round), 2);
+        _mm_storeu_si128((__m128i *)(out + 2 * x), _mm_packus_epi16(lo, hi));
+    }
+    halveLineUV(row0, row1, x, pairs, out);
+}
+
+#endif // IMAGE_SCALER_SIMD
+
+/**
+ * How scalePlane() writes the samples of a plane. Chroma planes are always
+ * read as interleaved pairs, and filtered per component.
+ */
+enum PlaneLayout {
+    PLANE_SINGLE,   // one component per sample
+    PLANE_PAIRS,    // interleaved pairs, in source order
+    PLANE_SWAPPED,  // interleaved pairs, the two components swapped (NV12 <-> NV21)
+    PLANE_SPLIT,    // the first component to dst, the second to dst2
+};
+
+/**
+ * Scales the destination rows [first, last) of one plane. dst (and dst2)
+ * point at destination row first. For chroma planes the filters are those
+ * of a single chroma component.
+ */
+static void scalePlane(const unsigned char *src, int srcBpl,
+                       unsigned char *dst, unsigned char *dst2, int dstBpl,
+                       const ScalerFilter *hf, const ScalerFilter *vf, PlaneLayout layout,
+                       int first, int last)
+{
+#ifdef IMAGE_SCALER_SIMD
+    const bool simd = (getCpuFeatures() & CPU_FEATURE_SSE2) != 0;
+#endif
+
+    // exact 2:1 downscale, see halveLine()
+    if (hf->srcLen == 2 * hf->dstLen && vf->srcLen == 2 * vf->dstLen
+        && (layout == PLANE_SINGLE || layout == PLANE_PAIRS)) {
+        for (int y = first; y < last; y++) {
+            const unsigned char *row0 = src + 2 * y * srcBpl;
+            const unsigned char *row1 = row0 + srcBpl;
+            unsigned char *out = dst + (y - first) * dstBpl;
+#ifdef IMAGE_SCALER_SIMD
+            if (simd) {
+                if (layout == PLANE_SINGLE)
+                    halveLineSSE2(row0, row1, hf->dstLen, out);
+                else
+                    halveLineUVSSE2(row0, row1, hf->dstLen, out);
+                continue;
+            }
+#endif
+            if (layout == PLANE_SINGLE)
+                halveLine(row0, row1, 0, hf->dstLen, out);
+            else
+                halveLineUV(row0, row1, 0, hf->dstLen, out);
         }
+        return;
     }
 
-    // UV components
-    src = &src[src_bpl * src_h];
-    dest = &dest[dest_bpl * dest_h];
+    // the horizontal pass reads up to 'taps' samples past the last start
+    const int lineLen = hf->srcLen + hf->taps;
+    short *lines = (short *) calloc(2 * lineLen, sizeof(short));
+    const unsigned char **rows = (const unsigned char **) malloc(vf->count * sizeof(*rows));
+    if (lines == NULL || rows == NULL) {
+        ALOGE("%s: no memory for line buffers", __func__);
+        free(lines);
+        free(rows);
+        return;
+    }
+    short *lineU = lines;
+    short *lineV = lines + lineLen;
 
-    for (int i = 0; i < dest_h/2; i++) {
-        u_int32_t *s1 = (u_int32_t *)(&src[(i * scale + 0) * src_bpl]);
-        u_int32_t *s2 = (u_int32_t *)(&src[(i * scale + 1) * src_bpl]);
-        u_int32_t  *d = (u_int32_t *)(&dest[i * dest_bpl]);
-        // This processes 2 dest UV pairs at a time
-        for (int j = 0; j < dest_w/2; j+=2) {
-            u_int32_t a1; // Input data upper row
-            u_int32_t a2; // Input data lower row
-            u_int32_t b;  // Output data
-            a1 = *s1++;
-            a2 = *s2++;
-            b  = ((a1 & 0xff) + ((a1 >> 16) & 0xff) + (a2 & 0xff) + ((a2 >> 16) & 0xff) + 2) / 4;
-            b |= ((((a1 >> 8) & 0xff) + ((a1 >> 24) & 0xff) + ((a2 >> 8) & 0xff) + ((a2 >> 24) & 0xff) + 2) / 4) << 8;
-            a1 = *s1++;
-            a2 = *s2++;
-            b |= (((a1 & 0xff) + ((a1 >> 16) & 0xff) + (a2 & 0xff) + ((a2 >> 16) & 0xff) + 2) / 4) << 16;
-            b |= ((((a1 >> 8) & 0xff) + ((a1 >> 24) & 0xff) + ((a2 >> 8) & 0xff) + ((a2 >> 24) & 0xff) + 2) / 4) << 24;
-            *d++ = b;
+    for (int y = first; y < last; y++) {
+        const short *coef = vf->coef + y * vf->taps;
+        for (int i = 0; i < vf->count; i++)
+            rows[i] = src + MIN(vf->start[y] + i, vf->srcLen - 1) * srcBpl;
+
+        unsigned char *out = dst + (y - first) * dstBpl;
+        unsigned char *out2 = dst2 + (y - first) * dstBpl;
+#ifdef IMAGE_SCALER_SIMD
+        if (simd) {
+            if (layout == PLANE_SINGLE) {
+                verticalPassSSE2(rows, coef, vf->count, hf->srcLen, lineU);
+                horizontalPassSSE2(lineU, hf, out);
+                continue;
+            }
+            verticalPassUVSSE2(rows, coef, vf->count, hf->srcLen, lineU, lineV);
+            if (layout == PLANE_PAIRS) {
+                horizontalPassUVSSE2(lineU, lineV, hf, out);
+            } else if (layout == PLANE_SWAPPED) {
+                horizontalPassUVSSE2(lineV, lineU, hf, out);
+            } else {
+                horizontalPassSSE2(lineU, hf, out);
+                horizontalPassSSE2(lineV, hf, out2);
+            }
+            continue;
+        }
+#endif
+        if (layout == PLANE_SINGLE) {
+            verticalPass(rows, coef, vf->count, 0, hf->srcLen, lineU);
+            horizontalPass(lineU, hf, 0, out);
+            continue;
+        }
+        verticalPassUV(rows, coef, vf->count, 0, hf->srcLen, lineU, lineV);
+        if (layout == PLANE_PAIRS) {
+            horizontalPassUV(lineU, lineV, hf, 0, out);
+        } else if (layout == PLANE_SWAPPED) {
+            horizontalPassUV(lineV, lineU, hf, 0, out);
+        } else {
+            horizontalPass(lineU, hf, 0, out);
+            horizontalPass(lineV, hf, 0, out2);
         }
     }
+
+    free(lines);
+    free(rows);
 }
 
-void ImageScaler::downScaleAndCropNv12ImageQcif(unsigned char *dest, const unsigned char *src,
-    const int dest_bpl, const int src_bpl)
+struct Nv12ScaleJob {
+    const unsigned char *srcY;
+    const unsigned char *srcUV;
+    int srcBpl;
+    int destWidth;
+    unsigned char *destY;       // luma plane, or the RGB image
+    int destBpl;
+    unsigned char *destC0;      // chroma plane, the first component with PLANE_SPLIT
+    unsigned char *destC1;      // second component with PLANE_SPLIT, otherwise NULL
+    int destCBpl;
+    PlaneLayout chromaLayout;
+    int rgbFourcc;              // RGB565 or RGB32 for scaleNv12ToRGBRows()
+    ColorMatrix matrix;
+    sp<ScalerFilter> yh;
+    sp<ScalerFilter> yv;
+    sp<ScalerFilter> uvh;
+    sp<ScalerFilter> uvv;
+};
+
+/**
+ * Fills in the source planes and filters of job for scaling an NV12 or
+ * NV21 image to dest_w x dest_h. If the aspect ratio of the destination
+ * differs from the source, the source is center cropped to the destination
+ * aspect ratio. Returns false if the geometry cannot be scaled.
+ */
+static bool initNv12ScaleJob(Nv12ScaleJob *job, const unsigned char *src,
+                             int dest_w, int dest_h, int src_w, int src_h, int src_bpl,
+                             int src_skip_lines_top, int src_skip_lines_bottom)
 {
-    LOG1("@%s", __FUNCTION__);
-    const int dest_w = RESOLUTION_QCIF_WIDTH;
-    const int dest_h = RESOLUTION_QCIF_HEIGHT;
-    const int src_w = RESOLUTION_VGA_WIDTH;
-    const int src_h = RESOLUTION_VGA_HEIGHT;
+    if (dest_w < 2 || dest_h < 2 || src_w < 2 || src_h < 2) {
+        ALOGE("%s: invalid geometry %dx%d -> %dx%d", __func__, src_w, src_h, dest_w, dest_h);
+        return false;
+    }
+
+    // skip lines from top
+    const unsigned char *srcY = src + src_skip_lines_top * src_bpl;
+    const unsigned char *srcUV = srcY + src_bpl * (src_h + src_skip_lines_bottom + (src_skip_lines_top >> 1));
 
     // Correct aspect ratio is defined by destination buffer
     long int aspect_ratio = (dest_w << 16) / dest_h;
@@ -336,432 +855,192 @@ void ImageScaler::downScaleAndCropNv12ImageQcif(unsigned char *dest, const unsig
     // (should be multiple by four)
     int proper_source_width = (aspect_ratio * (long int)(src_h) + 0x8000L) >> 16;
     proper_source_width = (proper_source_width + 2) & ~0x3;
-    // Now, the source image should have some surplus width
-    if (src_w < proper_source_width) {
-        ALOGE("%s: source image too narrow", __func__);
-        return;
+    int crop_w = src_w;
+    int crop_h = src_h;
+    if (src_w >= proper_source_width) {
+        // divide the surplus width to both sides
+        crop_w = proper_source_width;
+    } else {
+        // the source is too narrow, crop lines from top and bottom instead
+        crop_h = (int)(((int64_t)src_w * dest_h + dest_w / 2) / dest_w) & ~0x1;
+    }
+    if (crop_w < 2 || crop_h < 2) {
+        ALOGE("%s: cannot crop %dx%d to the aspect ratio of %dx%d", __func__, src_w, src_h, dest_w, dest_h);
+        return false;
     }
-    // Let's divide the surplus to both sides
-    int l_skip = (src_w - proper_source_width) >> 1;
-    int r_skip = src_w - proper_source_width - l_skip;
-    int skip = l_skip + r_skip;
+    const int l_skip = ((src_w - crop_w) >> 1) & ~0x1;
+    const int t_skip = ((src_h - crop_h) >> 1) & ~0x1;
 
-    int i, j, x1, y1, x2, y2;
-    unsigned int val_1, val_2;
-    int dx, dy;
-    int src_Y_data = src_bpl * src_h;
-    int dest_Y_data = dest_bpl * dest_h;
-    int flag, width, height;
-    const int scaling_w = ((src_w - skip) << 8) / dest_w;
-    const int scaling_h = (src_h << 8) / dest_h;
-    dx = 0;
-    dy = 0;
-    // get Y data
-    for (i = 0; i < dest_h; i++) {
-        y1 = i * scaling_h;
-        dy = y1 & 0xff;
-        y2 = y1 >> 8;
-        for (j = 0; j < dest_w; j++) {
-            x1 = j * scaling_w;
-            dx = x1 & 0xff;
-            x2 = (x1 >> 8) + l_skip;
-            val_1 = ((unsigned int)src[y2 * src_bpl + x2] * (256 - dx)
-                    + (unsigned int)src[y2 * src_bpl + x2 + 1] * dx) >> 8;
-            val_2 = ((unsigned int)src[(y2 + 1) * src_bpl + x2] * (256 - dx)
-                    + (unsigned int)src[(y2 + 1) * src_bpl + x2 + 1] * dx) >> 8;
-            dest[i * dest_bpl + j] = MIN(((val_1 * (256 - dy) + val_2 * dy) >> 8), 0xff);
-        }
+    job->yh = getScalerFilter(crop_w, dest_w);
+    job->yv = getScalerFilter(crop_h, dest_h);
+    job->uvh = getScalerFilter(crop_w >> 1, dest_w >> 1);
+    job->uvv = getScalerFilter(crop_h >> 1, dest_h >> 1);
+    if (!job->yh->isValid() || !job->yv->isValid() || !job->uvh->isValid() || !job->uvv->isValid()) {
+        ALOGE("%s: no memory for filter tables", __func__);
+        return false;
     }
-    flag = 0;
-    i = 0;
-    j = 0;
-    width = dest_w >> 1;
-    height = dest_h >> 1;
-    //get UV data
-    for (i = 0; i < height; i++) {
-        y1 = i * scaling_h;
-        dy = y1 & 0xff;
-        y2 = y1 >> 8;
-        for (j = 0; j < width; j++) {
-            x1 = j * scaling_w;
-            dx = x1 & 0xff;
-            x2 = (x1 >> 8) + l_skip / 2;
-            //fill U data
-            val_1 = ((unsigned int)src[y2 * src_bpl + (x2 << 1) + src_Y_data] * (256 - dx)
-                     + (unsigned int)src[y2 * src_bpl + ((x2 + 1) << 1) + src_Y_data] * dx) >> 8;
-            val_2 = ((unsigned int)src[(y2 + 1) * src_bpl + (x2 << 1) + src_Y_data] * (256 -dx)
-                     + (unsigned int)src[(y2 +1) * src_bpl + ((x2 + 1) << 1) + src_Y_data] * dx) >> 8;
-            dest[i * dest_bpl + (j << 1) + dest_Y_data] = MIN(((val_1 * (256 - dy) + val_2 * dy) >> 8), 0xff);
-            //fill V data
-            val_1 = ((unsigned int)src[y2 * src_w + (x2 << 1) + 1 + src_Y_data] * (256 - dx)
-                     + (unsigned int)src[y2 * src_w + ((x2 + 1) << 1) + 1 + src_Y_data] * dx) >> 8;
-            val_2 = ((unsigned int)src[(y2 + 1) * src_w + (x2 << 1) + 1 + src_Y_data] * (256 -dx)
-                     + (unsigned int)src[(y2 +1) * src_w + ((x2 + 1) << 1) + 1 + src_Y_data] * dx) >> 8;
-            dest[i * dest_bpl + (j << 1) + 1 + dest_Y_data] = MIN(((val_1 * (256 - dy) + val_2 * dy) >> 8), 0xff);
-        }
+
+    job->srcY = srcY + t_skip * src_bpl + l_skip;
+    job->srcUV = srcUV + (t_skip >> 1) * src_bpl + l_skip;
+    job->srcBpl = src_bpl;
+    job->destWidth = dest_w;
+    return true;
+}
+
+// scales the luma rows [first, last) and the chroma rows belonging to them
+static void scaleNv12Rows(void *context, int first, int last)
+{
+    const Nv12ScaleJob *job = (const Nv12ScaleJob *) context;
+    const int firstUV = first >> 1;
+
+    scalePlane(job->srcY, job->srcBpl, job->destY + first * job->destBpl, NULL, job->destBpl,
+               job->yh.get(), job->yv.get(), PLANE_SINGLE, first, last);
+    scalePlane(job->srcUV, job->srcBpl,
+               job->destC0 + firstUV * job->destCBpl,
+               job->destC1 ? job->destC1 + firstUV * job->destCBpl : NULL, job->destCBpl,
+               job->uvh.get(), job->uvv.get(), job->chromaLayout, firstUV, last >> 1);
+}
+
+// rows scaled into the NV12 block that is converted to RGB in one go
+static const int RGB_BLOCK_ROWS = 16;
+
+/**
+ * Scales the rows [first, last) block by block into a small NV12 image that
+ * stays in the cache, and converts each block to RGB565 or RGBA8888.
+ */
+static void scaleNv12ToRGBRows(void *context, int first, int last)
+{
+    const Nv12ScaleJob *job = (const Nv12ScaleJob *) context;
+    const int bpl = ALIGN16(job->destWidth);
+    unsigned char *block = (unsigned char *) malloc(bpl * RGB_BLOCK_ROWS * 3 / 2);
+    if (block == NULL) {
+        ALOGE("%s: no memory for the conversion block", __func__);
+        return;
     }
+
+    for (int y = first; y < last; y += RGB_BLOCK_ROWS) {
+        const int rows = MIN(RGB_BLOCK_ROWS, last - y);
+        scalePlane(job->srcY, job->srcBpl, block, NULL, bpl,
+                   job->yh.get(), job->yv.get(), PLANE_SINGLE, y, y + rows);
+        scalePlane(job->srcUV, job->srcBpl, block + rows * bpl, NULL, bpl,
+                   job->uvh.get(), job->uvv.get(), job->chromaLayout, y >> 1, (y + rows) >> 1);
+        convertNV12ToRGB(V4L2_PIX_FMT_NV12, job->rgbFourcc, job->destWidth, rows, bpl,
+                         job->destBpl, block, job->destY + y * job->destBpl, job->matrix);
+    }
+
+    free(block);
 }
 
-void ImageScaler::downScaleNv12ImageFrom800x600ToQvga(unsigned char *dest, const unsigned char *src,
-    const int dest_bpl, const int src_bpl)
-{
-    LOG1("@%s", __FUNCTION__);
-    const int dest_w = RESOLUTION_QVGA_WIDTH;
-    const int dest_h = RESOLUTION_QVGA_HEIGHT;
-    const int src_h = 600;
-
-    // Y component
-
-    // Processing 2 dest rows and 5 src rows at a time
-    for (int i = 0; i < dest_h / 2; i++) {
-        u_int32_t *s1 = (u_int32_t *)(&src[(i * 5 + 0) * src_bpl]);
-        u_int32_t *s2 = (u_int32_t *)(&src[(i * 5 + 1) * src_bpl]);
-        u_int32_t *s3 = (u_int32_t *)(&src[(i * 5 + 2) * src_bpl]);
-        u_int32_t *d = (u_int32_t *)(&dest[(i * 2 + 0) * dest_bpl]);
-        // This processes 8 dest pixels at a time
-        for (int j = 0; j < dest_w; j+=8) {
-            u_int32_t a1; // Input data upper row
-            u_int32_t a2; // Input data middle row
-            u_int32_t a3; // Input data lower row
-            u_int32_t t;  // Temp data (for constructing the output)
-            u_int32_t b;  // Output data
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            t = (4 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 8) & 0xff) + 2 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 8) & 0xff) + 2 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 8) & 0xff) + 1 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff));
-            t = (t + 12) / 25;
-            b = t; // First pixel
-            t = (0 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 8) & 0xff) + 2 * ((a1 >> 16) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 8) & 0xff) + 2 * ((a2 >> 16) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 8) & 0xff) + 1 * ((a3 >> 16) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            t = (4 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff))+ t;
-            t = (t + 12) / 25;
-            b |= t << 8; // Second pixel
-            t = (0 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 16) & 0xff) + 2 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 16) & 0xff) + 2 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 16) & 0xff) + 1 * ((a3 >> 24) & 0xff));
-            t = (t + 12) / 25;
-            b |= t << 16; // Third pixel
-            t = (2 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 2 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 1 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            t = (4 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff))+ t;
-            t = (t + 12) / 25;
-            b |= t << 24; // Fourth pixel
-            *d++ = b;
-            t = (0 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 16) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 16) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 16) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            t = (2 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 2 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 1 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff))+ t;
-            t = (t + 12) / 25;
-            b = t; // Fifth pixel
-            t = (2 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 2 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 1 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff));
-            t = (t + 12) / 25;
-            b |= t << 8; // Sixth pixel
-            t = (0 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 16) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 16) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 16) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            t = (4 * ((a1 >> 0) & 0xff) + 2 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 2 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 1 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff))+ t;
-            t = (t + 12) / 25;
-            b |= t << 16; // Seventh pixel
-            t = (0 * ((a1 >> 0) & 0xff) + 2 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 16) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 2 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 16) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 1 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 16) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            t = (t + 12) / 25;
-            b |= t << 24; // Eigth pixel
-            *d++ = b;
-        }
-        s1 = (u_int32_t *)(&src[(i * 5 + 4) * src_bpl]);
-        s2 = (u_int32_t *)(&src[(i * 5 + 3) * src_bpl]);
-        s3 = (u_int32_t *)(&src[(i * 5 + 2) * src_bpl]);
-        d = (u_int32_t *)(&dest[(i * 2 + 1) * dest_bpl]);
-        // This processes 8 dest pixels at a time
-        for (int j = 0; j < dest_w; j+=8) {
-            u_int32_t a1; // Input data lower row
-            u_int32_t a2; // Input data middle row
-            u_int32_t a3; // Input data upper row
-            u_int32_t t;  // Temp data (for constructing the output)
-            u_int32_t b;  // Output data
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            t = (4 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 8) & 0xff) + 2 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 8) & 0xff) + 2 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 8) & 0xff) + 1 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff));
-            t = (t + 12) / 25;
-            b = t; // First pixel
-            t = (0 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 8) & 0xff) + 2 * ((a1 >> 16) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 8) & 0xff) + 2 * ((a2 >> 16) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 8) & 0xff) + 1 * ((a3 >> 16) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            t = (4 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff))+ t;
-            t = (t + 12) / 25;
-            b |= t << 8; // Second pixel
-            t = (0 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 16) & 0xff) + 2 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 16) & 0xff) + 2 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 16) & 0xff) + 1 * ((a3 >> 24) & 0xff));
-            t = (t + 12) / 25;
-            b |= t << 16; // Third pixel
-            t = (2 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 2 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 1 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            t = (4 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff))+ t;
-            t = (t + 12) / 25;
-            b |= t << 24; // Fourth pixel
-            *d++ = b;
-            t = (0 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 16) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 16) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 16) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            t = (2 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 2 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 1 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff))+ t;
-            t = (t + 12) / 25;
-            b = t; // Fifth pixel
-            t = (2 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 2 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 1 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff));
-            t = (t + 12) / 25;
-            b |= t << 8; // Sixth pixel
-            t = (0 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 16) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 16) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 16) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            t = (4 * ((a1 >> 0) & 0xff) + 2 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 16) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 2 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 16) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 1 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 16) & 0xff) + 0 * ((a3 >> 24) & 0xff))+ t;
-            t = (t + 12) / 25;
-            b |= t << 16; // Seventh pixel
-            t = (0 * ((a1 >> 0) & 0xff) + 2 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 16) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 2 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 16) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 1 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 16) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            t = (t + 12) / 25;
-            b |= t << 24; // Eigth pixel
-            *d++ = b;
-        }
+static void runNv12ScaleJob(WorkerPool::StripeFunction function, Nv12ScaleJob *job,
+                            int dest_h, bool multiThreaded)
+{
+    if (!multiThreaded) {
+        function(job, 0, dest_h);
+        return;
     }
+    // a destination row costs about as much as reading its source rows
+    const int rowBytes = job->srcBpl * MAX(job->yv->srcLen / dest_h, 1);
+    WorkerPool::runStripes(function, job, dest_h, 2, WorkerPool::minStripeRows(rowBytes, 2));
+}
 
-    // UV components
-    src = &src[src_bpl * src_h];
-    dest = &dest[dest_bpl * dest_h];
-
-    // Processing 2 dest rows and 5 src rows at a time
-    for (int i = 0; i < (dest_h/2) / 2; i++) {
-        u_int32_t *s1 = (u_int32_t *)(&src[(i * 5 + 0) * src_bpl]);
-        u_int32_t *s2 = (u_int32_t *)(&src[(i * 5 + 1) * src_bpl]);
-        u_int32_t *s3 = (u_int32_t *)(&src[(i * 5 + 2) * src_bpl]);
-        u_int16_t *d = (u_int16_t *)(&dest[(i * 2 + 0) * dest_bpl]);
-        // This processes 4 dest UV pairs at a time
-        for (int j = 0; j < dest_w/2; j+=4) {
-            u_int32_t a1; // Input data upper row
-            u_int32_t a2; // Input data middle row
-            u_int32_t a3; // Input data lower row
-            u_int32_t u;  // Temp data (for constructing the output)
-            u_int32_t v;  // Temp data (for constructing the output)
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            u = (4 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 16) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 16) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 16) & 0xff));
-            v = (4 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            u = (2 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 16) & 0xff) +
-                 2 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 16) & 0xff) +
-                 1 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 16) & 0xff))+ u;
-            v = (2 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 2 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 1 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 24) & 0xff))+ v;
-            u = (u + 12) / 25;
-            v = (v + 12) / 25;
-            *d++ = u | (v << 8); // First uv pair;
-            u = (2 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 16) & 0xff) +
-                 2 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 16) & 0xff) +
-                 1 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 16) & 0xff));
-            v = (2 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 2 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 1 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            u = (4 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 16) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 16) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 16) & 0xff))+ u;
-            v = (4 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 24) & 0xff))+ v;
-            u = (u + 12) / 25;
-            v = (v + 12) / 25;
-            *d++ = u | (v << 8); // Second uv pair;
-            u = (0 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 16) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 16) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 16) & 0xff));
-            v = (0 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            u = (4 * ((a1 >> 0) & 0xff) + 2 * ((a1 >> 16) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 2 * ((a2 >> 16) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 1 * ((a3 >> 16) & 0xff))+ u;
-            v = (4 * ((a1 >> 8) & 0xff) + 2 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 8) & 0xff) + 2 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 8) & 0xff) + 1 * ((a3 >> 24) & 0xff))+ v;
-            u = (u + 12) / 25;
-            v = (v + 12) / 25;
-            *d++ = u | (v << 8); // Third uv pair;
-            u = (0 * ((a1 >> 0) & 0xff) + 2 * ((a1 >> 16) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 2 * ((a2 >> 16) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 1 * ((a3 >> 16) & 0xff));
-            v = (0 * ((a1 >> 8) & 0xff) + 2 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 8) & 0xff) + 2 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 8) & 0xff) + 1 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            u = (4 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 16) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 16) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 16) & 0xff))+ u;
-            v = (4 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 24) & 0xff))+ v;
-            u = (u + 12) / 25;
-            v = (v + 12) / 25;
-            *d++ = u | (v << 8); // Fourth uv pair;
-        }
-        s1 = (u_int32_t *)(&src[(i * 5 + 4) * src_bpl]);
-        s2 = (u_int32_t *)(&src[(i * 5 + 3) * src_bpl]);
-        s3 = (u_int32_t *)(&src[(i * 5 + 2) * src_bpl]);
-        d = (u_int16_t *)(&dest[(i * 2 + 1) * dest_bpl]);
-        // This processes 4 dest UV pairs at a time
-        for (int j = 0; j < dest_w/2; j+=4) {
-            u_int32_t a1; // Input data lower row
-            u_int32_t a2; // Input data middle row
-            u_int32_t a3; // Input data upper row
-            u_int32_t u;  // Temp data (for constructing the output)
-            u_int32_t v;  // Temp data (for constructing the output)
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            u = (4 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 16) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 16) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 16) & 0xff));
-            v = (4 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            u = (2 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 16) & 0xff) +
-                 2 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 16) & 0xff) +
-                 1 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 16) & 0xff))+ u;
-            v = (2 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 2 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 1 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 24) & 0xff))+ v;
-            u = (u + 12) / 25;
-            v = (v + 12) / 25;
-            *d++ = u | (v << 8); // First uv pair;
-            u = (2 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 16) & 0xff) +
-                 2 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 16) & 0xff) +
-                 1 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 16) & 0xff));
-            v = (2 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 2 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 1 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            u = (4 * ((a1 >> 0) & 0xff) + 0 * ((a1 >> 16) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 0 * ((a2 >> 16) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 0 * ((a3 >> 16) & 0xff))+ u;
-            v = (4 * ((a1 >> 8) & 0xff) + 0 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 8) & 0xff) + 0 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 8) & 0xff) + 0 * ((a3 >> 24) & 0xff))+ v;
-            u = (u + 12) / 25;
-            v = (v + 12) / 25;
-            *d++ = u | (v << 8); // Second uv pair;
-            u = (0 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 16) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 16) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 16) & 0xff));
-            v = (0 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            u = (4 * ((a1 >> 0) & 0xff) + 2 * ((a1 >> 16) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 2 * ((a2 >> 16) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 1 * ((a3 >> 16) & 0xff))+ u;
-            v = (4 * ((a1 >> 8) & 0xff) + 2 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 8) & 0xff) + 2 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 8) & 0xff) + 1 * ((a3 >> 24) & 0xff))+ v;
-            u = (u + 12) / 25;
-            v = (v + 12) / 25;
-            *d++ = u | (v << 8); // Third uv pair;
-            u = (0 * ((a1 >> 0) & 0xff) + 2 * ((a1 >> 16) & 0xff) +
-                 0 * ((a2 >> 0) & 0xff) + 2 * ((a2 >> 16) & 0xff) +
-                 0 * ((a3 >> 0) & 0xff) + 1 * ((a3 >> 16) & 0xff));
-            v = (0 * ((a1 >> 8) & 0xff) + 2 * ((a1 >> 24) & 0xff) +
-                 0 * ((a2 >> 8) & 0xff) + 2 * ((a2 >> 24) & 0xff) +
-                 0 * ((a3 >> 8) & 0xff) + 1 * ((a3 >> 24) & 0xff));
-            a1 = *s1++;
-            a2 = *s2++;
-            a3 = *s3++;
-            u = (4 * ((a1 >> 0) & 0xff) + 4 * ((a1 >> 16) & 0xff) +
-                 4 * ((a2 >> 0) & 0xff) + 4 * ((a2 >> 16) & 0xff) +
-                 2 * ((a3 >> 0) & 0xff) + 2 * ((a3 >> 16) & 0xff))+ u;
-            v = (4 * ((a1 >> 8) & 0xff) + 4 * ((a1 >> 24) & 0xff) +
-                 4 * ((a2 >> 8) & 0xff) + 4 * ((a2 >> 24) & 0xff) +
-                 2 * ((a3 >> 8) & 0xff) + 2 * ((a3 >> 24) & 0xff))+ v;
-            u = (u + 12) / 25;
-            v = (v + 12) / 25;
-            *d++ = u | (v << 8); // Fourth uv pair;
-        }
+/**
+ * Scales an NV12 or NV21 image to any size, up or down. If the aspect ratio
+ * of the destination differs from the source, the source is center cropped
+ * to the destination aspect ratio first.
+ */
+void ImageScaler::downScaleAndCropNv12Image(unsigned char *dest, const unsigned char *src,
+    const int dest_w, const int dest_h, const int dest_bpl,
+    const int src_w, const int src_h, const int src_bpl,
+    const int src_skip_lines_top, // number of lines that are skipped from src image start pointer
+    const int src_skip_lines_bottom, // number of lines that are skipped after reading src_h (should be set always to reach full image height)
+    bool multiThreaded)
+{
+    LOG1("@%s: dest_w: %d, dest_h: %d, dest_bpl: %d, src_w: %d, src_h: %d, src_bpl: %d, skip_top: %d, skip_bottom: %d, dest: %p, src: %p",
+         __FUNCTION__, dest_w, dest_h, dest_bpl, src_w, src_h, src_bpl, src_skip_lines_top, src_skip_lines_bottom, dest, src);
+
+    Nv12ScaleJob job;
+    if (!initNv12ScaleJob(&job, src, dest_w, dest_h, src_w, src_h, src_bpl,
+                          src_skip_lines_top, src_skip_lines_bottom))
+        return;
+
+    job.destY = dest;
+    job.destBpl = dest_bpl;
+    job.destC0 = dest + dest_h * dest_bpl;
+    job.destC1 = NULL;
+    job.destCBpl = dest_bpl;
+    job.chromaLayout = PLANE_PAIRS;
+    runNv12ScaleJob(scaleNv12Rows, &job, dest_h, multiThreaded);
+}
+
+/**
+ * Scales an NV12 or NV21 image and writes it in another format in the same
+ * pass. Scaling and cropping are those of downScaleAndCropNv12Image(), the
+ * output equals scaling to NV12/NV21 first and converting the result with
+ * the ColorConverter functions, without the intermediate image.
+ */
+bool ImageScaler::scaleAndConvertImage(void *src, void *dest,
+        int dest_w, int dest_h, int dest_bpl, int dest_fourcc,
+        int src_w, int src_h, int src_bpl, int src_fourcc,
+        bool multiThreaded, ColorMatrix matrix)
+{
+    LOG2("@%s: %dx%d %s -> %dx%d %s", __FUNCTION__, src_w, src_h, v4l2Fmt2Str(src_fourcc),
+         dest_w, dest_h, v4l2Fmt2Str(dest_fourcc));
+
+    if (src_fourcc != V4L2_PIX_FMT_NV12 && src_fourcc != V4L2_PIX_FMT_NV21)
+        return false;
+    if ((dest_w & 1) || (dest_h & 1))
+        return false;
+
+    // chroma pairs as NV12 (U first) or NV21 (V first)
+    const bool srcVU = src_fourcc == V4L2_PIX_FMT_NV21;
+    unsigned char *destY = (unsigned char *) dest;
+    WorkerPool::StripeFunction function = scaleNv12Rows;
+    Nv12ScaleJob job;
+
+    job.destY = destY;
+    job.destBpl = dest_bpl;
+    job.destC0 = destY + dest_h * dest_bpl;
+    job.destC1 = NULL;
+    job.destCBpl = dest_bpl;
+
+    switch (dest_fourcc) {
+    case V4L2_PIX_FMT_NV12:
+        job.chromaLayout = srcVU ? PLANE_SWAPPED : PLANE_PAIRS;
+        break;
+    case V4L2_PIX_FMT_NV21:
+        job.chromaLayout = srcVU ? PLANE_PAIRS : PLANE_SWAPPED;
+        break;
+    case V4L2_PIX_FMT_YVU420: {
+        // YV12 as Android defines it: V then U plane, 16 byte aligned strides
+        unsigned char *destV = job.destC0;
+        unsigned char *destU = destV + ALIGN16(dest_bpl / 2) * (dest_h / 2);
+        job.destCBpl = ALIGN16(dest_bpl / 2);
+        job.destC0 = srcVU ? destV : destU;
+        job.destC1 = srcVU ? destU : destV;
+        job.chromaLayout = PLANE_SPLIT;
+        break;
+    }
+    case V4L2_PIX_FMT_RGB565:
+    case V4L2_PIX_FMT_RGB32:
+        // converted from NV12 blocks, see scaleNv12ToRGBRows()
+        if (dest_bpl < pixelsToBytes(dest_fourcc, dest_w) || (dest_bpl & 1))
+            return false;
+        job.chromaLayout = srcVU ? PLANE_SWAPPED : PLANE_PAIRS;
+        job.rgbFourcc = dest_fourcc;
+        job.matrix = matrix;
+        function = scaleNv12ToRGBRows;
+        break;
+    default:
+        return false;
     }
 
+    if (!initNv12ScaleJob(&job, (const unsigned char *) src, dest_w, dest_h,
+                          src_w, src_h, src_bpl, 0, 0))
+        return false;
+
+    runNv12ScaleJob(function, &job, dest_h, multiThreaded);
+    return true;
 }
-// VGA-QCIF end
 
 /**
  * Crops then input image to destination size. The params must be such that
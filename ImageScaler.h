@@ -16,19 +16,43 @@
 #ifndef IMAGESCALER_H_
 #define IMAGESCALER_H_
 
+#include "ColorConverter.h"
+
 namespace android {
 
 class AtomBuffer;
 
 class ImageScaler {
 public:
+    /**
+     * Scales src into dst. With multiThreaded the work is split into
+     * stripes run on the WorkerPool, for snapshot size images.
+     */
     static void downScaleImage(AtomBuffer *src, AtomBuffer *dst,
-            int src_skip_lines_top = 0, int src_skip_lines_bottom = 0);
+            int src_skip_lines_top = 0, int src_skip_lines_bottom = 0,
+            bool multiThreaded = false);
     static void downScaleImage(void *src, void *dest,
             int dest_w, int dest_h, int dest_bpl,
             int src_w, int src_h, int src_bpl,
             int fourcc, int src_skip_lines_top = 0,
-            int src_skip_lines_bottom = 0);
+            int src_skip_lines_bottom = 0,
+            bool multiThreaded = false);
+
+    /**
+     * Scales an NV12 or NV21 image and converts it to dest_fourcc in a single
+     * pass over the source, without an intermediate image. Supported
+     * destinations are NV12, NV21, YV12 (V4L2_PIX_FMT_YVU420, chroma planes
+     * with a stride of ALIGN16(dest_bpl / 2)), and RGB565 and RGBA8888
+     * (V4L2_PIX_FMT_RGB32) converted with the given matrix.
+     *
+     * \return false if the combination of formats or the geometry is not
+     *         supported, the destination is not touched then
+     */
+    static bool scaleAndConvertImage(void *src, void *dest,
+            int dest_w, int dest_h, int dest_bpl, int dest_fourcc,
+            int src_w, int src_h, int src_bpl, int src_fourcc,
+            bool multiThreaded = false,
+            ColorMatrix matrix = COLOR_MATRIX_BT601_FULL);
 
     static void cropNV12orNV21Image(const AtomBuffer *src, AtomBuffer *dst,
                                     int leftCrop, int rightCrop, int topCrop, int bottomCrop);
@@ -36,14 +60,16 @@ public:
 
 protected:
     static void downScaleYUY2Image(unsigned char *dest, const unsigned char *src,
-        const int dest_w, const int dest_h, const int src_w, const int src_h);
+        const int dest_w, const int dest_h, const int src_w, const int src_h,
+        bool multiThreaded = false);
 
     static void downScaleAndCropNv12Image(
         unsigned char *dest, const unsigned char *src,
         const int dest_w, const int dest_h, const int dest_bpl,
         const int src_w, const int src_h, const int src_bpl,
         const int src_skip_lines_top = 0,
-        const int src_skip_lines_bottom = 0);
+        const int src_skip_lines_bottom = 0,
+        bool multiThreaded = false);
 
     static void trimNv12Image(
         unsigned char *dest, const unsigned char *src,
@@ -52,18 +78,6 @@ protected:
         const int src_skip_lines_top = 0,
         const int src_skip_lines_bottom = 0);
 
-    static void downScaleAndCropNv12ImageQvga(
-        unsigned char *dest, const unsigned char *src,
-        const int dest_bpl, const int src_bpl);
-
-    static void downScaleAndCropNv12ImageQcif(
-        unsigned char *dest, const unsigned char *src,
-        const int dest_bpl, const int src_bpl);
-
-    static void downScaleNv12ImageFrom800x600ToQvga(
-        unsigned char *dest, const unsigned char *src,
-        const int dest_bpl, const int src_bpl);
-
 };
 
 };
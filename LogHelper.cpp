@@ -91,6 +91,10 @@ void android::LogHelper::setDebugLevel(void)
         if (gPerfLevel & CAMERA_DEBUG_LOG_PERF_IO_MEMORY) {
             PerformanceTraces::IOBreakdown::enableMemInfo(true);
         }
+
+        if (gPerfLevel & CAMERA_DEBUG_LOG_PERF_FRAME_TRACE) {
+            PerformanceTraces::FrameTrace::enable(true);
+        }
     }
 
     //Power property
@@ -67,7 +67,10 @@ enum  {
     CAMERA_DEBUG_LOG_PERF_IO_BREAKDOWN = 1<<2,
 
     /* Print out detailed memory information analysis for IOCTL */
-    CAMERA_DEBUG_LOG_PERF_IO_MEMORY = 1<<3
+    CAMERA_DEBUG_LOG_PERF_IO_MEMORY = 1<<3,
+
+    /* Record per-frame pipeline traces, written out by dumpsys media.camera */
+    CAMERA_DEBUG_LOG_PERF_FRAME_TRACE = 1<<6
 };
 
 enum  {
@@ -79,7 +82,11 @@ enum  {
 //TODO: we will combine the gPowerLevel to gControlLevel.
 enum  {
     CAMERA_DISABLE_FRONT_NVM = 1<<3,
-    CAMERA_DISABLE_BACK_NVM = 1<<4
+    CAMERA_DISABLE_BACK_NVM = 1<<4,
+    /* force the scalar reference path of the image processing kernels */
+    CAMERA_DISABLE_SIMD = 1<<5,
+    /* observe the ISP devices from one epoll thread, see AtomIspObserverManager */
+    CAMERA_ENABLE_OBSERVER_REACTOR = 1<<6
 };
 
 #define LOG1(...) ALOGD_IF(gLogLevel & CAMERA_DEBUG_LOG_LEVEL1, __VA_ARGS__);
@@ -18,7 +18,15 @@
 
 #include <fcntl.h>
 #include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <cutils/atomic.h>
 #include <utils/Timers.h>
+#include <utils/Vector.h>
+#include <utils/KeyedVector.h>
 #include "PerformanceTraces.h"
 
 namespace android {
@@ -129,7 +137,7 @@ void reset(void)
     gShutterLag.mRequested = false;
     gSwitchCameras.mRequested = false;
     gLaunch2FocusLock.mRequested = false;
-
+    FrameTrace::enable(false);
 }
 /**
  * Controls trace state
@@ -651,5 +659,284 @@ void IOBreakdown::stop(void)
     }
 }
 
+/**
+ * FrameTrace event, begin or end of a stage, or an instant event
+ */
+struct FrameTraceEvent {
+    nsecs_t ts;
+    const char *stage;
+    int32_t frameCounter;
+    int32_t sequence;
+    char phase;             // 'B', 'E' or 'I'
+};
+
+/**
+ * Ring of FrameTrace events of one thread. Only the owning thread
+ * writes, head is published after the event so dump() can read
+ * concurrently.
+ */
+struct FrameTraceRing {
+    static const int SIZE = 512;    // power of 2
+    volatile int32_t owner;         // tid of the writing thread, 0 when free
+    int32_t tid;                    // tid of the thread the events are from
+    char name[16];
+    volatile int32_t head;          // number of events written
+    FrameTraceEvent events[SIZE];
+};
+
+static const int FRAME_TRACE_MAX_THREADS = 24;
+static FrameTraceRing *gFrameTraceRings = NULL;
+static bool gFrameTraceEnabled = false;
+static pthread_key_t gFrameTraceKey;
+
+/**
+ * Releases the ring of an exiting thread to be reused, the events stay
+ * in it until then.
+ */
+static void frameTraceThreadExit(void *ring)
+{
+    android_atomic_release_store(0, &((FrameTraceRing*) ring)->owner);
+}
+
+/**
+ * \return the ring of the calling thread, claiming a free one on the
+ *         first call of the thread, NULL if all are in use
+ */
+static FrameTraceRing *frameTraceRing(void)
+{
+    FrameTraceRing *ring = (FrameTraceRing*) pthread_getspecific(gFrameTraceKey);
+    if (ring)
+        return ring;
+
+    int32_t tid = gettid();
+    for (int i = 0; i < FRAME_TRACE_MAX_THREADS; i++) {
+        ring = &gFrameTraceRings[i];
+        if (ring->owner == 0 && android_atomic_cmpxchg(0, tid, &ring->owner) == 0) {
+            ring->tid = tid;
+            prctl(PR_GET_NAME, ring->name);
+            ring->name[sizeof(ring->name) - 1] = 0;
+            android_atomic_release_store(0, &ring->head);
+            pthread_setspecific(gFrameTraceKey, ring);
+            return ring;
+        }
+    }
+
+    return NULL;
+}
+
+static void frameTraceRecord(char phase, const char *stage, int frameCounter, int sequence)
+{
+    FrameTraceRing *ring = frameTraceRing();
+    if (ring == NULL)
+        return;
+
+    int32_t head = ring->head;
+    FrameTraceEvent &event = ring->events[head & (FrameTraceRing::SIZE - 1)];
+    event.ts = systemTime();
+    event.stage = stage;
+    event.frameCounter = frameCounter;
+    event.sequence = sequence;
+    event.phase = phase;
+    android_atomic_release_store(head + 1, &ring->head);
+}
+
+/**
+ * Enable the per-frame tracer. The rings are allocated on the first
+ * enable, before the camera threads run, and kept.
+ */
+void FrameTrace::enable(bool set)
+{
+    if (set && gFrameTraceRings == NULL) {
+        if (pthread_key_create(&gFrameTraceKey, frameTraceThreadExit) != 0) {
+            ALOGE("Failed to create the frame trace thread key");
+            return;
+        }
+        gFrameTraceRings = new FrameTraceRing[FRAME_TRACE_MAX_THREADS];
+        memset(gFrameTraceRings, 0, sizeof(FrameTraceRing) * FRAME_TRACE_MAX_THREADS);
+    }
+    gFrameTraceEnabled = set && gFrameTraceRings != NULL;
+}
+
+/**
+ * Begin a stage of a frame, ended when the object goes out of scope.
+ *
+ * @arg stage, static name of the stage, e.g. __FUNCTION__
+ * @arg frameCounter, AtomBuffer::frameCounter or -1
+ * @arg sequence, V4L2 sequence number or -1
+ */
+FrameTrace::FrameTrace(const char *stage, int frameCounter, int sequence) :
+    mStage(stage),
+    mFrameCounter(frameCounter),
+    mSequence(sequence),
+    mRecording(gFrameTraceEnabled)
+{
+    if (mRecording)
+        frameTraceRecord('B', mStage, mFrameCounter, mSequence);
+}
+
+FrameTrace::~FrameTrace()
+{
+    if (mRecording)
+        frameTraceRecord('E', mStage, mFrameCounter, mSequence);
+}
+
+/**
+ * Set the frame of a stage that only knows it at its end, e.g. a dequeue
+ */
+void FrameTrace::setFrame(int frameCounter, int sequence)
+{
+    mFrameCounter = frameCounter;
+    mSequence = sequence;
+}
+
+/**
+ * Record an instant event of a frame
+ */
+void FrameTrace::event(const char *stage, int frameCounter, int sequence)
+{
+    if (gFrameTraceEnabled)
+        frameTraceRecord('I', stage, frameCounter, sequence);
+}
+
+/**
+ * Stage of a frame completed in the rings, input for the flow events
+ */
+struct FrameTraceSlice {
+    nsecs_t ts;
+    int32_t tid;
+    int32_t frameCounter;
+    int32_t sequence;
+};
+
+static int compareFrameTraceSlices(const FrameTraceSlice *a, const FrameTraceSlice *b)
+{
+    if (a->sequence != b->sequence)
+        return a->sequence < b->sequence ? -1 : 1;
+    if (a->ts != b->ts)
+        return a->ts < b->ts ? -1 : 1;
+    return 0;
+}
+
+static void frameTraceWriteSlice(FILE *file, int pid, int32_t tid, const FrameTraceEvent &begin, nsecs_t end,
+                                 int frameCounter, int sequence, bool *first)
+{
+    fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+            "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%d,\"seq\":%d}}",
+            *first ? "" : ",", begin.stage, pid, tid,
+            begin.ts / 1000.0, (end - begin.ts) / 1000.0, frameCounter, sequence);
+    *first = false;
+}
+
+/**
+ * Write the events in the rings to a file in Chrome trace event JSON
+ * format. Recording continues meanwhile, events overwritten during the
+ * copy are left out.
+ */
+status_t FrameTrace::dump(const char *path)
+{
+    if (gFrameTraceRings == NULL)
+        return INVALID_OPERATION;
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        ALOGE("Failed to open %s for the frame trace", path);
+        return UNKNOWN_ERROR;
+    }
+
+    const int pid = getpid();
+    const int maxDepth = 16;
+    bool first = true;
+    Vector<FrameTraceSlice> slices;
+    KeyedVector<int32_t, int32_t> sequences;    // frameCounter -> sequence
+    FrameTraceEvent *events = new FrameTraceEvent[FrameTraceRing::SIZE];
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for (int i = 0; i < FRAME_TRACE_MAX_THREADS; i++) {
+        FrameTraceRing *ring = &gFrameTraceRings[i];
+        int32_t tid = ring->tid;
+        int32_t head = android_atomic_acquire_load(&ring->head);
+        int32_t start = head > FrameTraceRing::SIZE ? head - FrameTraceRing::SIZE : 0;
+        for (int32_t j = start; j < head; j++)
+            events[j - start] = ring->events[j & (FrameTraceRing::SIZE - 1)];
+        // the slot of the event being written when we finished copying
+        // is the oldest one that may have been overwritten
+        int32_t written = android_atomic_acquire_load(&ring->head);
+        int32_t skip = written - FrameTraceRing::SIZE + 1 - start;
+        if (skip < 0)
+            skip = 0;
+        if (head <= start + skip)
+            continue;
+
+        fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", pid, tid, ring->name);
+        first = false;
+
+        // pair the begin and end events into complete slices; ends
+        // without a begin lost in the ring wrap are dropped
+        const FrameTraceEvent *stack[maxDepth];
+        int depth = 0;
+        for (int32_t j = skip; j < head - start; j++) {
+            const FrameTraceEvent &event = events[j];
+            const FrameTraceEvent *begin = &event;
+            int frameCounter = event.frameCounter;
+            int sequence = event.sequence;
+
+            if (event.phase == 'B') {
+                if (depth < maxDepth)
+                    stack[depth] = &event;
+                depth++;
+                continue;
+            }
+            if (event.phase == 'E') {
+                if (depth == 0)
+                    continue;
+                depth--;
+                if (depth >= maxDepth)
+                    continue;
+                begin = stack[depth];
+            }
+
+            frameTraceWriteSlice(file, pid, tid, *begin, event.ts, frameCounter, sequence, &first);
+
+            if (frameCounter >= 0 && sequence >= 0)
+                sequences.add(frameCounter, sequence);
+            if (frameCounter >= 0 || sequence >= 0) {
+                FrameTraceSlice slice = { begin->ts, tid, frameCounter, sequence };
+                slices.push(slice);
+            }
+        }
+    }
+
+    // connect the stages of each frame with flow events, by sequence
+    // number when known or else through the frame counter
+    for (size_t i = 0; i < slices.size(); i++) {
+        FrameTraceSlice &slice = slices.editItemAt(i);
+        if (slice.sequence < 0) {
+            ssize_t index = sequences.indexOfKey(slice.frameCounter);
+            if (index >= 0)
+                slice.sequence = sequences.valueAt(index);
+        }
+    }
+    slices.sort(compareFrameTraceSlices);
+    for (size_t i = 0; i < slices.size(); i++) {
+        const FrameTraceSlice &slice = slices[i];
+        bool firstOfFrame = i == 0 || slices[i - 1].sequence != slice.sequence;
+        bool lastOfFrame = i + 1 == slices.size() || slices[i + 1].sequence != slice.sequence;
+        if (slice.sequence < 0 || (firstOfFrame && lastOfFrame))
+            continue;
+        fprintf(file, ",\n{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"%s\",\"id\":%d,\"pid\":%d,\"tid\":%d,\"ts\":%.3f}",
+                firstOfFrame ? "s" : lastOfFrame ? "f\",\"bp\":\"e" : "t",
+                slice.sequence, pid, slice.tid, slice.ts / 1000.0);
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    delete[] events;
+
+    ALOGD("Frame trace written to %s", path);
+    return NO_ERROR;
+}
+
 } // namespace PerformanceTraces
 } // namespace android
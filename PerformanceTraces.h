@@ -132,6 +132,38 @@ namespace PerformanceTraces {
     static Mutex mMemMutex;
   };
 
+  /**
+   * \class FrameTrace
+   *
+   * Follows preview frames through the pipeline stages (SOF, ISP dequeue,
+   * 3A statistics, preview rendering, callbacks).
+   *
+   * Each stage is a scoped object recording begin and end events, with
+   * the frame counter and the V4L2 sequence number of the frame, into a
+   * ring of the calling thread. Recording takes no locks and the rings
+   * are only allocated when enabled, so the tracer can be left running.
+   *
+   * dump() writes the last events of all threads in the Chrome trace
+   * event JSON format, which can be opened in chrome://tracing or
+   * Perfetto UI. The stages of one frame are connected with flow events
+   * keyed by the sequence number.
+   */
+  class FrameTrace {
+  public:
+    FrameTrace(const char *stage, int frameCounter, int sequence = -1);
+    ~FrameTrace();
+    void setFrame(int frameCounter, int sequence);
+  public:
+    static void enable(bool set);
+    static void event(const char *stage, int frameCounter, int sequence = -1);
+    static status_t dump(const char *path);
+  private:
+    const char *mStage;
+    int mFrameCounter;
+    int mSequence;
+    bool mRecording;
+  };
+
 
   /**
    * Helper function to disable all the performance traces
@@ -223,6 +255,16 @@ namespace PerformanceTraces {
   #define PERFORMANCE_TRACES_IO_STOP() \
       PerformanceTraces::IOBreakdown::stop();
 
+  /**
+   * Helper macro to trace the rest of the calling scope as a pipeline
+   * stage of a frame, named after the function.
+   *
+   * @param frameCounter AtomBuffer::frameCounter, -1 if not known
+   * @param sequence V4L2 sequence number, -1 if not known
+   */
+  #define PERFORMANCE_TRACES_FRAME_STAGE(frameCounter, sequence) \
+      PerformanceTraces::FrameTrace frameTrace(__FUNCTION__, frameCounter, sequence)
+
   #define PERFORMANCE_TRACES_IO_BREAKDOWN(note) \
   { \
       if (gPerfLevel & CAMERA_DEBUG_LOG_PERF_IO_BREAKDOWN) \
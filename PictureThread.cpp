@@ -36,6 +36,7 @@ static const int SIZE_OF_APP0_MARKER = 18;      /* Size of the JFIF App0 marker
                                                  * This is introduced by SW encoder after
                                                  * SOI. And sometimes needs to be removed
                                                  */
+
 PictureThread::PictureThread(I3AControls *aaaControls, sp<ScalerService> scaler,
                              sp<CallbacksThread> callbacksThread, Callbacks *callbacks,
                              ICallbackPicture *pictureDone,
@@ -49,9 +50,12 @@ PictureThread::PictureThread(I3AControls *aaaControls, sp<ScalerService> scaler,
     ,mExifMaker(NULL)
     ,mExifBuf(AtomBufferFactory::createAtomBuffer(ATOM_BUFFER_SNAPSHOT_JPEG))
     ,mOutBuf(AtomBufferFactory::createAtomBuffer(ATOM_BUFFER_SNAPSHOT_JPEG))
+    ,mThumbOutBuf(AtomBufferFactory::createAtomBuffer(ATOM_BUFFER_SNAPSHOT_JPEG))
     ,mThumbBuf(AtomBufferFactory::createAtomBuffer(ATOM_BUFFER_POSTVIEW))
     ,mScaledPic(AtomBufferFactory::createAtomBuffer(ATOM_BUFFER_SNAPSHOT))
     ,mFirstPartBuf(AtomBufferFactory::createAtomBuffer(ATOM_BUFFER_SNAPSHOT))
+    ,mPictWidth(0)
+    ,mPictHeight(0)
     ,mPictureQuality(80)
     ,mThumbnailQuality(50)
     ,mInputBufferArray(NULL)
@@ -77,23 +81,45 @@ PictureThread::PictureThread(I3AControls *aaaControls, sp<ScalerService> scaler,
     if (mExifMaker == NULL) {
         ALOGE("ExifMaker allocation failed");
     }
+
+    for (int i = 0; i < MAX_ENCODE_JOBS; i++) {
+        mJobs[i].exifBuf = AtomBufferFactory::createAtomBuffer(ATOM_BUFFER_SNAPSHOT_JPEG);
+        mJobs[i].inUse = false;
+        mJobs[i].exifDone = false;
+    }
+
+    mEncoderThread = new EncoderThread(this);
+    if (mEncoderThread->run("CamHAL_PIC_ENCODER") != NO_ERROR) {
+        ALOGW("Encoder thread could not be started, pictures are encoded serially");
+        mEncoderThread.clear();
+    }
 }
 
 PictureThread::~PictureThread()
 {
     LOG1("@%s", __FUNCTION__);
 
+    if (mEncoderThread != NULL) {
+        mEncoderThread->requestExitAndWait();
+        mEncoderThread.clear();
+    }
+
     LOG2("@%s: release mOutBuf", __FUNCTION__);
-    MemoryUtils::freeAtomBuffer(mOutBuf);
+    mCallbacks->releasePooledMemory(&mOutBuf);
+
+    LOG2("@%s: release mThumbOutBuf", __FUNCTION__);
+    mCallbacks->releasePooledMemory(&mThumbOutBuf);
 
     LOG2("@%s: release mExifBuf", __FUNCTION__);
-    MemoryUtils::freeAtomBuffer(mExifBuf);
+    mCallbacks->releasePooledMemory(&mExifBuf);
+    for (int i = 0; i < MAX_ENCODE_JOBS; i++)
+        mCallbacks->releasePooledMemory(&mJobs[i].exifBuf);
 
     LOG2("@%s: release mThumbBuf", __FUNCTION__);
     MemoryUtils::freeAtomBuffer(mThumbBuf);
 
     LOG2("@%s: release mScaledPic", __FUNCTION__);
-    MemoryUtils::freeAtomBuffer(mScaledPic);
+    mCallbacks->releasePooledMemory(&mScaledPic);
 
     LOG2("@%s: release mCapturePostViewBufList", __FUNCTION__);
     List<AtomBuffer>::iterator it = mCapturePostViewBufList.begin();
@@ -122,43 +148,22 @@ PictureThread::~PictureThread()
 }
 
 /*
- * encodeToJpeg: encodes the given buffer and creates the final JPEG file
+ * encodeToJpeg: encodes the main picture of a job and creates the final JPEG file
  * It allocates the memory for the final JPEG that contains EXIF(with thumbnail)
- * plus main picture
- * Input:  mainBuf  - buffer containing the main picture image
- *         thumbBuf - buffer containing the thumbnail image (optional, can be NULL)
- *         dataHasBeenFlushed - bool indicating whether data has been flushed from CPU cache
+ * plus main picture. Runs in the EncoderThread, the EXIF of the job is
+ * generated by the PictureThread meanwhile and joined before assembly.
+ * Input:  job      - snapshot, requested size and quality of the picture
  * Output: destBuf  - buffer containing the final JPEG image including EXIF header
- *         Note that, if present, thumbBuf will be included in EXIF header
  */
-status_t PictureThread::encodeToJpeg(AtomBuffer *mainBuf, AtomBuffer *thumbBuf, AtomBuffer *destBuf, bool dataHasBeenFlushed)
+status_t PictureThread::encodeToJpeg(EncodeJob *job, AtomBuffer *destBuf)
 {
     LOG1("@%s", __FUNCTION__);
     status_t status = NO_ERROR;
     nsecs_t startTime = systemTime();
     bool swFallback = false;
+    AtomBuffer *mainBuf = &job->snapshotBuf;
 
-    size_t bufferSize = (mainBuf->width * mainBuf->height * 2);
-    if (mOutBuf.dataPtr != NULL && bufferSize != (size_t) mOutBuf.size) {
-        MemoryUtils::freeAtomBuffer(mOutBuf);
-    }
-
-    if (mOutBuf.dataPtr == NULL) {
-        mCallbacks->allocateMemory(&mOutBuf, bufferSize);
-    }
-
-    if (mOutBuf.dataPtr == NULL) {
-        ALOGE("Could not allocate memory for temp buffer!");
-        return NO_MEMORY;
-    }
-
-    LOG1("Out buffer: @%p (%d bytes)", mOutBuf.dataPtr, mOutBuf.size);
-
-    status = allocateExifBuffer();
-    if (status != NO_ERROR)
-        return status;
-
-    status = scaleMainPic(mainBuf);
+    status = scaleMainPic(mainBuf, job->width, job->height);
     if (status == NO_ERROR) {
        mainBuf = &mScaledPic;
     }
@@ -175,10 +180,10 @@ status_t PictureThread::encodeToJpeg(AtomBuffer *mainBuf, AtomBuffer *thumbBuf,
     // Start encoding main picture using HW encoder (except for panorama, which
     // often has resolution which the HW-encoder can't handle
     if (mainBuf->type != ATOM_BUFFER_PANORAMA && isAligned) {
-        if (!dataHasBeenFlushed)
+        if (!job->dataHasBeenFlushed)
             MemoryUtils::flushMemory((char *)mainBuf->dataPtr, mainBuf->size);
 
-        status = startHwEncoding(mainBuf);
+        status = startHwEncoding(mainBuf, job->quality);
         if(status != NO_ERROR) {
             LOG1("@%s, hw encoding failed", __FUNCTION__);
             swFallback = true;
@@ -188,16 +193,10 @@ status_t PictureThread::encodeToJpeg(AtomBuffer *mainBuf, AtomBuffer *thumbBuf,
         swFallback = true;
     }
 
-    // Convert and encode the thumbnail, if present and EXIF maker is initialized
-    if (mExifMaker->isInitialized())
-    {
-        encodeExif(thumbBuf);
-    }
-
     if (swFallback) {  // Encode main picture with SW encoder
-        status = doSwEncode(mainBuf, destBuf);
+        status = doSwEncode(job, mainBuf, destBuf);
     } else {
-        status = completeHwEncode(mainBuf, destBuf);
+        status = completeHwEncode(job, mainBuf, destBuf);
     }
 
     if (status != NO_ERROR)
@@ -214,6 +213,86 @@ status_t PictureThread::encodeToJpeg(AtomBuffer *mainBuf, AtomBuffer *thumbBuf,
     return status;
 }
 
+/**
+ * Takes a free job, waits for one to be released when MAX_ENCODE_JOBS
+ * pictures are in the pipeline already.
+ */
+PictureThread::EncodeJob *PictureThread::acquireJob()
+{
+    Mutex::Autolock lock(mJobLock);
+    for (;;) {
+        for (int i = 0; i < MAX_ENCODE_JOBS; i++) {
+            if (!mJobs[i].inUse) {
+                mJobs[i].inUse = true;
+                mJobs[i].exifDone = false;
+                return &mJobs[i];
+            }
+        }
+        LOG1("@%s: %d pictures in the pipeline, waiting", __FUNCTION__, MAX_ENCODE_JOBS);
+        mJobCondition.wait(mJobLock);
+    }
+}
+
+void PictureThread::releaseJob(EncodeJob *job)
+{
+    Mutex::Autolock lock(mJobLock);
+    job->inUse = false;
+    mJobCondition.broadcast();
+}
+
+void PictureThread::setExifDone(EncodeJob *job)
+{
+    Mutex::Autolock lock(mJobLock);
+    job->exifDone = true;
+    mJobCondition.broadcast();
+}
+
+void PictureThread::waitForExif(EncodeJob *job)
+{
+    Mutex::Autolock lock(mJobLock);
+    while (!job->exifDone)
+        mJobCondition.wait(mJobLock);
+}
+
+/**
+ * Waits until the pipeline is empty, i.e. the JPEGs of all the
+ * pictures handed to the EncoderThread have been delivered.
+ */
+void PictureThread::waitForJobs()
+{
+    Mutex::Autolock lock(mJobLock);
+    for (int i = 0; i < MAX_ENCODE_JOBS; i++) {
+        while (mJobs[i].inUse)
+            mJobCondition.wait(mJobLock);
+    }
+}
+
+/**
+ * Encodes the main picture of a job and delivers the JPEG.
+ * Runs in the EncoderThread, jobs complete in the order they were queued.
+ */
+status_t PictureThread::encodeJob(EncodeJob *job)
+{
+    LOG1("@%s: snapshot ID = %d", __FUNCTION__, job->snapshotBuf.id);
+    AtomBuffer jpegBuf = AtomBufferFactory::createAtomBuffer(ATOM_BUFFER_SNAPSHOT_JPEG);
+
+    status_t status = encodeToJpeg(job, &jpegBuf);
+    if (status != NO_ERROR) {
+        ALOGE("Error generating JPEG image!");
+        LOG1("Releasing jpegBuf @%p", jpegBuf.dataPtr);
+        MemoryUtils::freeAtomBuffer(jpegBuf);
+    }
+
+    jpegBuf.frameCounter = job->snapshotBuf.frameCounter;
+
+    // the thumbnail is made from the postview, let the PictureThread finish with it
+    waitForExif(job);
+    mCallbacksThread->compressedFrameDone(&jpegBuf, &job->snapshotBuf, &job->postviewBuf);
+
+    releaseJob(job);
+    return status;
+}
+
 status_t PictureThread::encode(MetaData &metaData, AtomBuffer *snapshotBuf, AtomBuffer *postviewBuf, bool dataHasBeenFlushed)
 {
     LOG1("@%s", __FUNCTION__);
@@ -289,9 +368,9 @@ status_t PictureThread::handleMessageInitialize(MessageParam *msg)
         MemoryUtils::freeAtomBuffer(mThumbBuf);
     }
 
-    params.getPictureSize(&mScaledPic.width, &mScaledPic.height);
-    mScaledPic.bpl = mScaledPic.width;
-    mScaledPic.size = frameSize(mScaledPic.fourcc, bytesToPixels(mScaledPic.fourcc, mScaledPic.bpl), mScaledPic.height);
+    // the EncoderThread may still be scaling a picture to the previous size,
+    // each job takes a copy of these
+    params.getPictureSize(&mPictWidth, &mPictHeight);
 
     mMessageQueue.reply(MESSAGE_ID_INITIALIZE, NO_ERROR);
     return NO_ERROR;
@@ -606,15 +685,10 @@ status_t PictureThread::assembleJpeg(AtomBuffer *mainBuf, AtomBuffer *mainBuf2)
     uint32_t thumbnailId(getU32fromFrame((uint8_t*)mainBuf->dataPtr,
                                          JPEG_INFO_START + JPEG_INFO_YUV_FRAME_ID_ADDR));
 
-    status = allocateExifBuffer();
+    status = allocateExifBuffer(mExifBuf);
     if (status != NO_ERROR)
         return status;
 
-    /* Allocate Output buffer for thumbnail */
-    if (mOutBuf.dataPtr == NULL) {
-        mCallbacks->allocateMemory(&mOutBuf, EXIF_SIZE_LIMITATION);
-    }
-
     // prepare EXIF data (focal length etc)
     mExifMaker->setDriverData(mMakerInfo);
     // Read exif info from META data
@@ -641,10 +715,10 @@ status_t PictureThread::assembleJpeg(AtomBuffer *mainBuf, AtomBuffer *mainBuf2)
     if (postviewBuf.dataPtr != NULL) {
         LOG2("@%s: Thumbnail id, %u - %u", __FUNCTION__, postviewBuf.id,
              getU32fromFrame((uint8_t*)mainBuf->dataPtr, JPEG_INFO_START + JPEG_INFO_YUV_FRAME_ID_ADDR));
-        encodeExif(&postviewBuf);
+        encodeExif(&postviewBuf, &mExifBuf);
     } else {
         ALOGW("No thumbnail available during JPEG assemble.");
-        encodeExif(NULL);
+        encodeExif(NULL, &mExifBuf);
     }
 
     MemoryUtils::freeAtomBuffer(postviewBuf);
@@ -745,7 +819,6 @@ status_t PictureThread::handleMessageEncode(MessageEncode *msg)
 {
     LOG1("@%s: snapshot ID = %d", __FUNCTION__, msg->snapshotBuf.id);
     status_t status = NO_ERROR;
-    AtomBuffer jpegBuf = AtomBufferFactory::createAtomBuffer(ATOM_BUFFER_SNAPSHOT_JPEG);
 
     if (msg->snapshotBuf.width == 0 ||
         msg->snapshotBuf.height == 0 ||
@@ -766,21 +839,35 @@ status_t PictureThread::handleMessageEncode(MessageEncode *msg)
 
     // Mirror snapshot and postview buffers if requested
     if (msg->metaData.saveMirrored) {
-        mirrorBuffer(&msg->snapshotBuf, msg->metaData.currentOrientation, msg->metaData.cameraOrientation);
+        mirrorBuffer(&msg->snapshotBuf, msg->metaData.currentOrientation, msg->metaData.cameraOrientation, true);
         if (postviewBuf)
-            mirrorBuffer(postviewBuf, msg->metaData.currentOrientation, msg->metaData.cameraOrientation);
+            mirrorBuffer(postviewBuf, msg->metaData.currentOrientation, msg->metaData.cameraOrientation, true);
     }
 
-    status = encodeToJpeg(&msg->snapshotBuf, postviewBuf, &jpegBuf, msg->dataHasBeenFlushed);
-    if (status != NO_ERROR) {
-        ALOGE("Error generating JPEG image!");
-        LOG1("Releasing jpegBuf @%p", jpegBuf.dataPtr);
-        MemoryUtils::freeAtomBuffer(jpegBuf);
-    }
+    EncodeJob *job = acquireJob();
+    job->snapshotBuf = msg->snapshotBuf;
+    job->postviewBuf = msg->postviewBuf;
+    job->dataHasBeenFlushed = msg->dataHasBeenFlushed;
+    job->width = mPictWidth;
+    job->height = mPictHeight;
+    job->quality = mPictureQuality;
+
+    // the main picture is encoded in the EncoderThread while the EXIF and
+    // thumbnail are done here, in a burst also those of the next pictures
+    if (mEncoderThread != NULL)
+        mEncoderThread->encode(job);
 
-    jpegBuf.frameCounter = msg->snapshotBuf.frameCounter;
+    // Convert and encode the thumbnail, if present and EXIF maker is initialized
+    if (mExifMaker->isInitialized() &&
+        allocateExifBuffer(job->exifBuf) == NO_ERROR) {
+        encodeExif(postviewBuf ? &job->postviewBuf : NULL, &job->exifBuf);
+    } else {
+        job->exifBuf.size = 0; // fails the encode
+    }
+    setExifDone(job);
 
-    mCallbacksThread->compressedFrameDone(&jpegBuf, &msg->snapshotBuf, &msg->postviewBuf);
+    if (mEncoderThread == NULL)
+        status = encodeJob(job);
 
     // ownership was transferred to us from ControlThread, so we need
     // to free resources here after encoding
@@ -799,7 +886,6 @@ status_t PictureThread::handleMessageAllocBufs(MessageAllocBufs *msg)
             v4l2Fmt2Str(msg->formatDesc.fourcc),
             msg->numBufs);
     status_t status = NO_ERROR;
-    size_t bufferSize = frameSize(msg->formatDesc.fourcc, msg->formatDesc.width, msg->formatDesc.height);
 
     /* check if re-allocation is needed */
     if( (mInputBufferArray != NULL) &&
@@ -812,26 +898,15 @@ status_t PictureThread::handleMessageAllocBufs(MessageAllocBufs *msg)
         goto skip;
     }
 
-    /* Free old buffers if already allocated */
-    if (bufferSize != (size_t) mOutBuf.size) {
-        MemoryUtils::freeAtomBuffer(mOutBuf);
-    }
-
-    /* Allocate Output buffer : JPEG and EXIF */
-    if (mOutBuf.dataPtr == NULL) {
-        mCallbacks->allocateMemory(&mOutBuf, bufferSize);
-    }
+    // the EncoderThread uses the output and input buffers
+    waitForJobs();
 
-    if (mOutBuf.dataPtr == NULL) {
-        ALOGE("Could not allocate memory for output buffers!");
-        status = NO_MEMORY;
-        goto exit_fail;
+    for (int i = 0; i < MAX_ENCODE_JOBS; i++) {
+        status = allocateExifBuffer(mJobs[i].exifBuf);
+        if (status != NO_ERROR)
+            goto exit_fail;
     }
 
-    status = allocateExifBuffer();
-    if (status != NO_ERROR)
-        goto exit_fail;
-
     /* re-allocates array of input buffers into mInputBufferArray */
     freeInputBuffers();
     status = allocateInputBuffers(msg->formatDesc, msg->numBufs, msg->registerToScaler);
@@ -1045,7 +1120,7 @@ void PictureThread::freePostviewBuffers()
 /**
  * \brief Allocates a buffer for EXIF information
  */
-status_t PictureThread::allocateExifBuffer()
+status_t PictureThread::allocateExifBuffer(AtomBuffer &exifBuf)
 {
     LOG1("@%s", __FUNCTION__);
 
@@ -1066,18 +1141,20 @@ status_t PictureThread::allocateExifBuffer()
     exifBufferSize += (EXIF_SIZE_LIMITATION - remainder);
     exifBufferSize += sizeof(JPEG_MARKER_SOI);
 
-    if (mExifBuf.dataPtr != NULL && exifBufferSize > mExifBuf.size) {
+    // exifBuf.size is the size of the last EXIF, compare with the capacity
+    if (exifBuf.dataPtr != NULL &&
+        (exifBuf.buff == NULL || (size_t) exifBufferSize > exifBuf.buff->size)) {
         LOG1("Reallocating EXIF buffer due to size requirement.");
-        MemoryUtils::freeAtomBuffer(mExifBuf); // Sets dataPtr to NULL
+        mCallbacks->releasePooledMemory(&exifBuf); // Sets dataPtr to NULL
     }
 
-    if (mExifBuf.dataPtr == NULL) {
-        mCallbacks->allocateMemory(&mExifBuf, exifBufferSize);
+    if (exifBuf.dataPtr == NULL) {
+        mCallbacks->allocatePooledMemory(&exifBuf, exifBufferSize);
     }
 
-    LOG1("Exif buffer: @%p (%d bytes)", mExifBuf.dataPtr, mExifBuf.size);
+    LOG1("Exif buffer: @%p (%d bytes)", exifBuf.dataPtr, exifBuf.size);
 
-    if (mExifBuf.dataPtr == NULL) {
+    if (exifBuf.dataPtr == NULL) {
         ALOGE("Could not allocate EXIF buffer");
         status = NO_MEMORY;
     }
@@ -1086,7 +1163,7 @@ status_t PictureThread::allocateExifBuffer()
 }
 
 /**
- * Encode Thumbnail picture into mOutBuf
+ * Encode Thumbnail picture into mThumbOutBuf
  *
  * It encodes the Exif data into buffer exifDst
  *
@@ -1098,11 +1175,15 @@ int PictureThread::encodeExifAndThumbnail(AtomBuffer *thumbBuf, unsigned char* e
     LOG1("@%s", __FUNCTION__);
     int size = 0;
     int exifSize = 0;
+    int thumbOutSize = 0;
     nsecs_t endTime;
     SWJpegEncoder swEncoder;
     SWJpegEncoder::InputBuffer inBuf;
     SWJpegEncoder::OutputBuffer outBuf;
 
+    inBuf.clear();
+    outBuf.clear();
+
     if (thumbBuf == NULL || exifDst == NULL)
         goto exit;
 
@@ -1121,14 +1202,28 @@ int PictureThread::encodeExifAndThumbnail(AtomBuffer *thumbBuf, unsigned char* e
     // setup the SWJpegEncoder input and output buffers
     inBuf.width = thumbBuf->width;
     inBuf.height = thumbBuf->height;
+    inBuf.bpl = thumbBuf->bpl;
     inBuf.fourcc = thumbBuf->fourcc;
     inBuf.size = frameSize(thumbBuf->fourcc, thumbBuf->width, thumbBuf->height);
 
-    outBuf.buf = (unsigned char*)mOutBuf.dataPtr;
+    // big enough to not overflow, an oversized thumbnail is retried with lower quality
+    thumbOutSize = MAX(thumbBuf->width * thumbBuf->height * 2, EXIF_SIZE_LIMITATION);
+    if (mThumbOutBuf.dataPtr != NULL && mThumbOutBuf.size < thumbOutSize)
+        mCallbacks->releasePooledMemory(&mThumbOutBuf);
+
+    if (mThumbOutBuf.dataPtr == NULL)
+        mCallbacks->allocatePooledMemory(&mThumbOutBuf, thumbOutSize);
+
+    if (mThumbOutBuf.dataPtr == NULL) {
+        ALOGE("Could not allocate memory for thumbnail JPEG!");
+        goto exit;
+    }
+
+    outBuf.buf = (unsigned char*)mThumbOutBuf.dataPtr;
     outBuf.width = thumbBuf->width;
     outBuf.height = thumbBuf->height;
     outBuf.quality = mThumbnailQuality;
-    outBuf.size = mOutBuf.size;
+    outBuf.size = mThumbOutBuf.size;
 
     // Set Exif data
     if (!mExifMakerName.isEmpty())
@@ -1163,6 +1258,7 @@ status_t PictureThread::handleMessageWait()
 {
     LOG1("@%s", __FUNCTION__);
     status_t status = NO_ERROR;
+    waitForJobs();
     mMessageQueue.reply(MESSAGE_ID_WAIT, status);
     return status;
 }
@@ -1171,6 +1267,26 @@ status_t PictureThread::handleMessageFlush()
 {
     LOG1("@%s", __FUNCTION__);
     status_t status = NO_ERROR;
+
+    // give back the buffers of the pictures the EncoderThread has not started
+    // yet, their EXIF is done already. Then let it finish the current one.
+    if (mEncoderThread != NULL) {
+        Vector<EncodeJob*> jobs;
+        mEncoderThread->cancel(&jobs);
+        Vector<EncodeJob*>::iterator it;
+        for (it = jobs.begin(); it != jobs.end(); ++it) {
+            LOG1("@%s gives buffers back to owner", __FUNCTION__);
+            mPictureDoneCallback->pictureDone(&(*it)->snapshotBuf, &(*it)->postviewBuf);
+            releaseJob(*it);
+        }
+    }
+    waitForJobs();
+
+    // the capture is over, its multi-MB scratch buffers are not kept idle
+    mCallbacks->releasePooledMemory(&mOutBuf);
+    mCallbacks->releasePooledMemory(&mScaledPic);
+    mCallbacks->trimMemoryPool();
+
     // Now, flush the queued JPEG buffers from CallbacksThread
     status = mCallbacksThread->flushPictures();
     mMessageQueue.reply(MESSAGE_ID_FLUSH, status);
@@ -1270,7 +1386,15 @@ status_t PictureThread::requestExitAndWait()
     mMessageQueue.send(&msg);
 
     // propagate call to base class
-    return Thread::requestExitAndWait();
+    status_t status = Thread::requestExitAndWait();
+
+    // only now, the last queued pictures may still be handed to the EncoderThread
+    if (mEncoderThread != NULL) {
+        mEncoderThread->requestExitAndWait();
+        mEncoderThread.clear();
+    }
+
+    return status;
 }
 
 /**
@@ -1279,9 +1403,10 @@ status_t PictureThread::requestExitAndWait()
  * This may fail in that case we should failback to SW encoding
  *
  * \param mainBuf buffer containing the full resolution snapshot
+ * \param quality JPEG quality
  *
  */
-status_t PictureThread::startHwEncoding(AtomBuffer* mainBuf)
+status_t PictureThread::startHwEncoding(AtomBuffer* mainBuf, int quality)
 {
     JpegHwEncoder::InputBuffer inBuf;
     JpegHwEncoder::OutputBuffer outBuf;
@@ -1300,7 +1425,7 @@ status_t PictureThread::startHwEncoding(AtomBuffer* mainBuf)
     outBuf.clear();
     outBuf.width = mainBuf->width;
     outBuf.height = mainBuf->height;
-    outBuf.quality = mPictureQuality;
+    outBuf.quality = quality;
     endTime = systemTime();
     if (mHwCompressor &&
         mHwCompressor->encodeAsync(inBuf, outBuf, mMaxOutJpegBufSize) == 0) {
@@ -1314,18 +1439,19 @@ status_t PictureThread::startHwEncoding(AtomBuffer* mainBuf)
 }
 
 /**
- * Generates the EXIF header for the final JPEG into the mExifBuf
+ * Generates the EXIF header for the final JPEG into exifBuf
  *
  * This will be finally pre-appended to the main JPEG
  * In case a thumbnail frame is passed it will be scaled to fit the thumbnail
  * resolution required and then compressed to JPEG and added to the EXIF data
  *
- * If no thumbnail is passed only the exif information is stored in mExfBuf
+ * If no thumbnail is passed only the exif information is stored in exifBuf
  *
  * \param thumbBuf buffer storing the thumbnail image.
+ * \param exifBuf buffer where the EXIF is stored, its size is set to the EXIF size
  *
  */
-void PictureThread::encodeExif(AtomBuffer *thumbBuf)
+void PictureThread::encodeExif(AtomBuffer *thumbBuf, AtomBuffer *exifBuf)
 {
    LOG1("Encoding EXIF with thumb : %p", thumbBuf);
 
@@ -1335,8 +1461,7 @@ void PictureThread::encodeExif(AtomBuffer *thumbBuf)
         thumbBuf = &mThumbBuf;
     } else if (thumbBuf &&
         (mThumbBuf.width < thumbBuf->width ||
-         mThumbBuf.height < thumbBuf->height ||
-         mThumbBuf.width < thumbBuf->bpl)) {
+         mThumbBuf.height < thumbBuf->height)) {
         int srcHeighByThumbAspect = thumbBuf->width * mThumbBuf.height / mThumbBuf.width;
         mThumbBuf.fourcc = thumbBuf->fourcc;
         mThumbBuf.bpl = pixelsToBytes(mThumbBuf.fourcc, mThumbBuf.width);
@@ -1358,19 +1483,19 @@ void PictureThread::encodeExif(AtomBuffer *thumbBuf)
             int skipLines = (thumbBuf->height - srcHeighByThumbAspect) / 2;
             ALOGW("Thumbnail cropped to match requested aspect ratio");
             thumbBuf->height = srcHeighByThumbAspect;
-            ImageScaler::downScaleImage(thumbBuf, &mThumbBuf, skipLines, skipLines);
+            ImageScaler::downScaleImage(thumbBuf, &mThumbBuf, skipLines, skipLines, true);
         } else {
-            ImageScaler::downScaleImage(thumbBuf, &mThumbBuf);
+            ImageScaler::downScaleImage(thumbBuf, &mThumbBuf, 0, 0, true);
         }
         thumbBuf = &mThumbBuf;
     }
 
-    unsigned char* currentPtr = (unsigned char*)mExifBuf.dataPtr;
-    mExifBuf.size = 0;
+    unsigned char* currentPtr = (unsigned char*)exifBuf->dataPtr;
+    exifBuf->size = 0;
 
     // Copy the SOI marker
     memcpy(currentPtr, JPEG_MARKER_SOI, sizeof(JPEG_MARKER_SOI));
-    mExifBuf.size += sizeof(JPEG_MARKER_SOI);
+    exifBuf->size += sizeof(JPEG_MARKER_SOI);
     currentPtr += sizeof(JPEG_MARKER_SOI);
 
     // Set Exif data
@@ -1383,15 +1508,15 @@ void PictureThread::encodeExif(AtomBuffer *thumbBuf)
     if (!mExifSoftwareName.isEmpty())
         mExifMaker->setSoftware(mExifSoftwareName.string());
 
-    // Encode thumbnail as JPEG and exif into mExifBuf
+    // Encode thumbnail as JPEG and exif into exifBuf
     int tmpSize = encodeExifAndThumbnail(thumbBuf, currentPtr);
     if (tmpSize == 0) {
         // This is not critical, we can continue with main picture image
         ALOGI("Exif created without thumbnail stream!");
         tmpSize = mExifMaker->makeExif(&currentPtr);
     }
-    mExifBuf.size += tmpSize;
-    currentPtr += mExifBuf.size;
+    exifBuf->size += tmpSize;
+    currentPtr += exifBuf->size;
 }
 
 /**
@@ -1399,45 +1524,75 @@ void PictureThread::encodeExif(AtomBuffer *thumbBuf)
  *
  * This is used in the failback scenario in case the HW encoder fails
  *
+ * \param job the job of the picture, provides the EXIF and the quality
  * \param mainBuf the AtomBuffer with the full resolution snapshot
  * \param destBuf AtomBuffer where the final JPEG is stored
  *
  * This method allocates the memory for the final JPEG, that will be freed
  * in the CallbackThread once the jpeg has been given to the user.
  *
- * The final JPEG contains the EXIF header stored in mExifBuf plus the
- * JPEG bitstream for the full resolution snapshot
+ * The final JPEG contains the EXIF header stored in the job plus the
+ * JPEG bitstream for the full resolution snapshot. The picture is encoded
+ * into mOutBuf, sized from the rate estimate of the picture at the job
+ * quality, and, once its size is known, written straight into destBuf
+ * after a hole for the EXIF header. The SOI and APP0 markers of the encoded
+ * picture land at the end of the hole and are overwritten by the EXIF.
  */
-status_t PictureThread::doSwEncode(AtomBuffer *mainBuf, AtomBuffer* destBuf)
+status_t PictureThread::doSwEncode(EncodeJob *job, AtomBuffer *mainBuf, AtomBuffer* destBuf)
 {
     status_t status= NO_ERROR;
     nsecs_t endTime;
     SWJpegEncoder swEncoder;
     SWJpegEncoder::InputBuffer inBuf;
     SWJpegEncoder::OutputBuffer outBuf;
+    const int skipSize = sizeof(JPEG_MARKER_SOI) + SIZE_OF_APP0_MARKER;
     int finalSize = 0;
+    int bufferSize;
 
     PERFORMANCE_TRACES_BREAKDOWN_STEP_PARAM("In",mainBuf->frameCounter);
     inBuf.clear();
 
-    int realWidth = (mainBuf->bpl > mainBuf->width)? mainBuf->bpl:
-                                                       mainBuf->width;
     inBuf.buf = (unsigned char *) mainBuf->dataPtr;
-    inBuf.width = realWidth;
+    inBuf.width = mainBuf->width;
     inBuf.height = mainBuf->height;
+    inBuf.bpl = mainBuf->bpl;
     inBuf.fourcc = mainBuf->fourcc;
     inBuf.size = frameSize(mainBuf->fourcc, mainBuf->width, mainBuf->height);
+
+    // a jpeg bigger than the estimate spills to the heap, it is not encoded twice
+    bufferSize = swEncoder.estimateSize(inBuf, job->quality);
+    if (bufferSize < 0)
+        bufferSize = mainBuf->width * mainBuf->height * 2;
+    if (mOutBuf.dataPtr != NULL && bufferSize > mOutBuf.size) {
+        mCallbacks->releasePooledMemory(&mOutBuf);
+    }
+
+    if (mOutBuf.dataPtr == NULL) {
+        mCallbacks->allocatePooledMemory(&mOutBuf, bufferSize);
+    }
+
+    if (mOutBuf.dataPtr == NULL) {
+        ALOGE("Could not allocate memory for temp buffer!");
+        return NO_MEMORY;
+    }
+    LOG1("Out buffer: @%p (%d bytes, %d estimated)", mOutBuf.dataPtr, mOutBuf.size, bufferSize);
+
     outBuf.clear();
     outBuf.buf = (unsigned char*)mOutBuf.dataPtr;
-    outBuf.width = realWidth;
+    outBuf.width = mainBuf->width;
     outBuf.height = mainBuf->height;
-    outBuf.quality = mPictureQuality;
+    outBuf.quality = job->quality;
     outBuf.size = mOutBuf.size;
     endTime = systemTime();
-    int mainSize = swEncoder.encode(inBuf, outBuf) - sizeof(JPEG_MARKER_SOI) - SIZE_OF_APP0_MARKER;
+    int mainSize = swEncoder.encodeToScratch(inBuf, outBuf) - skipSize;
     LOG1("Picture JPEG size: %d (time to encode: %ums)", mainSize, (unsigned)((systemTime() - endTime) / 1000000));
-    if (mainSize > 0) {
-        finalSize = mExifBuf.size + mainSize;
+
+    // the EXIF is generated by the PictureThread meanwhile
+    waitForExif(job);
+    AtomBuffer *exifBuf = &job->exifBuf;
+
+    if (mainSize > 0 && exifBuf->size >= skipSize) {
+        finalSize = exifBuf->size + mainSize;
     } else {
         ALOGE("Could not encode picture stream!");
         status = UNKNOWN_ERROR;
@@ -1452,14 +1607,17 @@ status_t PictureThread::doSwEncode(AtomBuffer *mainBuf, AtomBuffer* destBuf)
     }
     if (status == NO_ERROR) {
         destBuf->size = finalSize;
-        // Copy EXIF (it will also have the SOI markers)
-        memcpy(destBuf->dataPtr, mExifBuf.dataPtr, mExifBuf.size);
-        // Copy the final /
-        // JPEG stream into the final destination buffer
-        // avoid the copying the SOI and APP0 but copy EOI marker
-        char *copyTo = (char*)destBuf->dataPtr + mExifBuf.size;
-        char *copyFrom = (char*)mOutBuf.dataPtr + sizeof(JPEG_MARKER_SOI) + SIZE_OF_APP0_MARKER;
-        memcpy(copyTo, copyFrom, mainSize);
+        // JPEG stream right after the EXIF hole, minus its SOI and APP0
+        unsigned char *jpegStart = (unsigned char*)destBuf->dataPtr + exifBuf->size - skipSize;
+        if (swEncoder.writeJpeg(jpegStart) < 0) {
+            ALOGE("Could not write picture stream!");
+            MemoryUtils::freeAtomBuffer(*destBuf);
+            status = UNKNOWN_ERROR;
+        }
+    }
+    if (status == NO_ERROR) {
+        // Fill the hole with EXIF (it will also have the SOI markers)
+        memcpy(destBuf->dataPtr, exifBuf->dataPtr, exifBuf->size);
 
         destBuf->id = mainBuf->id;
     }
@@ -1471,18 +1629,20 @@ status_t PictureThread::doSwEncode(AtomBuffer *mainBuf, AtomBuffer* destBuf)
  * Waits for the HW encode to complete the JPEG encoding and completes the final
  * JPEG with the EXIF header
  *
+ * \param job input, provides the EXIF
  * \param mainBuf input, full resolution snapshot
  * \param destBuf output, jpeg encoded buffer
  *
  * The memory for the encoded jpeg will be allocated in this meethod. It will be
  * freed by the CallbackThread once the JPEG has been delivered to the client
  */
-status_t PictureThread::completeHwEncode(AtomBuffer *mainBuf, AtomBuffer *destBuf)
+status_t PictureThread::completeHwEncode(EncodeJob *job, AtomBuffer *mainBuf, AtomBuffer *destBuf)
 {
     status_t status= NO_ERROR;
     unsigned int mainSize = 0;
     int finalSize = 0;
     unsigned char* dstPtr = NULL;
+    AtomBuffer *exifBuf = &job->exifBuf;
 
     //get JPEG size
     if (mHwCompressor->getOutputSize(mainSize) < 0) {
@@ -1490,7 +1650,14 @@ status_t PictureThread::completeHwEncode(AtomBuffer *mainBuf, AtomBuffer *destBu
         return UNKNOWN_ERROR;
     }
 
-    finalSize = mExifBuf.size + mainSize - sizeof(JPEG_MARKER_SOI);
+    // the EXIF is generated by the PictureThread while the HW encodes
+    waitForExif(job);
+    if (exifBuf->size < (int) sizeof(JPEG_MARKER_SOI)) {
+        ALOGE("No EXIF for the picture!");
+        return UNKNOWN_ERROR;
+    }
+
+    finalSize = exifBuf->size + mainSize - sizeof(JPEG_MARKER_SOI);
     //allocate JPEG buffer base on the actual coded JPEG size
     mCallbacks->allocateMemory(destBuf, finalSize);
     if (destBuf->dataPtr == NULL) {
@@ -1503,13 +1670,13 @@ status_t PictureThread::completeHwEncode(AtomBuffer *mainBuf, AtomBuffer *destBu
         /*Since the jpeg got from libmix JPEG encoder start with SOI marker, and EXIF also have the SOI marker
          *so need to remove SOI marker fom jpeg data
          */
-        dstPtr = (unsigned char*)destBuf->dataPtr + mExifBuf.size - sizeof(JPEG_MARKER_SOI);
+        dstPtr = (unsigned char*)destBuf->dataPtr + exifBuf->size - sizeof(JPEG_MARKER_SOI);
         if (mHwCompressor->getOutput(dstPtr, mainSize) < 0) {
             ALOGE("Could not encode picture stream!");
             status = UNKNOWN_ERROR;
         } else {
             //Copy EXIF (it will also have the SOI marker)
-            memcpy(destBuf->dataPtr, mExifBuf.dataPtr, mExifBuf.size);
+            memcpy(destBuf->dataPtr, exifBuf->dataPtr, exifBuf->size);
 
             char *copyTo = (char*)destBuf->dataPtr + finalSize - sizeof(JPEG_MARKER_EOI);
             memcpy(copyTo, (void*)JPEG_MARKER_EOI, sizeof(JPEG_MARKER_EOI));
@@ -1520,36 +1687,43 @@ status_t PictureThread::completeHwEncode(AtomBuffer *mainBuf, AtomBuffer *destBu
 }
 
 /**
- * Scales the main picture to the resolution setup to the mScaledPic buffer
- * in case both resolutions are the same no scaling is done
- * mScaledPic resolution is setup during initialize()
- * The scled image is stored in the local buffer mScaledPic
+ * Scales the main picture to the resolution requested by the client into the
+ * mScaledPic buffer, in case the snapshot is bigger. Otherwise no scaling is done.
+ * The scaled image is stored in the local buffer mScaledPic
  *
  * \param  mainBuf snapshot buffer to be scaled
+ * \param  width, height picture size requested by the client
  *
  * \return NO_ERROR in case the scale was done and successful
  * \return INVALID_OPERATION in case there was no need to scale
  * \return NO_MEMORY in case it could not allocate the scaled buffer.
  *
  */
-status_t PictureThread::scaleMainPic(AtomBuffer *mainBuf)
+status_t PictureThread::scaleMainPic(AtomBuffer *mainBuf, int width, int height)
 {
     LOG1("%s",__FUNCTION__);
     status_t status = NO_ERROR;
 
-    if ((mainBuf->width > mScaledPic.width) ||
-        (mainBuf->height > mScaledPic.height) ||
-        (mainBuf->bpl > mScaledPic.width)) {
-        LOG1("Need to scale or trim from (%dx%d) s(%d)--> (%d,%d) s(%d)",mainBuf->width, mainBuf->height,mainBuf->bpl,
-                                                      mScaledPic.width, mScaledPic.height, mScaledPic.bpl);
+    // padded lines are fine, both encoders take the bpl
+    if ((mainBuf->width > width) ||
+        (mainBuf->height > height)) {
+        mCallbacks->releasePooledMemory(&mScaledPic);
 
-        MemoryUtils::freeAtomBuffer(mScaledPic);
+        mScaledPic.width = width;
+        mScaledPic.height = height;
+        mScaledPic.bpl = width;
+        mScaledPic.size = frameSize(mScaledPic.fourcc, bytesToPixels(mScaledPic.fourcc, mScaledPic.bpl), mScaledPic.height);
 
-        mCallbacks->allocateMemory(&mScaledPic, mScaledPic.size);
-        if (mScaledPic.dataPtr == NULL)
+        LOG1("Need to scale from (%dx%d) s(%d)--> (%d,%d) s(%d)",mainBuf->width, mainBuf->height,mainBuf->bpl,
+                                                      mScaledPic.width, mScaledPic.height, mScaledPic.bpl);
+
+        mCallbacks->allocatePooledMemory(&mScaledPic, mScaledPic.size);
+        if (mScaledPic.dataPtr == NULL) {
+            status = NO_MEMORY;
             goto exit;
+        }
 
-        ImageScaler::downScaleImage(mainBuf, &mScaledPic);
+        ImageScaler::downScaleImage(mainBuf, &mScaledPic, 0, 0, true);
     } else {
         LOG1("No need to scale");
         status = INVALID_OPERATION;
@@ -1576,4 +1750,95 @@ void PictureThread::setExifSoftware(const String8& data)
     mExifSoftwareName = data;
 }
 
+PictureThread::EncoderThread::EncoderThread(PictureThread *pictureThread) :
+     Thread(false)
+    ,mMessageQueue("PictureEncoder", (int) MESSAGE_ID_MAX)
+    ,mThreadRunning(false)
+    ,mPictureThread(pictureThread)
+{
+    LOG1("@%s", __FUNCTION__);
+}
+
+bool PictureThread::EncoderThread::threadLoop()
+{
+    LOG2("@%s", __FUNCTION__);
+    mThreadRunning = true;
+    while(mThreadRunning)
+        waitForAndExecuteMessage();
+
+    return false;
+}
+
+status_t PictureThread::EncoderThread::requestExitAndWait()
+{
+    LOG1("@%s", __FUNCTION__);
+    Message msg;
+    msg.id = MESSAGE_ID_EXIT;
+
+    // tell thread to exit
+    // send message asynchronously
+    mMessageQueue.send(&msg);
+
+    // propagate call to base class
+    return Thread::requestExitAndWait();
+}
+
+status_t PictureThread::EncoderThread::encode(EncodeJob *job)
+{
+    LOG1("@%s", __FUNCTION__);
+    Message msg;
+    msg.id = MESSAGE_ID_ENCODE;
+    msg.data.encode.job = job;
+    return mMessageQueue.send(&msg);
+}
+
+void PictureThread::EncoderThread::cancel(Vector<EncodeJob*> *jobs)
+{
+    LOG1("@%s", __FUNCTION__);
+    Vector<Message> pending;
+    mMessageQueue.remove(MESSAGE_ID_ENCODE, &pending);
+
+    Vector<Message>::iterator it;
+    for (it = pending.begin(); it != pending.end(); ++it)
+        jobs->push(it->data.encode.job);
+}
+
+status_t PictureThread::EncoderThread::handleMessageEncode(MessageEncode &encode)
+{
+    LOG1("@%s", __FUNCTION__);
+    return mPictureThread->encodeJob(encode.job);
+}
+
+status_t PictureThread::EncoderThread::handleExit()
+{
+    LOG1("@%s", __FUNCTION__);
+    mThreadRunning = false;
+    return NO_ERROR;
+}
+
+status_t PictureThread::EncoderThread::waitForAndExecuteMessage()
+{
+    LOG2("@%s", __FUNCTION__);
+    status_t status = NO_ERROR;
+    Message msg;
+    mMessageQueue.receive(&msg);
+
+    switch (msg.id)
+    {
+        case MESSAGE_ID_ENCODE:
+            status = handleMessageEncode(msg.data.encode);
+            break;
+        case MESSAGE_ID_EXIT:
+            status = handleExit();
+            break;
+        default:
+            status = INVALID_OPERATION;
+            break;
+    }
+    if (status != NO_ERROR) {
+        ALOGE("operation failed, ID = %d, status = %d", msg.id, status);
+    }
+    return status;
+}
+
 } // namespace android
@@ -103,6 +103,80 @@ public:
 // private types
 private:
 
+    /**
+     * A picture in the encoding pipeline. The PictureThread generates the
+     * EXIF into exifBuf while the EncoderThread encodes the main picture.
+     */
+    struct EncodeJob {
+        AtomBuffer snapshotBuf;
+        AtomBuffer postviewBuf;
+        AtomBuffer exifBuf;
+        bool dataHasBeenFlushed;
+        int width;          /*!< picture size requested by the client */
+        int height;
+        int quality;
+        bool inUse;         /*!< protected by mJobLock */
+        bool exifDone;      /*!< protected by mJobLock */
+    };
+
+    /**
+     * Second stage of the encoding pipeline. Encodes the main picture of the
+     * queued jobs one at a time, joins them with their EXIF and delivers them
+     * in the order they were queued.
+     */
+    class EncoderThread : public Thread {
+    public:
+        EncoderThread(PictureThread *pictureThread);
+        ~EncoderThread() {};
+        status_t requestExitAndWait();
+        status_t encode(EncodeJob *job); // async
+        void cancel(Vector<EncodeJob*> *jobs); // removes the jobs not started yet
+
+    // prevent copy constructor and assignment operator
+    private:
+        EncoderThread(const EncoderThread& other);
+        EncoderThread& operator=(const EncoderThread& other);
+
+    private:
+        virtual bool threadLoop();
+        status_t waitForAndExecuteMessage();
+
+        enum MessageId {
+            MESSAGE_ID_EXIT = 0, // call requestExitAndWait
+            MESSAGE_ID_ENCODE,
+            MESSAGE_ID_MAX
+        };
+
+        struct MessageEncode {
+            EncodeJob *job;
+        };
+
+        // union of all message data
+        union MessageData {
+            // MESSAGE_ID_ENCODE
+            MessageEncode encode;
+        };
+
+        // message id and message data
+        struct Message {
+            MessageId id;
+            MessageData data;
+        };
+
+        status_t handleMessageEncode(MessageEncode &encode);
+        status_t handleExit();
+        MessageQueue<Message, MessageId> mMessageQueue;
+        bool mThreadRunning;
+        PictureThread *mPictureThread;
+    };
+
+    /**
+     * Pictures in the pipeline at most, i.e. snapshot buffers held by it.
+     * In a burst the EXIF and thumbnail of the next pictures are generated
+     * while the main picture of the first one is encoded.
+     */
+    static const int MAX_ENCODE_JOBS = 3;
+
     // thread message id's
     enum MessageId {
 
@@ -186,7 +260,15 @@ private:
     status_t waitForAndExecuteMessage();
 
     void setupExifWithMetaData(const MetaData &metaData);
-    status_t encodeToJpeg(AtomBuffer *mainBuf, AtomBuffer *thumbBuf, AtomBuffer *destBuf, bool dataHasBeenFlushed);
+    status_t encodeToJpeg(EncodeJob *job, AtomBuffer *destBuf);
+
+    // encoding pipeline
+    EncodeJob *acquireJob();
+    void     releaseJob(EncodeJob *job);
+    void     setExifDone(EncodeJob *job);
+    void     waitForExif(EncodeJob *job);
+    void     waitForJobs();
+    status_t encodeJob(EncodeJob *job);
 
     status_t allocateInputBuffers(AtomBuffer& formatDescriptor, int numBufs, bool registerToScaler);
     void     freeInputBuffers();
@@ -194,16 +276,16 @@ private:
     status_t allocatePostviewBuffers(const AtomBuffer& formatDescriptor, int numBufs, bool registerToScaler);
     void freePostviewBuffers();
 
-    status_t allocateExifBuffer();
+    status_t allocateExifBuffer(AtomBuffer &exifBuf);
 
     void unregisterFromGpuScalerAndFree(AtomBuffer bufferArray[], int numBuffs);
 
     int      encodeExifAndThumbnail(AtomBuffer *thumbnail, unsigned char* exifDst);
-    status_t startHwEncoding(AtomBuffer *mainBuf);
-    status_t completeHwEncode(AtomBuffer *mainBuf, AtomBuffer *destBuf);
-    void     encodeExif(AtomBuffer *thumBuf);
-    status_t doSwEncode(AtomBuffer *mainBuf, AtomBuffer* destBuf);
-    status_t scaleMainPic(AtomBuffer *mainBuf);
+    status_t startHwEncoding(AtomBuffer *mainBuf, int quality);
+    status_t completeHwEncode(EncodeJob *job, AtomBuffer *mainBuf, AtomBuffer *destBuf);
+    void     encodeExif(AtomBuffer *thumBuf, AtomBuffer *exifBuf);
+    status_t doSwEncode(EncodeJob *job, AtomBuffer *mainBuf, AtomBuffer* destBuf);
+    status_t scaleMainPic(AtomBuffer *mainBuf, int width, int height);
 
     uint32_t getJpegDataSize(const void* framePtr) const;
     void setupExifWithNv12Meta(AtomBuffer *mainBuf);
@@ -222,12 +304,15 @@ private:
     sp<CallbacksThread> mCallbacksThread;
     JpegHwEncoder   *mHwCompressor;
     EXIFMaker       *mExifMaker;
-    AtomBuffer      mExifBuf;
-    AtomBuffer      mOutBuf;
+    AtomBuffer      mExifBuf;     /*!< EXIF of the JPEGs assembled from ISP captures */
+    AtomBuffer      mOutBuf;      /*!< Scratch of the SW main picture encode, sized from its rate estimate */
+    AtomBuffer      mThumbOutBuf; /*!< Encoded thumbnail, separate from mOutBuf so the
+                                       thumbnail can be encoded during the main picture */
     AtomBuffer      mThumbBuf;
     AtomBuffer      mScaledPic; /*!< Temporary local buffer where we scale the main
                                      picture (snapshot) in case is of a different
-                                     resolution than the image requested by the client */
+                                     resolution than the image requested by the client.
+                                     Used by the EncoderThread */
     AtomBuffer      mFirstPartBuf;
 
     List<AtomBuffer> mCapturePostViewBufList;
@@ -268,6 +353,11 @@ private:
     int mCameraId;
 
     atomisp_makernote_info mMakerInfo;
+
+    sp<EncoderThread> mEncoderThread;
+    EncodeJob       mJobs[MAX_ENCODE_JOBS];
+    Mutex           mJobLock;       // protects the state of mJobs
+    Condition       mJobCondition;  // signaled when a job is released or its EXIF is done
 }; // class PictureThread
 
 }; // namespace android
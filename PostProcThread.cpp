@@ -62,6 +62,19 @@ PostProcThread::PostProcThread(ICallbackPostProc *postProcDone, PanoramaThread *
     mSmartShutter.captureForced = false;
     mSmartShutter.smileThreshold = SMILE_THRESHOLD;
     mSmartShutter.blinkThreshold = BLINK_THRESHOLD;
+
+    // face detection may take longer than a frame, only the latest frame is
+    // kept queued and the queries and settings do not wait behind it
+    mMessageQueue.setMaxDepth(MESSAGE_ID_FRAME, 1, dropFrame);
+    mMessageQueue.setPriority(MESSAGE_ID_STOP_FACE_DETECTION);
+    mMessageQueue.setPriority(MESSAGE_ID_IS_SMILE_RUNNING);
+    mMessageQueue.setPriority(MESSAGE_ID_GET_SMILE_THRESHOLD);
+    mMessageQueue.setPriority(MESSAGE_ID_IS_BLINK_RUNNING);
+    mMessageQueue.setPriority(MESSAGE_ID_GET_BLINK_THRESHOLD);
+    mMessageQueue.setPriority(MESSAGE_ID_IS_SMART_CAPTURE_TRIGGERED);
+    mMessageQueue.setPriority(MESSAGE_ID_IS_FACE_RECOGNITION_RUNNING);
+    mMessageQueue.setPriority(MESSAGE_ID_SET_ZOOM);
+    mMessageQueue.setPriority(MESSAGE_ID_SET_ROTATION);
 }
 
 PostProcThread::~PostProcThread()
@@ -580,13 +593,7 @@ int PostProcThread::sendFrame(AtomBuffer *img)
 
     // Face detection/recognition and panorama overlap detection may take long time, which
     // slows down the preview because the buffers are not returned until they are processed.
-    // Allow post-processing only when the queue is empty. Otherwise the frame will be skipped,
-    // and ControlThread returns the buffer back to ISP.
-    if (!mMessageQueue.isEmpty()) {
-        LOG1("@%s: skipping frame", __FUNCTION__);
-        return -1;
-    }
-
+    // A frame still queued is replaced by this one and returned to its owner, see dropFrame().
     if (img != NULL) {
         msg.data.frame.img = *img;
     } else {
@@ -872,6 +879,18 @@ status_t PostProcThread::handleFrame(MessageFrame frame)
     return status;
 }
 
+/**
+ * called by the message queue on the sending thread when a newer frame
+ * replaces one that was not processed yet
+ */
+void PostProcThread::dropFrame(void *context, Message *msg)
+{
+    LOG1("@%s: skipping frame", __FUNCTION__);
+    if (msg->data.frame.img.owner != 0) {
+        msg->data.frame.img.owner->returnBuffer(&msg->data.frame.img);
+    }
+}
+
 status_t PostProcThread::handleExtIspFaceDetection(AtomBuffer *auxBuf)
 {
     if (auxBuf == NULL) {
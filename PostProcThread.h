@@ -22,7 +22,7 @@
 #include <camera/CameraParameters.h>
 #include "IntelParameters.h"
 #include "FaceDetector.h"
-#include "MessageQueue.h"
+#include "RingMessageQueue.h"
 #include "IFaceDetector.h"
 #include "PanoramaThread.h"
 #include "ICallbackPreview.h"
@@ -227,6 +227,7 @@ private:
     status_t handleMessageSetAutoLowLight(MessageConfig &msg);
 
     status_t handleExtIspFaceDetection(AtomBuffer *auxBuf);
+    static void dropFrame(void *context, Message *msg);
 
     // main message function
     status_t waitForAndExecuteMessage();
@@ -235,7 +236,7 @@ private:
 private:
     FaceDetector* mFaceDetector;
     PanoramaThread *mPanoramaThread;
-    MessageQueue<Message, MessageId> mMessageQueue;
+    RingMessageQueue<Message, MessageId> mMessageQueue;
     int mLastReportedNumberOfFaces;
     Callbacks *mCallbacks;
     ICallbackPostProc* mPostProcDoneCallback;
@@ -51,6 +51,7 @@ PreviewThread::PreviewThread(sp<CallbacksThread> callbacksThread, Callbacks* cal
     ,mState(STATE_STOPPED)
     ,mLastFrameTs(0)
     ,mFramesDone(0)
+    ,mFramesDropped(0)
     ,mCallbacksThread(callbacksThread)
     ,mHALVS(NULL)
     ,mPreviewWindow(NULL)
@@ -71,6 +72,7 @@ PreviewThread::PreviewThread(sp<CallbacksThread> callbacksThread, Callbacks* cal
     ,mPreviewBpl(0)
     ,mPreviewFourcc(PlatformData::getPreviewPixelFormat(cameraId))
     ,mPreviewCbFormat(V4L2_PIX_FMT_NV21)
+    ,mPreviewCbMatrix(COLOR_MATRIX_BT601_FULL)
     ,mGfxBpl(640)
     ,mOverlayEnabled(false)
     ,mRotation(0)
@@ -86,6 +88,13 @@ PreviewThread::PreviewThread(sp<CallbacksThread> callbacksThread, Callbacks* cal
     LOG1("@%s", __FUNCTION__);
     mPreviewBuffers.setCapacity(MAX_NUMBER_PREVIEW_GFX_BUFFERS);
     CLEAR(mErrorCounter);
+
+    // keep only the latest preview frame queued, see handleSetPreviewConfig(),
+    // and do not let queries wait behind it
+    mMessageQueue.setMaxDepth(MESSAGE_ID_PREVIEW, 1, dropPreviewFrame, this);
+    mMessageQueue.setPriority(MESSAGE_ID_WINDOW_QUERY);
+    mMessageQueue.setPriority(MESSAGE_ID_FETCH_BUF_GEOMETRY);
+    mMessageQueue.setPriority(MESSAGE_ID_FPS);
 }
 
 PreviewThread::~PreviewThread()
@@ -294,8 +303,9 @@ void PreviewThread::getDefaultParameters(CameraParameters *params, int cameraId)
                  CameraParameters::PIXEL_FORMAT_YUV420SP, CameraParameters::PIXEL_FORMAT_YUV420P,
                  CameraParameters::PIXEL_FORMAT_YUV422I);
     else
-        ret = snprintf(previewFormats, sizeof(previewFormats), "%s,%s",
-                 CameraParameters::PIXEL_FORMAT_YUV420SP, CameraParameters::PIXEL_FORMAT_YUV420P);
+        ret = snprintf(previewFormats, sizeof(previewFormats), "%s,%s,%s",
+                 CameraParameters::PIXEL_FORMAT_YUV420SP, CameraParameters::PIXEL_FORMAT_YUV420P,
+                 CameraParameters::PIXEL_FORMAT_RGB565);
     if (ret < 0) {
         ALOGE("Could not generate %s string: %s", CameraParameters::KEY_SUPPORTED_PREVIEW_FORMATS, strerror(errno));
         return;
@@ -331,9 +341,11 @@ status_t PreviewThread::setPreviewWindow(struct preview_stream_ops *window)
  * \param preview_cb_format preview callback buffer format (fourcc)
  * \param shared_mode       allocate buffers for shared mode (0-copy)
  * \param buffer_count      amount of buffers to allocate
+ * \param cb_matrix         YUV->RGB matrix of the stream, for RGB callbacks
  */
 status_t PreviewThread::setPreviewConfig(int preview_width, int preview_height,
-                                         int preview_cb_format, bool shared_mode, bool vs_video, int buffer_count)
+                                         int preview_cb_format, bool shared_mode, bool vs_video, int buffer_count,
+                                         ColorMatrix cb_matrix)
 {
     LOG1("@%s", __FUNCTION__);
 
@@ -349,6 +361,7 @@ status_t PreviewThread::setPreviewConfig(int preview_width, int preview_height,
     msg.data.setPreviewConfig.bufferCount = buffer_count;
     msg.data.setPreviewConfig.sharedMode = shared_mode;
     msg.data.setPreviewConfig.halVSVideo = vs_video;
+    msg.data.setPreviewConfig.cbMatrix = cb_matrix;
     setState(STATE_CONFIGURED);
     return mMessageQueue.send(&msg);
 }
@@ -461,6 +474,9 @@ bool PreviewThread::atomIspNotify(IAtomIspObserver::Message *msg, const Observer
         // after pausing, we no longer receive new frames for the same session.
         // Reset frame counter based on any observer state change
         mFramesDone = 0;
+        int32_t dropped = android_atomic_and(0, &mFramesDropped);
+        if (dropped > 0)
+            LOG1("%d preview frames replaced by newer ones before rendering", dropped);
         return false;
     }
 
@@ -644,6 +660,27 @@ void PreviewThread::frameDone(AtomBuffer &buff)
     mFramesDone++;
 }
 
+/**
+ * called by the message queue on the observer thread when a newer preview
+ * frame replaces one that was not displayed yet
+ *
+ * The frame goes straight back to its owner: it is not rendered, not
+ * counted as a displayed frame and not given to the preview callbacks.
+ * It is only counted as dropped, see DebugFrameRate and atomIspNotify().
+ */
+void PreviewThread::dropPreviewFrame(void *context, Message *msg)
+{
+    PreviewThread *thread = static_cast<PreviewThread *>(context);
+    AtomBuffer *buff = &msg->data.preview.buff;
+    LOG2("@%s: frame %d", __FUNCTION__, buff->frameCounter);
+    PerformanceTraces::FrameTrace::event(__FUNCTION__, buff->frameCounter,
+                                         buff->frameSequenceNbr);
+    android_atomic_inc(&thread->mFramesDropped);
+    thread->mDebugFPS->drop();
+    if (buff->owner)
+        buff->owner->returnBuffer(buff);
+}
+
 void PreviewThread::setCallbackMode(CallbackMode mode)
 {
     LOG1("@%s", __FUNCTION__);
@@ -844,6 +881,11 @@ void PreviewThread::allocateLocalPreviewBuf(void)
         size = bpl * mPreviewBuf.height;
         break;
 
+    case V4L2_PIX_FMT_RGB32:
+        bpl  = mPreviewBuf.width * 4;
+        size = bpl * mPreviewBuf.height;
+        break;
+
     default:
         ALOGE("invalid preview format: %d", mPreviewCbFormat);
         break;
@@ -1213,7 +1255,16 @@ status_t PreviewThread::handlePreviewCallback(AtomBuffer &srcBuff)
     if (callbacksEnabled() || mPreviewCallbackMode == PREVIEW_CALLBACK_BEFORE_DISPLAY) {
         void *src = srcBuff.dataPtr;
         int src_bpl = srcBuff.bpl;
-        if (mTransferingBuffer) {
+        bool converted = false;
+        if (mTransferingBuffer && !PlatformData::getIntelligentMode(mCameraId)) {
+            // scale straight into the callback format when the kernel supports it
+            converted = ImageScaler::scaleAndConvertImage(src, mPreviewBuf.dataPtr,
+                    mPreviewBuf.width, mPreviewBuf.height, mPreviewBuf.bpl, mPreviewCbFormat,
+                    mPreviewWidth, mPreviewHeight, src_bpl, mPreviewFourcc, true,
+                    mPreviewCbMatrix);
+        }
+
+        if (mTransferingBuffer && !converted) {
             int transfer_bpl = pixelsToBytes(mPreviewFourcc, mPreviewBuf.width);
             // scale to transfering buffer if requested preview size is not equal to actual preview size
             ImageScaler::downScaleImage(src, mTransferingBuffer,
@@ -1224,7 +1275,9 @@ status_t PreviewThread::handlePreviewCallback(AtomBuffer &srcBuff)
             src_bpl = transfer_bpl;
         }
 
-        if (PlatformData::getIntelligentMode(mCameraId)) {
+        if (converted) {
+            status = NO_ERROR;
+        } else if (PlatformData::getIntelligentMode(mCameraId)) {
             char *pDst = (char *)mPreviewBuf.dataPtr;
             char *pSrc = (char *)src;
             for (int i = 0; i < mPreviewBuf.height; ++i)
@@ -1257,8 +1310,12 @@ status_t PreviewThread::handlePreviewCallback(AtomBuffer &srcBuff)
             }
             break;
         case V4L2_PIX_FMT_RGB565:
-            if (mPreviewFourcc == V4L2_PIX_FMT_NV12)
-                trimConvertNV12ToRGB565(mPreviewBuf.width, mPreviewBuf.height, src_bpl, src, mPreviewBuf.dataPtr);
+        case V4L2_PIX_FMT_RGB32:
+            if (mPreviewFourcc == V4L2_PIX_FMT_NV12 || mPreviewFourcc == V4L2_PIX_FMT_NV21)
+                status = convertNV12ToRGB(mPreviewFourcc, mPreviewCbFormat,
+                                          mPreviewBuf.width, mPreviewBuf.height, src_bpl,
+                                          mPreviewBuf.bpl, src, mPreviewBuf.dataPtr,
+                                          mPreviewCbMatrix, true);
             //TBD for other preview format, not supported yet
             break;
         default:
@@ -1294,6 +1351,9 @@ status_t PreviewThread::handlePreviewCallback(AtomBuffer &srcBuff)
             } else
                 srcBuff.returnAfterCB = false;
 
+            // the local copy carries the frame identity for the traces
+            mPreviewBuf.frameCounter = srcBuff.frameCounter;
+            mPreviewBuf.frameSequenceNbr = srcBuff.frameSequenceNbr;
             mCallbacksThread->previewFrameDone(callbackBuffer);
             mPreviewCbTs = systemTime();
         }
@@ -1429,6 +1489,7 @@ status_t PreviewThread::handlePreview(MessagePreview *msg)
 {
     LOG2("@%s: id = %d, width = %d, height = %d, fourcc = %s, bpl = %d", __FUNCTION__,
             msg->buff.id, msg->buff.width, msg->buff.height, v4l2Fmt2Str(msg->buff.fourcc), msg->buff.bpl);
+    PERFORMANCE_TRACES_FRAME_STAGE(msg->buff.frameCounter, msg->buff.frameSequenceNbr);
 
     if (PlatformData::getMaxDepthPreviewBufferQueueSize(mCameraId) > 0)
         return handlePreviewBufferQueue(&msg->buff);
@@ -1606,6 +1667,13 @@ status_t PreviewThread::handleSetPreviewConfig(MessageSetPreviewConfig *msg)
     if (mHALVideoStabilization && mHALVS == NULL)
         mHALVS = new HALVideoStabilization();
 
+    // preview frames may be skipped under load, unless they also feed video
+    // or are held for capture in the preview buffer queue
+    if (mHALVideoStabilization || PlatformData::getMaxDepthPreviewBufferQueueSize(mCameraId) > 0)
+        mMessageQueue.setMaxDepth(MESSAGE_ID_PREVIEW, 0, dropPreviewFrame, this);
+    else
+        mMessageQueue.setMaxDepth(MESSAGE_ID_PREVIEW, 1, dropPreviewFrame, this);
+
     mSharedMode = msg->sharedMode;
 
     if ((w != 0 && h != 0)) {
@@ -1661,7 +1729,7 @@ status_t PreviewThread::handleSetPreviewConfig(MessageSetPreviewConfig *msg)
         mPreviewWidth = msg->width;
         mPreviewHeight = msg->height;
         // If the preview needs to be rotated, let AtomISP decide the bpl
-        // since nv12rotateBy90() supports arbitrary line-badding.
+        // since the nv12rotation functions support arbitrary line-padding.
         // Otherwise use the bpl of buffers dequeued from the preview window.
         if (mRotation == 90 || mRotation == 270 || mPreviewWindow == NULL)
             mPreviewBpl = 0;
@@ -1670,8 +1738,10 @@ status_t PreviewThread::handleSetPreviewConfig(MessageSetPreviewConfig *msg)
     }
 
     mPreviewCbFormat = msg->cb_format;
+    mPreviewCbMatrix = msg->cbMatrix;
 
-    LOG1("%s: preview callback format %s", __FUNCTION__, v4l2Fmt2Str(mPreviewCbFormat));
+    LOG1("%s: preview callback format %s, matrix %d", __FUNCTION__,
+         v4l2Fmt2Str(mPreviewCbFormat), mPreviewCbMatrix);
 
     // allocate local buffer used with preview callbacks
     allocateLocalPreviewBuf();
@@ -2152,9 +2222,13 @@ void PreviewThread::copyPreviewBuffer(AtomBuffer* src, AtomBuffer* dst)
                        (const char*)src->dataPtr,               // source image
                        (char *)dst->dataPtr);                 // target image
         break;
+    case 180:
+        nv12rotateBy180(src->width, src->height, src->bpl, dst->bpl,
+                        (const char*)src->dataPtr, (char *)dst->dataPtr);
+        break;
     case 270:
-        // TODO: Not handled, waiting for Semi
-        ALOGE("@%s: 270 case not handled", __FUNCTION__);
+        nv12rotateBy270(src->width, src->height, src->bpl, dst->bpl,
+                        (const char*)src->dataPtr, (char *)dst->dataPtr);
         break;
     case 0:
         memcpy((char *)dst->dataPtr, (const char*)src->dataPtr, dst->size);
@@ -21,7 +21,7 @@
 #include <utils/Vector.h>
 #include <camera.h>
 #include <camera/CameraParameters.h>
-#include "MessageQueue.h"
+#include "RingMessageQueue.h"
 #include "AtomCommon.h"
 #include "IAtomIspObserver.h"
 #include "HALVideoStabilization.h"
@@ -29,6 +29,7 @@
 #include "AtomISP.h"
 #include "DebugFrameRate.h"
 #include "ICallbackPreview.h"
+#include "ColorConverter.h"
 
 namespace android {
 
@@ -129,7 +130,8 @@ public:
     status_t setPreviewWindow(struct preview_stream_ops *window);
     status_t setPreviewConfig(int preview_width, int preview_height,
                               int preview_cb_format, bool shared_mode = true,
-                              bool video_mode = false, int buffer_count = -1);
+                              bool video_mode = false, int buffer_count = -1,
+                              ColorMatrix cb_matrix = COLOR_MATRIX_BT601_FULL);
     status_t fetchPreviewBuffers(Vector<AtomBuffer> &pvBufs);
     status_t fetchPreviewBufferGeometry(int *w, int *h, int *bpl);
     status_t returnPreviewBuffers();
@@ -230,6 +232,7 @@ private:
         int bufferCount;
         bool sharedMode;
         bool halVSVideo;
+        ColorMatrix cbMatrix;
     };
 
     struct MessageReturnBuffer {
@@ -333,6 +336,7 @@ private:
     void allocateLocalPreviewBuf(void);
     bool checkSkipFrame(int frameNum);
     void frameDone(AtomBuffer &buff);
+    static void dropPreviewFrame(void *context, Message *msg);
     status_t allocateGfxPreviewBuffers(int numberOfBuffers);
     status_t freeGfxPreviewBuffers();
     int getGfxBufferBytesPerLine();
@@ -357,7 +361,7 @@ private:
 
 // private data
 private:
-    MessageQueue<Message, MessageId> mMessageQueue;
+    RingMessageQueue<Message, MessageId> mMessageQueue;
     bool mThreadRunning;
     PreviewState mState;
     mutable Mutex mStateMutex;
@@ -367,6 +371,7 @@ private:
     CallbackVector mOutputBufferCb;
     nsecs_t         mLastFrameTs;
     unsigned int    mFramesDone;
+    volatile int32_t mFramesDropped;    // replaced before rendering, see dropPreviewFrame()
     sp<CallbacksThread> mCallbacksThread;
     sp<HALVideoStabilization> mHALVS;
 
@@ -393,6 +398,7 @@ private:
     int mPreviewBpl;
     int mPreviewFourcc; /*!< Native preview stream pixel format (PlatformData::getPreviewFormat()) */
     int mPreviewCbFormat; /*!< Preview callback pixel format (CameraParameters::KEY_PREVIEW_FORMAT) */
+    ColorMatrix mPreviewCbMatrix; /*!< YUV->RGB matrix for RGB preview callbacks */
     int mGfxBpl;        /*!< Gfx buffer bpl, due to hardware limitation Gfx
                           and ISP buffer bpl alignment may be mismatched. */
 
@@ -0,0 +1,623 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RING_MESSAGE_QUEUE
+#define RING_MESSAGE_QUEUE
+
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <cutils/atomic.h>
+#include "MessageQueue.h"
+
+namespace android {
+
+/**
+ * \class RingMessageQueue
+ *
+ * Drop-in replacement of MessageQueue for the threads that get a message
+ * per frame. The messages are stored in a ring of preallocated slots
+ * instead of a List, so a send() does not allocate nor take a lock:
+ *
+ * - Senders claim a slot by advancing the enqueue position with a CAS and
+ *   publish the message by setting the sequence number of the slot.
+ * - There is a single receiver, the thread owning the queue. It reads the
+ *   slots in order and parks on a futex when the ring is empty. Senders
+ *   only make the wake-up syscall when it is parked.
+ * - remove() may be called by any thread, it claims the slots it removes
+ *   with a CAS so it never races with the receiver.
+ *
+ * When the ring is full the messages go to an overflow List, under a mutex,
+ * until the receiver has drained it, so nothing is dropped and the order of
+ * the messages of a sender is kept. The capacity should be large enough to
+ * never need it. Synchronous messages work as with MessageQueue.
+ *
+ * Per message id policies keep a slow receiver from piling up frames:
+ *
+ * - setMaxDepth() bounds how many messages of an id may be queued. When a
+ *   send() goes over it, the oldest one is taken out and handed to the drop
+ *   handler, with the context given with it, on the sending thread, so its
+ *   buffer goes back to its owner.
+ *   A depth of 1 keeps only the latest frame.
+ * - setPriority() lets the messages of an id overtake the queued messages
+ *   that have a depth limit. They never overtake other messages, so the
+ *   order of the control messages between themselves is kept. Messages
+ *   that work as barriers for the frames before them, like a flush or an
+ *   exit, must not be given priority.
+ *
+ * The policies of the ids are added before the queue is used, the depth of
+ * an id may be changed at any time afterwards, 0 turns the limit off.
+ */
+template <class MessageType, class MessageId>
+class RingMessageQueue {
+
+    // constructor / destructor
+public:
+    RingMessageQueue(const char *name, // for debugging
+            int numReply = 0,          // set numReply only if you need synchronous messages
+            int capacity = DEFAULT_CAPACITY) :
+        mName(name)
+        ,mCapacity(roundUpPow2(capacity))
+        ,mSlots(new Slot[mCapacity])
+        ,mEnqueuePos(0)
+        ,mDequeuePos(0)
+        ,mCount(0)
+        ,mParked(0)
+        ,mPriorityCount(0)
+        ,mNumPolicies(0)
+        ,mOverflowCount(0)
+        ,mNumReply(numReply)
+        ,mReplyMutex(NULL)
+        ,mReplyCondition(NULL)
+        ,mReplyStatus(NULL)
+    {
+        for (int i = 0; i < mCapacity; i++) {
+            mSlots[i].seq = i;
+            mSlots[i].claim = CLAIM_NONE;
+        }
+
+        if (mNumReply > 0) {
+            mReplyMutex = new Mutex[numReply];
+            mReplyCondition = new Condition[numReply];
+            mReplyStatus = new status_t[numReply];
+        }
+    }
+
+    ~RingMessageQueue()
+    {
+        if (size() > 0) {
+            // The last message a thread should receive is EXIT.
+            // If for some reason a thread is sent a message after
+            // the thread has exited then there is a race condition
+            // or design issue.
+            ALOGE("Atom_MessageQueue error: %s queue should be empty. Find the bug.", mName);
+        }
+
+        delete [] mSlots;
+        mSlots = NULL;
+
+        if (mNumReply > 0) {
+            delete [] mReplyMutex;
+            mReplyMutex = NULL;
+            delete [] mReplyCondition;
+            mReplyCondition = NULL;
+            delete [] mReplyStatus;
+            mReplyStatus = NULL;
+        }
+    }
+
+    // public methods
+public:
+
+    // Push a message onto the queue. If replyId is not -1 function will block until
+    // the caller is signalled with a reply. Caller is unblocked when reply method is
+    // called with the corresponding message id.
+    status_t send(MessageType *msg, MessageId replyId = (MessageId) -1)
+    {
+        status_t status = NO_ERROR;
+
+        // someone is misusing the API. replies have not been enabled
+        if (replyId != -1 && mNumReply == 0) {
+            ALOGE("Atom_MessageQueue error: %s replies not enabled\n", mName);
+            return BAD_VALUE;
+        }
+
+        if (replyId != -1) {
+            mReplyMutex[replyId].lock();
+            mReplyStatus[replyId] = WOULD_BLOCK;
+            mReplyMutex[replyId].unlock();
+        }
+
+        // counted before it is published, so the count never goes negative.
+        // Full barrier, pairs with the one of the receiver going to sleep.
+        Policy *policy = findPolicy(msg->id);
+        count(policy);
+
+        // once a message went to the overflow list the following ones
+        // follow it there, until the receiver has drained it
+        int32_t pos;
+        if (android_atomic_acquire_load(&mOverflowCount) > 0 || !enqueue(msg, &pos)) {
+            pos = android_atomic_acquire_load(&mEnqueuePos);
+            pushOverflow(msg);
+        }
+
+        // only the messages sent before this one are dropped: the count may
+        // still include one the receiver is taking, this one must not be
+        // dropped in its place
+        const int32_t maxDepth = policy ? policy->maxDepth : 0;
+        if (maxDepth > 0) {
+            MessageType dropped;
+            while (android_atomic_acquire_load(&policy->queued) > maxDepth
+                   && takeOldest(msg->id, &dropped, pos)) {
+                ALOGV("Atom_MessageQueue: %s dropped message %d", mName, dropped.id);
+                if (policy->onDrop)
+                    policy->onDrop(policy->dropContext, &dropped);
+            }
+        }
+
+        if (android_atomic_acquire_load(&mParked) && android_atomic_and(0, &mParked))
+            syscall(__NR_futex, &mParked, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+
+        if (replyId >= 0 && status == NO_ERROR) {
+            mReplyMutex[replyId].lock();
+            while (mReplyStatus[replyId] == WOULD_BLOCK) {
+                mReplyCondition[replyId].wait(mReplyMutex[replyId]);
+                // wait() should never complete without a new status having
+                // been set, but for diagnostic purposes let's check it.
+                if (mReplyStatus[replyId] == WOULD_BLOCK) {
+                    ALOGE("Atom_MessageQueue - woke with WOULD_BLOCK\n");
+                }
+            }
+            status = mReplyStatus[replyId];
+            mReplyMutex[replyId].unlock();
+        }
+
+        return status;
+    }
+
+    status_t remove(MessageId id, Vector<MessageType> *vect = NULL)
+    {
+        status_t status = NO_ERROR;
+        if(isEmpty())
+            return status;
+
+        const int32_t end = android_atomic_acquire_load(&mEnqueuePos);
+        for (int32_t pos = android_atomic_acquire_load(&mDequeuePos);
+             seqDiff(pos, end) < 0; pos = seqNext(pos, 1)) {
+            Slot &slot = mSlots[pos & (mCapacity - 1)];
+
+            if (!claimSlot(pos))
+                continue;
+
+            if (slot.msg.id != id) {
+                android_atomic_release_store(CLAIM_NONE, &slot.claim);
+                continue;
+            }
+
+            if (vect) {
+                vect->push(slot.msg);
+            }
+            uncount(id);
+            android_atomic_release_store(CLAIM_REMOVED, &slot.claim);
+        }
+
+        if (android_atomic_acquire_load(&mOverflowCount) > 0) {
+            Mutex::Autolock lock(mOverflowMutex);
+            typename List<MessageType>::iterator it = mOverflow.begin();
+            while (it != mOverflow.end()) {
+                if (it->id == id) {
+                    if (vect) {
+                        vect->push(*it);
+                    }
+                    it = mOverflow.erase(it); // returns pointer to next item in list
+                    android_atomic_dec(&mOverflowCount);
+                    uncount(id);
+                } else {
+                    it++;
+                }
+            }
+        }
+
+        // unblock caller if waiting
+        if (mNumReply > 0) {
+            reply(id, INVALID_OPERATION);
+        }
+
+        return status;
+    }
+
+    // Pop a message from the queue, only the thread owning the queue may call it
+    status_t receive(MessageType *msg,
+            unsigned int timeout_ms = MESSAGE_QUEUE_RECEIVE_TIMEOUT_MSEC_INFINITE)
+    {
+        nsecs_t deadline = 0;
+
+        while (!(android_atomic_acquire_load(&mPriorityCount) > 0 && takePriority(msg))
+               && !dequeue(msg) && !popOverflow(msg)) {
+            if (android_atomic_acquire_load(&mCount) > 0) {
+                // a sender has counted its message but not published it yet
+                sched_yield();
+                continue;
+            }
+
+            // full barrier, a sender either sees mParked or we see mCount
+            android_atomic_or(1, &mParked);
+            if (android_atomic_acquire_load(&mCount) > 0) {
+                android_atomic_and(0, &mParked);
+                continue;
+            }
+
+            if (timeout_ms) {
+                // only read the clock when there is nothing to receive
+                if (deadline == 0)
+                    deadline = systemTime() + nsecs_t(timeout_ms) * 1000000LL;
+                const nsecs_t left = deadline - systemTime();
+                if (left <= 0) {
+                    android_atomic_and(0, &mParked);
+                    return TIMED_OUT;
+                }
+                struct timespec ts;
+                ts.tv_sec = left / 1000000000LL;
+                ts.tv_nsec = left % 1000000000LL;
+                syscall(__NR_futex, &mParked, FUTEX_WAIT_PRIVATE, 1, &ts, NULL, 0);
+            } else {
+                syscall(__NR_futex, &mParked, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+            }
+            android_atomic_and(0, &mParked);
+        }
+
+        return NO_ERROR;
+    }
+
+    // Unblock the caller of send and indicate the status of the received message
+    void reply(MessageId replyId, status_t status)
+    {
+        mReplyMutex[replyId].lock();
+        mReplyStatus[replyId] = status;
+        mReplyCondition[replyId].signal();
+        mReplyMutex[replyId].unlock();
+    }
+
+    void replyAll(MessageId replyId, status_t status)
+    {
+        mReplyMutex[replyId].lock();
+        mReplyStatus[replyId] = status;
+        mReplyCondition[replyId].signal(Condition::WAKE_UP_ALL);
+        mReplyMutex[replyId].unlock();
+    }
+
+    // Return true if the queue is empty
+    bool isEmpty() {
+        return size() == 0;
+    }
+
+    int size() {
+        return android_atomic_acquire_load(&mCount);
+    }
+
+    typedef void (*DropHandler)(void *context, MessageType *msg);
+
+    // Keep at most maxDepth messages of id queued, the older ones are
+    // passed to onDrop with context, on the thread sending the new one.
+    // 0 for no limit.
+    void setMaxDepth(MessageId id, int maxDepth, DropHandler onDrop, void *context = NULL)
+    {
+        Policy *policy = addPolicy(id);
+        if (policy) {
+            policy->onDrop = onDrop;
+            policy->dropContext = context;
+            android_atomic_release_store(maxDepth > 0 ? maxDepth : 0, &policy->maxDepth);
+        }
+    }
+
+    // Let the messages of id overtake the queued messages with a depth limit
+    void setPriority(MessageId id)
+    {
+        Policy *policy = addPolicy(id);
+        if (policy) {
+            policy->priority = true;
+        }
+    }
+
+    static const int DEFAULT_CAPACITY = 32;
+
+private:
+    static const int MAX_POLICIES = 16;
+
+    struct Policy {
+        MessageId id;
+        volatile int32_t maxDepth;  /*!< 0 when unbounded */
+        DropHandler onDrop;
+        void *dropContext;
+        bool priority;
+        volatile int32_t queued;    /*!< messages of the id in the queue */
+    };
+
+    enum {
+        CLAIM_NONE = 0,     /*!< published or free */
+        CLAIM_RECEIVING,    /*!< being received */
+        CLAIM_REMOVING,     /*!< being removed by remove() */
+        CLAIM_REMOVED       /*!< removed, the receiver skips it */
+    };
+
+    struct Slot {
+        volatile int32_t seq;   /*!< position + 1 once published, position + capacity once free again */
+        volatile int32_t claim;
+        MessageType msg;
+    };
+
+    // positions wrap around, they are compared by difference
+    static inline int32_t seqDiff(int32_t a, int32_t b) { return (int32_t)((uint32_t)a - (uint32_t)b); }
+    static inline int32_t seqNext(int32_t a, int n) { return (int32_t)((uint32_t)a + n); }
+
+    Policy *findPolicy(MessageId id)
+    {
+        for (int i = 0; i < mNumPolicies; i++) {
+            if (mPolicies[i].id == id)
+                return &mPolicies[i];
+        }
+        return NULL;
+    }
+
+    Policy *addPolicy(MessageId id)
+    {
+        Policy *policy = findPolicy(id);
+        if (policy)
+            return policy;
+
+        if (mNumPolicies == MAX_POLICIES) {
+            ALOGE("Atom_MessageQueue error: %s too many message policies", mName);
+            return NULL;
+        }
+        policy = &mPolicies[mNumPolicies++];
+        policy->id = id;
+        policy->maxDepth = 0;
+        policy->onDrop = NULL;
+        policy->dropContext = NULL;
+        policy->priority = false;
+        policy->queued = 0;
+        return policy;
+    }
+
+    void count(Policy *policy)
+    {
+        android_atomic_inc(&mCount);
+        if (policy) {
+            if (policy->priority)
+                android_atomic_inc(&mPriorityCount);
+            android_atomic_inc(&policy->queued);
+        }
+    }
+
+    void uncount(MessageId id)
+    {
+        Policy *policy = findPolicy(id);
+        if (policy) {
+            if (policy->priority)
+                android_atomic_dec(&mPriorityCount);
+            android_atomic_dec(&policy->queued);
+        }
+        android_atomic_dec(&mCount);
+    }
+
+    static int roundUpPow2(int n)
+    {
+        int pow2 = 1;
+        while (pow2 < n)
+            pow2 <<= 1;
+        return pow2;
+    }
+
+    // Copy the message to a free slot at *pos, false if the ring is full
+    bool enqueue(const MessageType *msg, int32_t *slotPos)
+    {
+        int32_t pos = android_atomic_acquire_load(&mEnqueuePos);
+
+        while (true) {
+            Slot &slot = mSlots[pos & (mCapacity - 1)];
+            const int32_t diff = seqDiff(android_atomic_acquire_load(&slot.seq), pos);
+
+            if (diff == 0) {
+                if (android_atomic_acquire_cas(pos, seqNext(pos, 1), &mEnqueuePos) == 0) {
+                    slot.msg = *msg;
+                    android_atomic_release_store(seqNext(pos, 1), &slot.seq);
+                    *slotPos = pos;
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            }
+            pos = android_atomic_acquire_load(&mEnqueuePos);
+        }
+    }
+
+    // Take the message of the head slot, false if it is not published.
+    // The message is uncounted before its slot is freed.
+    bool dequeue(MessageType *msg)
+    {
+        while (true) {
+            const int32_t pos = mDequeuePos;
+            Slot &slot = mSlots[pos & (mCapacity - 1)];
+            bool removed = false;
+
+            if (seqDiff(android_atomic_acquire_load(&slot.seq), seqNext(pos, 1)) != 0)
+                return false;
+
+            if (android_atomic_acquire_cas(CLAIM_NONE, CLAIM_RECEIVING, &slot.claim) != 0) {
+                // remove() has it, wait until it is done copying the message
+                int32_t claim;
+                while ((claim = android_atomic_acquire_load(&slot.claim)) == CLAIM_REMOVING)
+                    sched_yield();
+                if (claim == CLAIM_NONE)
+                    continue;   // not the id remove() looks for
+                removed = true;
+            } else {
+                *msg = slot.msg;
+                uncount(msg->id);
+            }
+
+            // free the slot before dropping the claim, see remove()
+            android_atomic_release_store(seqNext(pos, mCapacity), &slot.seq);
+            android_atomic_release_store(CLAIM_NONE, &slot.claim);
+            android_atomic_release_store(seqNext(pos, 1), &mDequeuePos);
+
+            if (!removed)
+                return true;
+        }
+    }
+
+    // Claim the published slot at pos to take its message out of order,
+    // false if it is not published, being received or already claimed
+    bool claimSlot(int32_t pos)
+    {
+        Slot &slot = mSlots[pos & (mCapacity - 1)];
+
+        if (seqDiff(android_atomic_acquire_load(&slot.seq), seqNext(pos, 1)) != 0
+            || android_atomic_acquire_cas(CLAIM_NONE, CLAIM_REMOVING, &slot.claim) != 0)
+            return false;
+
+        // the slot may have been received and reused before the claim
+        if (seqDiff(android_atomic_acquire_load(&slot.seq), seqNext(pos, 1)) != 0) {
+            android_atomic_release_store(CLAIM_NONE, &slot.claim);
+            return false;
+        }
+        return true;
+    }
+
+    // Take out the oldest message of id queued in the ring before end, or
+    // in the overflow list before the newest one of id, false if there is none
+    bool takeOldest(MessageId id, MessageType *msg, int32_t end)
+    {
+        for (int32_t pos = android_atomic_acquire_load(&mDequeuePos);
+             seqDiff(pos, end) < 0; pos = seqNext(pos, 1)) {
+            Slot &slot = mSlots[pos & (mCapacity - 1)];
+
+            if (!claimSlot(pos))
+                continue;
+
+            if (slot.msg.id != id) {
+                android_atomic_release_store(CLAIM_NONE, &slot.claim);
+                continue;
+            }
+
+            *msg = slot.msg;
+            uncount(id);
+            android_atomic_release_store(CLAIM_REMOVED, &slot.claim);
+            return true;
+        }
+
+        if (android_atomic_acquire_load(&mOverflowCount) > 0) {
+            Mutex::Autolock lock(mOverflowMutex);
+            typename List<MessageType>::iterator it = mOverflow.begin();
+            for (; it != mOverflow.end(); it++) {
+                if (it->id != id)
+                    continue;
+                typename List<MessageType>::iterator newer = it;
+                for (newer++; newer != mOverflow.end() && newer->id != id; newer++)
+                    ;
+                if (newer == mOverflow.end())
+                    break;
+                *msg = *it;
+                mOverflow.erase(it);
+                android_atomic_dec(&mOverflowCount);
+                uncount(id);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Take the first priority message queued behind messages with a depth
+    // limit only, receiver only. The slot is left to dequeue() to free.
+    bool takePriority(MessageType *msg)
+    {
+        const int32_t end = android_atomic_acquire_load(&mEnqueuePos);
+        for (int32_t pos = mDequeuePos; seqDiff(pos, end) < 0; pos = seqNext(pos, 1)) {
+            Slot &slot = mSlots[pos & (mCapacity - 1)];
+
+            if (!claimSlot(pos)) {
+                if (android_atomic_acquire_load(&slot.claim) == CLAIM_REMOVED)
+                    continue;
+                return false;
+            }
+
+            const Policy *policy = findPolicy(slot.msg.id);
+            if (policy && policy->priority) {
+                *msg = slot.msg;
+                uncount(msg->id);
+                android_atomic_release_store(CLAIM_REMOVED, &slot.claim);
+                return true;
+            }
+
+            android_atomic_release_store(CLAIM_NONE, &slot.claim);
+            if (!policy || policy->maxDepth == 0)
+                return false;
+        }
+        return false;
+    }
+
+    void pushOverflow(const MessageType *msg)
+    {
+        Mutex::Autolock lock(mOverflowMutex);
+        if (mOverflow.empty())
+            ALOGW("Atom_MessageQueue: %s ring of %d full, using the overflow list", mName, mCapacity);
+        mOverflow.push_back(*msg);
+        android_atomic_inc(&mOverflowCount);
+    }
+
+    bool popOverflow(MessageType *msg)
+    {
+        if (android_atomic_acquire_load(&mOverflowCount) == 0)
+            return false;
+
+        Mutex::Autolock lock(mOverflowMutex);
+        if (mOverflow.empty())
+            return false;
+        *msg = *mOverflow.begin();
+        mOverflow.erase(mOverflow.begin());
+        android_atomic_dec(&mOverflowCount);
+        uncount(msg->id);
+        return true;
+    }
+
+    const char *mName;
+    const int mCapacity;
+    Slot *mSlots;
+    volatile int32_t mEnqueuePos;
+    volatile int32_t mDequeuePos;  /*!< written by the receiver only */
+    volatile int32_t mCount;       /*!< messages in the ring and the overflow list */
+    volatile int32_t mParked;      /*!< futex, 1 while the receiver sleeps */
+    volatile int32_t mPriorityCount; /*!< priority messages in the ring and the overflow list */
+
+    Policy mPolicies[MAX_POLICIES];
+    int mNumPolicies;
+
+    Mutex mOverflowMutex;
+    List<MessageType> mOverflow;
+    volatile int32_t mOverflowCount;
+
+    int mNumReply;
+    Mutex *mReplyMutex;
+    Condition *mReplyCondition;
+    status_t *mReplyStatus;
+
+}; // class RingMessageQueue
+
+}; // namespace android
+
+#endif // RING_MESSAGE_QUEUE
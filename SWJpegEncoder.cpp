@@ -20,16 +20,32 @@
 #include "ColorConverter.h"
 #include "LogHelper.h"
 #include <string.h>
+#include <math.h>
 #include "PlatformData.h"
+#include "WorkerPool.h"
 
 namespace android {
 
+#define NV12_MCU_SIZE 16
+
+// jpeg markers, the second byte after 0xFF
+static const unsigned char JPEG_MARKER_SOF0 = 0xC0;
+static const unsigned char JPEG_MARKER_RST0 = 0xD0;
+static const unsigned char JPEG_MARKER_SOI = 0xD8;
+static const unsigned char JPEG_MARKER_EOI = 0xD9;
+static const unsigned char JPEG_MARKER_SOS = 0xDA;
+static const unsigned char JPEG_MARKER_DRI = 0xDD;
+
 SWJpegEncoder::SWJpegEncoder() :
     mJpegSize(-1)
     ,mTotalWidth(0)
     ,mTotalHeight(0)
     ,mDstBuf(NULL)
     ,mCPUCoresNum(1)
+    ,mThreads(0)
+    ,mSpill(NULL)
+    ,mSpillSize(0)
+    ,mRestartInterval(0)
 {
     LOG1("@%s, line:%d", __FUNCTION__, __LINE__);
 }
@@ -37,12 +53,57 @@ SWJpegEncoder::SWJpegEncoder() :
 SWJpegEncoder::~SWJpegEncoder()
 {
     LOG1("@%s, line:%d", __FUNCTION__, __LINE__);
+    clearOutput();
+}
+
+/**
+ * drops the slices and frees the spill buffers of the last encode
+ */
+void SWJpegEncoder::clearOutput()
+{
+    for (unsigned int i = 0; i < mSlices.size(); i++)
+        free(mSlices[i].spill);
+    mSlices.clear();
+    free(mSpill);
+    mSpill = NULL;
+    mSpillSize = 0;
+}
+
+/**
+ * checks the input and fills in the bpl and the chroma plane if not given
+ *
+ * \param in: input buffer description
+ * \param src: returns the completed description
+ * \return 0 if the input is valid, -1 if not
+ */
+static int prepareInput(const SWJpegEncoder::InputBuffer &in, SWJpegEncoder::InputBuffer &src)
+{
+    src = in;
+    if (in.width == 0 || in.height == 0 || in.fourcc == 0) {
+        ALOGE("Invalid input received!");
+        return -1;
+    }
+
+    if (src.bpl == 0)
+        src.bpl = pixelsToBytes(src.fourcc, src.width);
+    if (src.bpl < pixelsToBytes(src.fourcc, src.width)) {
+        ALOGE("Invalid input bpl %d for width %d", src.bpl, src.width);
+        return -1;
+    }
+    if (src.uvBuf == NULL && src.fourcc != V4L2_PIX_FMT_YUYV)
+        src.uvBuf = src.buf + src.bpl * src.height;
+
+    return 0;
 }
 
 /**
  * encode jpeg by calling the Codec which is the libjpeg wrapper
  * the public interface of the SWJpegEncoder
- * Takes YUV data (NV12 or YUV420) and outputs JPEG encoded stream
+ * Takes YUV data (NV12, NV21 or YUYV) and outputs JPEG encoded stream.
+ * The source lines may be padded and the chroma plane of NV12/NV21 need
+ * not follow the luma plane, so ISP buffers can be passed as they are.
+ *
+ * The jpeg is written in place, so encoding fails if it does not fit in out.
  *
  * \param in: input buffer description
  * \param out: output param description
@@ -50,38 +111,100 @@ SWJpegEncoder::~SWJpegEncoder()
  * \return -1 if encoding failed
  */
 int SWJpegEncoder::encode(const InputBuffer &in, const OutputBuffer &out)
+{
+    if (encodeToScratch(in, out) < 0)
+        return -1;
+
+    return writeJpeg(out.buf);
+}
+
+/**
+ * first step of the two step encoding
+ *
+ * Encodes the picture using out as scratch memory. The jpeg is not complete
+ * until writeJpeg() is called, but its size is known, so the final buffer
+ * can be allocated in between at exactly that size. A jpeg bigger than the
+ * scratch does not fail, the rest of it is kept in a heap spill buffer.
+ *
+ * \param in: input buffer description
+ * \param out: scratch buffer description, it must stay valid until writeJpeg()
+ * \return the size writeJpeg() will write if encoding was successful
+ * \return -1 if encoding failed
+ */
+int SWJpegEncoder::encodeToScratch(const InputBuffer &in, const OutputBuffer &out)
 {
     int status;
     nsecs_t startTime = systemTime();
+    InputBuffer src;
 
-    LOG1("@%s:\n\t IN  = {buf:%p, w:%u, h:%u, sz:%u, f:%s}" \
+    LOG1("@%s:\n\t IN  = {buf:%p, uv:%p, w:%u, h:%u, bpl:%u, sz:%u, f:%s}" \
              "\n\t OUT = {buf:%p, w:%u, h:%u, sz:%u, q:%d}",
             __FUNCTION__,
-            in.buf, in.width, in.height, in.size, v4l2Fmt2Str(in.fourcc),
+            in.buf, in.uvBuf, in.width, in.height, in.bpl, in.size, v4l2Fmt2Str(in.fourcc),
             out.buf, out.width, out.height, out.size, out.quality);
 
-    if (in.width == 0 || in.height == 0 || in.fourcc == 0) {
-        ALOGE("Invalid input received!");
-        mJpegSize = -1;
+    clearOutput();
+    if (prepareInput(in, src) < 0)
         goto exit;
-    }
 
     mTotalWidth = in.width;
     mTotalHeight = in.height;
     mDstBuf = out.buf;
 
-    status = isNeedMultiThreadEncoding(in.width, in.height)
-                ? swEncodeMultiThread(in, out)
-                : swEncode(in, out);
-    if (status < 0)
+    if (isNeedMultiThreadEncoding(in.width, in.height))
+        status = swEncodeMultiThread(src, out);
+    else
+        status = swEncode(src, out);
+    if (status < 0 || mJpegSize < 0)
         goto exit;
 
     LOG1("@%s encode, total consume:%ums", __FUNCTION__, (unsigned)((systemTime() - startTime) / 1000000));
     return mJpegSize;
 exit:
+    clearOutput();
     return (mJpegSize = -1);
 }
 
+/**
+ * second step of the two step encoding
+ *
+ * Writes the jpeg produced by encodeToScratch() to dst. For a multi thread
+ * encode the slices are merged straight into dst, so the coded data is only
+ * copied once. dst may also be the scratch buffer itself, unless the jpeg
+ * did not fit in it.
+ *
+ * \param dst: buffer of at least the size encodeToScratch() returned
+ * \return the jpeg size if successful
+ * \return -1 if there is no encoded jpeg
+ */
+int SWJpegEncoder::writeJpeg(unsigned char *dst)
+{
+    LOG1("@%s, dst:%p", __FUNCTION__, dst);
+    int size = mJpegSize;
+    bool spilled = mSpill != NULL;
+
+    if (size < 0 || dst == NULL)
+        return -1;
+
+    for (unsigned int i = 0; i < mSlices.size(); i++)
+        spilled = spilled || mSlices[i].spill != NULL;
+    if (spilled && dst == mDstBuf) {
+        ALOGE("@%s, the jpeg of %d bytes does not fit in the scratch buffer", __FUNCTION__, size);
+        size = -1;
+    } else if (!mSlices.isEmpty()) {
+        size = mergeJpeg(dst);
+    } else {
+        if (dst != mDstBuf)
+            memcpy(dst, mDstBuf, size - mSpillSize);
+        if (mSpillSize > 0)
+            memcpy(dst + size - mSpillSize, mSpill, mSpillSize);
+    }
+
+    clearOutput();
+    mJpegSize = -1;
+    return size;
+}
+
 /**
  *  This function will decide if we need to enable the multi thread jpeg encoding.
  *  currently, we have two conditions to use the old single jpeg encoding.
@@ -100,7 +223,9 @@ bool SWJpegEncoder::isNeedMultiThreadEncoding(int width, int height)
     bool ret = false;
 
     /* more conditions could be added to here by according to the request */
-    if ((width < RESOLUTION_1_3MP_WIDTH && height < RESOLUTION_1_3MP_HEIGHT)
+    if (mThreads > 0)
+        ret = mThreads > 1;
+    else if ((width < RESOLUTION_1_3MP_WIDTH && height < RESOLUTION_1_3MP_HEIGHT)
         || (1 == (mCPUCoresNum = PlatformData::getNumOfCPUCores())))
         ret = false;
     else
@@ -131,15 +256,19 @@ int SWJpegEncoder::swEncode(const InputBuffer &in, const OutputBuffer &out)
     if (status)
         goto exit;
 
-    status = encoder.doJpegEncoding(in.buf, (in.buf + in.width * in.height), in.fourcc);
+    status = encoder.doJpegEncoding(in.buf, in.uvBuf, in.fourcc, in.bpl);
     if (status)
         goto exit;
 
 exit:
-    if (status)
+    if (status) {
         mJpegSize = -1;
-    else
+    } else {
         encoder.getJpegSize(&mJpegSize);
+        mSpillSize = encoder.takeSpill(&mSpill);
+        if (mSpill)
+            LOG1("@%s, %d bytes past the %d byte scratch", __FUNCTION__, mSpillSize, out.size);
+    }
 
     encoder.deInit();
 
@@ -149,7 +278,8 @@ exit:
 /**
  * encode jpeg by calling the SWJpegEncoder which is the libjpeg wrapper
  * multi thread.
- * the thread number depends on the CPU number.
+ * the image is split into slices which are encoded on the WorkerPool threads,
+ * writeJpeg() merges them into one jpeg.
  *
  * \param in: input buffer description
  * \param out: output param description
@@ -161,292 +291,729 @@ int SWJpegEncoder::swEncodeMultiThread(const InputBuffer &in, const OutputBuffer
     LOG1("@%s, line:%d, use the libjpeg to do sw jpeg encoding", __FUNCTION__, __LINE__);
     int status = 0;
 
-    init(mCPUCoresNum);
-    config(in, out);
-
-    status = doJpegEncodingMultiThread();
+    status = config(in, out);
     if (status)
         goto exit;
 
+    WorkerPool::runStripes(encodeSlices, this, mSlices.size());
+
+    for (unsigned int i = 0; i < mSlices.size(); i++) {
+        if (mSlices[i].dataSize < 0) {
+            ALOGE("@%s, line:%d, slice %u failed", __FUNCTION__, __LINE__, i);
+            status = -1;
+            goto exit;
+        }
+    }
+
+    // the slices are merged by writeJpeg(), into the final buffer
+    mJpegSize = mergeJpeg(NULL);
+    if (mJpegSize < 0)
+        status = -1;
+
 exit:
-    mJpegSize = status ? -1 : mergeJpeg();
-    deInit();
+    if (status) {
+        mJpegSize = -1;
+        clearOutput();
+    }
 
     return (status ? -1 : 0);
 }
 
 /**
- * Initialize for the multi thread jpeg encoding
+ * number and height of the slices of a multi thread encode
+ *
+ * There is one slice per CPU core. All the slices but the last one are a
+ * multiple of the MCU height, and a slice may not have more MCUs than fit
+ * in the restart interval field.
  *
- * it will create n CodecWorkerThread by according to the thread number.
+ * \param width: the jpeg width
+ * \param height: the jpeg height
+ * \param sliceNum: returns the number of slices
+ * \param sliceMcuRows: returns the MCU rows per slice, the last one may have less
  */
-void SWJpegEncoder::init(unsigned int threadNum)
+void SWJpegEncoder::sliceLayout(int width, int height, int &sliceNum, int &sliceMcuRows)
 {
-    unsigned int num = CLIP(threadNum, MAX_THREAD_NUM, MIN_THREAD_NUM);
-    LOG1("@%s, line:%d, thread number, pass:%d, real:%d", __FUNCTION__, __LINE__, threadNum, num);
-
-    for (unsigned int i = 0; i < num; i++) {
-        mSwJpegEncoder.push(new CodecWorkerThread);
-    }
+    const int mcuCols = (width + NV12_MCU_SIZE - 1) / NV12_MCU_SIZE;
+    const int mcuRows = (height + NV12_MCU_SIZE - 1) / NV12_MCU_SIZE;
+    const int maxSliceMcuRows = MAX(MAX_RESTART_INTERVAL / mcuCols, 1);
+
+    sliceNum = mThreads > 0 ? mThreads : (int)mCPUCoresNum;
+    sliceNum = MAX(sliceNum, (mcuRows + maxSliceMcuRows - 1) / maxSliceMcuRows);
+    sliceMcuRows = (mcuRows + sliceNum - 1) / sliceNum;
+    sliceNum = (mcuRows + sliceMcuRows - 1) / sliceMcuRows;
 }
 
 /**
- * deInit for the multi thread jpeg encoding
+ * split the image into slices for the multi thread jpeg encoding,
+ * as laid out by sliceLayout()
  *
- * it will release all n CodecWorkerThread
+ * \param in: input buffer description
+ * \param out: output param description
+ * \return 0 if the configuration is right.
+ * \return -1 if the configuration fails.
  */
-void SWJpegEncoder::deInit(void)
+int SWJpegEncoder::config(const InputBuffer &in, const OutputBuffer &out)
 {
     LOG1("@%s, line:%d", __FUNCTION__, __LINE__);
-    for (unsigned int i = 0; i < mSwJpegEncoder.size(); i++) {
-        mSwJpegEncoder.editItemAt(i).clear();
+    const int mcuCols = (in.width + NV12_MCU_SIZE - 1) / NV12_MCU_SIZE;
+    int sliceMcuRows, sliceNum;
+    Slice slice;
+
+    sliceLayout(in.width, in.height, sliceNum, sliceMcuRows);
+    mRestartInterval = sliceMcuRows * mcuCols;
+
+    if (out.size <= (int)DEST_BUF_OFFSET) {
+        ALOGE("@%s, line:%d, output buffer too small: %d", __FUNCTION__, __LINE__, out.size);
+        return -1;
+    }
+
+    mSlices.clear();
+    for (int i = 0; i < sliceNum; i++) {
+        const int firstRow = i * sliceMcuRows * NV12_MCU_SIZE;
+
+        slice.width = in.width;
+        slice.height = MIN(sliceMcuRows * NV12_MCU_SIZE, in.height - firstRow);
+        slice.fourcc = in.fourcc;
+        slice.bpl = in.bpl;
+        slice.inBufY = in.buf + in.bpl * firstRow;
+        slice.inBufUV = in.uvBuf ? in.uvBuf + in.bpl * firstRow / 2 : NULL;
+        slice.quality = out.quality;
+        slice.outBufSize = (out.size - DEST_BUF_OFFSET) / sliceNum;
+        slice.outBuf = out.buf + DEST_BUF_OFFSET + slice.outBufSize * i;
+        slice.dataSize = -1;
+        slice.spill = NULL;
+        slice.spillSize = 0;
+        slice.duration = 0;
+        mSlices.push(slice);
+
+        LOG1("@%s, line:%d, slice %d: %dx%d, inBufY:%p, inBufUV:%p, outBuf:%p, outBufSize:%d",
+             __FUNCTION__, __LINE__, i, slice.width, slice.height,
+             slice.inBufY, slice.inBufUV, slice.outBuf, slice.outBufSize);
+    }
+    LOG1("@%s, line:%d, %d slices, restart interval %d MCUs", __FUNCTION__, __LINE__,
+         sliceNum, mRestartInterval);
+
+    return 0;
+}
+
+/**
+ * WorkerPool stripe function, encodes the slices [first, last)
+ */
+void SWJpegEncoder::encodeSlices(void *context, int first, int last)
+{
+    SWJpegEncoder *encoder = (SWJpegEncoder *) context;
+
+    for (int i = first; i < last; i++) {
+        Slice &slice = encoder->mSlices.editItemAt(i);
+        nsecs_t startTime = systemTime();
+        int ret = encoder->encodeSlice(slice);
+        slice.duration = systemTime() - startTime;
+        LOG1("@%s slice %d done, consume:%ums, ret:%d", __FUNCTION__, i,
+             (unsigned)(slice.duration / 1000000), ret);
     }
-    mSwJpegEncoder.removeItemsAt(0, mSwJpegEncoder.size());
-    mSwJpegEncoder.clear();
 }
 
 /**
- * configue every thread for multi thread jpeg
+ * Copies the encode times of the slices of the last multi thread encode
  *
- * \param in: input buffer description
- * \param out: output param description
+ * \param times: array for the times in ns
+ * \param maxCount: size of times
+ * \return the number of slices, 0 after a single thread encode
  */
-void SWJpegEncoder::config(const InputBuffer &in, const OutputBuffer &out)
+int SWJpegEncoder::getSliceTimes(nsecs_t *times, int maxCount) const
 {
-    LOG1("@%s, line:%d", __FUNCTION__, __LINE__);
-    sp<CodecWorkerThread> encThread;
-    CodecWorkerThread::CodecConfig cfg;
-
-    for (unsigned int i = 0; i < mSwJpegEncoder.size(); i++) {
-        cfg.width = in.width;
-        /*
-            for example, there are 4 threads.
-            the first 3 threads must align to 16 which is NV12_MCU_SIZE
-            but for the last thread, it doesn't have this request.
-        */
-        cfg.height = ALIGN16(in.height / mSwJpegEncoder.size());
-        cfg.fourcc = in.fourcc;
-        cfg.inBufY = in.buf + cfg.width * cfg.height * i;
-        cfg.inBufUV = (cfg.fourcc == V4L2_PIX_FMT_NV12)
-            ? (in.buf + in.width * in.height + cfg.width * cfg.height * i / 2)
-            : NULL;
-        cfg.quality = out.quality;
-        cfg.outBufSize = (out.size - DEST_BUF_OFFSET) / mSwJpegEncoder.size();
-        cfg.outBuf = out.buf + DEST_BUF_OFFSET + cfg.outBufSize * i;
-        /* update the last thread's height */
-        if (i == mSwJpegEncoder.size() - 1)
-            cfg.height = in.height - cfg.height * (mSwJpegEncoder.size() - 1);
-
-        encThread = mSwJpegEncoder.editItemAt(i);
-        encThread->setConfig(cfg);
-        LOG1("@%s, line:%d, the %d picture thread cfg", __FUNCTION__, __LINE__, i);
-        LOG1("@%s, line:%d, cfg.width:%d, cfg.height:%d", __FUNCTION__, __LINE__, cfg.width, cfg.height);
-        LOG1("@%s, line:%d, cfg.fourcc:%s 0x%x, cfg.quality:%d", __FUNCTION__, __LINE__, v4l2Fmt2Str(cfg.fourcc), cfg.fourcc, cfg.quality);
-        LOG1("@%s, line:%d, cfg.inBufY:0x%p, cfg.inBufUV:0x%p", __FUNCTION__, __LINE__, cfg.inBufY, cfg.inBufUV);
-        LOG1("@%s, line:%d, cfg.outBuf:0x%p, cfg.outBufSize:%d", __FUNCTION__, __LINE__, cfg.outBuf, cfg.outBufSize);
-    }
-}
-
-/**
- * the function will trigger the multi jpeg encoding
+    const int count = mSlices.size();
+    for (int i = 0; i < count && i < maxCount; i++)
+        times[i] = mSlices[i].duration;
+    return count;
+}
+
+/**
+ * encode one slice into its part of the output buffer
  *
+ * \param slice: the slice to encode, its dataSize is updated
  * \return 0 if encoding was successful
  * \return -1 if encoding failed
  */
-int SWJpegEncoder::doJpegEncodingMultiThread(void)
+int SWJpegEncoder::encodeSlice(Slice &slice)
 {
-    LOG1("@%s, line:%d", __FUNCTION__, __LINE__);
-    sp<CodecWorkerThread> encThread;
-    status_t status = UNKNOWN_ERROR;
-    String8 threadName("CamHAL_SWEncodeMultiThread");
-
-    /* run all threads */
-    for (unsigned int i = 0; i <mSwJpegEncoder.size(); i++) {
-        threadName.appendFormat(":%d", i);
-        LOG1("@%s, new sw jpeg thread name:%s", __FUNCTION__, threadName.string());
-        encThread = mSwJpegEncoder.editItemAt(i);
-        status = encThread->runThread(threadName.string());
-        if (status != NO_ERROR) {
-            ALOGE("@%s, line:%d, start jpeg thread fail, thread name:%s", __FUNCTION__, __LINE__, threadName.string());
-            return -1;
-        }
+    int status = 0;
+    Codec encoder(slice.quality);
+
+    encoder.init();
+    encoder.setJpegQuality(slice.quality);
+    status = encoder.configEncoding(slice.width, slice.height,
+                            (JSAMPLE *)slice.outBuf, slice.outBufSize);
+    if (status)
+        goto exit;
+
+    status = encoder.doJpegEncoding(slice.inBufY, slice.inBufUV, slice.fourcc, slice.bpl);
+    if (status)
+        goto exit;
+
+exit:
+    if (status) {
+        slice.dataSize = -1;
+    } else {
+        encoder.getJpegSize(&slice.dataSize);
+        slice.spillSize = encoder.takeSpill(&slice.spill);
+        if (slice.spill)
+            LOG1("@%s, %d bytes past the %d byte slice scratch", __FUNCTION__,
+                 slice.spillSize, slice.outBufSize);
     }
 
-    /* wait all threads to finish */
-    for (unsigned int i = 0; i < mSwJpegEncoder.size(); i++) {
-        LOG1("@%s, the %d sw jpeg encoder thread before join!", __FUNCTION__, i);
-        encThread = mSwJpegEncoder.editItemAt(i);
-        encThread->waitThreadFinish();
+    encoder.deInit();
+
+    return (status ? -1 : 0);
+}
+
+/**
+ * Returns the size of the marker segment at pos, marker included,
+ * or -1 if there is no valid segment there
+ */
+static int jpegSegmentSize(const unsigned char *jpeg, int size, int pos)
+{
+    if (pos + 4 > size || jpeg[pos] != 0xFF)
+        return -1;
+
+    const int segmentSize = 2 + ((jpeg[pos + 2] << 8) | jpeg[pos + 3]);
+    return (segmentSize < 4 || pos + segmentSize > size) ? -1 : segmentSize;
+}
+
+/**
+ * Returns the offset of the entropy coded data in a jpeg, which is
+ * right after the SOS segment, or -1 if the header is malformed
+ */
+static int jpegScanOffset(const unsigned char *jpeg, int size)
+{
+    int pos = 2;    // SOI
+
+    while (true) {
+        const int segmentSize = jpegSegmentSize(jpeg, size, pos);
+        if (segmentSize < 0)
+            return -1;
+        if (jpeg[pos + 1] == JPEG_MARKER_SOS)
+            return pos + segmentSize;
+        pos += segmentSize;
     }
+}
 
-    return 0;
+/**
+ * Returns the byte at pos of jpeg data that continues in spill past size
+ */
+static inline unsigned char jpegByte(const unsigned char *jpeg, int size,
+                                     const unsigned char *spill, int pos)
+{
+    return pos < size ? jpeg[pos] : spill[pos - size];
+}
+
+/**
+ * Copies size bytes to dst at pos unless dst is NULL, returns the new pos
+ */
+static int jpegWrite(unsigned char *dst, int pos, const void *data, int size)
+{
+    if (dst)
+        memmove(dst + pos, data, size);
+    return pos + size;
 }
 
 /**
- * the function will merge all jpeg pictures which are generated in multi threads
- * to one jpeg picture
+ * the function will merge the jpeg slices generated by the multi thread
+ * encoding into one jpeg picture
  *
+ * The header of the first slice is parsed segment by segment: the frame
+ * size in SOF is set to the full image and a DRI segment is inserted before
+ * SOS. The entropy coded data of every slice follows, separated by RSTn
+ * markers. The header of a slice is in its part of the scratch, the coded
+ * data may continue in its spill.
+ *
+ * \param dst: where to write the jpeg, NULL to only compute its size.
+ *             It may overlap the slices if it is below them and none spilled.
  * \return int the merged jpeg size
+ * \return -1 if a slice is malformed
  */
-int SWJpegEncoder::mergeJpeg(void)
+int SWJpegEncoder::mergeJpeg(unsigned char *dst)
 {
-#define HEADER_TOTAL_LEN 623
-#define HEADER_SOS_LEN 14
-#define HEADER_EOI_LEN 2
-#define HEADER_HEIGHT_POS 163
-#define HEADER_WIDTH_POS 165
-#define NV12_MCU_SIZE 16
     LOG1("@%s, line:%d", __FUNCTION__, __LINE__);
+    const Slice &first = mSlices[0];
+    const unsigned char *src = first.outBuf;
+    const int firstSize = first.dataSize - first.spillSize;
+    const unsigned char soi[2] = { 0xFF, JPEG_MARKER_SOI };
+    const unsigned char eoi[2] = { 0xFF, JPEG_MARKER_EOI };
+    const unsigned char dri[6] = { 0xFF, JPEG_MARKER_DRI, 0, 4,
+                                   (unsigned char)((mRestartInterval >> 8) & 0xFF),
+                                   (unsigned char)(mRestartInterval & 0xFF) };
     int size = 0;
-    CodecWorkerThread::CodecConfig cfg;
-    nsecs_t startTime;
-    sp<CodecWorkerThread> encThread = mSwJpegEncoder.editItemAt(0);
-    encThread->getConfig(&cfg);
+    int pos = 2;
+    int segmentSize;
+    unsigned char marker;
 
-    /* Write the JPEG header */
-    memcpy(mDstBuf, cfg.outBuf, HEADER_TOTAL_LEN - HEADER_SOS_LEN);
-    size = HEADER_TOTAL_LEN - HEADER_SOS_LEN;
+    if (firstSize < 4 || src[0] != 0xFF || src[1] != JPEG_MARKER_SOI) {
+        ALOGE("@%s, line:%d, no SOI in the first slice", __FUNCTION__, __LINE__);
+        return -1;
+    }
 
-    /* Update the width and height info */
-    mDstBuf[HEADER_HEIGHT_POS] = (mTotalHeight >> 8) & 0xFF;
-    mDstBuf[HEADER_HEIGHT_POS+1] = mTotalHeight & 0xFF;
-    mDstBuf[HEADER_WIDTH_POS] = (mTotalWidth >> 8) & 0xFF;
-    mDstBuf[HEADER_WIDTH_POS+1] = mTotalWidth & 0xFF;
+    /* Write SOI and the header segments */
+    size = jpegWrite(dst, size, soi, sizeof(soi));
+    while (true) {
+        segmentSize = jpegSegmentSize(src, firstSize, pos);
+        if (segmentSize < 0) {
+            ALOGE("@%s, line:%d, malformed header at %d", __FUNCTION__, __LINE__, pos);
+            return -1;
+        }
+        marker = src[pos + 1];
+        if (marker == JPEG_MARKER_SOS)
+            break;
+
+        if (marker != JPEG_MARKER_DRI) {
+            /* Update the height and width in the frame header */
+            if (dst && marker == JPEG_MARKER_SOF0 && segmentSize >= 9) {
+                memmove(dst + size, src + pos, segmentSize);
+                dst[size + 5] = (mTotalHeight >> 8) & 0xFF;
+                dst[size + 6] = mTotalHeight & 0xFF;
+                dst[size + 7] = (mTotalWidth >> 8) & 0xFF;
+                dst[size + 8] = mTotalWidth & 0xFF;
+                size += segmentSize;
+            } else {
+                size = jpegWrite(dst, size, src + pos, segmentSize);
+            }
+        }
+        pos += segmentSize;
+    }
 
     /* Write the restarting interval */
-    if (mSwJpegEncoder.size() > 1) {
-        unsigned int MCUs = (cfg.height / NV12_MCU_SIZE) * (cfg.width / NV12_MCU_SIZE);
-        mDstBuf[size++] = 0xFF;
-        mDstBuf[size++] = 0xDD;
-        mDstBuf[size++] = 0;
-        mDstBuf[size++] = 4;
-        mDstBuf[size++] = (MCUs >> 8) & 0xFF;
-        mDstBuf[size++] = MCUs & 0xFF;
-    }
+    if (mSlices.size() > 1)
+        size = jpegWrite(dst, size, dri, sizeof(dri));
 
     /* Write the SOS */
-    memcpy((void *)((unsigned int)mDstBuf + size),
-            (void *)((unsigned int)cfg.outBuf + HEADER_TOTAL_LEN - HEADER_SOS_LEN),
-            HEADER_SOS_LEN);
-    size += HEADER_SOS_LEN;
+    size = jpegWrite(dst, size, src + pos, segmentSize);
 
     /* Write coded segments */
-    for (unsigned int i = 0; i <mSwJpegEncoder.size(); i++) {
-        encThread = mSwJpegEncoder.editItemAt(i);
-        startTime = systemTime();
-        encThread->getConfig(&cfg);
-        memmove((void *)((unsigned int)mDstBuf + size),
-               (void *)((unsigned int)cfg.outBuf + HEADER_TOTAL_LEN),
-               (encThread->getJpegDataSize() - HEADER_TOTAL_LEN - HEADER_EOI_LEN));
-        LOG1("@%s, wr %d segments, size:%d, consume:%ums", __FUNCTION__, i, (encThread->getJpegDataSize()- HEADER_TOTAL_LEN - HEADER_EOI_LEN), (unsigned)((systemTime() - startTime) / 1000000));
-        size += (encThread->getJpegDataSize() - HEADER_TOTAL_LEN - HEADER_EOI_LEN);
-
-        if (i != (mSwJpegEncoder.size() - 1)) {
-            mDstBuf[size++] = 0xFF;
-            mDstBuf[size++] = (i & 0x7) | 0xD0;
+    for (unsigned int i = 0; i < mSlices.size(); i++) {
+        const Slice &slice = mSlices[i];
+        const int mainSize = slice.dataSize - slice.spillSize;
+        const int offset = (i == 0) ? pos + segmentSize
+                                    : jpegScanOffset(slice.outBuf, mainSize);
+        const int end = slice.dataSize - 2;     // EOI
+        if (offset < 0 || end < offset
+            || jpegByte(slice.outBuf, mainSize, slice.spill, end) != 0xFF
+            || jpegByte(slice.outBuf, mainSize, slice.spill, end + 1) != JPEG_MARKER_EOI) {
+            ALOGE("@%s, line:%d, malformed slice %u", __FUNCTION__, __LINE__, i);
+            return -1;
+        }
+
+        size = jpegWrite(dst, size, slice.outBuf + offset, MIN(end, mainSize) - offset);
+        if (end > mainSize)
+            size = jpegWrite(dst, size, slice.spill, end - mainSize);
+        LOG2("@%s, wr %u segments, size:%d", __FUNCTION__, i, end - offset);
+
+        if (i != (mSlices.size() - 1)) {
+            const unsigned char rst[2] = { 0xFF, (unsigned char)(JPEG_MARKER_RST0 | (i & 0x7)) };
+            size = jpegWrite(dst, size, rst, sizeof(rst));
         }
     }
 
     /* Write EOI */
-    mDstBuf[size++]= 0xFF;
-    mDstBuf[size++]= 0xD9;
+    size = jpegWrite(dst, size, eoi, sizeof(eoi));
 
     return size;
 }
 
-SWJpegEncoder::CodecWorkerThread::CodecWorkerThread() :
-    mDataSize(-1)
+/*
+ * Rate estimation for estimateSize()
+ *
+ * Every RATE_SAMPLE_STEP-th 8x8 block of every RATE_SAMPLE_STEP-th block row
+ * of each component is transformed. The
+ * coefficients are quantized with the libjpeg tables of that quality and
+ * the bits of the block are counted with the default huffman tables, as
+ * libjpeg would code them. The sampled bits are scaled to all the blocks of
+ * each band, a band being a slice of a multi thread encode.
+ */
+static const int RATE_SAMPLE_STEP = 4;
+static const int RATE_MARGIN_PERCENT = 10;  /*!< the estimate is within a few % on photos and noise */
+static const int JPEG_HEADER_SIZE = 640;    /*!< SOI, APP0, DQT, SOF, DHT, SOS and EOI */
+
+/*!< natural order index of the zig-zag order coefficients */
+static const unsigned char JPEG_ZIGZAG[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+class JpegRateEstimator {
+public:
+    JpegRateEstimator();
+    ~JpegRateEstimator() { free(mBlocks); }
+
+    int sample(const SWJpegEncoder::InputBuffer &in, int bands, int bandHeight);
+    int bandSize(int quality);
+
+private:
+    /*!
+     * DCT of a sampled block. The coefficients are kept times 4, the AC ones
+     * as magnitudes in zig-zag order, only their size is coded with huffman.
+     */
+    struct Block {
+        unsigned short ac[64];  /*!< ac[1..63] */
+        short dc;
+        short leftDc;           /*!< DC of the block on the left */
+        short band;
+        unsigned char chroma;
+        unsigned char last;     /*!< last AC that is not 0 at quality 100 */
+    };
+    struct Band {
+        int blocks[2];   /*!< luma and chroma blocks in the band */
+        int sampled[2];  /*!< of which sampled */
+        double bits[2];  /*!< coded bits of the sampled blocks */
+    };
+    struct Plane {
+        const unsigned char *base;
+        int stride;      /*!< bytes between lines */
+        int step;        /*!< bytes between pixels */
+        int width;
+        int height;
+        int chroma;
+    };
+
+    static int sampleCount(int blockRows, int blockCols);
+    void samplePlane(const Plane &plane, int blockRows, int blockCols, int bandHeight,
+                     int linesPerBlockRow, Block *&dst);
+    void forwardDct(const float *pixels, Block &block) const;
+    static int blockBits(const Block &block, const float *qScale,
+                         const unsigned char *dcLen, const unsigned char *acLen);
+    static void codeLengths(const JHUFF_TBL *table, unsigned char *lengths);
+
+    Block *mBlocks;
+    int mBlockCount;
+    Vector<Band> mBands;
+    float mBasis[8][8];     /*!< DCT basis functions */
+    float mQScale[2][64];   /*!< 1 / (4 * quantizer) of the luma and chroma tables, zig-zag order */
+    unsigned char mDcLen[2][256];
+    unsigned char mAcLen[2][256];
+};
+
+JpegRateEstimator::JpegRateEstimator() :
+    mBlocks(NULL)
+    ,mBlockCount(0)
 {
-    LOG1("@%s, line:%d", __FUNCTION__, __LINE__);
+    for (int u = 0; u < 8; u++)
+        for (int x = 0; x < 8; x++)
+            mBasis[u][x] = (u == 0 ? sqrtf(0.125f) : 0.5f)
+                           * cosf((2 * x + 1) * u * (float)M_PI / 16);
 }
 
-SWJpegEncoder::CodecWorkerThread::~CodecWorkerThread()
+/**
+ * number of blocks samplePlane() samples in a plane
+ */
+int JpegRateEstimator::sampleCount(int blockRows, int blockCols)
 {
-    LOG1("@%s, line:%d", __FUNCTION__, __LINE__);
+    return ((blockRows + RATE_SAMPLE_STEP - 1) / RATE_SAMPLE_STEP)
+           * ((blockCols + RATE_SAMPLE_STEP - 1) / RATE_SAMPLE_STEP);
 }
 
 /**
- * run one thread for multi thread jpeg encoding
+ * transforms the sampled blocks of the picture
  *
- * \param name: the thread name
+ * \param in: the picture, with its bpl and chroma plane set
+ * \param bands: number of bands the estimate is done for
+ * \param bandHeight: lines per band, a multiple of the MCU height
+ * \return 0 on success, -1 if out of memory
  */
-status_t SWJpegEncoder::CodecWorkerThread::runThread(const char *name)
+int JpegRateEstimator::sample(const SWJpegEncoder::InputBuffer &in, int bands, int bandHeight)
 {
-    LOG1("@%s, line:%d", __FUNCTION__, __LINE__);
-    return this->run(name);
+    const int mcuCols = (in.width + NV12_MCU_SIZE - 1) / NV12_MCU_SIZE;
+    const int mcuRows = (in.height + NV12_MCU_SIZE - 1) / NV12_MCU_SIZE;
+    const int lumaRows = mcuRows * 2, lumaCols = mcuCols * 2;
+    const int samples = sampleCount(lumaRows, lumaCols) + 2 * sampleCount(mcuRows, mcuCols);
+    const bool yuyv = in.fourcc == V4L2_PIX_FMT_YUYV;
+    Plane y, u, v;
+    Band band;
+
+    mBlocks = (Block *) malloc(samples * sizeof(Block));
+    if (mBlocks == NULL)
+        return -1;
+
+    memset(&band, 0, sizeof(band));
+    mBands.clear();
+    mBands.insertAt(band, 0, bands);
+
+    // libjpeg pads the picture to whole MCUs by repeating the last pixels
+    y.base = in.buf;
+    y.stride = in.bpl;
+    y.step = yuyv ? 2 : 1;
+    y.width = in.width;
+    y.height = in.height;
+    y.chroma = 0;
+    u = y;
+    u.width = MAX(in.width / 2, 1);
+    u.height = MAX(in.height / 2, 1);
+    u.chroma = 1;
+    if (yuyv) {
+        // U comes from the even lines, V from the odd ones, as in YUY2ToP411
+        u.base = in.buf + 1;
+        u.stride = in.bpl * 2;
+        u.step = 4;
+        v = u;
+        v.base = in.buf + in.bpl + 3;
+    } else {
+        u.base = in.uvBuf;
+        u.step = 2;
+        v = u;
+        v.base = in.uvBuf + 1;
+    }
+
+    Block *dst = mBlocks;
+    samplePlane(y, lumaRows, lumaCols, bandHeight, 8, dst);
+    samplePlane(u, mcuRows, mcuCols, bandHeight, 16, dst);
+    samplePlane(v, mcuRows, mcuCols, bandHeight, 16, dst);
+    mBlockCount = dst - mBlocks;
+
+    return 0;
 }
 
 /**
- * wait one thread until it has finished
+ * transforms the sampled blocks of one plane and counts the blocks per band
  *
+ * \param linesPerBlockRow: picture lines covered by a block row
  */
-void SWJpegEncoder::CodecWorkerThread::waitThreadFinish(void)
+void JpegRateEstimator::samplePlane(const Plane &plane, int blockRows, int blockCols,
+                                    int bandHeight, int linesPerBlockRow, Block *&dst)
 {
-    LOG1("@%s, line:%d", __FUNCTION__, __LINE__);
-    this->join();
-    this->requestExitAndWait();
+    // the middle block of every RATE_SAMPLE_STEP, the first one if there are less
+    const int firstRow = MIN(RATE_SAMPLE_STEP / 2, blockRows - 1);
+    const int firstCol = MIN(RATE_SAMPLE_STEP / 2, blockCols - 1);
+    const unsigned char *lines[8];
+    int offsets[8], leftOffsets[8];
+    float pixels[64];
+
+    for (int by = 0; by < blockRows; by++) {
+        const int band = MIN(by * linesPerBlockRow / bandHeight, (int)mBands.size() - 1);
+        Band &stats = mBands.editItemAt(band);
+
+        stats.blocks[plane.chroma] += blockCols;
+        if (by < firstRow || (by - firstRow) % RATE_SAMPLE_STEP != 0)
+            continue;
+
+        for (int i = 0; i < 8; i++)
+            lines[i] = plane.base + MIN(by * 8 + i, plane.height - 1) * plane.stride;
+
+        for (int bx = firstCol; bx < blockCols; bx += RATE_SAMPLE_STEP) {
+            for (int j = 0; j < 8; j++) {
+                const int x = MIN(bx * 8 + j, plane.width - 1);
+                offsets[j] = x * plane.step;
+                leftOffsets[j] = MAX(x - 8, 0) * plane.step;
+            }
+
+            int leftSum = 0;
+            for (int i = 0; i < 8; i++) {
+                for (int j = 0; j < 8; j++) {
+                    pixels[i * 8 + j] = lines[i][offsets[j]] - 128.0f;
+                    leftSum += lines[i][leftOffsets[j]] - 128;
+                }
+            }
+
+            forwardDct(pixels, *dst);
+            dst->leftDc = leftSum / 2;  // DC is sum / 8
+            dst->band = band;
+            dst->chroma = plane.chroma;
+            stats.sampled[plane.chroma]++;
+            dst++;
+        }
+    }
 }
 
 /**
- * get jpeg size which is done in one thread
- *
- * \return int the coded jpeg size
+ * 8x8 DCT-II with the jpeg scaling
  */
-int SWJpegEncoder::CodecWorkerThread::getJpegDataSize(void)
+void JpegRateEstimator::forwardDct(const float *pixels, Block &block) const
 {
-    LOG1("@%s, line:%d", __FUNCTION__, __LINE__);
-    return mDataSize;
+    float tmp[64];
+    float coef[64];
+
+    for (int i = 0; i < 8; i++) {
+        for (int u = 0; u < 8; u++) {
+            float sum = 0;
+            for (int x = 0; x < 8; x++)
+                sum += mBasis[u][x] * pixels[i * 8 + x];
+            tmp[i * 8 + u] = sum;
+        }
+    }
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            float sum = 0;
+            for (int y = 0; y < 8; y++)
+                sum += mBasis[v][y] * tmp[y * 8 + u];
+            coef[v * 8 + u] = sum * 4;
+        }
+    }
+
+    block.dc = (short)lrintf(coef[0]);
+    block.last = 0;
+    for (int k = 1; k < 64; k++) {
+        block.ac[k] = (unsigned short)lrintf(fabsf(coef[JPEG_ZIGZAG[k]]));
+        // quantizers are at least 1, which is 4 here
+        if (block.ac[k] >= 2)
+            block.last = k;
+    }
 }
 
 /**
- * the thread exe function for one jpeg thread
- * when the encoding has been done, it will return false to terminate the thread
- *
- * \return false
+ * quantizes a DC coefficient stored times 4, rounding like libjpeg
  */
-bool SWJpegEncoder::CodecWorkerThread::threadLoop()
+static inline int quantizeDc(int coef, float qScale)
 {
-    LOG1("@%s, line:%d, in CodecWorkerThread", __FUNCTION__, __LINE__);
-    nsecs_t startTime = systemTime();
-    int ret = swEncode();
-    LOG1("@%s one swEncode done!, consume:%ums, ret:%d", __FUNCTION__, (unsigned)((systemTime() - startTime) / 1000000), ret);
+    return coef >= 0 ? (int)(coef * qScale + 0.5f) : -(int)(0.5f - coef * qScale);
+}
+
+/**
+ * number of bits of the jpeg magnitude category of value
+ */
+static inline int magnitudeBits(int value)
+{
+    return value == 0 ? 0 : 32 - __builtin_clz(value < 0 ? -value : value);
+}
+
+/**
+ * counts the bits of one block coded with the given tables
+ */
+int JpegRateEstimator::blockBits(const Block &block, const float *qScale,
+                                 const unsigned char *dcLen, const unsigned char *acLen)
+{
+    const int dcBits = magnitudeBits(quantizeDc(block.dc, qScale[0])
+                                     - quantizeDc(block.leftDc, qScale[0]));
+    int bits = dcLen[dcBits] + dcBits;
+    int run = 0;
+
+    for (int k = 1; k <= block.last; k++) {
+        const int level = (int)(block.ac[k] * qScale[k] + 0.5f);
+        if (level == 0) {
+            run++;
+            continue;
+        }
+        for (; run > 15; run -= 16)
+            bits += acLen[0xF0];    // ZRL
+        const int size = magnitudeBits(level);
+        bits += acLen[(run << 4) | size] + size;
+        run = 0;
+    }
+    if (run > 0 || block.last < 63)
+        bits += acLen[0x00];        // EOB
 
-    return false;
+    return bits;
 }
 
 /**
- * this function will call the SWJpegEncoder to encode one jpeg.
- * it's the main function of the threadLoop
+ * code length of every symbol of a huffman table, 16 for unused symbols
+ */
+void JpegRateEstimator::codeLengths(const JHUFF_TBL *table, unsigned char *lengths)
+{
+    int k = 0;
+
+    memset(lengths, 16, 256);
+    for (int len = 1; len <= 16; len++)
+        for (int i = 0; i < table->bits[len]; i++)
+            lengths[table->huffval[k++]] = len;
+}
+
+/**
+ * estimates the coded size of the biggest band at a quality
  *
- * \return 0 if encoding was successful
- * \return -1 if encoding failed
+ * \return the size in bytes, margin and jpeg header included
  */
-int SWJpegEncoder::CodecWorkerThread::swEncode(void)
+int JpegRateEstimator::bandSize(int quality)
 {
-    LOG1("@%s, line:%d, in CodecWorkerThread", __FUNCTION__, __LINE__);
-    int status = 0;
-    Codec encoder(mCfg.quality);
+    struct jpeg_compress_struct cInfo;
+    struct jpeg_error_mgr jErr;
+    Band *bands = mBands.editArray();
+    double bits[2] = { 0, 0 };
+    int sampled[2] = { 0, 0 };
+    double maxSize = 0;
+
+    // libjpeg knows the tables, no encode is started
+    memset(&cInfo, 0, sizeof(cInfo));
+    cInfo.err = jpeg_std_error(&jErr);
+    jpeg_create_compress(&cInfo);
+    cInfo.input_components = 3;
+    cInfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&cInfo);
+    jpeg_set_quality(&cInfo, CLIP(quality, 100, 1), TRUE);
+    for (int c = 0; c < 2; c++) {
+        codeLengths(cInfo.dc_huff_tbl_ptrs[c], mDcLen[c]);
+        codeLengths(cInfo.ac_huff_tbl_ptrs[c], mAcLen[c]);
+        for (int k = 0; k < 64; k++)
+            mQScale[c][k] = 0.25f / cInfo.quant_tbl_ptrs[c]->quantval[JPEG_ZIGZAG[k]];
+    }
+    jpeg_destroy_compress(&cInfo);
+
+    for (unsigned int i = 0; i < mBands.size(); i++)
+        bands[i].bits[0] = bands[i].bits[1] = 0;
+
+    for (int i = 0; i < mBlockCount; i++) {
+        const Block &block = mBlocks[i];
+        const int c = block.chroma;
+        const int blockBitCount = blockBits(block, mQScale[c], mDcLen[c], mAcLen[c]);
+        bands[block.band].bits[c] += blockBitCount;
+        bits[c] += blockBitCount;
+        sampled[c]++;
+    }
 
-    encoder.init();
-    encoder.setJpegQuality(mCfg.quality);
-    status = encoder.configEncoding(mCfg.width, mCfg.height,
-                            (JSAMPLE *)mCfg.outBuf, mCfg.outBufSize);
-    if (status)
-        goto exit;
+    for (unsigned int i = 0; i < mBands.size(); i++) {
+        const Band &band = bands[i];
+        double size = 0;
+        for (int c = 0; c < 2; c++) {
+            // a band too short to be sampled gets the average of the picture
+            if (band.sampled[c] > 0)
+                size += band.bits[c] / band.sampled[c] * band.blocks[c] / 8;
+            else if (sampled[c] > 0)
+                size += bits[c] / sampled[c] * band.blocks[c] / 8;
+        }
+        maxSize = MAX(maxSize, size);
+    }
 
-    status = encoder.doJpegEncoding(mCfg.inBufY, mCfg.inBufUV, mCfg.fourcc);
-    if (status)
-        goto exit;
+    return (int)(maxSize * (100 + RATE_MARGIN_PERCENT) / 100) + JPEG_HEADER_SIZE;
+}
 
-exit:
-    if (status)
-        mDataSize = -1;
-    else
-        encoder.getJpegSize(&mDataSize);
+/**
+ * estimates the scratch size encodeToScratch() needs for a picture
+ *
+ * The coded size of every slice is estimated at the quality from a sample
+ * of the picture, with a margin. A jpeg that outgrows the scratch anyway
+ * only costs a spill buffer and a copy, not a second encode.
+ *
+ * \param in: input buffer description
+ * \param quality: the quality the picture will be encoded at
+ * \return the scratch size in bytes
+ * \return -1 if the input is invalid or there is no memory for the estimate
+ */
+int SWJpegEncoder::estimateSize(const InputBuffer &in, int quality)
+{
+    nsecs_t startTime = systemTime();
+    JpegRateEstimator estimator;
+    InputBuffer src;
+    int bands = 1;
+    int bandMcuRows = (in.height + NV12_MCU_SIZE - 1) / NV12_MCU_SIZE;
+    int size;
 
-    encoder.deInit();
+    if (prepareInput(in, src) < 0)
+        return -1;
 
-    return (status ? -1 : 0);
+    const bool multiThread = isNeedMultiThreadEncoding(in.width, in.height);
+    if (multiThread)
+        sliceLayout(in.width, in.height, bands, bandMcuRows);
+
+    if (estimator.sample(src, bands, bandMcuRows * NV12_MCU_SIZE) < 0) {
+        ALOGE("@%s, no memory for the rate estimate", __FUNCTION__);
+        return -1;
+    }
+    // every slice gets the same part of the scratch
+    size = estimator.bandSize(quality) * bands;
+    if (multiThread)
+        size += DEST_BUF_OFFSET;
+
+    LOG1("@%s, %d bytes for %dx%d at quality %d, consume:%ums", __FUNCTION__, size,
+         in.width, in.height, quality, (unsigned)((systemTime() - startTime) / 1000000));
+    return size;
 }
 
 SWJpegEncoder::Codec::Codec(int quality) :
@@ -481,6 +1048,13 @@ void SWJpegEncoder::Codec::init(void)
 void SWJpegEncoder::Codec::deInit(void)
 {
     LOG1("@%s", __FUNCTION__);
+    JpegDestMgrPtr dest = (JpegDestMgrPtr)mCInfo.dest;
+
+    // the dest manager is freed with libjpeg, the spill is not
+    if (dest != NULL) {
+        free(dest->spill);
+        dest->spill = NULL;
+    }
     jpeg_destroy_compress(&mCInfo);
 }
 
@@ -543,69 +1117,84 @@ configEncoding(int width, int height, void *jpegBuf, int jpegBufSize)
 /**
  * Do the SW jpeg encoding.
  *
- * it will convert the YUV data to P411 and then do jpeg encoding.
+ * The source is fed to libjpeg one MCU row (16 lines) at a time. NV12/NV21
+ * luma rows are passed as is, the chroma of the MCU row is deinterleaved
+ * into a small staging buffer right before it is handed over, so the frame
+ * is read once and no full-frame P411 copy is made. YUYV MCU rows are
+ * converted to P411 into the same staging buffer.
  *
  * \param y_buf: the source buffer for Y data
  * \param uv_buf: the source buffer for UV data,
  * \it could be NULL if fourcc is V4L2_PIX_FMT_YUYV
+ * \param fourcc: the source format
+ * \param bpl: bytes per line of the source planes, 0 if they are not padded
  * \return 0 if the encoding is successful.
  * \return -1 if the encoding fails.
  */
 int SWJpegEncoder::Codec::
-doJpegEncoding(const void *y_buf, const void *uv_buf, int fourcc)
+doJpegEncoding(const void *y_buf, const void *uv_buf, int fourcc, int bpl)
 {
     LOG1("@%s, fourcc:%d, yuyv:%d, nv12:%d", __FUNCTION__, fourcc, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_NV12);
 
     unsigned char *srcY = NULL;
     unsigned char *srcUV = NULL;
-    unsigned char *p411 = NULL;
-    JSAMPROW y[16],u[16],v[16];
+    unsigned char *mcuRow = NULL;
+    unsigned char *mcuY, *mcuU, *mcuV;
+    JSAMPROW y[MCU_LINES], u[MCU_LINES / 2], v[MCU_LINES / 2];
     JSAMPARRAY data[3];
-    int i, j, width, height;
+    int i, j, rows, yBpl, width, height;
+
+    if (fourcc != V4L2_PIX_FMT_YUYV && fourcc != V4L2_PIX_FMT_NV12 && fourcc != V4L2_PIX_FMT_NV21) {
+        ALOGE("%s Unsupported fourcc %s 0x%x", __func__,v4l2Fmt2Str(fourcc), fourcc);
+        return -1;
+    }
 
     width = mCInfo.image_width;
     height = mCInfo.image_height;
     srcY = (unsigned char*)y_buf;
     srcUV = (unsigned char*)uv_buf;
-    p411 = (unsigned char*)malloc(width * height * 3 / 2);
-    if (NULL == p411) {
-        ALOGE("@%s, line:%d, malloc fail", __FUNCTION__, __LINE__);
-        return -1;
-    }
+    if (bpl == 0)
+        bpl = (fourcc == V4L2_PIX_FMT_YUYV) ? width * 2 : width;
 
-    switch (fourcc) {
-    case V4L2_PIX_FMT_YUYV:
-        YUY2ToP411(width, height, srcY, p411);
-        break;
-    case V4L2_PIX_FMT_NV12:
-        NV12ToP411Separate(width, height, srcY, srcUV, p411);
-        break;
-    case V4L2_PIX_FMT_NV21:
-        NV21ToP411Separate(width, height, srcY, srcUV, p411);
-        break;
-    defaut:
-        ALOGE("%s Unsupported fourcc %s 0x%x", __func__,v4l2Fmt2Str(fourcc), fourcc);
+    // one MCU row of P411, plus slack for libjpeg reading whole 8x8 blocks
+    mcuRow = (unsigned char*)malloc(width * MCU_LINES * 3 / 2 + MCU_LINES);
+    if (NULL == mcuRow) {
+        ALOGE("@%s, line:%d, malloc fail", __FUNCTION__, __LINE__);
         return -1;
     }
 
     data[0] = y;
     data[1] = u;
     data[2] = v;
-    for (i = 0; i < height; i += 16) {
-        for (j = 0; j < 16 && (i + j) < height; j++) {
-            y[j] = p411 + width * (j + i);
-            if (j % 2 == 0) {
-                u[j / 2] = p411 + width * height + width / 2 * ((j + i) / 2);
-                v[j / 2] = p411 + width * height + width * height / 4 + width / 2 * ((j + i) / 2);
-            }
+    for (i = 0; i < height; i += MCU_LINES) {
+        rows = MIN(MCU_LINES, height - i);
+        mcuY = mcuRow;
+        mcuU = mcuY + width * rows;
+        mcuV = mcuU + width * rows / 4;
+
+        if (fourcc == V4L2_PIX_FMT_YUYV) {
+            YUY2ToP411(width, rows, bpl, srcY + i * bpl, mcuRow);
+            yBpl = width;
+        } else {
+            mcuY = srcY + i * bpl;
+            yBpl = bpl;
+            splitNV12Chroma(fourcc, width, rows / 2, bpl, srcUV + i / 2 * bpl, mcuU, mcuV);
         }
-        jpeg_write_raw_data(&mCInfo, data, 16);
+
+        // the bottom MCU row repeats the last line of the image
+        for (j = 0; j < MCU_LINES; j++)
+            y[j] = mcuY + yBpl * MIN(j, rows - 1);
+        for (j = 0; j < MCU_LINES / 2; j++) {
+            u[j] = mcuU + width / 2 * MIN(j, MAX(rows / 2 - 1, 0));
+            v[j] = mcuV + width / 2 * MIN(j, MAX(rows / 2 - 1, 0));
+        }
+        jpeg_write_raw_data(&mCInfo, data, MCU_LINES);
     }
 
     jpeg_finish_compress(&mCInfo);
 
-    free(p411);
-    p411 = NULL;
+    free(mcuRow);
+    mcuRow = NULL;
 
     return 0;
 }
@@ -624,6 +1213,23 @@ void SWJpegEncoder::Codec::getJpegSize(int *jpegSize)
     *jpegSize = (false == dest->encodeSuccess) ? -1 : dest->codedSize;
 }
 
+/**
+ * Takes over the spill buffer of the encode
+ *
+ * \param spill: returns the buffer with the end of the jpeg data, NULL if
+ *               it all fit in the destination buffer. The caller frees it.
+ * \return the jpeg data in the spill buffer
+ */
+int SWJpegEncoder::Codec::takeSpill(unsigned char **spill)
+{
+    JpegDestMgrPtr dest = (JpegDestMgrPtr)mCInfo.dest;
+    int size = dest->spill ? dest->spillUsed : 0;
+
+    *spill = dest->spill;
+    dest->spill = NULL;
+    return size;
+}
+
 /**
  * Setup the jpeg destination buffer manager
  *
@@ -678,16 +1284,20 @@ void SWJpegEncoder::Codec::initDestination(j_compress_ptr cInfo)
 
     dest->pub.next_output_byte = dest->outJpegBuf;
     dest->pub.free_in_buffer = dest->outJpegBufSize;
+    dest->spill = NULL;
+    dest->spillSize = 0;
+    dest->spillUsed = 0;
     dest->encodeSuccess = true;
 }
 
 /**
  * Empty the output buffer
  *
- * The function should not be called,
- * because we should allocate enough memory for the jpeg destination buffer
+ * It is called when the jpeg destination buffer is full. The encoding goes
+ * on in a heap spill buffer, which grows when it is full too, so the
+ * picture does not have to be encoded again into a bigger buffer.
  * If we return FALSE, the libjpeg will terminate, so return TRUE always.
- * But when the function is called, the encoding failing will be recorded.
+ * If the spill cannot be allocated, the encoding failing will be recorded.
  *
  * \param cInfo: the compress pointer
  * \return TRUE if it is successful.
@@ -696,15 +1306,31 @@ void SWJpegEncoder::Codec::initDestination(j_compress_ptr cInfo)
 boolean SWJpegEncoder::Codec::emptyOutputBuffer(j_compress_ptr cInfo)
 {
     LOG1("@%s", __FUNCTION__);
-    ALOGE("@%s, line:%d, buffer overflow!", __FUNCTION__, __LINE__);
     JpegDestMgrPtr dest = (JpegDestMgrPtr)cInfo->dest;
+    const int size = dest->spill ? dest->spillSize * 2
+                                 : MAX(dest->outJpegBufSize / 4, MIN_SPILL_SIZE);
+    JSAMPLE *spill = NULL;
+
+    if (dest->encodeSuccess)
+        spill = (JSAMPLE *)realloc(dest->spill, size);
+    if (spill == NULL) {
+        ALOGE("@%s, line:%d, buffer overflow!", __FUNCTION__, __LINE__);
+        free(dest->spill);
+        dest->spill = NULL;
+        dest->spillSize = 0;
+        /* re-cfg the buffer info */
+        dest->pub.next_output_byte = dest->outJpegBuf;
+        dest->pub.free_in_buffer = dest->outJpegBufSize;
+        dest->encodeSuccess = false;
+        return TRUE; /* if return FALSE, the total taking picture will fail */
+    }
 
-    /* re-cfg the buffer info */
-    dest->pub.next_output_byte = dest->outJpegBuf;
-    dest->pub.free_in_buffer = dest->outJpegBufSize;
-    dest->encodeSuccess = false;
+    dest->pub.next_output_byte = spill + dest->spillSize;
+    dest->pub.free_in_buffer = size - dest->spillSize;
+    dest->spill = spill;
+    dest->spillSize = size;
 
-    return TRUE; /* if return FALSE, the total taking picture will fail */
+    return TRUE;
 }
 
 /**
@@ -721,7 +1347,12 @@ void SWJpegEncoder::Codec::termDestination(j_compress_ptr cInfo)
     LOG1("@%s", __FUNCTION__);
     JpegDestMgrPtr dest = (JpegDestMgrPtr)cInfo->dest;
 
-    dest->codedSize = dest->outJpegBufSize - dest->pub.free_in_buffer;
+    if (dest->spill) {
+        dest->spillUsed = dest->spillSize - dest->pub.free_in_buffer;
+        dest->codedSize = dest->outJpegBufSize + dest->spillUsed;
+    } else {
+        dest->codedSize = dest->outJpegBufSize - dest->pub.free_in_buffer;
+    }
     LOG1("@%s, line:%d, codedSize:%d", __FUNCTION__, __LINE__, dest->codedSize);
 }
 
@@ -34,6 +34,7 @@
 #include <utils/Errors.h>
 #include <utils/Vector.h>
 #include <utils/threads.h>
+#include <utils/Timers.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -48,8 +49,13 @@ namespace android {
  * \class SWJpegEncoder
  *
  * This class is used for sw jpeg encoder.
- * It will use single or multi thread to do the sw jpeg encoding
- * It just support NV12 input currently.
+ * It will use single or multi thread to do the sw jpeg encoding.
+ * Large images are split into slices which are encoded on the WorkerPool
+ * threads. It supports NV12, NV21 and YUYV input.
+ * estimateSize() gives the scratch size a picture needs at a quality, from
+ * a rate estimate on a sample of the picture. If the jpeg outgrows the
+ * scratch of a two step encode anyway, the rest of it is kept in a heap
+ * spill buffer instead of encoding the picture again.
  */
 class SWJpegEncoder {
 public:
@@ -58,16 +64,20 @@ public:
 
     struct InputBuffer {
         unsigned char *buf;
+        unsigned char *uvBuf;  /*!< NV12/NV21 chroma plane, NULL if it follows the luma plane */
         int width;
         int height;
+        int bpl;  /*!< bytes per line of both planes, 0 if the lines are not padded */
         int fourcc;
         int size;
 
         void clear()
         {
             buf = NULL;
+            uvBuf = NULL;
             width = 0;
             height = 0;
+            bpl = 0;
             fourcc = 0;
             size = 0;
         }
@@ -95,6 +105,27 @@ public:
     // Encoder functions
     int encode(const InputBuffer &in, const OutputBuffer &out);
 
+    /*
+        Two step encoding, for writing the jpeg into a buffer that can only
+        be allocated once its size is known: encodeToScratch() encodes using
+        out as scratch memory and returns the jpeg size, writeJpeg() then
+        writes the jpeg to its final place without an extra copy.
+        estimateSize() returns the scratch size to pass to encodeToScratch()
+        for a picture at a quality.
+    */
+    int encodeToScratch(const InputBuffer &in, const OutputBuffer &out);
+    int writeJpeg(unsigned char *dst);
+    int estimateSize(const InputBuffer &in, int quality);
+
+    /*
+        Benchmarking hooks. setThreads() overrides the number of slices,
+        0 picks one per core above 1.3MP, 1 forces the single thread path.
+        getSliceTimes() returns the encode time of each slice of the last
+        multi thread encodeToScratch(), until writeJpeg() is called.
+    */
+    void setThreads(int threads) { mThreads = threads; }
+    int getSliceTimes(nsecs_t *times, int maxCount) const;
+
 // prevent copy constructor and assignment operator
 private:
     SWJpegEncoder(const SWJpegEncoder& other);
@@ -104,62 +135,53 @@ private:
     int mJpegSize;  /*!< it's used to store jpeg size */
 
     bool isNeedMultiThreadEncoding(int width, int height);
+    void clearOutput();
     int swEncode(const InputBuffer &in, const OutputBuffer &out);
     int swEncodeMultiThread(const InputBuffer &in, const OutputBuffer &out);
 
     int mTotalWidth;  /*!< the final jpeg width */
     int mTotalHeight;  /*!< the final jpeg height */
-    unsigned char *mDstBuf;  /*!< the dest buffer to store the final jpeg */
+    unsigned char *mDstBuf;  /*!< the scratch buffer the jpeg is encoded into */
     unsigned int mCPUCoresNum;  /*!< use to remember the CPU Cores number */
+    int mThreads;  /*!< slice count requested with setThreads(), 0 for automatic */
+    unsigned char *mSpill;  /*!< single thread: the jpeg data that did not fit in the scratch */
+    int mSpillSize;
 
 private:
     /**
-     * \class CodecWorkerThread
+     * \struct Slice
      *
-     * This class will create one thread to do one sw jpeg encoder.
-     * It will call the SWJpegEncoderWrapper directly.
+     * One horizontal slice of a multi thread encode. Every slice is coded
+     * as a complete jpeg into its own part of the output buffer, what does
+     * not fit there goes to its spill buffer. The slices are merged into one jpeg with restart markers between them.
      */
-    class CodecWorkerThread : private Thread, public virtual RefBase {
-    public:
-        struct CodecConfig {
-            // input buffer configuration
-            int width;
-            int height;
-            int fourcc;
-            void *inBufY;
-            void *inBufUV;
-            // output buffer configuration
-            int quality;
-            void *outBuf;
-            int outBufSize;
-        };
-
-        CodecWorkerThread();
-        ~CodecWorkerThread();
-
-        void setConfig(CodecConfig &cfg) {mCfg = cfg;}
-        void getConfig(CodecConfig *cfg){*cfg = mCfg;}
-        status_t runThread(const char *name);
-        void waitThreadFinish(void);
-        int getJpegDataSize(void);
-    private:
-        int mDataSize;  /*!< the jpeg data size in one thread */
-        CodecConfig mCfg;  /*!< the cfg in one thread */
-    private:
-        virtual bool threadLoop();
-        int swEncode(void);
+    struct Slice {
+        // input buffer configuration
+        int width;
+        int height;
+        int fourcc;
+        int bpl;
+        void *inBufY;
+        void *inBufUV;
+        // output buffer configuration
+        int quality;
+        unsigned char *outBuf;
+        int outBufSize;
+        int dataSize;  /*!< the jpeg data size of the slice, spill included, -1 on failure */
+        unsigned char *spill;  /*!< the end of the jpeg data if it did not fit in outBuf */
+        int spillSize;
+        nsecs_t duration;  /*!< encode time of the slice */
     };
 
-private:
-    void init(unsigned int threadNum = 1);
-    void deInit(void);
-    void config(const InputBuffer &in, const OutputBuffer &out);
-    int doJpegEncodingMultiThread(void);
-    int mergeJpeg(void);
+    void sliceLayout(int width, int height, int &sliceNum, int &sliceMcuRows);
+    int config(const InputBuffer &in, const OutputBuffer &out);
+    static void encodeSlices(void *context, int first, int last);
+    int encodeSlice(Slice &slice);
+    int mergeJpeg(unsigned char *dst);
 
-    Vector<sp<CodecWorkerThread> > mSwJpegEncoder;
-    static const unsigned int MAX_THREAD_NUM = 8; /*!< the same as max jpeg restart time */
-    static const unsigned int MIN_THREAD_NUM = 1;
+    Vector<Slice> mSlices;
+    int mRestartInterval;  /*!< MCUs per slice */
+    static const int MAX_RESTART_INTERVAL = 0xFFFF; /*!< MCUs, the DRI field is 16 bit */
 
     /*!< it's used to use one buffer to merge the multi jpeg data to one jpeg data */
     static const unsigned int DEST_BUF_OFFSET = 1024;
@@ -184,9 +206,11 @@ private:
         /*
             if fourcc is V4L2_PIX_FMT_NV12, y_buf and uv_buf must be passed
             if fourcc is V4L2_PIX_FMT_YUYV, y_buf must be passed, uv_buf could be NULL
+            bpl is the bytes per line of the source planes, 0 if not padded
         */
-        int doJpegEncoding(const void* y_buf, const void* uv_buf = NULL, int fourcc = V4L2_PIX_FMT_NV12);
+        int doJpegEncoding(const void* y_buf, const void* uv_buf = NULL, int fourcc = V4L2_PIX_FMT_NV12, int bpl = 0);
         void getJpegSize(int *jpegSize);
+        int takeSpill(unsigned char **spill);
 
     // prevent copy constructor and assignment operator
     private:
@@ -198,14 +222,19 @@ private:
             struct jpeg_destination_mgr pub;
             JSAMPLE *outJpegBuf;  /*!< jpeg output buffer */
             int outJpegBufSize;  /*!< jpeg output buffer size */
-            int codedSize;  /*!< the final encoded out jpeg size */
-            bool encodeSuccess;  /*!< if buffer overflow, it will be set to false */
+            int codedSize;  /*!< the final encoded out jpeg size, spill included */
+            JSAMPLE *spill;  /*!< heap buffer the jpeg continues in once outJpegBuf is full */
+            int spillSize;  /*!< allocated size of spill */
+            int spillUsed;  /*!< jpeg data in spill */
+            bool encodeSuccess;  /*!< set to false if the spill cannot be allocated */
         } JpegDestMgr, *JpegDestMgrPtr;
 
         struct jpeg_compress_struct mCInfo;
         struct jpeg_error_mgr mJErr;
         int mJpegQuality;
         static const unsigned int SUPPORTED_FORMAT = JCS_YCbCr;
+        static const int MCU_LINES = 16;  /*!< lines per MCU row, 4:2:0 subsampling */
+        static const int MIN_SPILL_SIZE = 64 * 1024;
 
         int setupJpegDestMgr(j_compress_ptr cInfo, JSAMPLE *jpegBuf, int jpegBufSize);
         // the below three functions are for the dest buffer manager.
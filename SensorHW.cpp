@@ -1208,6 +1208,7 @@ status_t SensorHW::observe(IAtomIspObserver::Message *msg)
     msg->data.event.timestamp.tv_sec  = event.timestamp.tv_sec;
     msg->data.event.timestamp.tv_usec = event.timestamp.tv_nsec / 1000;
     msg->data.event.sequence = event.sequence;
+    PerformanceTraces::FrameTrace::event("SOF", -1, event.sequence);
 
     // Process exposure synchronization
     ts = TIMEVAL2USECS(&msg->data.event.timestamp);
@@ -213,7 +213,7 @@ status_t VideoThread::handleMessageDequeueRecording(MessageDequeueRecording *msg
                 mLock.lock();
                 // Mirror the recording buffer if mirroring is enabled
                 if (mMirror) {
-                    mirrorBuffer(&buff, mRecOrientation, mCamOrientation);
+                    mirrorBuffer(&buff, mRecOrientation, mCamOrientation, true);
                 }
 
                 mRecordingBuffers.push(buff);
@@ -617,7 +617,7 @@ status_t VideoThread::handleMessagePushFrame(MessagePushFrame *msg)
         mLock.lock();
         // Mirror the recording buffer if mirroring is enabled
         if (mMirror) {
-            mirrorBuffer(msg->buf, mRecOrientation, mCamOrientation);
+            mirrorBuffer(msg->buf, mRecOrientation, mCamOrientation, true);
         }
 
         // process video buffers
@@ -20,7 +20,7 @@
 #include <utils/Timers.h>
 #include <utils/threads.h>
 #include <camera/CameraParameters.h>
-#include "MessageQueue.h"
+#include "RingMessageQueue.h"
 #include "AtomCommon.h"
 #include "ICameraHwControls.h"
 #include "ICallbackPreview.h"
@@ -170,7 +170,7 @@ private:
 private:
 
     AtomISP *mIsp;
-    MessageQueue<Message, MessageId> mMessageQueue;
+    RingMessageQueue<Message, MessageId> mMessageQueue;
     bool mThreadRunning;
     Mutex mLock;
     Condition mFrameCondition;
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "Camera_WorkerPool"
+
+#include <pthread.h>
+#include <utils/threads.h>
+
+#include "LogHelper.h"
+#include "AtomCommon.h"
+#include "PlatformData.h"
+#include "WorkerPool.h"
+
+namespace android {
+
+static const unsigned int MAX_WORKERS = 7;
+
+/*
+ * A job submitted with runStripes(), allocated on the stack of the
+ * submitter. Stripes are handed out by incrementing nextStripe, pending
+ * counts the stripes that have not finished yet. All fields but the
+ * constant ones are protected by sLock.
+ */
+struct Job {
+    WorkerPool::StripeFunction function;
+    void *context;
+    int rows;
+    int stripeRows;
+    int stripes;
+    int nextStripe;
+    int pending;
+    Condition done;
+    Job *next;
+};
+
+/*
+ * Jobs with stripes left to hand out, oldest first. Workers serve the
+ * oldest job first, so a job is never starved by later submitters.
+ */
+static Mutex sLock;
+static Condition *sWorkCondition = NULL;    // never destroyed, idle workers wait on it
+static Job *sQueueHead = NULL;
+static Job *sQueueTail = NULL;
+
+static unsigned int sWorkerCount = 0;
+static pthread_once_t sInitOnce = PTHREAD_ONCE_INIT;
+
+// called with sLock held
+static void dequeueJob(Job *job)
+{
+    Job **link = &sQueueHead;
+    Job *prev = NULL;
+    while (*link != job) {
+        prev = *link;
+        link = &(*link)->next;
+    }
+    *link = job->next;
+    if (sQueueTail == job)
+        sQueueTail = prev;
+    job->next = NULL;
+}
+
+/**
+ * Runs one stripe of job, which must have stripes left. The job leaves
+ * the queue when its last stripe is handed out.
+ * Called and returns with sLock held.
+ */
+static void processStripe(Job *job)
+{
+    const int stripe = job->nextStripe++;
+    const int first = stripe * job->stripeRows;
+    const int last = MIN(first + job->stripeRows, job->rows);
+    if (job->nextStripe == job->stripes)
+        dequeueJob(job);
+
+    sLock.unlock();
+    job->function(job->context, first, last);
+    sLock.lock();
+
+    if (--job->pending == 0)
+        job->done.signal();
+}
+
+class WorkerThread : public Thread {
+public:
+    WorkerThread() : Thread(false) {}
+
+private:
+    virtual bool threadLoop()
+    {
+        Mutex::Autolock lock(sLock);
+        while (sQueueHead == NULL)
+            sWorkCondition->wait(sLock);
+        processStripe(sQueueHead);
+        return true;
+    }
+};
+
+// the workers live as long as the process, a running Thread keeps a
+// reference to itself so they need not be stored anywhere
+static void initWorkers()
+{
+    const unsigned int cores = PlatformData::getNumOfCPUCores();
+    const unsigned int wanted = MIN(cores > 1 ? cores - 1 : 0, MAX_WORKERS);
+
+    sWorkCondition = new Condition();
+
+    for (unsigned int i = 0; i < wanted; i++) {
+        sp<WorkerThread> worker = new WorkerThread();
+        if (worker->run("CamHAL_WORKER") != NO_ERROR) {
+            ALOGW("@%s: could not start worker %u", __FUNCTION__, i);
+            break;
+        }
+        sWorkerCount++;
+    }
+    LOG1("@%s: %u cores, %u workers", __FUNCTION__, cores, sWorkerCount);
+}
+
+int WorkerPool::minStripeRows(int bytesPerRow, int alignment)
+{
+    int rows = MIN_STRIPE_BYTES / MAX(bytesPerRow, 1);
+    rows = MAX(rows, 1);
+    return (rows + alignment - 1) / alignment * alignment;
+}
+
+void WorkerPool::runStripes(StripeFunction function, void *context,
+                            int rows, int alignment, int minStripeRows)
+{
+    pthread_once(&sInitOnce, initWorkers);
+
+    alignment = MAX(alignment, 1);
+    minStripeRows = MAX(minStripeRows, alignment);
+    const int threads = MIN((int) sWorkerCount + 1, rows / minStripeRows);
+
+    // too small or no workers: run it here
+    if (threads < 2) {
+        LOG2("@%s: %d rows inline, %u workers, min stripe %d rows", __FUNCTION__,
+             rows, sWorkerCount, minStripeRows);
+        function(context, 0, rows);
+        return;
+    }
+
+    int stripeRows = (rows + threads - 1) / threads;
+    stripeRows = (stripeRows + alignment - 1) / alignment * alignment;
+
+    Job job;
+    job.function = function;
+    job.context = context;
+    job.rows = rows;
+    job.stripeRows = stripeRows;
+    job.stripes = (rows + stripeRows - 1) / stripeRows;
+    job.nextStripe = 0;
+    job.pending = job.stripes;
+    job.next = NULL;
+
+    Mutex::Autolock lock(sLock);
+    if (sQueueTail != NULL)
+        sQueueTail->next = &job;
+    else
+        sQueueHead = &job;
+    sQueueTail = &job;
+    sWorkCondition->broadcast();
+
+    // the submitting thread works on its own job until all of its stripes
+    // are handed out, so the job completes even when every worker is busy
+    // with other jobs, or the caller is itself a stripe of another job
+    while (job.nextStripe < job.stripes)
+        processStripe(&job);
+    while (job.pending > 0)
+        job.done.wait(sLock);
+}
+
+}; // namespace android
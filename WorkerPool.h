@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ANDROID_LIBCAMERA_WORKER_POOL_H
+#define ANDROID_LIBCAMERA_WORKER_POOL_H
+
+namespace android {
+
+/**
+ * \class WorkerPool
+ *
+ * Process wide pool of worker threads for row parallel image kernels.
+ *
+ * A job is a function that processes the rows [first, last) of an image.
+ * runStripes() splits the rows into one horizontal stripe per CPU core,
+ * runs the stripes on the pool threads and the calling thread, and returns
+ * when all of them are done.
+ *
+ * The threads are created on first use, one less than the number of online
+ * cores. Jobs from several threads can run at the same time: they are
+ * queued and the workers take stripes from the oldest job first. A
+ * submitter always processes stripes of its own job, so it never waits for
+ * other jobs to finish, and runStripes() can be called from inside a stripe
+ * function. Jobs too small to split run on the calling thread.
+ */
+class WorkerPool {
+public:
+    typedef void (*StripeFunction)(void *context, int first, int last);
+
+    /**
+     * Stripes smaller than this are not worth waking up a thread for.
+     * Kernels use it to derive the minStripeRows of their jobs.
+     */
+    static const int MIN_STRIPE_BYTES = 256 * 1024;
+
+    /**
+     * Runs function over the rows [0, rows) in parallel.
+     *
+     * \param function stripe function, called with the row range to process
+     * \param context passed as is to the stripe function
+     * \param rows total number of rows
+     * \param alignment every stripe but the last starts and ends at a
+     *        multiple of this, e.g. 2 for kernels that also process the
+     *        subsampled chroma rows of a 4:2:0 image
+     * \param minStripeRows minimum rows in a stripe
+     */
+    static void runStripes(StripeFunction function, void *context,
+                           int rows, int alignment = 1, int minStripeRows = 1);
+
+    /**
+     * Returns the minimum stripe height for a kernel that touches
+     * bytesPerRow bytes per row, rounded up to alignment.
+     */
+    static int minStripeRows(int bytesPerRow, int alignment = 1);
+};
+
+}; // namespace android
+
+#endif // ANDROID_LIBCAMERA_WORKER_POOL_H
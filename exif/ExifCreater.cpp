@@ -36,10 +36,22 @@ ExifCreater::ExifCreater()
 {
     m_thumbBuf = NULL;
     m_thumbSize = 0;
+    m_template = NULL;
+    m_templateSize = 0;
+    m_templateTagOffset = 0;
+    m_templateNextIfdOffset = 0;
+    m_templateMakerNoteOffset = 0;
+    m_templateValid = false;
+    memset(&m_templateInfo, 0, sizeof(m_templateInfo));
+    m_patchCount = 0;
+    m_patchOverflow = false;
+    m_patchDstBase = NULL;
+    m_patchSrcBase = NULL;
 }
 
 ExifCreater::~ExifCreater()
 {
+    delete [] m_template;
 }
 
 exif_status ExifCreater::setThumbData (const void *thumbBuf, unsigned int thumbSize)
@@ -62,20 +74,113 @@ bool ExifCreater::isThumbDataSet() const
     return m_thumbBuf != NULL;
 }
 
-// if exif tags size + thumbnail size is > 64K, it will disable thumbnail
-exif_status ExifCreater::makeExif (void *exifOut,
-                                        exif_attribute_t *exifInfo,
-                                        unsigned int *size)
+void ExifCreater::addPatch(const unsigned char *dst, const void *src, unsigned int len)
 {
-    ALOGV("makeExif start");
+    if (m_patchCount >= MAX_EXIF_PATCHES) {
+        // the template cannot be reused without this field
+        m_patchOverflow = true;
+        return;
+    }
+    m_patches[m_patchCount].dst = dst - m_patchDstBase;
+    m_patches[m_patchCount].src = (const unsigned char *)src - (const unsigned char *)m_patchSrcBase;
+    m_patches[m_patchCount].len = len;
+    m_patchCount++;
+}
 
-    unsigned char *pCur, *pApp1Start, *pIfdStart, *pGpsIfdPtr, *pNextIfdOffset;
-    unsigned int tmp, LongerTagOffset = 0, LongerTagOffsetWithoutThumbnail;
-    pApp1Start = pCur = (unsigned char *)exifOut;
+/**
+ * Checks whether exifInfo serializes to the same bytes as the cached
+ * template once the per shot fields are patched in, i.e. all the other
+ * attributes are equal and the patched fields still have the same size.
+ */
+bool ExifCreater::templateMatches(const exif_attribute_t *exifInfo) const
+{
+    if (!m_templateValid)
+        return false;
+
+    if (strlen((const char *)exifInfo->user_comment) !=
+        strlen((const char *)m_templateInfo.user_comment))
+        return false;
+    if ((exifInfo->exposure_time.den == 0) != (m_templateInfo.exposure_time.den == 0) ||
+        (exifInfo->shutter_speed.den == 0) != (m_templateInfo.shutter_speed.den == 0))
+        return false;
+
+    exif_attribute_t masked;
+    memcpy(&masked, exifInfo, sizeof(masked));
+    for (int i = 0; i < m_patchCount; i++) {
+        memcpy((unsigned char *)&masked + m_patches[i].src,
+               (const unsigned char *)&m_templateInfo + m_patches[i].src,
+               m_patches[i].len);
+    }
+    // the comment may have stale bytes after its terminator
+    memcpy(masked.user_comment, m_templateInfo.user_comment, sizeof(masked.user_comment));
+    // maker note contents are patched, the 1st IFD is always rewritten
+    masked.makerNoteData = m_templateInfo.makerNoteData;
+    masked.enableThumb = m_templateInfo.enableThumb;
+    masked.widthThumb = m_templateInfo.widthThumb;
+    masked.heightThumb = m_templateInfo.heightThumb;
+
+    return memcmp(&masked, &m_templateInfo, sizeof(masked)) == 0;
+}
 
-    // If we write the Makernote to APP2 segment,
-    // we need to skip some IFDs in the APP1 segment
-    bool makernoteToApp2 = PlatformData::extendedMakernote();
+void ExifCreater::saveTemplate(const unsigned char *pApp1Start,
+                               const exif_attribute_t *exifInfo,
+                               unsigned int LongerTagOffset,
+                               const unsigned char *pNextIfdOffset)
+{
+    m_templateValid = false;
+    if (m_patchOverflow)
+        return;
+
+    if (m_template == NULL) {
+        m_template = new unsigned char[TEMPLATE_SIZE];
+        if (m_template == NULL)
+            return;
+    }
+
+    // everything up to the 1st IFD, i.e. the APP1 header and the 0th,
+    // Exif and GPS IFDs with their values
+    m_templateSize = 4 + 6 + LongerTagOffset;
+    memcpy(m_template, pApp1Start, m_templateSize);
+    m_templateTagOffset = LongerTagOffset;
+    m_templateNextIfdOffset = pNextIfdOffset - pApp1Start;
+    memcpy(&m_templateInfo, exifInfo, sizeof(m_templateInfo));
+    m_templateValid = true;
+}
+
+void ExifCreater::applyPatches(unsigned char *pApp1Start, const exif_attribute_t *exifInfo) const
+{
+    for (int i = 0; i < m_patchCount; i++) {
+        memcpy(pApp1Start + m_patches[i].dst,
+               (const unsigned char *)exifInfo + m_patches[i].src,
+               m_patches[i].len);
+    }
+    if (m_templateMakerNoteOffset > 0) {
+        memcpy(pApp1Start + m_templateMakerNoteOffset,
+               exifInfo->makerNoteData, exifInfo->makerNoteDataSize);
+    }
+}
+
+/**
+ * Writes the APP1 header and the 0th, Exif and GPS IFDs, leaving room for
+ * the APP1 marker and size and the next IFD offset of the 0th IFD.
+ *
+ * While writing, it records where the per shot fields go, see addPatch().
+ */
+exif_status ExifCreater::writeIfds(unsigned char *pApp1Start,
+                                   exif_attribute_t *exifInfo,
+                                   bool makernoteToApp2,
+                                   unsigned int *tagOffset,
+                                   unsigned char **nextIfdOffset)
+{
+    unsigned char *pCur, *pIfdStart, *pGpsIfdPtr, *pNextIfdOffset;
+    unsigned int tmp, LongerTagOffset = 0;
+    pCur = pApp1Start;
+
+    m_patchDstBase = pApp1Start;
+    m_patchSrcBase = exifInfo;
+    m_patchCount = 0;
+    m_patchOverflow = false;
+    m_templateMakerNoteOffset = 0;
 
     // 2 Exif Identifier Code & TIFF Header
     pCur += 4;  // Skip 4 Byte for APP1 marker and length
@@ -122,6 +227,7 @@ exif_status ExifCreater::makeExif (void *exifOut,
                  strlen((char *)exifInfo->software) + 1, exifInfo->software, &LongerTagOffset, pIfdStart);
     writeExifIfd(&pCur, EXIF_TAG_DATE_TIME, EXIF_TYPE_ASCII,
                  20, exifInfo->date_time, &LongerTagOffset, pIfdStart);
+    addPatch(pIfdStart + LongerTagOffset - 20, exifInfo->date_time, 20);
     writeExifIfd(&pCur, EXIF_TAG_YCBCR_POSITIONING, EXIF_TYPE_SHORT,
                  1, exifInfo->ycbcr_positioning);
     writeExifIfd(&pCur, EXIF_TAG_EXIF_IFD_POINTER, EXIF_TYPE_LONG,
@@ -156,57 +262,79 @@ exif_status ExifCreater::makeExif (void *exifOut,
     if (exifInfo->exposure_time.den != 0) {
         writeExifIfd(&pCur, EXIF_TAG_EXPOSURE_TIME, EXIF_TYPE_RATIONAL,
                      1, &exifInfo->exposure_time, &LongerTagOffset, pIfdStart);
+        addPatch(pIfdStart + LongerTagOffset - 8, &exifInfo->exposure_time, 8);
     }
     writeExifIfd(&pCur, EXIF_TAG_FNUMBER, EXIF_TYPE_RATIONAL,
                  1, &exifInfo->fnumber, &LongerTagOffset, pIfdStart);
+    addPatch(pIfdStart + LongerTagOffset - 8, &exifInfo->fnumber, 8);
     writeExifIfd(&pCur, EXIF_TAG_EXPOSURE_PROGRAM, EXIF_TYPE_SHORT,
                  1, exifInfo->exposure_program);
+    addPatch(pCur - 4, &exifInfo->exposure_program, 2);
     writeExifIfd(&pCur, EXIF_TAG_ISO_SPEED_RATING, EXIF_TYPE_SHORT,
                  1, exifInfo->iso_speed_rating);
+    addPatch(pCur - 4, &exifInfo->iso_speed_rating, 2);
     writeExifIfd(&pCur, EXIF_TAG_EXIF_VERSION, EXIF_TYPE_UNDEFINED,
                  4, exifInfo->exif_version);
     writeExifIfd(&pCur, EXIF_TAG_DATE_TIME_ORG, EXIF_TYPE_ASCII,
                  20, exifInfo->date_time, &LongerTagOffset, pIfdStart);
+    addPatch(pIfdStart + LongerTagOffset - 20, exifInfo->date_time, 20);
     writeExifIfd(&pCur, EXIF_TAG_DATE_TIME_DIGITIZE, EXIF_TYPE_ASCII,
                  20, exifInfo->date_time, &LongerTagOffset, pIfdStart);
+    addPatch(pIfdStart + LongerTagOffset - 20, exifInfo->date_time, 20);
     writeExifIfd(&pCur, EXIF_TAG_COMPONENTS_CONFIGURATION, EXIF_TYPE_UNDEFINED,
                  4, exifInfo->components_configuration);
     if (exifInfo->shutter_speed.den != 0) {
         writeExifIfd(&pCur, EXIF_TAG_SHUTTER_SPEED, EXIF_TYPE_SRATIONAL,
                      1, (rational_t *)&exifInfo->shutter_speed, &LongerTagOffset, pIfdStart);
+        addPatch(pIfdStart + LongerTagOffset - 8, &exifInfo->shutter_speed, 8);
     }
     writeExifIfd(&pCur, EXIF_TAG_APERTURE, EXIF_TYPE_RATIONAL,
                  1, &exifInfo->aperture, &LongerTagOffset, pIfdStart);
+    addPatch(pIfdStart + LongerTagOffset - 8, &exifInfo->aperture, 8);
     writeExifIfd(&pCur, EXIF_TAG_BRIGHTNESS, EXIF_TYPE_SRATIONAL,
                  1, (rational_t *)&exifInfo->brightness, &LongerTagOffset, pIfdStart);
+    addPatch(pIfdStart + LongerTagOffset - 8, &exifInfo->brightness, 8);
     writeExifIfd(&pCur, EXIF_TAG_EXPOSURE_BIAS, EXIF_TYPE_SRATIONAL,
                  1, (rational_t *)&exifInfo->exposure_bias, &LongerTagOffset, pIfdStart);
+    addPatch(pIfdStart + LongerTagOffset - 8, &exifInfo->exposure_bias, 8);
     writeExifIfd(&pCur, EXIF_TAG_MAX_APERTURE, EXIF_TYPE_RATIONAL,
                  1, &exifInfo->max_aperture, &LongerTagOffset, pIfdStart);
+    addPatch(pIfdStart + LongerTagOffset - 8, &exifInfo->max_aperture, 8);
     writeExifIfd(&pCur, EXIF_TAG_SUBJECT_DISTANCE, EXIF_TYPE_RATIONAL,
                  1, &exifInfo->subject_distance, &LongerTagOffset, pIfdStart);
     writeExifIfd(&pCur, EXIF_TAG_METERING_MODE, EXIF_TYPE_SHORT,
                  1, exifInfo->metering_mode);
+    addPatch(pCur - 4, &exifInfo->metering_mode, 2);
     writeExifIfd(&pCur, EXIF_TAG_LIGHT_SOURCE, EXIF_TYPE_SHORT,
                  1, exifInfo->light_source);
+    addPatch(pCur - 4, &exifInfo->light_source, 2);
     writeExifIfd(&pCur, EXIF_TAG_FLASH, EXIF_TYPE_SHORT,
                  1, exifInfo->flash);
+    addPatch(pCur - 4, &exifInfo->flash, 2);
     writeExifIfd(&pCur, EXIF_TAG_FOCAL_LENGTH, EXIF_TYPE_RATIONAL,
                  1, &exifInfo->focal_length, &LongerTagOffset, pIfdStart);
+    addPatch(pIfdStart + LongerTagOffset - 8, &exifInfo->focal_length, 8);
+    // the comment is prefixed in a copy, exifInfo stays untouched so that
+    // it can be compared against the template on the next shot
     char code[8] = { 0x41, 0x53, 0x43, 0x49, 0x49, 0x00, 0x00, 0x00 };
+    unsigned char comment[sizeof(exifInfo->user_comment)];
     size_t commentsLen = strlen((char *)exifInfo->user_comment) + 1;
     if(commentsLen > (sizeof(exifInfo->user_comment) - sizeof(code)))
         return EXIF_FAIL;
-    memmove(exifInfo->user_comment + sizeof(code), exifInfo->user_comment, commentsLen);
-    memcpy(exifInfo->user_comment, code, sizeof(code));
+    memcpy(comment, code, sizeof(code));
+    memcpy(comment + sizeof(code), exifInfo->user_comment, commentsLen);
     writeExifIfd(&pCur, EXIF_TAG_USER_COMMENT, EXIF_TYPE_UNDEFINED,
-                 commentsLen + sizeof(code), exifInfo->user_comment, &LongerTagOffset, pIfdStart);
+                 commentsLen + sizeof(code), comment, &LongerTagOffset, pIfdStart);
+    addPatch(pIfdStart + LongerTagOffset - commentsLen, exifInfo->user_comment, commentsLen);
     writeExifIfd(&pCur, EXIF_TAG_SUBSECTIME, EXIF_TYPE_ASCII,
                  4, exifInfo->subsectime, &LongerTagOffset, pIfdStart);
+    addPatch(pCur - 4, exifInfo->subsectime, 4);
     writeExifIfd(&pCur, EXIF_TAG_SUBSECTIME_ORIGINAL, EXIF_TYPE_ASCII,
                  4, exifInfo->subsectime, &LongerTagOffset, pIfdStart);
+    addPatch(pCur - 4, exifInfo->subsectime, 4);
     writeExifIfd(&pCur, EXIF_TAG_SUBSECTIME_DIGITIZED, EXIF_TYPE_ASCII,
                  4, exifInfo->subsectime, &LongerTagOffset, pIfdStart);
+    addPatch(pCur - 4, exifInfo->subsectime, 4);
     writeExifIfd(&pCur, EXIF_TAG_FLASH_PIX_VERSION, EXIF_TYPE_UNDEFINED,
                  4, exifInfo->flashpix_version);
     writeExifIfd(&pCur, EXIF_TAG_COLOR_SPACE, EXIF_TYPE_SHORT,
@@ -217,12 +345,15 @@ exif_status ExifCreater::makeExif (void *exifOut,
                  1, exifInfo->height);
     writeExifIfd(&pCur, EXIF_TAG_EXPOSURE_MODE, EXIF_TYPE_SHORT,
                  1, exifInfo->exposure_mode);
+    addPatch(pCur - 4, &exifInfo->exposure_mode, 2);
     writeExifIfd(&pCur, EXIF_TAG_WHITE_BALANCE, EXIF_TYPE_SHORT,
                  1, exifInfo->white_balance);
+    addPatch(pCur - 4, &exifInfo->white_balance, 2);
     writeExifIfd(&pCur, EXIF_TAG_JPEG_ZOOM_RATIO, EXIF_TYPE_RATIONAL,
                 1, &exifInfo->zoom_ratio, &LongerTagOffset, pIfdStart);
     writeExifIfd(&pCur, EXIF_TAG_SCENCE_CAPTURE_TYPE, EXIF_TYPE_SHORT,
                  1, exifInfo->scene_capture_type);
+    addPatch(pCur - 4, &exifInfo->scene_capture_type, 2);
     writeExifIfd(&pCur, EXIF_TAG_GAIN_CONTROL, EXIF_TYPE_SHORT,
                  1, exifInfo->gain_control);
     writeExifIfd(&pCur, EXIF_TAG_CONTRAST, EXIF_TYPE_SHORT,
@@ -243,6 +374,10 @@ exif_status ExifCreater::makeExif (void *exifOut,
             &LongerTagOffset,
             pIfdStart
             );
+        if (exifInfo->makerNoteDataSize > 4)
+            m_templateMakerNoteOffset = pIfdStart + LongerTagOffset - exifInfo->makerNoteDataSize - pApp1Start;
+        else
+            m_patchOverflow = true; // stored in the IFD entry itself, don't bother
     }
 
     tmp = 0;
@@ -330,13 +465,57 @@ exif_status ExifCreater::makeExif (void *exifOut,
         pCur += OFFSET_SIZE;
     }
 
-    // backup LongerTagOffset, if the total exif size is > 64K, we will use it.
-    LongerTagOffsetWithoutThumbnail = LongerTagOffset;
-    if (LongerTagOffsetWithoutThumbnail >= EXIF_SIZE_LIMITATION) {
+    if (LongerTagOffset >= EXIF_SIZE_LIMITATION) {
         ALOGE("line:%d, in the makeExif, the size exceeds 64K", __LINE__);
         return EXIF_FAIL;
     }
 
+    *tagOffset = LongerTagOffset;
+    *nextIfdOffset = pNextIfdOffset;
+    return EXIF_SUCCESS;
+}
+
+/**
+ * The IFDs only change layout when the parameters do, e.g. GPS, strings or
+ * maker note size. The first call serializes them and keeps the bytes as a
+ * template together with the offsets of the per shot fields (time stamps,
+ * exposure, 3A results, faces, maker note). The following calls copy the
+ * template and patch those fields, falling back to a full serialization
+ * when anything else differs. The 1st IFD with the thumbnail is always
+ * written.
+ *
+ * if exif tags size + thumbnail size is > 64K, it will disable thumbnail
+ */
+exif_status ExifCreater::makeExif (void *exifOut,
+                                        exif_attribute_t *exifInfo,
+                                        unsigned int *size)
+{
+    ALOGV("makeExif start");
+
+    unsigned char *pApp1Start, *pIfdStart, *pNextIfdOffset;
+    unsigned int tmp, LongerTagOffset = 0;
+    pApp1Start = (unsigned char *)exifOut;
+    pIfdStart = pApp1Start + 4 + 6; // APP1 marker and length, ExifIdentifierCode
+
+    // If we write the Makernote to APP2 segment,
+    // we need to skip some IFDs in the APP1 segment
+    bool makernoteToApp2 = PlatformData::extendedMakernote();
+
+    if (templateMatches(exifInfo)) {
+        memcpy(pApp1Start, m_template, m_templateSize);
+        applyPatches(pApp1Start, exifInfo);
+        LongerTagOffset = m_templateTagOffset;
+        pNextIfdOffset = pApp1Start + m_templateNextIfdOffset;
+    } else {
+        exif_status status = writeIfds(pApp1Start, exifInfo, makernoteToApp2,
+                                       &LongerTagOffset, &pNextIfdOffset);
+        if (status != EXIF_SUCCESS) {
+            m_templateValid = false;
+            return status;
+        }
+        saveTemplate(pApp1Start, exifInfo, LongerTagOffset, pNextIfdOffset);
+    }
+
     // 2 1th IFD TIFF Tags
     if (exifInfo->enableThumb && (m_thumbBuf != NULL) && (m_thumbSize > 0)) {
         writeThumbData(pIfdStart, pNextIfdOffset, &LongerTagOffset, exifInfo);
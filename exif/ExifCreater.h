@@ -133,9 +133,48 @@ private:
                                  unsigned char *pNextIfdOffset,
                                  unsigned int *LongerTagOffset,
                                  exif_attribute_t *exifInfo);
+    exif_status writeIfds(unsigned char *pApp1Start,
+                                 exif_attribute_t *exifInfo,
+                                 bool makernoteToApp2,
+                                 unsigned int *tagOffset,
+                                 unsigned char **nextIfdOffset);
+
+    /*
+        Template of the APP1 segment up to the 1st IFD, see makeExif().
+        A patch copies len bytes from offset src in exif_attribute_t to
+        offset dst in the APP1 segment.
+    */
+    struct ExifPatch {
+        unsigned int dst;
+        unsigned int src;
+        unsigned int len;
+    };
+    static const int MAX_EXIF_PATCHES = 32;
+    static const unsigned int TEMPLATE_SIZE = 4 + 6 + EXIF_SIZE_LIMITATION;
+
+    void addPatch(const unsigned char *dst, const void *src, unsigned int len);
+    bool templateMatches(const exif_attribute_t *exifInfo) const;
+    void saveTemplate(const unsigned char *pApp1Start,
+                                 const exif_attribute_t *exifInfo,
+                                 unsigned int LongerTagOffset,
+                                 const unsigned char *pNextIfdOffset);
+    void applyPatches(unsigned char *pApp1Start, const exif_attribute_t *exifInfo) const;
 
     unsigned char * m_thumbBuf; // MAP: Added to set thumbnail from external data
     unsigned int m_thumbSize; // MAP: Added to set thumbnail from external data
+
+    unsigned char *m_template;
+    unsigned int m_templateSize;
+    unsigned int m_templateTagOffset;       // LongerTagOffset after the GPS IFD
+    unsigned int m_templateNextIfdOffset;   // next IFD offset of the 0th IFD
+    unsigned int m_templateMakerNoteOffset; // maker note in APP1, 0 if none
+    bool m_templateValid;
+    exif_attribute_t m_templateInfo;        // attributes the template was made of
+    ExifPatch m_patches[MAX_EXIF_PATCHES];
+    int m_patchCount;
+    bool m_patchOverflow;                   // set when the template can't be patched
+    const unsigned char *m_patchDstBase;    // only valid in writeIfds()
+    const exif_attribute_t *m_patchSrcBase;
 };
 };
 #endif /* __EXIFCREATER_H__ */
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2012 Intel Corporation.
+ * Copyright (c) 2012-2014 Intel Corporation.
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
  * you may not use this file except in compliance with the License.
@@ -13,332 +13,266 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-// TODO:
-// 1. add macroblock support for UV
-// 2. test optimal reading direction for top & right when (ROWS|COLUMNS)%MACROBLOCK
+#define LOG_TAG "Camera_NV12Rotation"
+
 #include "nv12rotation.h"
 #include "AtomCommon.h"
+#include "LogHelper.h"
 #include <cstdlib>
+#include <cstring>
 
-#define STRIZE2(s) #s
-#define STRIZE(s) STRIZE2(s)
+#if defined(__i386__) || defined(__x86_64__)
+#include <emmintrin.h>
+#define NV12_ROTATION_SIMD
+#endif
 
+/*
+ * The luma plane is rotated as a plane of bytes and the chroma plane as a
+ * plane of UV (or VU) byte pairs, with half the width and height. Both are
+ * walked in square tiles so that the lines of the tile being written stay
+ * in the cache, and every tile is rotated in 8x8 blocks of samples. The
+ * SSE2 block kernels transpose a block in registers; whatever is left at the
+ * right and bottom edges goes through the scalar code, so any width, height
+ * and stride works.
+ */
 
-bool genericRotateBy90(const int   width,
-                        const int   height,
-                        const int   rstride,
-                        const int   wstride,
-                        const char* sptr,
-                        char*       dptr);
-
-#define NV12_ROTATION_STRIDES(RSTRIDE, WSTRIDE, MACROBLOCK) \
-static void rotateXx4x##RSTRIDE##x##WSTRIDE##Y \
-    (const unsigned char* source, unsigned char* target, int columns) \
-    __attribute__ ((noinline)); \
-static void rotateXx4x##RSTRIDE##x##WSTRIDE##Y \
-    (const unsigned char* source, unsigned char* target, int columns) \
-{ \
-    const unsigned char* terminator = source + columns; \
- \
-    asm /*volatile*/ ( "\
-                    mov %0, %%esi;            \
-                    mov %1, %%edi;            \
-                    mov %2, %%ecx;            \
-                    .align 16;                \
-                    1:                        \
-                    movdqu                    (%%esi), %%xmm0; \
-                    movdqu "STRIZE(  RSTRIDE)"(%%esi), %%xmm1; \
-                    movdqu "STRIZE(2*RSTRIDE)"(%%esi), %%xmm2; \
-                    movdqu "STRIZE(3*RSTRIDE)"(%%esi), %%xmm3; \
-                                              \
-                    prefetchnta                     64(%%esi);  \
-                    prefetchnta "STRIZE(  RSTRIDE+64)"(%%esi);  \
-                    prefetchnta "STRIZE(2*RSTRIDE+64)"(%%esi);  \
-                    prefetchnta "STRIZE(3*RSTRIDE+64)"(%%esi);  \
-                                              \
-                    add $16, %%esi;           \
-                                              \
-                                              \
-                    movdqa %%xmm1, %%xmm4;    \
-                    movdqa %%xmm3, %%xmm5;    \
-                    punpcklbw %%xmm0, %%xmm4; \
-                    punpcklbw %%xmm2, %%xmm5; \
-                                              \
-                    movdqa %%xmm1, %%xmm6;    \
-                    movdqa %%xmm3, %%xmm7;    \
-                    punpckhbw %%xmm0, %%xmm6; \
-                    punpckhbw %%xmm2, %%xmm7; \
-                                              \
-                    movdqa %%xmm5, %%xmm0;    \
-                    punpckhwd %%xmm4, %%xmm5; \
-                    punpcklwd %%xmm4, %%xmm0; \
-                                              \
-                    movdqa %%xmm7, %%xmm2;    \
-                    punpckhwd %%xmm6, %%xmm7; \
-                    punpcklwd %%xmm6, %%xmm2; \
-                                              \
-                                              \
-                    movd %%xmm0,                     (%%edi); \
-                    movd %%xmm5, "STRIZE( 4*WSTRIDE)"(%%edi); \
-                    movd %%xmm2, "STRIZE( 8*WSTRIDE)"(%%edi); \
-                    movd %%xmm7, "STRIZE(12*WSTRIDE)"(%%edi); \
-                    psrldq $4, %%xmm0;        \
-                    psrldq $4, %%xmm5;        \
-                    psrldq $4, %%xmm2;        \
-                    psrldq $4, %%xmm7;        \
-                    movd %%xmm0, "STRIZE(   WSTRIDE)"(%%edi); \
-                    movd %%xmm5, "STRIZE( 5*WSTRIDE)"(%%edi); \
-                    movd %%xmm2, "STRIZE( 9*WSTRIDE)"(%%edi); \
-                    movd %%xmm7, "STRIZE(13*WSTRIDE)"(%%edi); \
-                    psrldq $4, %%xmm0;        \
-                    psrldq $4, %%xmm5;        \
-                    psrldq $4, %%xmm2;        \
-                    psrldq $4, %%xmm7;        \
-                    movd %%xmm0, "STRIZE( 2*WSTRIDE)"(%%edi); \
-                    movd %%xmm5, "STRIZE( 6*WSTRIDE)"(%%edi); \
-                    movd %%xmm2, "STRIZE(10*WSTRIDE)"(%%edi); \
-                    movd %%xmm7, "STRIZE(14*WSTRIDE)"(%%edi); \
-                    psrldq $4, %%xmm0;        \
-                    psrldq $4, %%xmm5;        \
-                    psrldq $4, %%xmm2;        \
-                    psrldq $4, %%xmm7;        \
-                    movd %%xmm0, "STRIZE( 3*WSTRIDE)"(%%edi); \
-                    movd %%xmm5, "STRIZE( 7*WSTRIDE)"(%%edi); \
-                    movd %%xmm2, "STRIZE(11*WSTRIDE)"(%%edi); \
-                    movd %%xmm7, "STRIZE(15*WSTRIDE)"(%%edi); \
-                                              \
-                                              \
-                    cmp %%esi, %%ecx;         \
-                    lea "STRIZE(16*WSTRIDE)"(%%edi), %%edi;   \
-                                              \
-                    jne 1b;                   \
-                    " \
-                 : \
-                 : "g"(source), "g"(target), "m"(terminator) \
-                 : "%ecx", "%esi", "%edi", "memory" \
-                 ); \
+// tile side in samples, a tile of both planes fits in the L1 cache
+static const int TILE = 64;
+static const int BLOCK = 8;
+
+enum Rotation {
+    ROTATE_90,      // clockwise
+    ROTATE_180,
+    ROTATE_270,
+};
+
+/**
+ * Describes one plane to rotate: 'size' bytes per sample, strides in bytes.
+ * The rotated plane has the source width as its height for 90 and 270.
+ */
+struct RotationPlane {
+    const unsigned char *src;
+    unsigned char *dst;
+    int width;
+    int height;
+    int rstride;
+    int wstride;
+    int size;
+};
+
+// destination of source sample (x, y)
+static inline unsigned char *rotatedSample(const RotationPlane &p, Rotation rotation,
+                                           int x, int y)
+{
+    switch (rotation) {
+    case ROTATE_90:
+        return p.dst + x * p.wstride + (p.height - 1 - y) * p.size;
+    case ROTATE_270:
+        return p.dst + (p.width - 1 - x) * p.wstride + y * p.size;
+    default:
+        return p.dst + (p.height - 1 - y) * p.wstride + (p.width - 1 - x) * p.size;
+    }
+}
+
+static void rotateRectScalar(const RotationPlane &p, Rotation rotation,
+                             int x0, int x1, int y0, int y1)
+{
+    for (int y = y0; y < y1; y++) {
+        const unsigned char *s = p.src + y * p.rstride + x0 * p.size;
+        for (int x = x0; x < x1; x++, s += p.size) {
+            unsigned char *d = rotatedSample(p, rotation, x, y);
+            d[0] = s[0];
+            if (p.size == 2)
+                d[1] = s[1];
+        }
+    }
+}
+
+#ifdef NV12_ROTATION_SIMD
+
+/*
+ * SSE2 block kernels. A block is 8 rows of 8 samples: 8 bytes per row for
+ * luma, 16 bytes (8 UV pairs) per row for chroma. The rows are passed in the
+ * order that makes the transposed block land in the destination as is.
+ */
+
+__attribute__((target("sse2")))
+static void transposeBlock8(const unsigned char *const *rows, unsigned char *const *out)
+{
+    __m128i r[8];
+    for (int i = 0; i < 8; i++)
+        r[i] = _mm_loadl_epi64((const __m128i *) rows[i]);
+
+    const __m128i a0 = _mm_unpacklo_epi8(r[0], r[1]);
+    const __m128i a1 = _mm_unpacklo_epi8(r[2], r[3]);
+    const __m128i a2 = _mm_unpacklo_epi8(r[4], r[5]);
+    const __m128i a3 = _mm_unpacklo_epi8(r[6], r[7]);
+    const __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+    const __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+    const __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+    const __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+    // every vector holds two columns of the block
+    const __m128i c[4] = {
+        _mm_unpacklo_epi32(b0, b2),
+        _mm_unpackhi_epi32(b0, b2),
+        _mm_unpacklo_epi32(b1, b3),
+        _mm_unpackhi_epi32(b1, b3),
+    };
+    for (int i = 0; i < 4; i++) {
+        _mm_storel_epi64((__m128i *) out[2 * i], c[i]);
+        _mm_storel_epi64((__m128i *) out[2 * i + 1], _mm_unpackhi_epi64(c[i], c[i]));
+    }
 }
-#include "nv12rotationgeometry.h"
-
-
-#define NV12_ROTATION_STRIDES(RSTRIDE, WSTRIDE, MACROBLOCK) \
-static void rotateXx4x##RSTRIDE##x##WSTRIDE##UV \
-    (const unsigned char* source, unsigned char* target) \
-    __attribute__ ((noinline)); \
-static void rotateXx4x##RSTRIDE##x##WSTRIDE##UV \
-    (const unsigned char* source, unsigned char* target, size_t columns) \
-{ \
-    const unsigned char* terminator = source + columns; \
- \
-    asm /*volatile*/ ( "\
-                    mov %0, %%esi;            \
-                    mov %1, %%edi;            \
-                    mov %2, %%ecx;            \
-                                              \
-                    .align 16;                \
-                    1:                        \
-                    movdqu    (%%esi), %%xmm0; \
-                    movdqu " STRIZE(RSTRIDE) "(%%esi), %%xmm1; \
-                                              \
-                    prefetchnta 64(%%esi);   \
-                    prefetchnta "STRIZE(RSTRIDE+64)"(%%esi);   \
-                                              \
-                    add $16, %%esi;           \
-                                              \
-                    movdqa %%xmm0, %%xmm3;    \
-                    movdqa %%xmm1, %%xmm2;    \
-                                              \
-                    punpcklwd %%xmm0, %%xmm1; \
-                    punpckhwd %%xmm3, %%xmm2; \
-                    movd %%xmm1,                    (%%edi); \
-                    movd %%xmm2, "STRIZE(4*WSTRIDE)"(%%edi); \
-                                              \
-                    psrldq $4, %%xmm1;        \
-                    psrldq $4, %%xmm2;        \
-                    movd %%xmm1, "STRIZE(  WSTRIDE)"(%%edi); \
-                    movd %%xmm2, "STRIZE(5*WSTRIDE)"(%%edi); \
-                                              \
-                    psrldq $4, %%xmm1;        \
-                    psrldq $4, %%xmm2;        \
-                    movd %%xmm1, "STRIZE(2*WSTRIDE)"(%%edi); \
-                    movd %%xmm2, "STRIZE(6*WSTRIDE)"(%%edi); \
-                                              \
-                    psrldq $4, %%xmm1;        \
-                    psrldq $4, %%xmm2;        \
-                    movd %%xmm1, "STRIZE(3*WSTRIDE)"(%%edi); \
-                    movd %%xmm2, "STRIZE(7*WSTRIDE)"(%%edi); \
-                                              \
-                    cmp %%esi, %%ecx;         \
-                    lea "STRIZE(8*WSTRIDE)"(%%edi), %%edi;   \
-                                              \
-                    jne 1b;                   \
-                    " \
-                 : \
-                 : "g"(source), "g"(target), "m"(terminator) \
-                 : "%ecx", "%esi", "%edi", "memory" \
-                 ); \
+
+__attribute__((target("sse2")))
+static void transposeBlock16(const unsigned char *const *rows, unsigned char *const *out)
+{
+    __m128i a[8];
+    for (int i = 0; i < 8; i += 2) {
+        const __m128i r0 = _mm_loadu_si128((const __m128i *) rows[i]);
+        const __m128i r1 = _mm_loadu_si128((const __m128i *) rows[i + 1]);
+        a[i] = _mm_unpacklo_epi16(r0, r1);
+        a[i + 1] = _mm_unpackhi_epi16(r0, r1);
+    }
+    // b[k] holds columns 2k and 2k+1 of rows 0-3, b[k + 4] of rows 4-7
+    __m128i b[8];
+    for (int half = 0; half < 8; half += 4) {
+        b[half] = _mm_unpacklo_epi32(a[half], a[half + 2]);
+        b[half + 1] = _mm_unpackhi_epi32(a[half], a[half + 2]);
+        b[half + 2] = _mm_unpacklo_epi32(a[half + 1], a[half + 3]);
+        b[half + 3] = _mm_unpackhi_epi32(a[half + 1], a[half + 3]);
+    }
+    for (int k = 0; k < 4; k++) {
+        _mm_storeu_si128((__m128i *) out[2 * k], _mm_unpacklo_epi64(b[k], b[k + 4]));
+        _mm_storeu_si128((__m128i *) out[2 * k + 1], _mm_unpackhi_epi64(b[k], b[k + 4]));
+    }
+}
+
+// reverses the order of the eight 16 bit words of v
+__attribute__((target("sse2")))
+static inline __m128i reverseWords(__m128i v)
+{
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
 }
-#include "nv12rotationgeometry.h"
-
-
-#define NV12_ROTATION_STRIDES(RSTRIDE, WSTRIDE, MACROBLOCK) \
-static void rotate##MACROBLOCK##x4x##RSTRIDE##x##WSTRIDE##Y \
-    (const unsigned char* source, unsigned char* target) \
-    __attribute__ ((noinline)); \
-static void rotate##MACROBLOCK##x4x##RSTRIDE##x##WSTRIDE##Y \
-    (const unsigned char* source, unsigned char* target) \
-{ \
-    const unsigned char* terminator = source + MACROBLOCK; \
- \
-    asm /*volatile*/ ( "\
-                    mov %0, %%esi;            \
-                    mov %1, %%edi;            \
-                    mov %2, %%ecx;            \
-                    .align 16;                \
-                    1:                        \
-                    movdqu                    (%%esi), %%xmm0; \
-                    movdqu "STRIZE(  RSTRIDE)"(%%esi), %%xmm1; \
-                    movdqu "STRIZE(2*RSTRIDE)"(%%esi), %%xmm2; \
-                    movdqu "STRIZE(3*RSTRIDE)"(%%esi), %%xmm3; \
-                                              \
-                    prefetchnta                     64(%%esi);  \
-                    prefetchnta "STRIZE(  RSTRIDE+64)"(%%esi);  \
-                    prefetchnta "STRIZE(2*RSTRIDE+64)"(%%esi);  \
-                    prefetchnta "STRIZE(3*RSTRIDE+64)"(%%esi);  \
-                                              \
-                    add $16, %%esi;           \
-                                              \
-                                              \
-                    movdqa %%xmm1, %%xmm4;    \
-                    movdqa %%xmm3, %%xmm5;    \
-                    punpcklbw %%xmm0, %%xmm4; \
-                    punpcklbw %%xmm2, %%xmm5; \
-                                              \
-                    movdqa %%xmm1, %%xmm6;    \
-                    movdqa %%xmm3, %%xmm7;    \
-                    punpckhbw %%xmm0, %%xmm6; \
-                    punpckhbw %%xmm2, %%xmm7; \
-                                              \
-                    movdqa %%xmm5, %%xmm0;    \
-                    punpckhwd %%xmm4, %%xmm5; \
-                    punpcklwd %%xmm4, %%xmm0; \
-                                              \
-                    movdqa %%xmm7, %%xmm2;    \
-                    punpckhwd %%xmm6, %%xmm7; \
-                    punpcklwd %%xmm6, %%xmm2; \
-                                              \
-                                              \
-                    movd %%xmm0,                     (%%edi); \
-                    movd %%xmm5, "STRIZE( 4*WSTRIDE)"(%%edi); \
-                    movd %%xmm2, "STRIZE( 8*WSTRIDE)"(%%edi); \
-                    movd %%xmm7, "STRIZE(12*WSTRIDE)"(%%edi); \
-                    psrldq $4, %%xmm0;        \
-                    psrldq $4, %%xmm5;        \
-                    psrldq $4, %%xmm2;        \
-                    psrldq $4, %%xmm7;        \
-                    movd %%xmm0, "STRIZE(   WSTRIDE)"(%%edi); \
-                    movd %%xmm5, "STRIZE( 5*WSTRIDE)"(%%edi); \
-                    movd %%xmm2, "STRIZE( 9*WSTRIDE)"(%%edi); \
-                    movd %%xmm7, "STRIZE(13*WSTRIDE)"(%%edi); \
-                    psrldq $4, %%xmm0;        \
-                    psrldq $4, %%xmm5;        \
-                    psrldq $4, %%xmm2;        \
-                    psrldq $4, %%xmm7;        \
-                    movd %%xmm0, "STRIZE( 2*WSTRIDE)"(%%edi); \
-                    movd %%xmm5, "STRIZE( 6*WSTRIDE)"(%%edi); \
-                    movd %%xmm2, "STRIZE(10*WSTRIDE)"(%%edi); \
-                    movd %%xmm7, "STRIZE(14*WSTRIDE)"(%%edi); \
-                    psrldq $4, %%xmm0;        \
-                    psrldq $4, %%xmm5;        \
-                    psrldq $4, %%xmm2;        \
-                    psrldq $4, %%xmm7;        \
-                    movd %%xmm0, "STRIZE( 3*WSTRIDE)"(%%edi); \
-                    movd %%xmm5, "STRIZE( 7*WSTRIDE)"(%%edi); \
-                    movd %%xmm2, "STRIZE(11*WSTRIDE)"(%%edi); \
-                    movd %%xmm7, "STRIZE(15*WSTRIDE)"(%%edi); \
-                                              \
-                                              \
-                    cmp %%esi, %%ecx;         \
-                    lea "STRIZE(16*WSTRIDE)"(%%edi), %%edi;   \
-                                              \
-                    jne 1b;                   \
-                    "\
-                 :\
-                 : "g"(source), "g"(target), "m"(terminator)\
-                 : "%ecx", "%esi", "%edi", "memory"\
-                 );\
+
+/**
+ * Rotates the source rows [y0, y1) by 180 degrees, 16 bytes at a time;
+ * returns the first column left for the scalar code.
+ */
+__attribute__((target("sse2")))
+static int rotateRows180SSE2(const RotationPlane &p, int y0, int y1)
+{
+    const int bytes = p.width * p.size;
+    const int vectorBytes = bytes & ~15;
+    for (int y = y0; y < y1; y++) {
+        const unsigned char *s = p.src + y * p.rstride;
+        unsigned char *d = p.dst + (p.height - 1 - y) * p.wstride + bytes;
+        for (int x = 0; x < vectorBytes; x += 16) {
+            __m128i v = reverseWords(_mm_loadu_si128((const __m128i *)(s + x)));
+            if (p.size == 1)
+                v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            _mm_storeu_si128((__m128i *)(d - x - 16), v);
+        }
+    }
+    return vectorBytes / p.size;
 }
-#include "nv12rotationgeometry.h"
-
-
-#define NV12_ROTATION_STRIDES(RSTRIDE, WSTRIDE, MACROBLOCK) \
-static void rotate##MACROBLOCK##x##MACROBLOCK##x##RSTRIDE##x##WSTRIDE##Y \
-    (const unsigned char* source, unsigned char* target) \
-{ \
-    const unsigned char* s = source + (MACROBLOCK - 4) * RSTRIDE; \
-    unsigned char*       t = target; \
- \
-    for (int slices = MACROBLOCK / 4; slices > 0; --slices) { \
-        rotate##MACROBLOCK##x4x##RSTRIDE##x##WSTRIDE##Y(s, t); \
-        s -= 4 * RSTRIDE; \
-        t += 4; \
-    } \
+
+/**
+ * Rotates the full 8x8 blocks of the source rectangle [x0, x1) x [y0, y1)
+ * by 90 or 270 degrees; the rectangle has to be block aligned.
+ */
+__attribute__((target("sse2")))
+static void rotateBlocks90SSE2(const RotationPlane &p, Rotation rotation,
+                               int x0, int x1, int y0, int y1)
+{
+    const unsigned char *rows[BLOCK];
+    unsigned char *out[BLOCK];
+
+    for (int y = y0; y < y1; y += BLOCK) {
+        // 90: the bottom row of the block becomes the left column
+        const int first = rotation == ROTATE_90 ? y + BLOCK - 1 : y;
+        const int step = rotation == ROTATE_90 ? -1 : 1;
+        for (int x = x0; x < x1; x += BLOCK) {
+            for (int i = 0; i < BLOCK; i++) {
+                rows[i] = p.src + (first + i * step) * p.rstride + x * p.size;
+                out[i] = rotatedSample(p, rotation, x + i, first);
+            }
+            if (p.size == 1)
+                transposeBlock8(rows, out);
+            else
+                transposeBlock16(rows, out);
+        }
+    }
 }
-#include "nv12rotationgeometry.h"
-
-
-#define NV12_ROTATION_GEOMETRY(COLUMNS, ROWS, RSTRIDE, WSTRIDE, MACROBLOCK) \
-static void rotate##COLUMNS##x##ROWS##x##RSTRIDE##x##WSTRIDE##x##MACROBLOCK \
-    (const unsigned char* source, unsigned char* target) \
-{ \
-    const unsigned char* s; \
-    unsigned char*       t; \
- \
-    for (int row = 0; row < ROWS/MACROBLOCK; ++row) { \
-        s = source + ROWS * RSTRIDE - ((row + 1) * MACROBLOCK * RSTRIDE); \
-        t = target + row * MACROBLOCK; \
-        for (int col = 0; col < COLUMNS/MACROBLOCK; ++col) { \
-            rotate##MACROBLOCK##x##MACROBLOCK##x##RSTRIDE##x##WSTRIDE##Y(s, t); \
-            s += MACROBLOCK; \
-            t += MACROBLOCK * WSTRIDE; \
-        } \
-    } \
- \
-    if (ROWS % MACROBLOCK) { \
-        s = source; \
-        t = target + ROWS - 4; \
-        \
-        for (int row = 0; row < (ROWS % MACROBLOCK) / 4; ++row) { \
-            rotateXx4x##RSTRIDE##x##WSTRIDE##Y(s, t, COLUMNS); \
-            s += 4 * RSTRIDE; \
-            t -= 4; \
-        } \
-    } \
- \
-    if (COLUMNS % MACROBLOCK) { \
-        s = source \
-          + (ROWS % MACROBLOCK) * RSTRIDE + (COLUMNS - COLUMNS % MACROBLOCK); \
-        t = target \
-          + (COLUMNS - COLUMNS % MACROBLOCK) * WSTRIDE \
-          + (ROWS - ROWS % MACROBLOCK - 4); \
-        \
-        for (int row = 0; row < (ROWS - ROWS % MACROBLOCK) / 4; ++row) { \
-            rotateXx4x##RSTRIDE##x##WSTRIDE##Y(s, t, COLUMNS % MACROBLOCK); \
-            s += 4 * RSTRIDE; \
-            t -= 4; \
-        } \
-    } \
- \
-    s = source + RSTRIDE * ROWS; \
-    t = target + COLUMNS * WSTRIDE + (ROWS - 4); \
-    for (int rows = ROWS / 4; rows > 0; --rows) { \
-        rotateXx4x##RSTRIDE##x##WSTRIDE##UV(s, t, COLUMNS); \
-        s += 4 * RSTRIDE / 2; \
-        t -= 4; \
-    } \
+
+#endif // NV12_ROTATION_SIMD
+
+static void rotatePlane(const RotationPlane &p, Rotation rotation)
+{
+#ifdef NV12_ROTATION_SIMD
+    const bool simd = (android::getCpuFeatures() & android::CPU_FEATURE_SSE2) != 0;
+#else
+    const bool simd = false;
+#endif
+
+    if (rotation == ROTATE_180) {
+        // rows map to rows, streaming through both planes is cache friendly
+        int x = 0;
+#ifdef NV12_ROTATION_SIMD
+        if (simd)
+            x = rotateRows180SSE2(p, 0, p.height);
+#endif
+        rotateRectScalar(p, rotation, x, p.width, 0, p.height);
+        return;
+    }
+
+    const int blockWidth = simd ? p.width & ~(BLOCK - 1) : 0;
+    const int blockHeight = simd ? p.height & ~(BLOCK - 1) : 0;
+
+    for (int ty = 0; ty < p.height; ty += TILE) {
+        for (int tx = 0; tx < p.width; tx += TILE) {
+            const int x1 = MIN(tx + TILE, p.width);
+            const int y1 = MIN(ty + TILE, p.height);
+            const int bx1 = MAX(tx, MIN(x1, blockWidth));
+            const int by1 = MAX(ty, MIN(y1, blockHeight));
+#ifdef NV12_ROTATION_SIMD
+            if (bx1 > tx && by1 > ty)
+                rotateBlocks90SSE2(p, rotation, tx, bx1, ty, by1);
+#endif
+            // right and bottom edges that do not fill a block
+            rotateRectScalar(p, rotation, bx1, x1, ty, by1);
+            rotateRectScalar(p, rotation, tx, x1, by1, y1);
+        }
+    }
 }
-#include "nv12rotationgeometry.h"
 
+static bool nv12rotate(Rotation rotation,
+                       const int width, const int height,
+                       const int rstride, const int wstride,
+                       const char *sptr, char *dptr)
+{
+    if (width < 2 || height < 2 || (width & 1) || (height & 1)) {
+        ALOGE("@%s: cannot rotate a %dx%d NV12 image", __FUNCTION__, width, height);
+        return false;
+    }
+
+    // the rotated image has 'width' lines for 90 and 270
+    const int dstLines = rotation == ROTATE_180 ? height : width;
+    RotationPlane luma = {
+        (const unsigned char *) sptr, (unsigned char *) dptr,
+        width, height, rstride, wstride, 1
+    };
+    RotationPlane chroma = {
+        luma.src + height * rstride, luma.dst + dstLines * wstride,
+        width / 2, height / 2, rstride, wstride, 2
+    };
+
+    rotatePlane(luma, rotation);
+    rotatePlane(chroma, rotation);
+    return true;
+}
 
 bool nv12rotateBy90(const int   width,
                     const int   height,
@@ -347,25 +281,31 @@ bool nv12rotateBy90(const int   width,
                     const char* sptr,
                     char*       dptr)
 {
-    bool rotated;
-
-#define NV12_ROTATION_GEOMETRY(COLUMNS, ROWS, RSTRIDE, WSTRIDE, MACROBLOCK) \
-    if (width == COLUMNS && height == ROWS && rstride == RSTRIDE && wstride == WSTRIDE) { \
-        rotate##COLUMNS##x##ROWS##x##RSTRIDE##x##WSTRIDE##x##MACROBLOCK \
-            ((const unsigned char*)sptr, (unsigned char*)dptr); \
-        rotated = true; \
-    } else
-#include "nv12rotationgeometry.h"
-    {
-         rotated = genericRotateBy90(width, height, rstride, wstride, sptr, dptr);
-    }
+    return nv12rotate(ROTATE_90, width, height, rstride, wstride, sptr, dptr);
+}
 
-    return rotated;
+bool nv12rotateBy180(const int   width,
+                     const int   height,
+                     const int   rstride,
+                     const int   wstride,
+                     const char* sptr,
+                     char*       dptr)
+{
+    return nv12rotate(ROTATE_180, width, height, rstride, wstride, sptr, dptr);
+}
+
+bool nv12rotateBy270(const int   width,
+                     const int   height,
+                     const int   rstride,
+                     const int   wstride,
+                     const char* sptr,
+                     char*       dptr)
+{
+    return nv12rotate(ROTATE_270, width, height, rstride, wstride, sptr, dptr);
 }
 
 /**
- * Fall back rotation algorithm in case the resolution requested is not
- * optimized
+ * Plain C 90 degree rotation, kept as the reference for nv12rotateBy90()
  **/
 bool genericRotateBy90(const int   width,
                         const int   height,
@@ -378,9 +318,6 @@ bool genericRotateBy90(const int   width,
     char* a = (char*) sptr;
     char* b = dptr;
 
-    ALOGW("Unoptimized CPU rotation! "
-         "Disable overlay or optimize for this resolution(%dx%d)",width, height);
-
     // Luma rotation
     for (i = 0; i < width; i++) {
         for (j = height-1; j >= 0 ; j--) {
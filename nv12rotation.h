@@ -16,10 +16,13 @@
 #ifndef NV12ROTATION_H
 #define NV12ROTATION_H
 
-// nv12rotateBy90() is an optimized 90 degree rotation for a select
-// set of NV12 images. Since it can only rotate some image geometries,
-// the return value indicates whether the rotation was done or not.
-// Width, height, rstride and wstride parameters are in pixels.
+// nv12rotateBy90(), nv12rotateBy180() and nv12rotateBy270() rotate an NV12
+// (or NV21) image clockwise by the given angle. They work for any even width
+// and height and any stride, and use SSE2 where the CPU has it. The return
+// value indicates whether the rotation was done or not.
+// Width, height, rstride and wstride parameters are in pixels. The chroma
+// plane of the target follows its luma plane, which has 'width' lines for
+// 90 and 270 degrees.
 bool nv12rotateBy90(const int   width,   // width of the source image
                     const int   height,  // height of the source image
                     const int   rstride, // scanline stride of the source image
@@ -27,4 +30,27 @@ bool nv12rotateBy90(const int   width,   // width of the source image
                     const char* sptr,    // source image
                     char*       dptr);   // target image
 
+bool nv12rotateBy180(const int   width,
+                     const int   height,
+                     const int   rstride,
+                     const int   wstride,
+                     const char* sptr,
+                     char*       dptr);
+
+bool nv12rotateBy270(const int   width,
+                     const int   height,
+                     const int   rstride,
+                     const int   wstride,
+                     const char* sptr,
+                     char*       dptr);
+
+// genericRotateBy90() is the plain C 90 degree rotation, kept as the
+// reference for nv12rotateBy90(). Parameters are the same.
+bool genericRotateBy90(const int   width,
+                       const int   height,
+                       const int   rstride,
+                       const int   wstride,
+                       const char* sptr,
+                       char*       dptr);
+
 #endif
@@ -0,0 +1,502 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Host check and benchmark of the CPU image processing kernels
+ * (ColorConverter, ImageScaler and nv12rotation).
+ *
+ * Every kernel is run over synthetic frames from QCIF up to 13MP, once
+ * on the scalar reference path (CAMERA_DISABLE_SIMD) and once on the
+ * path selected for this CPU. The two outputs have to be bit exact, and
+ * the checksum of the reference output has to match the one stored in
+ * the golden file, so that a change of the scalar code is caught too.
+ * Throughput of both paths is printed in MB/s and ns/pixel.
+ *
+ * Usage: ImageKernelBenchmark [-c] [-u] [-g golden]
+ *   -c  check only, run every kernel once instead of timing it
+ *   -u  write the golden file from the reference outputs of this run
+ *   -g  golden file, golden/ImageKernelBenchmark.txt by default
+ *
+ * The exit status is the number of failed kernel runs (at most 255).
+ */
+#define LOG_TAG "Camera_ImageKernelBenchmark"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/KeyedVector.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+#include <linux/videodev2.h>
+
+#include "LogHelper.h"
+#include "AtomCommon.h"
+#include "ColorConverter.h"
+#include "ImageScaler.h"
+#include "nv12rotation.h"
+
+namespace android {
+
+// every kernel is timed for at least this long on both paths
+static const nsecs_t kMinDuration = 100000000; // 100ms
+static const int kMinIterations = 3;
+static const int kMaxIterations = 100;
+
+static const struct {
+    const char *name;
+    int width;
+    int height;
+} sResolutions[] = {
+    { "QCIF",  176,  144 },
+    { "QVGA",  320,  240 },
+    { "VGA",   640,  480 },
+    { "720p", 1280,  720 },
+    { "1080p", 1920, 1080 },
+    { "5MP",  2560, 1920 },
+    { "8MP",  3264, 2448 },
+    { "13MP", 4208, 3120 },
+};
+
+/**
+ * One synthetic frame and an output buffer to run a kernel on. The
+ * source is filled with a noisy gradient, and it is interpreted by each
+ * kernel in its own input format. Planar inputs use bpl bytes per line,
+ * YUYV inputs 2 * bpl.
+ */
+struct KernelFrame {
+    int width;
+    int height;
+    int bpl;
+    unsigned char *src;
+    unsigned char *dst;
+};
+
+struct Kernel {
+    const char *name;
+    void (*run)(const KernelFrame &f);
+    float bytesPerPixel;    // bytes read and written per source pixel
+};
+
+static void runYUV420ToRGB565(const KernelFrame &f)
+{
+    YUV420ToRGB565(f.width, f.height, f.src, f.dst);
+}
+
+static void runTrimConvertNV12ToRGB565(const KernelFrame &f)
+{
+    trimConvertNV12ToRGB565(f.width, f.height, f.bpl, f.src, f.dst);
+}
+
+static void runNV12ToRGB565BT601(const KernelFrame &f)
+{
+    convertNV12ToRGB(V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_RGB565, f.width, f.height,
+                     f.bpl, f.width * 2, f.src, f.dst, COLOR_MATRIX_BT601_FULL);
+}
+
+static void runNV21ToRGBABT709(const KernelFrame &f)
+{
+    convertNV12ToRGB(V4L2_PIX_FMT_NV21, V4L2_PIX_FMT_RGB32, f.width, f.height,
+                     f.bpl, f.width * 4, f.src, f.dst, COLOR_MATRIX_BT709_LIMITED);
+}
+
+static void runTrimConvertNV12ToNV21(const KernelFrame &f)
+{
+    trimConvertNV12ToNV21(f.width, f.height, f.bpl, f.src, f.dst);
+}
+
+static void runConvertYV12ToNV21(const KernelFrame &f)
+{
+    convertYV12ToNV21(f.width, f.height, f.bpl, f.width, f.src, f.dst);
+}
+
+static void runAlign16ConvertNV12ToYV12(const KernelFrame &f)
+{
+    align16ConvertNV12ToYV12(f.width, f.height, f.bpl, f.src, f.dst);
+}
+
+static void runNV12ToP411(const KernelFrame &f)
+{
+    NV12ToP411(f.width, f.height, f.src, f.dst);
+}
+
+static void runNV21ToP411(const KernelFrame &f)
+{
+    NV21ToP411(f.width, f.height, f.src, f.dst);
+}
+
+static void runYUY2ToP411(const KernelFrame &f)
+{
+    YUY2ToP411(f.width, f.height, f.width * 2, f.src, f.dst);
+}
+
+static void runConvertYUYVToYV12(const KernelFrame &f)
+{
+    convertYUYVToYV12(f.width, f.height, f.bpl * 2, f.width, f.src, f.dst);
+}
+
+static void runConvertYUYVToNV21(const KernelFrame &f)
+{
+    convertYUYVToNV21(f.width, f.height, f.bpl * 2, f.src, f.dst);
+}
+
+static void runRepadYUV420(const KernelFrame &f)
+{
+    repadYUV420(f.width, f.height, f.bpl, f.bpl + 64, f.src, f.dst);
+}
+
+static void runCopyNV21ToNV21(const KernelFrame &f)
+{
+    copyNV21ToNV21(f.width, f.height, f.bpl, f.width, (char *)f.src, (char *)f.dst);
+}
+
+static void runDownScaleNV12Half(const KernelFrame &f)
+{
+    ImageScaler::downScaleImage(f.src, f.dst,
+            f.width / 2, f.height / 2, f.width / 2,
+            f.width, f.height, f.bpl, V4L2_PIX_FMT_NV12);
+}
+
+static void runScaleNV12TwoThirds(const KernelFrame &f)
+{
+    const int w = (f.width * 2 / 3) & ~0x3;
+    const int h = (f.height * 2 / 3) & ~0x1;
+    ImageScaler::downScaleImage(f.src, f.dst, w, h, w,
+            f.width, f.height, f.bpl, V4L2_PIX_FMT_NV12);
+}
+
+static void runDownScaleYUYVHalf(const KernelFrame &f)
+{
+    ImageScaler::downScaleImage(f.src, f.dst,
+            f.width / 2, f.height / 2, f.width,
+            f.width, f.height, f.width * 2, V4L2_PIX_FMT_YUYV);
+}
+
+static void runDownScaleYUYVTwoThirds(const KernelFrame &f)
+{
+    const int w = (f.width * 2 / 3) & ~0x1;
+    const int h = f.height * 2 / 3;
+    ImageScaler::downScaleImage(f.src, f.dst, w, h, w,
+            f.width, f.height, f.width * 2, V4L2_PIX_FMT_YUYV);
+}
+
+static void runScaleConvertNV12ToNV21(const KernelFrame &f)
+{
+    const int w = (f.width * 2 / 3) & ~0x3;
+    const int h = (f.height * 2 / 3) & ~0x1;
+    ImageScaler::scaleAndConvertImage(f.src, f.dst, w, h, w, V4L2_PIX_FMT_NV21,
+            f.width, f.height, f.bpl, V4L2_PIX_FMT_NV12);
+}
+
+static void runScaleConvertNV12ToRGB565(const KernelFrame &f)
+{
+    const int w = (f.width * 2 / 3) & ~0x3;
+    const int h = (f.height * 2 / 3) & ~0x1;
+    ImageScaler::scaleAndConvertImage(f.src, f.dst, w, h, w * 2, V4L2_PIX_FMT_RGB565,
+            f.width, f.height, f.bpl, V4L2_PIX_FMT_NV12);
+}
+
+static void runScaleConvertNV12ToRGBA(const KernelFrame &f)
+{
+    const int w = (f.width * 2 / 3) & ~0x3;
+    const int h = (f.height * 2 / 3) & ~0x1;
+    ImageScaler::scaleAndConvertImage(f.src, f.dst, w, h, w * 4, V4L2_PIX_FMT_RGB32,
+            f.width, f.height, f.bpl, V4L2_PIX_FMT_NV12, false, COLOR_MATRIX_BT601_LIMITED);
+}
+
+static void runRotateBy90(const KernelFrame &f)
+{
+    if (gControlLevel & CAMERA_DISABLE_SIMD)
+        genericRotateBy90(f.width, f.height, f.bpl, ALIGN64(f.height),
+                          (const char *)f.src, (char *)f.dst);
+    else
+        nv12rotateBy90(f.width, f.height, f.bpl, ALIGN64(f.height),
+                       (const char *)f.src, (char *)f.dst);
+}
+
+static void runRotateBy180(const KernelFrame &f)
+{
+    nv12rotateBy180(f.width, f.height, f.bpl, f.bpl + 64, (const char *)f.src, (char *)f.dst);
+}
+
+static void runRotateBy270(const KernelFrame &f)
+{
+    nv12rotateBy270(f.width, f.height, f.bpl, ALIGN64(f.height),
+                    (const char *)f.src, (char *)f.dst);
+}
+
+static const Kernel sKernels[] = {
+    { "YUV420ToRGB565",           runYUV420ToRGB565,           3.5f },
+    { "trimConvertNV12ToRGB565",  runTrimConvertNV12ToRGB565,  3.5f },
+    { "NV12ToRGB565 BT601 full",  runNV12ToRGB565BT601,        3.5f },
+    { "NV21ToRGBA BT709",         runNV21ToRGBABT709,          5.5f },
+    { "trimConvertNV12ToNV21",    runTrimConvertNV12ToNV21,    3.0f },
+    { "convertYV12ToNV21",        runConvertYV12ToNV21,        3.0f },
+    { "align16ConvertNV12ToYV12", runAlign16ConvertNV12ToYV12, 3.0f },
+    { "NV12ToP411",               runNV12ToP411,               3.0f },
+    { "NV21ToP411",               runNV21ToP411,               3.0f },
+    { "YUY2ToP411",               runYUY2ToP411,               3.5f },
+    { "convertYUYVToYV12",        runConvertYUYVToYV12,        3.5f },
+    { "convertYUYVToNV21",        runConvertYUYVToNV21,        3.5f },
+    { "repadYUV420",              runRepadYUV420,              3.0f },
+    { "copyNV21ToNV21",           runCopyNV21ToNV21,           3.0f },
+    { "downScaleImage NV12 1/2",  runDownScaleNV12Half,        1.875f },
+    { "downScaleImage NV12 2/3",  runScaleNV12TwoThirds,       2.167f },
+    { "downScaleImage YUYV 1/2",  runDownScaleYUYVHalf,        2.5f },
+    { "downScaleImage YUYV 2/3",  runDownScaleYUYVTwoThirds,   2.889f },
+    { "scaleConvert NV21 2/3",    runScaleConvertNV12ToNV21,   2.167f },
+    { "scaleConvert RGB565 2/3",  runScaleConvertNV12ToRGB565, 2.389f },
+    { "scaleConvert RGBA 2/3",    runScaleConvertNV12ToRGBA,   3.278f },
+    { "nv12rotateBy90",           runRotateBy90,               3.0f },
+    { "nv12rotateBy180",          runRotateBy180,              3.0f },
+    { "nv12rotateBy270",          runRotateBy270,              3.0f },
+};
+
+static void fillSynthetic(unsigned char *buf, int bpl, int lines)
+{
+    unsigned int seed = 0x12345678;
+    for (int y = 0; y < lines; y++) {
+        for (int x = 0; x < bpl; x++) {
+            seed = seed * 1103515245 + 12345;
+            buf[y * bpl + x] = (unsigned char)(x + y + ((seed >> 16) & 0x1f));
+        }
+    }
+}
+
+static unsigned int checksum(const unsigned char *buf, size_t size)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ buf[i]) * 16777619u;
+    return hash;
+}
+
+static void setReferencePath(bool reference)
+{
+    if (reference)
+        android_atomic_or(CAMERA_DISABLE_SIMD, &gControlLevel);
+    else
+        android_atomic_and(~CAMERA_DISABLE_SIMD, &gControlLevel);
+}
+
+/**
+ * Runs the kernel until both kMinIterations and kMinDuration are reached
+ * and returns the fastest iteration in nanoseconds. In check mode the
+ * kernel runs only once.
+ */
+static nsecs_t timeKernel(const Kernel &kernel, const KernelFrame &frame, bool checkOnly)
+{
+    nsecs_t best = 0;
+    nsecs_t total = 0;
+    for (int i = 0; i < kMaxIterations; i++) {
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        kernel.run(frame);
+        nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        if (i == 0 || elapsed < best)
+            best = elapsed;
+        total += elapsed;
+        if (checkOnly || (i + 1 >= kMinIterations && total >= kMinDuration))
+            break;
+    }
+    return best > 0 ? best : 1;
+}
+
+/*
+ * The golden file has one "<resolution> <checksum> <kernel>" line per
+ * kernel run, lines starting with '#' are comments.
+ */
+typedef KeyedVector<String8, unsigned int> GoldenMap;
+
+static String8 goldenKey(const char *resolution, const char *kernel)
+{
+    String8 key(resolution);
+    key.append(" ");
+    key.append(kernel);
+    return key;
+}
+
+static bool readGolden(const char *path, GoldenMap &golden)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char resolution[16];
+        unsigned int crc;
+        int pos = 0;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || line[0] == '\0')
+            continue;
+        if (sscanf(line, "%15s %x %n", resolution, &crc, &pos) != 2 || pos == 0) {
+            fprintf(stderr, "%s: bad line \"%s\"\n", path, line);
+            continue;
+        }
+        golden.add(goldenKey(resolution, line + pos), crc);
+    }
+    fclose(file);
+    return true;
+}
+
+static bool writeGolden(const char *path, const String8 &lines)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        return false;
+    fprintf(file, "# FNV-1a checksums of the scalar reference output of the image kernels,\n"
+                  "# written by \"ImageKernelBenchmark -c -u\" (make -C tools golden).\n"
+                  "# <resolution> <checksum> <kernel>\n%s", lines.string());
+    return fclose(file) == 0;
+}
+
+static int run(bool checkOnly, bool update, const char *goldenPath)
+{
+    const int kernelCount = sizeof(sKernels) / sizeof(sKernels[0]);
+    const int resolutionCount = sizeof(sResolutions) / sizeof(sResolutions[0]);
+    GoldenMap golden;
+    String8 goldenLines;
+    int failures = 0;
+
+    if (!update && !readGolden(goldenPath, golden)) {
+        fprintf(stderr, "cannot read the golden file %s\n", goldenPath);
+        return -1;
+    }
+
+    printf("image kernel benchmark: %d kernels, %d resolutions, cpu features 0x%x\n",
+           kernelCount, resolutionCount, getCpuFeatures());
+
+    for (int r = 0; r < resolutionCount; r++) {
+        const int width = sResolutions[r].width;
+        const int height = sResolutions[r].height;
+        const int bpl = ALIGN64(width);
+        const size_t srcSize = bpl * 2 * height;
+        const int span = ALIGN64(MAX(bpl, height)) + 64;
+        // big enough for a rotation with padding and for an RGBA image
+        const size_t dstSize = MAX(span * MAX(width, height) * 2, width * height * 4);
+
+        unsigned char *src = (unsigned char *) malloc(srcSize);
+        unsigned char *ref = (unsigned char *) malloc(dstSize);
+        unsigned char *out = (unsigned char *) malloc(dstSize);
+        if (src == NULL || ref == NULL || out == NULL) {
+            fprintf(stderr, "no memory for %s\n", sResolutions[r].name);
+            free(src);
+            free(ref);
+            free(out);
+            return -1;
+        }
+        fillSynthetic(src, bpl * 2, height);
+
+        for (int k = 0; k < kernelCount; k++) {
+            const Kernel &kernel = sKernels[k];
+            KernelFrame frame = { width, height, bpl, src, NULL };
+
+            memset(ref, 0xa5, dstSize);
+            memset(out, 0xa5, dstSize);
+
+            setReferencePath(true);
+            frame.dst = ref;
+            nsecs_t refTime = timeKernel(kernel, frame, checkOnly);
+
+            setReferencePath(false);
+            frame.dst = out;
+            nsecs_t optTime = timeKernel(kernel, frame, checkOnly);
+
+            const unsigned int crc = checksum(ref, dstSize);
+            const String8 key = goldenKey(sResolutions[r].name, kernel.name);
+            const char *result;
+            if (memcmp(ref, out, dstSize) != 0) {
+                result = "SIMD MISMATCH";
+                failures++;
+            } else if (update) {
+                result = "OK";
+            } else if (golden.indexOfKey(key) < 0) {
+                result = "NO GOLDEN";
+                failures++;
+            } else if (golden.valueFor(key) != crc) {
+                result = "GOLDEN MISMATCH";
+                failures++;
+            } else {
+                result = "OK";
+            }
+            goldenLines.appendFormat("%-5s %08x %s\n", sResolutions[r].name, crc, kernel.name);
+
+            if (checkOnly) {
+                printf("%-24s %-5s crc %08x %s\n", kernel.name, sResolutions[r].name, crc, result);
+                continue;
+            }
+
+            const float pixels = (float) width * height;
+            const float bytes = pixels * kernel.bytesPerPixel;
+            printf("%-24s %-5s ref %8.1f MB/s %6.2f ns/px | opt %8.1f MB/s %6.2f ns/px | x%.2f crc %08x %s\n",
+                   kernel.name, sResolutions[r].name,
+                   bytes * 1000.0f / refTime, refTime / pixels,
+                   bytes * 1000.0f / optTime, optTime / pixels,
+                   (float) refTime / optTime, crc, result);
+        }
+
+        free(src);
+        free(ref);
+        free(out);
+    }
+
+    setReferencePath(false);
+
+    if (update && failures == 0) {
+        if (!writeGolden(goldenPath, goldenLines)) {
+            fprintf(stderr, "cannot write the golden file %s\n", goldenPath);
+            return -1;
+        }
+        printf("image kernel benchmark: wrote %s\n", goldenPath);
+    }
+
+    if (failures)
+        printf("image kernel benchmark: %d kernel runs failed\n", failures);
+    else
+        printf("image kernel benchmark: all kernels bit exact\n");
+
+    return failures;
+}
+
+}; // namespace android
+
+int main(int argc, char **argv)
+{
+    const char *goldenPath = "golden/ImageKernelBenchmark.txt";
+    bool checkOnly = false;
+    bool update = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "cug:")) != -1) {
+        switch (opt) {
+        case 'c':
+            checkOnly = true;
+            break;
+        case 'u':
+            update = true;
+            break;
+        case 'g':
+            goldenPath = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c] [-u] [-g golden]\n", argv[0]);
+            return 255;
+        }
+    }
+
+    int failures = android::run(checkOnly, update, goldenPath);
+    return failures < 0 || failures > 255 ? 255 : failures;
+}
@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Host throughput and quality check of SWJpegEncoder.
+ *
+ * NV12 and YUYV frames of 1MP, 5MP, 8MP and 13MP are encoded at several
+ * quality levels, on the single thread path and with 2, 4 and one slice
+ * per core. Synthetic frames are always used. Real frames are used as
+ * well when the frame directory has jpegbench_<width>x<height>.nv12 (or
+ * .yuyv), unpadded.
+ *
+ * The scratch of every encode is sized by SWJpegEncoder::estimateSize(),
+ * as the PictureThread does. At the highest quality the encodes are also
+ * run with a quarter of that scratch, so the spill path is exercised.
+ *
+ * Every encode is decoded again and compared with its source. One CSV
+ * line is written per run: the fastest encode time, the scratch and JPEG
+ * sizes, the slowest slice over the mean slice time and the PSNR of luma
+ * and chroma, so that the results of different builds can be compared.
+ *
+ * Usage: JpegEncoderBenchmark [-o csv] [-d framedir] [-r resolution]
+ *   -o  write the CSV to this file instead of stdout
+ *   -d  directory of the real frames, none by default
+ *   -r  only run this resolution, e.g. 1MP
+ *
+ * The exit status is the number of failed encodes (at most 255).
+ */
+#define LOG_TAG "Camera_JpegEncoderBenchmark"
+
+#include <limits.h>
+#include <math.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/Timers.h>
+#include <linux/videodev2.h>
+
+#include "LogHelper.h"
+#include "AtomCommon.h"
+#include "PlatformData.h"
+#include "SWJpegEncoder.h"
+
+namespace android {
+
+// every configuration is encoded this many times, the fastest one counts
+static const int kIterations = 3;
+static const int kMaxSlices = 64;
+
+static const struct {
+    const char *name;
+    int width;
+    int height;
+} sResolutions[] = {
+    { "1MP",  1280,  960 },
+    { "5MP",  2560, 1920 },
+    { "8MP",  3264, 2448 },
+    { "13MP", 4208, 3120 },
+};
+
+static const int sFormats[] = { V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUYV };
+
+static const int sQualities[] = { 50, 75, 95 };
+
+// scratch of the spill runs, in percent of the estimate
+static const int kSpillScratchPercent = 25;
+
+/**
+ * A source frame. NV12 has bpl bytes per line in both planes, YUYV 2 * bpl.
+ */
+struct BenchFrame {
+    const char *source;
+    int fourcc;
+    int width;
+    int height;
+    int bpl;
+    unsigned char *buf;
+};
+
+/**
+ * A smooth gradient with some noise and sharp edges, which codes to
+ * roughly the size of a real picture.
+ */
+static void fillSynthetic(const BenchFrame &f)
+{
+    unsigned int seed = 0x12345678;
+    const int lines = f.fourcc == V4L2_PIX_FMT_YUYV ? f.height : f.height * 3 / 2;
+    const int bytes = f.fourcc == V4L2_PIX_FMT_YUYV ? f.bpl * 2 : f.bpl;
+
+    for (int y = 0; y < lines; y++) {
+        unsigned char *line = f.buf + y * bytes;
+        for (int x = 0; x < bytes; x++) {
+            seed = seed * 1103515245 + 12345;
+            int v = (x * 96 / bytes) + (y * 96 / lines) + ((seed >> 16) & 0xf);
+            if (((x / 64) + (y / 64)) % 5 == 0)
+                v += 64;
+            line[x] = (unsigned char) MIN(v, 255);
+        }
+    }
+}
+
+/**
+ * Loads <dir>/jpegbench_<w>x<h>.<ext> into f, returns false if there is none
+ */
+static bool loadFrame(const char *dir, const BenchFrame &f)
+{
+    char path[PATH_MAX];
+    const bool yuyv = f.fourcc == V4L2_PIX_FMT_YUYV;
+    const size_t size = yuyv ? f.width * f.height * 2 : f.width * f.height * 3 / 2;
+
+    snprintf(path, sizeof(path), "%s/jpegbench_%dx%d.%s", dir, f.width, f.height,
+             yuyv ? "yuyv" : "nv12");
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return false;
+
+    bool ok = fread(f.buf, 1, size, fp) == size;
+    fclose(fp);
+    if (!ok)
+        fprintf(stderr, "%s is not %zu bytes, skipping\n", path, size);
+    return ok;
+}
+
+/*
+ * libjpeg source manager for a buffer in memory, and an error manager
+ * that returns to the caller instead of exiting
+ */
+struct BenchErrorMgr {
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+static void benchErrorExit(j_common_ptr cinfo)
+{
+    BenchErrorMgr *err = (BenchErrorMgr *) cinfo->err;
+    longjmp(err->jump, 1);
+}
+
+static void benchInitSource(j_decompress_ptr) {}
+static void benchTermSource(j_decompress_ptr) {}
+
+static boolean benchFillInputBuffer(j_decompress_ptr cinfo)
+{
+    // the whole jpeg is in the buffer already, end it with an EOI
+    static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = sizeof(eoi);
+    return TRUE;
+}
+
+static void benchSkipInputData(j_decompress_ptr cinfo, long count)
+{
+    if (count <= 0)
+        return;
+    if ((size_t) count > cinfo->src->bytes_in_buffer)
+        count = cinfo->src->bytes_in_buffer;
+    cinfo->src->next_input_byte += count;
+    cinfo->src->bytes_in_buffer -= count;
+}
+
+/**
+ * Adds the squared errors of decoded line y, in YCbCr 4:4:4, to sse
+ */
+static void compareLine(const BenchFrame &f, int y, const unsigned char *line, double sse[2])
+{
+    const bool yuyv = f.fourcc == V4L2_PIX_FMT_YUYV;
+    const unsigned char *uv = f.buf + f.bpl * f.height + (y / 2) * f.bpl;
+    int sseY = 0, sseC = 0;
+
+    for (int x = 0; x < f.width; x++) {
+        int srcY, srcU, srcV;
+        if (yuyv) {
+            const unsigned char *p = f.buf + y * f.bpl * 2 + (x & ~1) * 2;
+            srcY = p[(x & 1) * 2];
+            srcU = p[1];
+            srcV = p[3];
+        } else {
+            srcY = f.buf[y * f.bpl + x];
+            srcU = uv[x & ~1];
+            srcV = uv[(x & ~1) + 1];
+        }
+        const int dY = line[x * 3] - srcY;
+        const int dU = line[x * 3 + 1] - srcU;
+        const int dV = line[x * 3 + 2] - srcV;
+        sseY += dY * dY;
+        sseC += dU * dU + dV * dV;
+    }
+    sse[0] += sseY;
+    sse[1] += sseC;
+}
+
+/**
+ * Decodes jpeg and computes the PSNR of luma and chroma against the
+ * source frame. The chroma of the decoded picture is compared with the
+ * subsampled source chroma it was made from.
+ *
+ * \return false if the jpeg could not be decoded or has the wrong size
+ */
+static bool measurePsnr(const BenchFrame &f, const unsigned char *jpeg, int size,
+                        double *psnrY, double *psnrC)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_source_mgr src;
+    BenchErrorMgr err;
+    double sse[2] = { 0, 0 };
+
+    unsigned char *line = (unsigned char *) malloc(f.width * 3);
+    if (line == NULL)
+        return false;
+
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = benchErrorExit;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        free(line);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    src.init_source = benchInitSource;
+    src.fill_input_buffer = benchFillInputBuffer;
+    src.skip_input_data = benchSkipInputData;
+    src.resync_to_restart = jpeg_resync_to_restart;
+    src.term_source = benchTermSource;
+    src.next_input_byte = jpeg;
+    src.bytes_in_buffer = size;
+    cinfo.src = &src;
+
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_YCbCr;
+    jpeg_start_decompress(&cinfo);
+
+    if ((int) cinfo.output_width != f.width || (int) cinfo.output_height != f.height) {
+        fprintf(stderr, "decoded %ux%u, expected %dx%d\n",
+                cinfo.output_width, cinfo.output_height, f.width, f.height);
+        jpeg_destroy_decompress(&cinfo);
+        free(line);
+        return false;
+    }
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+        const int y = cinfo.output_scanline;
+        JSAMPROW row = line;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+        compareLine(f, y, line, sse);
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    free(line);
+
+    const double pixels = (double) f.width * f.height;
+    *psnrY = sse[0] > 0 ? 10.0 * log10(255.0 * 255.0 * pixels / sse[0]) : 99.0;
+    *psnrC = sse[1] > 0 ? 10.0 * log10(255.0 * 255.0 * pixels * 2 / sse[1]) : 99.0;
+    return true;
+}
+
+/**
+ * Encodes f kIterations times with the given quality and slice count
+ * into a scratch of scratchPercent of the estimate, writes the jpeg to
+ * out and the result to csv. Returns false if the encode failed.
+ */
+static bool benchmark(FILE *csv, SWJpegEncoder &encoder, const BenchFrame &f, const char *resolution,
+                      int quality, int threads, int scratchPercent,
+                      unsigned char *scratch, unsigned char *out, int outSize)
+{
+    SWJpegEncoder::InputBuffer in;
+    SWJpegEncoder::OutputBuffer dst;
+    nsecs_t sliceTimes[kMaxSlices];
+    nsecs_t best = 0;
+    float imbalance = 1.0f;
+    int size = -1;
+    int slices = 0;
+
+    in.clear();
+    in.buf = f.buf;
+    in.width = f.width;
+    in.height = f.height;
+    in.bpl = f.fourcc == V4L2_PIX_FMT_YUYV ? f.bpl * 2 : f.bpl;
+    in.fourcc = f.fourcc;
+    in.size = frameSize(f.fourcc, bytesToPixels(f.fourcc, in.bpl), f.height);
+
+    encoder.setThreads(threads);
+    dst.clear();
+    dst.buf = scratch;
+    dst.width = f.width;
+    dst.height = f.height;
+    dst.size = MIN(encoder.estimateSize(in, quality) * scratchPercent / 100, outSize);
+    dst.quality = quality;
+
+    for (int i = 0; i < kIterations && dst.size > 0; i++) {
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        const int jpegSize = encoder.encodeToScratch(in, dst);
+        if (jpegSize < 0 || jpegSize > outSize) {
+            size = -1;
+            break;
+        }
+        const int count = encoder.getSliceTimes(sliceTimes, kMaxSlices);
+        size = encoder.writeJpeg(out);
+        nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        if (size < 0)
+            break;
+
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+            slices = MIN(count, kMaxSlices);
+            nsecs_t total = 0, slowest = 0;
+            for (int s = 0; s < slices; s++) {
+                total += sliceTimes[s];
+                slowest = MAX(slowest, sliceTimes[s]);
+            }
+            imbalance = total > 0 ? (float) slowest * slices / total : 1.0f;
+        }
+    }
+    encoder.setThreads(0);
+
+    double psnrY = 0, psnrC = 0;
+    if (size < 0 || !measurePsnr(f, out, size, &psnrY, &psnrC)) {
+        fprintf(stderr, "%s %s %s q%d t%d scratch %d failed\n", f.source, v4l2Fmt2Str(f.fourcc),
+                resolution, quality, threads, dst.size);
+        return false;
+    }
+
+    fprintf(csv, "%s,%s,%s,%d,%d,%d,%d,%d,%.2f,%d,%d,%.3f,%.2f,%.2f,%.2f\n",
+            f.source, v4l2Fmt2Str(f.fourcc), resolution, f.width, f.height, quality,
+            threads, slices, best / 1000000.0f, dst.size, size, size * 8.0f / (f.width * f.height),
+            imbalance, psnrY, psnrC);
+    fflush(csv);
+    return true;
+}
+
+static int run(FILE *csv, const char *frameDir, const char *onlyResolution)
+{
+    const int cores = PlatformData::getNumOfCPUCores();
+    const int resolutionCount = sizeof(sResolutions) / sizeof(sResolutions[0]);
+    const int formatCount = sizeof(sFormats) / sizeof(sFormats[0]);
+    const int qualityCount = sizeof(sQualities) / sizeof(sQualities[0]);
+    SWJpegEncoder encoder;
+    int failures = 0;
+
+    // single thread path, 2 and 4 slices and one per core, if there are more
+    int threads[4];
+    int threadCount = 0;
+    threads[threadCount++] = 1;
+    for (int t = 2; t <= 4; t *= 2) {
+        if (t <= cores)
+            threads[threadCount++] = t;
+    }
+    if (cores > 4)
+        threads[threadCount++] = cores;
+
+    fprintf(stderr, "jpeg benchmark: %d cores, %d iterations per configuration\n",
+            cores, kIterations);
+    fprintf(csv, "source,format,resolution,width,height,quality,threads,slices,"
+            "time_ms,scratch_bytes,bytes,bits_per_pixel,slice_imbalance,psnr_y,psnr_c\n");
+
+    for (int r = 0; r < resolutionCount; r++) {
+        if (onlyResolution != NULL && strcmp(onlyResolution, sResolutions[r].name) != 0)
+            continue;
+
+        const int width = sResolutions[r].width;
+        const int height = sResolutions[r].height;
+        // synthetic frames have padded lines like the ISP buffers
+        const int bpl = ALIGN64(width);
+        const size_t srcSize = bpl * 2 * height;
+        const int outSize = width * height * 2;
+
+        unsigned char *src = (unsigned char *) malloc(srcSize);
+        unsigned char *scratch = (unsigned char *) malloc(outSize);
+        unsigned char *out = (unsigned char *) malloc(outSize);
+        if (src == NULL || scratch == NULL || out == NULL) {
+            fprintf(stderr, "no memory for %s\n", sResolutions[r].name);
+            free(src);
+            free(scratch);
+            free(out);
+            return -1;
+        }
+
+        for (int fmt = 0; fmt < formatCount; fmt++) {
+            BenchFrame frames[2] = {
+                { "synthetic", sFormats[fmt], width, height, bpl, src },
+                { "file", sFormats[fmt], width, height, width, src },
+            };
+
+            for (int i = 0; i < 2; i++) {
+                const BenchFrame &f = frames[i];
+                if (i == 0)
+                    fillSynthetic(f);
+                else if (frameDir == NULL || !loadFrame(frameDir, f))
+                    continue;
+
+                for (int q = 0; q < qualityCount; q++) {
+                    for (int t = 0; t < threadCount; t++) {
+                        if (!benchmark(csv, encoder, f, sResolutions[r].name, sQualities[q],
+                                       threads[t], 100, scratch, out, outSize))
+                            failures++;
+                        if (q == qualityCount - 1
+                            && !benchmark(csv, encoder, f, sResolutions[r].name, sQualities[q],
+                                          threads[t], kSpillScratchPercent, scratch, out, outSize))
+                            failures++;
+                    }
+                }
+            }
+        }
+
+        free(src);
+        free(scratch);
+        free(out);
+    }
+
+    if (failures)
+        fprintf(stderr, "jpeg benchmark: %d encodes failed\n", failures);
+    else
+        fprintf(stderr, "jpeg benchmark: done\n");
+
+    return failures;
+}
+
+}; // namespace android
+
+int main(int argc, char **argv)
+{
+    const char *csvPath = NULL;
+    const char *frameDir = NULL;
+    const char *resolution = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:d:r:")) != -1) {
+        switch (opt) {
+        case 'o':
+            csvPath = optarg;
+            break;
+        case 'd':
+            frameDir = optarg;
+            break;
+        case 'r':
+            resolution = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-o csv] [-d framedir] [-r resolution]\n", argv[0]);
+            return 255;
+        }
+    }
+
+    FILE *csv = stdout;
+    if (csvPath != NULL && (csv = fopen(csvPath, "w")) == NULL) {
+        fprintf(stderr, "cannot write %s\n", csvPath);
+        return 255;
+    }
+
+    int failures = android::run(csv, frameDir, resolution);
+
+    if (csv != stdout && fclose(csv) != 0) {
+        fprintf(stderr, "cannot write %s\n", csvPath);
+        return 255;
+    }
+    return failures < 0 || failures > 255 ? 255 : failures;
+}
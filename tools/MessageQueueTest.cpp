@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Host check of the frame policies of RingMessageQueue.
+ *
+ * With a depth of 1 only the latest frame may stay queued: a send() drops
+ * the older frames, never the one it has just queued, also while the
+ * receiver is taking a frame out of the ring. Frames are received in the
+ * order they were sent, and the last frame sent is always received.
+ *
+ * Usage: MessageQueueTest [-n rounds]
+ * The exit status is the number of failed checks, at most 255.
+ */
+
+#define LOG_TAG "MessageQueueTest"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "LogHelper.h"
+#include "RingMessageQueue.h"
+
+using namespace android;
+
+namespace {
+
+enum MessageId {
+    MESSAGE_ID_EXIT = 0,
+    MESSAGE_ID_FRAME,
+    MESSAGE_ID_QUERY,
+    MESSAGE_ID_MAX
+};
+
+struct Message {
+    MessageId id;
+    int frame;
+};
+
+typedef RingMessageQueue<Message, MessageId> Queue;
+
+int sFailures = 0;
+
+void fail(const char *what, int round, int frame)
+{
+    if (sFailures++ < 10)
+        fprintf(stderr, "FAIL %s: round %d frame %d\n", what, round, frame);
+}
+
+struct Round {
+    Queue *queue;
+    int round;
+    int frames;
+    volatile int32_t lastSent;    // frame of the send() in progress
+    int dropped;
+    int received;
+};
+
+// called on the sending thread
+void dropFrame(void *context, Message *msg)
+{
+    Round *r = static_cast<Round *>(context);
+    if (msg->frame >= android_atomic_acquire_load(&r->lastSent))
+        fail("dropped the frame being sent", r->round, msg->frame);
+    r->dropped++;
+}
+
+void *sendFrames(void *arg)
+{
+    Round *r = static_cast<Round *>(arg);
+    for (int i = 0; i < r->frames; i++) {
+        Message msg;
+        msg.id = MESSAGE_ID_FRAME;
+        msg.frame = i;
+        android_atomic_release_store(i, &r->lastSent);
+        r->queue->send(&msg);
+        // vary where the receiver is when the next frame comes
+        if ((i + r->round) % 3 == 0)
+            sched_yield();
+    }
+    Message msg;
+    msg.id = MESSAGE_ID_EXIT;
+    msg.frame = -1;
+    r->queue->send(&msg);
+    return NULL;
+}
+
+// receiver of one round: frames in order, the last one never dropped
+void checkLatestWins(int round, int frames, int capacity)
+{
+    Queue queue("MessageQueueTest", 0, capacity);
+    Round r;
+    r.queue = &queue;
+    r.round = round;
+    r.frames = frames;
+    r.lastSent = -1;
+    r.dropped = 0;
+    r.received = 0;
+    queue.setMaxDepth(MESSAGE_ID_FRAME, 1, dropFrame, &r);
+
+    pthread_t sender;
+    pthread_create(&sender, NULL, sendFrames, &r);
+
+    int last = -1;
+    while (true) {
+        Message msg;
+        queue.receive(&msg);
+        if (msg.id == MESSAGE_ID_EXIT)
+            break;
+        if (msg.frame <= last)
+            fail("frame received out of order", round, msg.frame);
+        last = msg.frame;
+        r.received++;
+    }
+    pthread_join(sender, NULL);
+
+    if (last != frames - 1)
+        fail("latest frame not received", round, last);
+    if (r.received + r.dropped != frames)
+        fail("frames lost", round, frames - r.received - r.dropped);
+    if (queue.size() != 0)
+        fail("messages left queued", round, queue.size());
+}
+
+// frames queued behind a full ring go to the overflow list, the newest
+// one of them must not be dropped either
+void checkOverflow()
+{
+    Queue queue("MessageQueueTest", 0, 2);
+    Round r;
+    r.queue = &queue;
+    r.round = -1;
+    r.frames = 0;
+    r.lastSent = -1;
+    r.dropped = 0;
+    r.received = 0;
+    queue.setMaxDepth(MESSAGE_ID_FRAME, 1, dropFrame, &r);
+
+    Message msg;
+    msg.frame = -1;
+    for (int i = 0; i < 3; i++) {
+        msg.id = MESSAGE_ID_QUERY;
+        queue.send(&msg);
+    }
+    for (int i = 0; i < 4; i++) {
+        msg.id = MESSAGE_ID_FRAME;
+        msg.frame = i;
+        android_atomic_release_store(i, &r.lastSent);
+        queue.send(&msg);
+    }
+
+    int frames = 0;
+    int last = -1;
+    while (queue.size() > 0) {
+        queue.receive(&msg);
+        if (msg.id == MESSAGE_ID_FRAME) {
+            frames++;
+            last = msg.frame;
+        }
+    }
+    if (frames != 1 || last != 3)
+        fail("overflow kept the wrong frames", r.round, last);
+    if (r.dropped != 3)
+        fail("overflow dropped the wrong number of frames", r.round, r.dropped);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    int rounds = 2000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n rounds]\n", argv[0]);
+            return 255;
+        }
+    }
+
+    checkOverflow();
+    for (int i = 0; i < rounds; i++)
+        checkLatestWins(i, 200, 32);
+
+    if (sFailures > 0) {
+        fprintf(stderr, "message queue test: %d failures\n", sFailures);
+        return sFailures > 255 ? 255 : sFailures;
+    }
+    fprintf(stderr, "message queue test: %d rounds passed\n", rounds);
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Force included by the tools Makefile in place of PlatformData.h, whose
+ * camera configuration needs the full Android build. It takes the include
+ * guard of the real header so that the #include "PlatformData.h" of the
+ * HAL sources is skipped.
+ */
+#ifndef PLATFORMDATA_H_
+#define PLATFORMDATA_H_
+
+// from PlatformData.h, the ones the HAL sources built into the tools use
+#define RESOLUTION_1_3MP_WIDTH  1280
+#define RESOLUTION_1_3MP_HEIGHT 960
+
+#ifdef __cplusplus
+namespace android {
+
+class PlatformData {
+public:
+    static unsigned int getNumOfCPUCores();
+};
+
+}; // namespace android
+#endif
+
+#endif // PLATFORMDATA_H_
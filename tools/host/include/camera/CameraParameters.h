@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HOST_CAMERA_PARAMETERS_H
+#define HOST_CAMERA_PARAMETERS_H
+
+#include <utils/KeyedVector.h>
+#include <utils/String8.h>
+
+namespace android {
+
+struct Size {
+    int width;
+    int height;
+
+    Size() : width(0), height(0) {}
+    Size(int w, int h) : width(w), height(h) {}
+};
+
+/*
+ * Only what the HAL sources built into the tools use, the constants are
+ * defined in HostSupport.cpp.
+ */
+class CameraParameters {
+public:
+    const char *get(const char *key) const
+    {
+        ssize_t index = mMap.indexOfKey(String8(key));
+        return index < 0 ? NULL : mMap.valueAt(index).string();
+    }
+    void set(const char *key, const char *value) { mMap.add(String8(key), String8(value)); }
+
+    static const char TRUE[];
+    static const char FALSE[];
+
+    static const char PIXEL_FORMAT_YUV422SP[];
+    static const char PIXEL_FORMAT_YUV420SP[];
+    static const char PIXEL_FORMAT_YUV422I[];
+    static const char PIXEL_FORMAT_YUV420P[];
+    static const char PIXEL_FORMAT_RGB565[];
+    static const char PIXEL_FORMAT_RGBA8888[];
+    static const char PIXEL_FORMAT_JPEG[];
+
+private:
+    KeyedVector<String8, String8> mMap;
+};
+
+}; // namespace android
+
+#endif // HOST_CAMERA_PARAMETERS_H
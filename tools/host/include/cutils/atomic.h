@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HOST_CUTILS_ATOMIC_H
+#define HOST_CUTILS_ATOMIC_H
+
+#include <stdint.h>
+
+static inline int32_t android_atomic_inc(volatile int32_t *addr)
+{
+    return __sync_fetch_and_add(addr, 1);
+}
+
+static inline int32_t android_atomic_dec(volatile int32_t *addr)
+{
+    return __sync_fetch_and_sub(addr, 1);
+}
+
+static inline int32_t android_atomic_add(int32_t value, volatile int32_t *addr)
+{
+    return __sync_fetch_and_add(addr, value);
+}
+
+static inline int32_t android_atomic_or(int32_t value, volatile int32_t *addr)
+{
+    return __sync_fetch_and_or(addr, value);
+}
+
+static inline int32_t android_atomic_and(int32_t value, volatile int32_t *addr)
+{
+    return __sync_fetch_and_and(addr, value);
+}
+
+static inline void android_atomic_write(int32_t value, volatile int32_t *addr)
+{
+    __sync_synchronize();
+    *addr = value;
+}
+
+static inline int32_t android_atomic_cmpxchg(int32_t oldvalue, int32_t newvalue,
+                                             volatile int32_t *addr)
+{
+    return !__sync_bool_compare_and_swap(addr, oldvalue, newvalue);
+}
+
+static inline int32_t android_atomic_acquire_load(volatile const int32_t *addr)
+{
+    return __atomic_load_n(addr, __ATOMIC_ACQUIRE);
+}
+
+static inline void android_atomic_release_store(int32_t value, volatile int32_t *addr)
+{
+    __atomic_store_n(addr, value, __ATOMIC_RELEASE);
+}
+
+static inline int android_atomic_acquire_cas(int32_t oldvalue, int32_t newvalue,
+                                             volatile int32_t *addr)
+{
+    return !__sync_bool_compare_and_swap(addr, oldvalue, newvalue);
+}
+
+#endif // HOST_CUTILS_ATOMIC_H
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Host stand-in for the gralloc HAL header, only the pixel formats
+ * AtomCommon.cpp maps the V4L2 formats to.
+ */
+#ifndef HOST_HAL_PUBLIC_H
+#define HOST_HAL_PUBLIC_H
+
+enum {
+    HAL_PIXEL_FORMAT_RGBA_8888    = 1,
+    HAL_PIXEL_FORMAT_YV12         = 0x32315659,
+    HAL_PIXEL_FORMAT_YCbCr_422_I  = 0x14,
+    HAL_PIXEL_FORMAT_NV12         = 0x3231564E,
+};
+
+#endif // HOST_HAL_PUBLIC_H
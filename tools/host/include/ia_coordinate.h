@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Host stand-in for the coordinate conversion of the Intel 3A library.
+ * The tools do not use it, AtomCommon.cpp only needs it to build; the
+ * conversion is a plain linear mapping between the two systems.
+ */
+#ifndef HOST_IA_COORDINATE_H
+#define HOST_IA_COORDINATE_H
+
+#define IA_COORDINATE_TOP    0
+#define IA_COORDINATE_LEFT   0
+#define IA_COORDINATE_BOTTOM 8192
+#define IA_COORDINATE_RIGHT  8192
+
+typedef struct {
+    int top;
+    int left;
+    int bottom;
+    int right;
+} ia_coordinate_system;
+
+typedef struct {
+    int x;
+    int y;
+} ia_coordinate;
+
+static inline ia_coordinate ia_coordinate_convert(const ia_coordinate_system *a_src_system,
+                                                  const ia_coordinate_system *a_trg_system,
+                                                  const ia_coordinate a_src_coordinate)
+{
+    ia_coordinate trg;
+    trg.x = a_trg_system->left + (long long) (a_src_coordinate.x - a_src_system->left) *
+            (a_trg_system->right - a_trg_system->left) / (a_src_system->right - a_src_system->left);
+    trg.y = a_trg_system->top + (long long) (a_src_coordinate.y - a_src_system->top) *
+            (a_trg_system->bottom - a_trg_system->top) / (a_src_system->bottom - a_src_system->top);
+    return trg;
+}
+
+#endif // HOST_IA_COORDINATE_H
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * The tools only use V4L2 formats, of the atomisp driver interface only
+ * what AtomCommon.h refers to is needed on the host.
+ */
+#ifndef HOST_LINUX_ATOMISP_H
+#define HOST_LINUX_ATOMISP_H
+
+#include <linux/videodev2.h>
+
+enum atomisp_frame_status {
+    ATOMISP_FRAME_STATUS_OK,
+    ATOMISP_FRAME_STATUS_CORRUPTED,
+    ATOMISP_FRAME_STATUS_FLASH_EXPOSED,
+    ATOMISP_FRAME_STATUS_FLASH_PARTIAL,
+    ATOMISP_FRAME_STATUS_FLASH_FAILED,
+};
+
+#endif // HOST_LINUX_ATOMISP_H
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Host stand-in for the camera HAL headers: the types the HAL headers
+ * included by the tools refer to, without any of the HAL itself.
+ */
+#ifndef HOST_SYSTEM_CAMERA_H
+#define HOST_SYSTEM_CAMERA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct camera_memory {
+    void *data;
+    size_t size;
+    void *handle;
+    void (*release)(struct camera_memory *mem);
+} camera_memory_t;
+
+typedef struct camera_face {
+    int32_t rect[4];
+    int32_t score;
+    int32_t id;
+    int32_t left_eye[2];
+    int32_t right_eye[2];
+    int32_t mouth[2];
+} camera_face_t;
+
+typedef struct camera_frame_metadata {
+    int32_t number_of_faces;
+    camera_face_t *faces;
+} camera_frame_metadata_t;
+
+#endif // HOST_SYSTEM_CAMERA_H
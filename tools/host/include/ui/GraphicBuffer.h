@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HOST_UI_GRAPHIC_BUFFER_H
+#define HOST_UI_GRAPHIC_BUFFER_H
+
+typedef const struct native_handle *buffer_handle_t;
+
+namespace android {
+
+// only referenced through pointers in AtomBuffer
+class GraphicBuffer;
+
+}; // namespace android
+
+#endif // HOST_UI_GRAPHIC_BUFFER_H
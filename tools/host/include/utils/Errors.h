@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Host stand-in for the Android utils headers, just enough of them to
+ * build the image kernels and the SW JPEG encoder into the tools.
+ */
+#ifndef HOST_UTILS_ERRORS_H
+#define HOST_UTILS_ERRORS_H
+
+#include <errno.h>
+#include <stdint.h>
+
+namespace android {
+
+typedef int32_t status_t;
+
+enum {
+    OK                = 0,
+    NO_ERROR          = 0,
+    UNKNOWN_ERROR     = (-2147483647-1),
+    NO_MEMORY         = -ENOMEM,
+    INVALID_OPERATION = -ENOSYS,
+    BAD_VALUE         = -EINVAL,
+    NAME_NOT_FOUND    = -ENOENT,
+    ALREADY_EXISTS    = -EEXIST,
+    DEAD_OBJECT       = -EPIPE,
+    TIMED_OUT         = -ETIMEDOUT,
+    WOULD_BLOCK       = -EWOULDBLOCK,
+};
+
+}; // namespace android
+
+#endif // HOST_UTILS_ERRORS_H
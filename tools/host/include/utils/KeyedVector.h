@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HOST_UTILS_KEYED_VECTOR_H
+#define HOST_UTILS_KEYED_VECTOR_H
+
+#include <iterator>
+#include <map>
+#include <sys/types.h>
+#include <utils/Errors.h>
+#include <utils/Vector.h>
+
+namespace android {
+
+template <typename KEY, typename VALUE>
+class KeyedVector {
+public:
+    size_t size() const { return mMap.size(); }
+    bool isEmpty() const { return mMap.empty(); }
+    void clear() { mMap.clear(); }
+
+    ssize_t indexOfKey(const KEY &key) const
+    {
+        typename std::map<KEY, VALUE>::const_iterator it = mMap.find(key);
+        return it == mMap.end() ? (ssize_t) NAME_NOT_FOUND : (ssize_t) std::distance(mMap.begin(), it);
+    }
+    const KEY &keyAt(size_t index) const { return at(index)->first; }
+    const VALUE &valueAt(size_t index) const { return at(index)->second; }
+    const VALUE &valueFor(const KEY &key) const { return mMap.find(key)->second; }
+
+    ssize_t add(const KEY &key, const VALUE &value)
+    {
+        mMap[key] = value;
+        return indexOfKey(key);
+    }
+    ssize_t replaceValueFor(const KEY &key, const VALUE &value) { return add(key, value); }
+    ssize_t removeItem(const KEY &key)
+    {
+        ssize_t index = indexOfKey(key);
+        mMap.erase(key);
+        return index;
+    }
+
+private:
+    typename std::map<KEY, VALUE>::const_iterator at(size_t index) const
+    {
+        typename std::map<KEY, VALUE>::const_iterator it = mMap.begin();
+        while (index--)
+            ++it;
+        return it;
+    }
+
+    std::map<KEY, VALUE> mMap;
+};
+
+}; // namespace android
+
+#endif // HOST_UTILS_KEYED_VECTOR_H
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Host stand-in for the Android log macros. Everything goes to stderr so
+ * that the results the tools print on stdout stay machine readable.
+ */
+#ifndef HOST_UTILS_LOG_H
+#define HOST_UTILS_LOG_H
+
+#include <stdio.h>
+
+#ifndef LOG_TAG
+#define LOG_TAG NULL
+#endif
+
+#define HOST_LOG(prio, ...) \
+    (fprintf(stderr, "%c/%s: ", prio, LOG_TAG ? LOG_TAG : ""), \
+     fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+
+#define ALOGV(...) ((void) 0)
+#define ALOGD(...) HOST_LOG('D', __VA_ARGS__)
+#define ALOGI(...) HOST_LOG('I', __VA_ARGS__)
+#define ALOGW(...) HOST_LOG('W', __VA_ARGS__)
+#define ALOGE(...) HOST_LOG('E', __VA_ARGS__)
+
+#define ALOGD_IF(cond, ...) ((cond) ? (void) ALOGD(__VA_ARGS__) : (void) 0)
+#define ALOGW_IF(cond, ...) ((cond) ? (void) ALOGW(__VA_ARGS__) : (void) 0)
+#define ALOGE_IF(cond, ...) ((cond) ? (void) ALOGE(__VA_ARGS__) : (void) 0)
+
+#endif // HOST_UTILS_LOG_H
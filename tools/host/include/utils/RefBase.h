@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HOST_UTILS_REFBASE_H
+#define HOST_UTILS_REFBASE_H
+
+#include <stddef.h>
+
+namespace android {
+
+class RefBase {
+public:
+    void incStrong(const void *id) const { __sync_fetch_and_add(&mStrong, 1); }
+    void decStrong(const void *id) const
+    {
+        if (__sync_fetch_and_sub(&mStrong, 1) == 1)
+            delete this;
+    }
+    int getStrongCount() const { return mStrong; }
+
+protected:
+    RefBase() : mStrong(0) {}
+    virtual ~RefBase() {}
+
+private:
+    RefBase(const RefBase &);
+    RefBase &operator=(const RefBase &);
+
+    mutable volatile int mStrong;
+};
+
+template <typename T>
+class sp {
+public:
+    sp() : m_ptr(NULL) {}
+    sp(T *other) : m_ptr(other) { if (m_ptr) m_ptr->incStrong(this); }
+    sp(const sp<T> &other) : m_ptr(other.m_ptr) { if (m_ptr) m_ptr->incStrong(this); }
+    ~sp() { if (m_ptr) m_ptr->decStrong(this); }
+
+    sp &operator=(T *other)
+    {
+        if (other)
+            other->incStrong(this);
+        if (m_ptr)
+            m_ptr->decStrong(this);
+        m_ptr = other;
+        return *this;
+    }
+    sp &operator=(const sp<T> &other) { return *this = other.m_ptr; }
+
+    void clear() { *this = (T *) NULL; }
+
+    T &operator*() const { return *m_ptr; }
+    T *operator->() const { return m_ptr; }
+    T *get() const { return m_ptr; }
+
+    bool operator==(const T *other) const { return m_ptr == other; }
+    bool operator!=(const T *other) const { return m_ptr != other; }
+    bool operator==(const sp<T> &other) const { return m_ptr == other.m_ptr; }
+    bool operator!=(const sp<T> &other) const { return m_ptr != other.m_ptr; }
+
+private:
+    T *m_ptr;
+};
+
+}; // namespace android
+
+#endif // HOST_UTILS_REFBASE_H
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HOST_UTILS_STRING8_H
+#define HOST_UTILS_STRING8_H
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <utils/Errors.h>
+
+namespace android {
+
+class String8 {
+public:
+    String8() {}
+    String8(const char *o) : mString(o ? o : "") {}
+    String8(const char *o, size_t len) : mString(o, len) {}
+
+    const char *string() const { return mString.c_str(); }
+    size_t size() const { return mString.size(); }
+    size_t length() const { return mString.size(); }
+    bool isEmpty() const { return mString.empty(); }
+    void clear() { mString.clear(); }
+    void setTo(const char *o) { mString = o; }
+
+    status_t append(const char *o) { mString += o; return NO_ERROR; }
+    status_t append(const String8 &o) { mString += o.mString; return NO_ERROR; }
+    status_t appendFormat(const char *fmt, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char buf[1024];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        mString += buf;
+        return NO_ERROR;
+    }
+
+    ssize_t find(const char *other, size_t start = 0) const
+    {
+        size_t pos = mString.find(other, start);
+        return pos == std::string::npos ? -1 : (ssize_t) pos;
+    }
+
+    String8 &operator+=(const char *o) { mString += o; return *this; }
+    bool operator<(const String8 &o) const { return mString < o.mString; }
+    bool operator==(const String8 &o) const { return mString == o.mString; }
+    bool operator!=(const String8 &o) const { return mString != o.mString; }
+    operator const char *() const { return mString.c_str(); }
+
+private:
+    std::string mString;
+};
+
+}; // namespace android
+
+#endif // HOST_UTILS_STRING8_H
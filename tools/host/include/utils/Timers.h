@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HOST_UTILS_TIMERS_H
+#define HOST_UTILS_TIMERS_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef int64_t nsecs_t;
+
+enum {
+    SYSTEM_TIME_REALTIME = 0,
+    SYSTEM_TIME_MONOTONIC = 1,
+};
+
+static inline nsecs_t systemTime(int clock = SYSTEM_TIME_MONOTONIC)
+{
+    struct timespec t;
+    clock_gettime(clock == SYSTEM_TIME_REALTIME ? CLOCK_REALTIME : CLOCK_MONOTONIC, &t);
+    return (nsecs_t) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+#endif // HOST_UTILS_TIMERS_H
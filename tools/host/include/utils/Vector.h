@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HOST_UTILS_VECTOR_H
+#define HOST_UTILS_VECTOR_H
+
+#include <sys/types.h>
+#include <vector>
+
+namespace android {
+
+template <typename TYPE>
+class Vector {
+public:
+    typedef TYPE value_type;
+    typedef TYPE *iterator;
+    typedef const TYPE *const_iterator;
+
+    size_t size() const { return mItems.size(); }
+    bool isEmpty() const { return mItems.empty(); }
+    size_t capacity() const { return mItems.capacity(); }
+    ssize_t setCapacity(size_t size) { mItems.reserve(size); return size; }
+    void clear() { mItems.clear(); }
+
+    const TYPE *array() const { return mItems.empty() ? NULL : &mItems[0]; }
+    TYPE *editArray() { return mItems.empty() ? NULL : &mItems[0]; }
+
+    const TYPE &operator[](size_t index) const { return mItems[index]; }
+    const TYPE &itemAt(size_t index) const { return mItems[index]; }
+    TYPE &editItemAt(size_t index) { return mItems[index]; }
+    const TYPE &top() const { return mItems.back(); }
+    TYPE &editTop() { return mItems.back(); }
+
+    ssize_t insertAt(const TYPE &item, size_t index, size_t numItems = 1)
+    {
+        mItems.insert(mItems.begin() + index, numItems, item);
+        return index;
+    }
+    void push() { mItems.push_back(TYPE()); }
+    void push(const TYPE &item) { mItems.push_back(item); }
+    ssize_t add(const TYPE &item) { mItems.push_back(item); return mItems.size() - 1; }
+    ssize_t replaceAt(const TYPE &item, size_t index) { mItems[index] = item; return index; }
+    ssize_t removeItemsAt(size_t index, size_t count = 1)
+    {
+        mItems.erase(mItems.begin() + index, mItems.begin() + index + count);
+        return index;
+    }
+    ssize_t removeAt(size_t index) { return removeItemsAt(index); }
+
+    iterator begin() { return editArray(); }
+    iterator end() { return editArray() + size(); }
+    const_iterator begin() const { return array(); }
+    const_iterator end() const { return array() + size(); }
+    void push_back(const TYPE &item) { push(item); }
+    void push_front(const TYPE &item) { insertAt(item, 0); }
+    iterator erase(iterator pos) { return begin() + removeAt(pos - begin()); }
+
+private:
+    std::vector<TYPE> mItems;
+};
+
+}; // namespace android
+
+#endif // HOST_UTILS_VECTOR_H
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2014 Intel Corporation.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef HOST_UTILS_THREADS_H
+#define HOST_UTILS_THREADS_H
+
+#include <pthread.h>
+#include <sys/resource.h>
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/Timers.h>
+
+enum {
+    PRIORITY_DEFAULT = 0,
+    PRIORITY_URGENT_DISPLAY = -8,
+};
+
+namespace android {
+
+class Mutex {
+public:
+    Mutex() { pthread_mutex_init(&mMutex, NULL); }
+    explicit Mutex(const char *name) { pthread_mutex_init(&mMutex, NULL); }
+    ~Mutex() { pthread_mutex_destroy(&mMutex); }
+
+    status_t lock() { return -pthread_mutex_lock(&mMutex); }
+    void unlock() { pthread_mutex_unlock(&mMutex); }
+    status_t tryLock() { return -pthread_mutex_trylock(&mMutex); }
+
+    class Autolock {
+    public:
+        explicit Autolock(Mutex &mutex) : mLock(mutex) { mLock.lock(); }
+        ~Autolock() { mLock.unlock(); }
+    private:
+        Mutex &mLock;
+    };
+
+private:
+    friend class Condition;
+    Mutex(const Mutex &);
+    Mutex &operator=(const Mutex &);
+
+    pthread_mutex_t mMutex;
+};
+
+class Condition {
+public:
+    enum WakeUpType {
+        WAKE_UP_ALL,
+        WAKE_UP_ONE
+    };
+
+    Condition() { pthread_cond_init(&mCond, NULL); }
+    ~Condition() { pthread_cond_destroy(&mCond); }
+
+    status_t wait(Mutex &mutex) { return -pthread_cond_wait(&mCond, &mutex.mMutex); }
+    status_t waitRelative(Mutex &mutex, nsecs_t reltime)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        nsecs_t ns = ts.tv_nsec + reltime;
+        ts.tv_sec += ns / 1000000000LL;
+        ts.tv_nsec = ns % 1000000000LL;
+        return -pthread_cond_timedwait(&mCond, &mutex.mMutex, &ts);
+    }
+    void signal() { pthread_cond_signal(&mCond); }
+    void broadcast() { pthread_cond_broadcast(&mCond); }
+    void signal(WakeUpType type) { if (type == WAKE_UP_ALL) broadcast(); else signal(); }
+
+private:
+    pthread_cond_t mCond;
+};
+
+/*
+ * Minimal Thread: threadLoop() runs until it returns false or exit is
+ * requested, and the running thread keeps a reference to itself.
+ */
+class Thread : public virtual RefBase {
+public:
+    explicit Thread(bool canCallJava = true) : mExitPending(false), mRunning(false) {}
+    virtual ~Thread() {}
+
+    virtual status_t run(const char *name = 0, int32_t priority = PRIORITY_DEFAULT,
+                         size_t stack = 0)
+    {
+        Mutex::Autolock lock(mLock);
+        if (mRunning)
+            return INVALID_OPERATION;
+        mExitPending = false;
+        status_t status = readyToRun();
+        if (status != NO_ERROR)
+            return status;
+        incStrong(this);
+        if (pthread_create(&mThread, NULL, entry, this) != 0) {
+            decStrong(this);
+            return UNKNOWN_ERROR;
+        }
+        pthread_detach(mThread);
+        mRunning = true;
+        return NO_ERROR;
+    }
+
+    virtual void requestExit()
+    {
+        Mutex::Autolock lock(mLock);
+        mExitPending = true;
+    }
+
+    status_t requestExitAndWait()
+    {
+        Mutex::Autolock lock(mLock);
+        mExitPending = true;
+        while (mRunning)
+            mExited.wait(mLock);
+        return NO_ERROR;
+    }
+
+    bool isRunning() const
+    {
+        Mutex::Autolock lock(mLock);
+        return mRunning;
+    }
+
+protected:
+    bool exitPending() const
+    {
+        Mutex::Autolock lock(mLock);
+        return mExitPending;
+    }
+
+private:
+    virtual status_t readyToRun() { return NO_ERROR; }
+    virtual bool threadLoop() = 0;
+
+    static void *entry(void *arg)
+    {
+        Thread *self = static_cast<Thread *>(arg);
+        while (!self->exitPending() && self->threadLoop())
+            ;
+        {
+            Mutex::Autolock lock(self->mLock);
+            self->mRunning = false;
+            self->mExited.broadcast();
+        }
+        self->decStrong(self);
+        return NULL;
+    }
+
+    mutable Mutex mLock;
+    Condition mExited;
+    pthread_t mThread;
+    bool mExitPending;
+    bool mRunning;
+};
+
+}; // namespace android
+
+#endif // HOST_UTILS_THREADS_H
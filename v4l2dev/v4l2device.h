@@ -131,6 +131,7 @@ public:
     virtual int dequeueEvent(struct v4l2_event *event);
 
     bool isOpen() { return mFd != -1; };
+    int getFd() const { return mFd; };
 
 public:
     const int mId;    /*!< Convenient index to identify the device in old AtomISP code